@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "addrindex.h"
+#include "util.h"
+
+// Deep enough for a walk from a root to a full-length IPv6 key
+#define MAX_DEPTH (ADDR_MAX_BYTES * 8 + 1)
+
+static struct addrindex_node** root(struct addrindex* index, uint8_t family) {
+    return &index->roots[(family == AF_INET)? 0 : 1];
+}
+
+static unsigned int bit(const uint8_t* key, size_t i) {
+    return (key[i / 8] >> (7 - i % 8)) & 1;
+}
+
+// The number of leading bits, from start up to max, that two keys share
+static size_t common_bits(const uint8_t* a, const uint8_t* b, size_t start, size_t max) {
+    size_t i = start;
+    while(i < max && bit(a, i) == bit(b, i)) { i += 1; }
+    return i;
+}
+
+static void mask(uint8_t* key, size_t len) {
+    for(size_t i = len; i < ADDR_MAX_BYTES * 8; i += 1) {
+        key[i / 8] &= ~(1 << (7 - i % 8));
+    }
+}
+
+static struct addrindex_node* node_new(const uint8_t* key, size_t len) {
+    struct addrindex_node* node = calloc(1, sizeof(*node));
+    if(node == NULL) { die("Failed to allocate address index"); }
+    memcpy(node->key, key, sizeof(node->key));
+    mask(node->key, len);
+    node->len = len;
+    return node;
+}
+
+static void node_free(struct addrindex_node* node) {
+    if(node == NULL) { return; }
+
+    node_free(node->child[0]);
+    node_free(node->child[1]);
+    while(node->owners != NULL) {
+        struct addrindex_owner* next = node->owners->next;
+        free(node->owners);
+        node->owners = next;
+    }
+
+    free(node);
+}
+
+// Drop a node that no longer owns anything, unless it still joins two
+// branches
+static void collapse(struct addrindex_node** link) {
+    struct addrindex_node* node = *link;
+    if(node == NULL || node->owners != NULL) { return; }
+    if(node->child[0] != NULL && node->child[1] != NULL) { return; }
+
+    *link = (node->child[0] != NULL)? node->child[0] : node->child[1];
+    free(node);
+}
+
+void addrindex_init(struct addrindex* index) {
+    memset(index, 0, sizeof(*index));
+}
+
+void addrindex_free(struct addrindex* index) {
+    node_free(index->roots[0]);
+    node_free(index->roots[1]);
+    memset(index, 0, sizeof(*index));
+}
+
+// Find the node for a key, adding it if there is none
+static struct addrindex_node* insert(struct addrindex_node** link, const uint8_t* key, size_t len) {
+    size_t matched = 0;
+    while(*link != NULL) {
+        struct addrindex_node* node = *link;
+        const size_t common = common_bits(node->key, key, matched, min(node->len, len));
+        if(common < node->len) {
+            // Split the node where the keys part ways
+            struct addrindex_node* split = node_new(key, common);
+            split->child[bit(node->key, common)] = node;
+            *link = split;
+            if(common == len) { return split; }
+
+            link = &split->child[bit(key, common)];
+            break;
+        }
+
+        if(node->len == len) { return node; }
+        matched = node->len;
+        link = &node->child[bit(key, node->len)];
+    }
+
+    *link = node_new(key, len);
+    return *link;
+}
+
+static bool owned(const struct addrindex_node* node, uint32_t ifindex) {
+    for(const struct addrindex_owner* owner = node->owners; owner != NULL; owner = owner->next) {
+        if(owner->ifindex == ifindex) { return true; }
+    }
+
+    return false;
+}
+
+// The node for exactly the given key, or NULL if there is none
+static const struct addrindex_node* find(const struct addrindex_node* node, const uint8_t* key, size_t len) {
+    size_t matched = 0;
+    while(node != NULL && node->len <= len && common_bits(node->key, key, matched, node->len) == node->len) {
+        if(node->len == len) { return node; }
+        matched = node->len;
+        node = node->child[bit(key, node->len)];
+    }
+
+    return NULL;
+}
+
+static void add_owner(struct addrindex_node* node, uint32_t ifindex) {
+    for(struct addrindex_owner* owner = node->owners; owner != NULL; owner = owner->next) {
+        if(owner->ifindex == ifindex) {
+            owner->refs += 1;
+            return;
+        }
+    }
+
+    struct addrindex_owner* owner = malloc(sizeof(*owner));
+    if(owner == NULL) { die("Failed to allocate address index"); }
+    owner->ifindex = ifindex;
+    owner->refs = 1;
+    owner->next = node->owners;
+    node->owners = owner;
+}
+
+// Drop one reference from the interface's ownership of a node. Returns false
+// if it did not own it.
+static bool remove_owner(struct addrindex_node* node, uint32_t ifindex) {
+    for(struct addrindex_owner** link = &node->owners; *link != NULL; link = &(*link)->next) {
+        struct addrindex_owner* owner = *link;
+        if(owner->ifindex != ifindex) { continue; }
+
+        owner->refs -= 1;
+        if(owner->refs == 0) {
+            *link = owner->next;
+            free(owner);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+static void remove_key(struct addrindex_node** link, uint32_t ifindex, const uint8_t* key, size_t len) {
+    struct addrindex_node** path[MAX_DEPTH];
+    size_t depth = 0;
+    size_t matched = 0;
+    while(*link != NULL) {
+        struct addrindex_node* node = *link;
+        if(node->len > len || common_bits(node->key, key, matched, node->len) < node->len) { return; }
+
+        path[depth] = link;
+        depth += 1;
+        if(node->len == len) { break; }
+        matched = node->len;
+        link = &node->child[bit(key, node->len)];
+    }
+
+    if(*link == NULL || !remove_owner(*link, ifindex)) { return; }
+
+    // Removing a node can leave its parent joining a single branch
+    while(depth > 0) {
+        depth -= 1;
+        collapse(path[depth]);
+    }
+}
+
+static bool link_local(const struct addr_prefix* addr) {
+    return addr->family == AF_INET6 && addr->bytes[0] == 0xfe && (addr->bytes[1] & 0xc0) == 0x80;
+}
+
+void addrindex_add(struct addrindex* index, uint32_t ifindex, const struct addr_prefix* addr) {
+    if(link_local(addr)) { return; }
+
+    // The kernel announces addresses again whenever they change, such as
+    // when their lifetimes are renewed
+    struct addrindex_node** tree = root(index, addr->family);
+    const size_t host_len = addr_family_bytes(addr->family) * 8;
+    const struct addrindex_node* host = find(*tree, addr->bytes, host_len);
+    if(host != NULL && owned(host, ifindex)) { return; }
+
+    add_owner(insert(tree, addr->bytes, addr->len), ifindex);
+    add_owner(insert(tree, addr->bytes, host_len), ifindex);
+    index->n_addresses += 1;
+}
+
+void addrindex_remove(struct addrindex* index, uint32_t ifindex, const struct addr_prefix* addr) {
+    if(link_local(addr)) { return; }
+
+    struct addrindex_node** tree = root(index, addr->family);
+    const size_t host_len = addr_family_bytes(addr->family) * 8;
+    const struct addrindex_node* host = find(*tree, addr->bytes, host_len);
+    if(host == NULL || !owned(host, ifindex)) { return; }
+
+    remove_key(tree, ifindex, addr->bytes, addr->len);
+    remove_key(tree, ifindex, addr->bytes, host_len);
+    index->n_addresses -= 1;
+}
+
+static void remove_all(struct addrindex_node** link, uint32_t ifindex, size_t* removed) {
+    struct addrindex_node* node = *link;
+    if(node == NULL) { return; }
+
+    remove_all(&node->child[0], ifindex, removed);
+    remove_all(&node->child[1], ifindex, removed);
+    for(struct addrindex_owner** owner = &node->owners; *owner != NULL;) {
+        if((*owner)->ifindex != ifindex) {
+            owner = &(*owner)->next;
+            continue;
+        }
+
+        struct addrindex_owner* next = (*owner)->next;
+        *removed += (*owner)->refs;
+        free(*owner);
+        *owner = next;
+    }
+
+    collapse(link);
+}
+
+void addrindex_remove_iface(struct addrindex* index, uint32_t ifindex) {
+    // Each address holds two references
+    size_t removed = 0;
+    remove_all(&index->roots[0], ifindex, &removed);
+    remove_all(&index->roots[1], ifindex, &removed);
+    index->n_addresses -= removed / 2;
+}
+
+bool addrindex_lookup(const struct addrindex* index, const struct addr_prefix* prefix, uint32_t* ifindex, struct addr_prefix* match) {
+    const struct addrindex_node* best = NULL;
+    const struct addrindex_node* node = index->roots[(prefix->family == AF_INET)? 0 : 1];
+    size_t matched = 0;
+    while(node != NULL) {
+        if(node->len > prefix->len || common_bits(node->key, prefix->bytes, matched, node->len) < node->len) {
+            break;
+        }
+
+        if(node->owners != NULL) { best = node; }
+        if(node->len == prefix->len) { break; }
+        matched = node->len;
+        node = node->child[bit(prefix->bytes, node->len)];
+    }
+
+    if(best == NULL) { return false; }
+
+    *ifindex = best->owners->ifindex;
+    match->family = prefix->family;
+    match->len = best->len;
+    memcpy(match->bytes, best->key, sizeof(match->bytes));
+    return true;
+}
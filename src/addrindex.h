@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prefix.h"
+
+// Every interface address, kept in a path-compressed binary trie per address
+// family, so that the interface owning an address or covering a prefix is
+// found by longest-prefix match in time bounded by the prefix length. Each
+// address is entered twice: as itself, and as the network it is on.
+//
+// IPv6 link-local addresses are left out, since every interface has the same
+// prefix.
+struct addrindex_owner {
+    uint32_t ifindex;
+
+    // How many of the interface's addresses put it here
+    uint32_t refs;
+    struct addrindex_owner* next;
+};
+
+struct addrindex_node {
+    uint8_t key[ADDR_MAX_BYTES];
+    uint8_t len;
+
+    // NULL if the node only joins two branches
+    struct addrindex_owner* owners;
+    struct addrindex_node* child[2];
+};
+
+struct addrindex {
+    // IPv4, then IPv6
+    struct addrindex_node* roots[2];
+    size_t n_addresses;
+};
+
+void addrindex_init(struct addrindex*);
+void addrindex_free(struct addrindex*);
+
+// Add or remove an interface address, given with its prefix length.
+void addrindex_add(struct addrindex*, uint32_t ifindex, const struct addr_prefix*);
+void addrindex_remove(struct addrindex*, uint32_t ifindex, const struct addr_prefix*);
+
+// Forget every address of an interface.
+void addrindex_remove_iface(struct addrindex*, uint32_t ifindex);
+
+// Find the interface with the longest prefix covering the given address or
+// prefix, and that prefix. Returns false if no interface covers it.
+bool addrindex_lookup(const struct addrindex*, const struct addr_prefix*, uint32_t* ifindex, struct addr_prefix* match);
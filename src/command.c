@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "flatjson.h"
+#include "validate.h"
+
+// Commands are found by a perfect hash of their first and last characters and
+// their length. Two commands in one slot would be caught by -Woverride-init.
+#define COMMAND_SLOTS 32
+#define SLOT(first, last, len) ((((first) * 3) + ((last) * 2) + (len)) & (COMMAND_SLOTS - 1))
+
+static const struct command_spec commands[COMMAND_SLOTS] = {
+    [SLOT('l', 't', 4)] = {"list", STATS_CMD_LIST, 0, 0, 0, {0}},
+    [SLOT('c', 'e', 9)] = {"configure", STATS_CMD_CONFIGURE, 1, 1 + PAYLOAD_MAX_STANZAS, 2,
+                           {COMMAND_ARG_IFACE, COMMAND_ARG_STANZA}},
+    [SLOT('c', 't', 7)] = {"connect", STATS_CMD_CONNECT, 1, 3, 3,
+                           {COMMAND_ARG_IFACE, COMMAND_ARG_WAIT, COMMAND_ARG_TIMEOUT}},
+    [SLOT('d', 't', 10)] = {"disconnect", STATS_CMD_DISCONNECT, 1, 1, 1, {COMMAND_ARG_IFACE}},
+    [SLOT('s', 's', 5)] = {"stats", STATS_CMD_STATS, 0, 0, 0, {0}},
+    [SLOT('t', 'p', 10)] = {"trace-dump", STATS_CMD_TRACE_DUMP, 0, 0, 0, {0}},
+    [SLOT('j', 's', 4)] = {"jobs", STATS_CMD_JOBS, 0, 0, 0, {0}},
+    [SLOT('c', 'l', 6)] = {"cancel", STATS_CMD_CANCEL, 1, 1, 1, {COMMAND_ARG_JOB}},
+    [SLOT('e', 's', 6)] = {"events", STATS_CMD_EVENTS, 0, 1 + COMMAND_MAX_CURSORS, 2,
+                           {COMMAND_ARG_SINCE, COMMAND_ARG_CURSOR}},
+    [SLOT('c', 's', 8)] = {"counters", STATS_CMD_COUNTERS, 0, 1, 1, {COMMAND_ARG_IFACE}},
+    [SLOT('s', 'e', 9)] = {"subscribe", STATS_CMD_SUBSCRIBE, 0, 2, 2,
+                           {COMMAND_ARG_SINCE, COMMAND_ARG_CURSOR}},
+    [SLOT('s', 'n', 4)] = {"scan", STATS_CMD_SCAN, 1, 2, 2, {COMMAND_ARG_IFACE, COMMAND_ARG_AGE}},
+    [SLOT('l', 'p', 6)] = {"lookup", STATS_CMD_LOOKUP, 1, 1, 1, {COMMAND_ARG_PREFIX}},
+};
+
+static const char* const arg_errors[] = {
+    [COMMAND_ARG_IFACE] = "invalid interface",
+    [COMMAND_ARG_STANZA] = "invalid stanza",
+    [COMMAND_ARG_JOB] = "invalid job",
+    [COMMAND_ARG_SINCE] = "expected since",
+    [COMMAND_ARG_CURSOR] = "invalid cursor",
+    [COMMAND_ARG_AGE] = "invalid age",
+    [COMMAND_ARG_WAIT] = "invalid condition",
+    [COMMAND_ARG_TIMEOUT] = "invalid timeout",
+    [COMMAND_ARG_PREFIX] = "invalid address"
+};
+
+static const char* const wait_names[] = {
+    [COMMAND_WAIT_LINK] = "link",
+    [COMMAND_WAIT_ADDRESS] = "address",
+    [COMMAND_WAIT_ROUTE] = "route"
+};
+
+const struct command_spec* command_lookup(const char* name) {
+    const size_t len = strlen(name);
+    if(len == 0) { return NULL; }
+
+    const struct command_spec* spec = &commands[SLOT((unsigned char)name[0], (unsigned char)name[len - 1], len)];
+    if(spec->name == NULL || strcmp(spec->name, name) != 0) { return NULL; }
+    return spec;
+}
+
+static bool parse_u64(const char* text, uint64_t max, uint64_t* value) {
+    if(text[0] < '0' || text[0] > '9') { return false; }
+
+    char* end;
+    errno = 0;
+    const unsigned long long parsed = strtoull(text, &end, 10);
+    if(*end != '\0' || errno != 0 || parsed > max) { return false; }
+
+    *value = parsed;
+    return true;
+}
+
+// Store one argument. Returns false if it is not valid for its type.
+static bool parse_arg(struct command* command, enum command_arg type, const char* arg) {
+    uint64_t value;
+    switch(type) {
+        case COMMAND_ARG_IFACE:
+            if(strlen(arg) >= sizeof(command->iface.name) || !validate_iface(arg)) { return false; }
+            strlcpy(command->iface.name, arg, sizeof(command->iface.name));
+            return true;
+        case COMMAND_ARG_STANZA:
+            if(command->n_stanzas == PAYLOAD_MAX_STANZAS || !validate_stanza(arg)) { return false; }
+            strlcpy(command->stanzas[command->n_stanzas], arg, PAYLOAD_STANZA_LEN);
+            command->n_stanzas += 1;
+            return true;
+        case COMMAND_ARG_JOB:
+            if(!parse_u64(arg, UINT32_MAX, &value)) { return false; }
+            command->job = value;
+            return true;
+        case COMMAND_ARG_SINCE:
+            return strcmp(arg, "since") == 0;
+        case COMMAND_ARG_CURSOR:
+            if(command->n_cursors == COMMAND_MAX_CURSORS || !parse_u64(arg, UINT64_MAX, &value)) { return false; }
+            command->cursors[command->n_cursors] = value;
+            command->n_cursors += 1;
+            return true;
+        case COMMAND_ARG_AGE:
+            if(!parse_u64(arg, UINT32_MAX, &value)) { return false; }
+            command->age = value;
+            return true;
+        case COMMAND_ARG_WAIT:
+            for(size_t i = COMMAND_WAIT_LINK; i <= COMMAND_WAIT_ROUTE; i += 1) {
+                if(strcmp(arg, wait_names[i]) == 0) {
+                    command->wait = i;
+                    return true;
+                }
+            }
+            return false;
+        case COMMAND_ARG_TIMEOUT:
+            if(!parse_u64(arg, COMMAND_MAX_TIMEOUT, &value)) { return false; }
+            command->timeout = value;
+            return true;
+        case COMMAND_ARG_PREFIX:
+            return addr_prefix_parse(arg, &command->prefix);
+    }
+
+    return false;
+}
+
+const char* command_parse(const char* line, struct command* command) {
+    memset(command, 0, sizeof(*command));
+
+    char name[COMMAND_NAME_LEN];
+    const char* cursor = flatjson_next(line, name, sizeof(name), NULL);
+    if(cursor == NULL || (command->spec = command_lookup(name)) == NULL) {
+        return "unknown command";
+    }
+
+    const struct command_spec* spec = command->spec;
+    size_t n_args = 0;
+    while(1) {
+        char arg[PAYLOAD_STANZA_LEN];
+        enum flatjson status;
+        cursor = flatjson_next(cursor, arg, sizeof(arg), &status);
+        if(cursor == NULL && status == FLATJSON_OK) { break; }
+        if(n_args == spec->max_args) { return "too many arguments"; }
+        if(status == FLATJSON_ERROR_INVALID) { return "invalid request"; }
+
+        const enum command_arg type = spec->types[(n_args < spec->n_types)? n_args : (size_t)spec->n_types - 1];
+        if(status != FLATJSON_OK || !parse_arg(command, type, arg)) { return arg_errors[type]; }
+        n_args += 1;
+    }
+
+    if(n_args < spec->min_args) { return "missing argument"; }
+    return NULL;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prefix.h"
+#include "payload.h"
+#include "stats.h"
+
+// The commands accepted on the control socket, and the arguments each takes.
+// A command line is tokenized and validated once, into a struct command,
+// before it is dispatched.
+#define COMMAND_NAME_LEN 20
+#define COMMAND_MAX_CURSORS 2
+
+enum command_arg {
+    // An interface name that passes validate_iface()
+    COMMAND_ARG_IFACE,
+    // A hostname.if stanza that passes validate_stanza()
+    COMMAND_ARG_STANZA,
+    // A job ID, as listed by jobs
+    COMMAND_ARG_JOB,
+    // The word "since"
+    COMMAND_ARG_SINCE,
+    // An event sequence number or count
+    COMMAND_ARG_CURSOR,
+    // An age in seconds
+    COMMAND_ARG_AGE,
+    // What connect waits for: "link", "address", or "route"
+    COMMAND_ARG_WAIT,
+    // A timeout in milliseconds, up to COMMAND_MAX_TIMEOUT
+    COMMAND_ARG_TIMEOUT,
+    // An IPv4 or IPv6 address, with an optional prefix length
+    COMMAND_ARG_PREFIX
+};
+
+enum command_wait {
+    COMMAND_WAIT_NONE,
+    // The link is up
+    COMMAND_WAIT_LINK,
+    // An address has been configured
+    COMMAND_WAIT_ADDRESS,
+    // A default route goes through the interface
+    COMMAND_WAIT_ROUTE
+};
+
+#define COMMAND_MAX_TIMEOUT 600000
+
+#define COMMAND_MAX_TYPES 3
+
+struct command_spec {
+    const char* name;
+    enum stats_command cmd;
+    uint8_t min_args;
+    uint8_t max_args;
+
+    // The type of each argument in turn. The last one repeats.
+    uint8_t n_types;
+    enum command_arg types[COMMAND_MAX_TYPES];
+};
+
+struct command {
+    const struct command_spec* spec;
+
+    // Each argument is stored by type. The interface name is empty if none
+    // was given, and the cursors are in the order given.
+    struct payload_iface iface;
+    uint32_t job;
+    uint32_t n_stanzas;
+    char stanzas[PAYLOAD_MAX_STANZAS][PAYLOAD_STANZA_LEN];
+    size_t n_cursors;
+    uint64_t cursors[COMMAND_MAX_CURSORS];
+    uint32_t age;
+    enum command_wait wait;
+    uint32_t timeout;
+    struct addr_prefix prefix;
+};
+
+// Find a command by name, or return NULL
+const struct command_spec* command_lookup(const char*);
+
+// Parse a command line. Returns NULL on success, or the reason it was
+// rejected, in which case the spec is still set if the command was known.
+const char* command_parse(const char*, struct command*);
@@ -0,0 +1,23 @@
+#pragma once
+
+// Shims for the OpenBSD interfaces that networkd uses, for building on
+// Linux. The Makefile includes this into every translation unit there.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+size_t strlcpy(char*, const char*, size_t);
+size_t strlcat(char*, const char*, size_t);
+
+// There is no equivalent to pledge(2), so it does nothing.
+static inline int pledge(const char* promises, const char* execpromises) {
+    return 0;
+}
+
+// Implemented with SO_PEERCRED
+int getpeereid(int, uid_t*, gid_t*);
+
+// glibc only defines IOV_MAX for X/Open builds. Linux's limit is 1024.
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
@@ -0,0 +1,19 @@
+#include <sys/socket.h>
+
+// glibc only defines struct ucred for _GNU_SOURCE, which would have to be
+// set before compat.h is included. This is its layout.
+struct peer_cred {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+int getpeereid(int fd, uid_t* euid, gid_t* egid) {
+    struct peer_cred cred;
+    socklen_t len = sizeof(cred);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) { return -1; }
+
+    *euid = cred.uid;
+    *egid = cred.gid;
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "imsg.h"
+
+void imsg_init(struct imsgbuf* ibuf, int fd) {
+    memset(ibuf, 0, sizeof(*ibuf));
+    ibuf->fd = fd;
+    ibuf->w.fd = fd;
+    ibuf->w.tail = &ibuf->w.head;
+    ibuf->pid = getpid();
+}
+
+ssize_t imsg_read(struct imsgbuf* ibuf) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * IMSG_MAX_FDS)];
+    } cmsgbuf;
+
+    struct iovec iov;
+    iov.iov_base = ibuf->r.buf + ibuf->r.wpos;
+    iov.iov_len = sizeof(ibuf->r.buf) - ibuf->r.wpos;
+    if(iov.iov_len == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    ssize_t n;
+    while((n = recvmsg(ibuf->fd, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+        if(errno != EINTR) { return -1; }
+    }
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) { continue; }
+
+        const size_t n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(size_t i = 0; i < n_fds; i += 1) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if(ibuf->n_fds < IMSG_MAX_FDS) {
+                ibuf->fds[ibuf->n_fds++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    ibuf->r.wpos += n;
+    return n;
+}
+
+ssize_t imsg_get(struct imsgbuf* ibuf, struct imsg* imsg) {
+    if(ibuf->r.wpos < IMSG_HEADER_SIZE) { return 0; }
+
+    memcpy(&imsg->hdr, ibuf->r.buf, IMSG_HEADER_SIZE);
+    if(imsg->hdr.len < IMSG_HEADER_SIZE || imsg->hdr.len > MAX_IMSGSIZE) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    if(ibuf->r.wpos < imsg->hdr.len) { return 0; }
+
+    const size_t data_len = imsg->hdr.len - IMSG_HEADER_SIZE;
+    imsg->data = NULL;
+    if(data_len > 0) {
+        imsg->data = malloc(data_len);
+        if(imsg->data == NULL) { return -1; }
+        memcpy(imsg->data, ibuf->r.buf + IMSG_HEADER_SIZE, data_len);
+    }
+
+    imsg->fd = -1;
+    if((imsg->hdr.flags & IMSGF_HASFD) && ibuf->n_fds > 0) {
+        imsg->fd = ibuf->fds[0];
+        ibuf->n_fds -= 1;
+        memmove(ibuf->fds, ibuf->fds + 1, ibuf->n_fds * sizeof(int));
+    }
+
+    const size_t len = imsg->hdr.len;
+    ibuf->r.wpos -= len;
+    memmove(ibuf->r.buf, ibuf->r.buf + len, ibuf->r.wpos);
+    return len;
+}
+
+int imsg_compose(struct imsgbuf* ibuf,
+                 uint32_t type,
+                 uint32_t peerid,
+                 pid_t pid,
+                 int fd,
+                 const void* data,
+                 size_t data_len) {
+    if(data_len > MAX_IMSGSIZE - IMSG_HEADER_SIZE) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    struct ibuf* buf = calloc(1, sizeof(struct ibuf));
+    if(buf == NULL) { return -1; }
+
+    buf->len = IMSG_HEADER_SIZE + data_len;
+    buf->buf = malloc(buf->len);
+    if(buf->buf == NULL) {
+        free(buf);
+        return -1;
+    }
+
+    struct imsg_hdr hdr;
+    hdr.type = type;
+    hdr.len = buf->len;
+    hdr.flags = (fd != -1)? IMSGF_HASFD : 0;
+    hdr.peerid = peerid;
+    hdr.pid = (pid == 0)? ibuf->pid : pid;
+    memcpy(buf->buf, &hdr, IMSG_HEADER_SIZE);
+    if(data_len > 0) { memcpy(buf->buf + IMSG_HEADER_SIZE, data, data_len); }
+
+    buf->fd = fd;
+    *ibuf->w.tail = buf;
+    ibuf->w.tail = &buf->next;
+    ibuf->w.queued += 1;
+    return 1;
+}
+
+// Write queued messages. Returns 1 once the socket stops accepting data or
+// the queue is empty, 0 if the other end has gone away, and -1 on error.
+int msgbuf_write(struct msgbuf* msgbuf) {
+    while(msgbuf->head != NULL) {
+        struct ibuf* buf = msgbuf->head;
+
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } cmsgbuf;
+
+        struct iovec iov;
+        iov.iov_base = buf->buf + buf->written;
+        iov.iov_len = buf->len - buf->written;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        // A descriptor travels with the first byte of its message
+        if(buf->fd != -1 && buf->written == 0) {
+            memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+            msg.msg_control = cmsgbuf.buf;
+            msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            memcpy(CMSG_DATA(cmsg), &buf->fd, sizeof(int));
+        }
+
+        const ssize_t n = sendmsg(msgbuf->fd, &msg, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN) { return 1; }
+            if(errno == EPIPE) { return 0; }
+            return -1;
+        }
+
+        // Like imsg, passing a descriptor hands it over to the receiver
+        if(buf->fd != -1) {
+            close(buf->fd);
+            buf->fd = -1;
+        }
+
+        buf->written += n;
+        if(buf->written < buf->len) { continue; }
+
+        msgbuf->head = buf->next;
+        if(msgbuf->head == NULL) { msgbuf->tail = &msgbuf->head; }
+        msgbuf->queued -= 1;
+        free(buf->buf);
+        free(buf);
+    }
+
+    return 1;
+}
+
+int imsg_flush(struct imsgbuf* ibuf) {
+    while(ibuf->w.queued > 0) {
+        if(msgbuf_write(&ibuf->w) <= 0) { return -1; }
+    }
+
+    return 0;
+}
+
+void imsg_free(struct imsg* imsg) {
+    free(imsg->data);
+    imsg->data = NULL;
+}
+
+void imsg_clear(struct imsgbuf* ibuf) {
+    while(ibuf->w.head != NULL) {
+        struct ibuf* buf = ibuf->w.head;
+        ibuf->w.head = buf->next;
+        if(buf->fd != -1) { close(buf->fd); }
+        free(buf->buf);
+        free(buf);
+    }
+
+    ibuf->w.tail = &ibuf->w.head;
+    ibuf->w.queued = 0;
+
+    while(ibuf->n_fds > 0) {
+        close(ibuf->fds[--ibuf->n_fds]);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// A minimal implementation of OpenBSD's imsg(3) framing, covering the subset
+// of the API that networkd uses, including descriptor passing.
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define IBUF_READ_SIZE 65535
+#define IMSG_HEADER_SIZE sizeof(struct imsg_hdr)
+#define MAX_IMSGSIZE 16384
+#define IMSG_MAX_FDS 16
+
+#define IMSGF_HASFD 1
+
+struct imsg_hdr {
+    uint32_t type;
+    uint16_t len;
+    uint16_t flags;
+    uint32_t peerid;
+    uint32_t pid;
+};
+
+struct imsg {
+    struct imsg_hdr hdr;
+    int fd;
+    void* data;
+};
+
+struct ibuf {
+    unsigned char* buf;
+    size_t len;
+    size_t written;
+    int fd;
+    struct ibuf* next;
+};
+
+struct msgbuf {
+    struct ibuf* head;
+    struct ibuf** tail;
+    uint32_t queued;
+    int fd;
+};
+
+struct ibuf_read {
+    unsigned char buf[IBUF_READ_SIZE];
+    size_t wpos;
+};
+
+struct imsgbuf {
+    struct ibuf_read r;
+    struct msgbuf w;
+    int fds[IMSG_MAX_FDS];
+    int n_fds;
+    int fd;
+    pid_t pid;
+};
+
+void imsg_init(struct imsgbuf*, int);
+ssize_t imsg_read(struct imsgbuf*);
+ssize_t imsg_get(struct imsgbuf*, struct imsg*);
+int imsg_compose(struct imsgbuf*, uint32_t, uint32_t, pid_t, int, const void*, size_t);
+int imsg_flush(struct imsgbuf*);
+void imsg_free(struct imsg*);
+void imsg_clear(struct imsgbuf*);
+int msgbuf_write(struct msgbuf*);
@@ -0,0 +1,21 @@
+#include <string.h>
+
+#include "compat.h"
+
+size_t strlcpy(char* dst, const char* src, size_t dst_len) {
+    const size_t src_len = strlen(src);
+    if(dst_len > 0) {
+        const size_t n = (src_len >= dst_len)? dst_len - 1 : src_len;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+
+    return src_len;
+}
+
+size_t strlcat(char* dst, const char* src, size_t dst_len) {
+    const size_t len = strnlen(dst, dst_len);
+    if(len == dst_len) { return len + strlen(src); }
+
+    return len + strlcpy(dst + len, src, dst_len - len);
+}
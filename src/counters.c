@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "counters.h"
+#include "util.h"
+
+static const char* const counter_names[COUNTER_MAX] = {
+    "ibytes",
+    "obytes",
+    "ipackets",
+    "opackets",
+    "ierrors",
+    "oerrors"
+};
+
+void counters_init(struct counters* counters) {
+    memset(counters, 0, sizeof(*counters));
+}
+
+void counters_begin(struct counters* counters) {
+    counters->round += 1;
+}
+
+void counters_record(struct counters* counters,
+                     uint32_t ifindex,
+                     const char* name,
+                     const struct counter_sample* sample) {
+    if(ifindex >= counters->len) {
+        size_t len = (counters->len > 0)? counters->len : 16;
+        while(len <= ifindex) { len *= 2; }
+
+        struct counters_iface** ifaces = realloc(counters->ifaces, len * sizeof(*ifaces));
+        if(ifaces == NULL) { die("Failed to allocate counters"); }
+        memset(ifaces + counters->len, 0, (len - counters->len) * sizeof(*ifaces));
+        counters->ifaces = ifaces;
+        counters->len = len;
+    }
+
+    struct counters_iface* iface = counters->ifaces[ifindex];
+    if(iface == NULL) {
+        iface = calloc(1, sizeof(*iface));
+        if(iface == NULL) { die("Failed to allocate counters"); }
+        counters->ifaces[ifindex] = iface;
+    }
+
+    // An index reused by a new interface starts a new history
+    if(strncmp(iface->name, name, sizeof(iface->name)) != 0) {
+        strlcpy(iface->name, name, sizeof(iface->name));
+        iface->len = 0;
+    }
+
+    iface->head = (iface->head + 1) % COUNTERS_HISTORY;
+    iface->samples[iface->head] = *sample;
+    if(iface->len < COUNTERS_HISTORY) { iface->len += 1; }
+    iface->round = counters->round;
+}
+
+void counters_end(struct counters* counters) {
+    for(size_t i = 0; i < counters->len; i += 1) {
+        struct counters_iface* iface = counters->ifaces[i];
+        if(iface != NULL && iface->round != counters->round) {
+            iface->name[0] = '\0';
+            iface->len = 0;
+        }
+    }
+}
+
+const struct counters_iface* counters_get(const struct counters* counters, uint32_t ifindex) {
+    if(ifindex >= counters->len) { return NULL; }
+
+    const struct counters_iface* iface = counters->ifaces[ifindex];
+    return (iface != NULL && iface->len > 0)? iface : NULL;
+}
+
+const struct counter_sample* counters_sample(const struct counters_iface* iface, size_t age) {
+    if(age >= iface->len) { return NULL; }
+    return &iface->samples[(iface->head + COUNTERS_HISTORY - age) % COUNTERS_HISTORY];
+}
+
+bool counters_rate(const struct counters_iface* iface, size_t age, uint64_t rates[COUNTER_MAX]) {
+    const struct counter_sample* newer = counters_sample(iface, age);
+    const struct counter_sample* older = counters_sample(iface, age + 1);
+    if(newer == NULL || older == NULL || newer->time <= older->time) { return false; }
+
+    const uint64_t elapsed = newer->time - older->time;
+    for(size_t i = 0; i < COUNTER_MAX; i += 1) {
+        if(newer->values[i] < older->values[i]) {
+            rates[i] = 0;
+            continue;
+        }
+
+        // Split the multiplication so that it cannot overflow
+        const uint64_t delta = newer->values[i] - older->values[i];
+        rates[i] = (delta / elapsed) * 1000000 + ((delta % elapsed) * 1000000) / elapsed;
+    }
+
+    return true;
+}
+
+const char* counter_name(enum counter counter) {
+    return counter_names[counter];
+}
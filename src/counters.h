@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+// Recent traffic counter samples for each interface, indexed by ifindex.
+// Each interface keeps a ring of its last COUNTERS_HISTORY samples, from
+// which rates are worked out on request.
+#define COUNTERS_HISTORY 60
+
+enum counter {
+    COUNTER_IBYTES,
+    COUNTER_OBYTES,
+    COUNTER_IPACKETS,
+    COUNTER_OPACKETS,
+    COUNTER_IERRORS,
+    COUNTER_OERRORS,
+
+    COUNTER_MAX
+};
+
+struct counter_sample {
+    // Microseconds on the monotonic clock
+    uint64_t time;
+    uint64_t values[COUNTER_MAX];
+};
+
+struct counters_iface {
+    char name[IF_NAMESIZE];
+
+    // The last sampling round which saw this interface
+    uint64_t round;
+
+    // Index of the newest sample, and the number of samples held
+    uint32_t head;
+    uint32_t len;
+    struct counter_sample samples[COUNTERS_HISTORY];
+};
+
+struct counters {
+    struct counters_iface** ifaces;
+    size_t len;
+    uint64_t round;
+};
+
+void counters_init(struct counters*);
+
+// Every sampling round records each interface once, between a call to
+// counters_begin() and one to counters_end(). Interfaces left out of a round
+// have gone away, and are forgotten.
+void counters_begin(struct counters*);
+void counters_record(struct counters*, uint32_t ifindex, const char* name, const struct counter_sample*);
+void counters_end(struct counters*);
+
+// The interface with the given index, or NULL if it has no samples.
+const struct counters_iface* counters_get(const struct counters*, uint32_t ifindex);
+
+// The sample taken the given number of rounds ago, or NULL.
+const struct counter_sample* counters_sample(const struct counters_iface*, size_t age);
+
+// Fill in per-second rates over the interval ending the given number of
+// rounds ago. Counters that went backwards, as when a driver resets them,
+// give a rate of zero. Returns false if there is no such interval.
+bool counters_rate(const struct counters_iface*, size_t age, uint64_t rates[COUNTER_MAX]);
+
+const char* counter_name(enum counter);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A thin event loop over kqueue, or epoll on Linux. Events are reported as
+// struct evloop_event, which has the same ident, filter, flags, data and
+// udata fields as a struct kevent. On kqueue it *is* a struct kevent, and
+// every function below is a direct inline wrapper around kevent(2).
+//
+// Watches on a descriptor must be dropped with evloop_del_fd() before it is
+// closed. Child processes that exit are not reaped.
+
+#ifdef __linux__
+
+#define EVLOOP_READ 1
+#define EVLOOP_WRITE 2
+#define EVLOOP_TIMER 3
+#define EVLOOP_PROC 4
+#define EVLOOP_SIGNAL 5
+
+#define EVLOOP_EOF 0x8000
+
+struct evloop_event {
+    uintptr_t ident;
+    short filter;
+    unsigned short flags;
+    int64_t data;
+    void* udata;
+};
+
+int evloop_create(void);
+void evloop_add_read(int, int, void*);
+void evloop_del_read(int, int);
+void evloop_add_write(int, int, void*);
+void evloop_del_write(int, int);
+void evloop_del_fd(int, int);
+void evloop_add_timer(int, uintptr_t, unsigned int, bool, void*);
+void evloop_del_timer(int, uintptr_t);
+bool evloop_add_proc(int, pid_t, void*);
+void evloop_add_signal(int, int, void*);
+int evloop_wait(int, struct evloop_event*, int, int);
+
+#else
+
+#include "evloop_kqueue.h"
+
+#endif
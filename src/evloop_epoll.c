@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "evloop.h"
+#include "util.h"
+
+// epoll backend for evloop.h. Timers, processes and signals each get their
+// own descriptor (timerfd, pidfd and signalfd) registered with epoll.
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define EVLOOP_BATCH 64
+
+enum watch_kind {
+    WATCH_FD,
+    WATCH_TIMER,
+    WATCH_PROC,
+    WATCH_SIGNAL
+};
+
+struct watch {
+    enum watch_kind kind;
+    int fd;
+    uintptr_t ident;
+    bool oneshot;
+
+    bool reading;
+    bool writing;
+    bool registered;
+    void* read_udata;
+    void* write_udata;
+
+    struct watch* next;
+};
+
+// Each process only ever has a single loop, so its watches can be global.
+// Descriptor watches are indexed by descriptor; the rest are kept in a list.
+static struct watch** fd_watches;
+static size_t fd_watches_len;
+static struct watch* other_watches;
+
+static struct watch* fd_watch(int fd, bool create) {
+    if(fd < 0) { die("Invalid descriptor"); }
+
+    if((size_t)fd >= fd_watches_len) {
+        if(!create) { return NULL; }
+
+        size_t len = (fd_watches_len > 0)? fd_watches_len : 64;
+        while(len <= (size_t)fd) { len *= 2; }
+
+        struct watch** watches = realloc(fd_watches, len * sizeof(*watches));
+        if(watches == NULL) { die("Failed to allocate watches"); }
+        memset(watches + fd_watches_len, 0, (len - fd_watches_len) * sizeof(*watches));
+        fd_watches = watches;
+        fd_watches_len = len;
+    }
+
+    if(fd_watches[fd] == NULL && create) {
+        struct watch* watch = calloc(1, sizeof(struct watch));
+        if(watch == NULL) { die("Failed to allocate watch"); }
+        watch->kind = WATCH_FD;
+        watch->fd = fd;
+        fd_watches[fd] = watch;
+    }
+
+    return fd_watches[fd];
+}
+
+static void fd_update(int loop, struct watch* watch) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.ptr = watch;
+    if(watch->reading) { event.events |= EPOLLIN | EPOLLRDHUP; }
+    if(watch->writing) { event.events |= EPOLLOUT; }
+
+    if(event.events == 0) {
+        evloop_del_fd(loop, watch->fd);
+        return;
+    }
+
+    const int op = watch->registered? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if(epoll_ctl(loop, op, watch->fd, &event) == -1) {
+        die("Failed to change epoll watch");
+    }
+
+    watch->registered = true;
+}
+
+static struct watch* other_watch(enum watch_kind kind, uintptr_t ident) {
+    for(struct watch* watch = other_watches; watch != NULL; watch = watch->next) {
+        if(watch->kind == kind && watch->ident == ident) { return watch; }
+    }
+
+    return NULL;
+}
+
+static struct watch* other_add(int loop,
+                               enum watch_kind kind,
+                               uintptr_t ident,
+                               int fd,
+                               void* udata) {
+    struct watch* watch = calloc(1, sizeof(struct watch));
+    if(watch == NULL) { die("Failed to allocate watch"); }
+    watch->kind = kind;
+    watch->fd = fd;
+    watch->ident = ident;
+    watch->read_udata = udata;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = watch;
+    if(epoll_ctl(loop, EPOLL_CTL_ADD, fd, &event) == -1) {
+        die("Failed to add epoll watch");
+    }
+
+    watch->next = other_watches;
+    other_watches = watch;
+    return watch;
+}
+
+static void other_del(int loop, struct watch* watch) {
+    struct watch** link = &other_watches;
+    while(*link != watch) { link = &(*link)->next; }
+    *link = watch->next;
+
+    epoll_ctl(loop, EPOLL_CTL_DEL, watch->fd, NULL);
+    close(watch->fd);
+    free(watch);
+}
+
+int evloop_create(void) {
+    const int loop = epoll_create1(EPOLL_CLOEXEC);
+    if(loop == -1) { die("Failed to create epoll"); }
+    return loop;
+}
+
+void evloop_add_read(int loop, int fd, void* udata) {
+    struct watch* watch = fd_watch(fd, true);
+    watch->reading = true;
+    watch->read_udata = udata;
+    fd_update(loop, watch);
+}
+
+void evloop_del_read(int loop, int fd) {
+    struct watch* watch = fd_watch(fd, false);
+    if(watch == NULL || !watch->reading) { return; }
+    watch->reading = false;
+    fd_update(loop, watch);
+}
+
+void evloop_add_write(int loop, int fd, void* udata) {
+    struct watch* watch = fd_watch(fd, true);
+    watch->writing = true;
+    watch->write_udata = udata;
+    fd_update(loop, watch);
+}
+
+void evloop_del_write(int loop, int fd) {
+    struct watch* watch = fd_watch(fd, false);
+    if(watch == NULL || !watch->writing) { return; }
+    watch->writing = false;
+    fd_update(loop, watch);
+}
+
+void evloop_del_fd(int loop, int fd) {
+    struct watch* watch = fd_watch(fd, false);
+    if(watch == NULL) { return; }
+
+    if(watch->registered) { epoll_ctl(loop, EPOLL_CTL_DEL, fd, NULL); }
+    fd_watches[fd] = NULL;
+    free(watch);
+}
+
+void evloop_add_timer(int loop,
+                      uintptr_t ident,
+                      unsigned int ms,
+                      bool oneshot,
+                      void* udata) {
+    struct watch* watch = other_watch(WATCH_TIMER, ident);
+    if(watch == NULL) {
+        const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(fd == -1) { die("Failed to create timer"); }
+        watch = other_add(loop, WATCH_TIMER, ident, fd, udata);
+    }
+
+    watch->read_udata = udata;
+    watch->oneshot = oneshot;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+    if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+    if(!oneshot) { spec.it_interval = spec.it_value; }
+
+    if(timerfd_settime(watch->fd, 0, &spec, NULL) == -1) {
+        die("Failed to set timer");
+    }
+}
+
+void evloop_del_timer(int loop, uintptr_t ident) {
+    struct watch* watch = other_watch(WATCH_TIMER, ident);
+    if(watch != NULL) { other_del(loop, watch); }
+}
+
+bool evloop_add_proc(int loop, pid_t pid, void* udata) {
+    const int fd = syscall(SYS_pidfd_open, pid, 0);
+    if(fd == -1) {
+        if(errno == ESRCH) { return false; }
+        die("Failed to open pidfd");
+    }
+
+    other_add(loop, WATCH_PROC, pid, fd, udata);
+    return true;
+}
+
+void evloop_add_signal(int loop, int signo, void* udata) {
+    // The signal must be blocked for signalfd to receive it. Linux queues
+    // blocked signals even when their disposition is SIG_IGN.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1) { die("Failed to block signal"); }
+
+    const int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(fd == -1) { die("Failed to create signalfd"); }
+    other_add(loop, WATCH_SIGNAL, signo, fd, udata);
+}
+
+static void set_event(struct evloop_event* event,
+                      uintptr_t ident,
+                      short filter,
+                      unsigned short flags,
+                      int64_t data,
+                      void* udata) {
+    event->ident = ident;
+    event->filter = filter;
+    event->flags = flags;
+    event->data = data;
+    event->udata = udata;
+}
+
+int evloop_wait(int loop, struct evloop_event* events, int n, int timeout_ms) {
+    struct epoll_event ready[EVLOOP_BATCH];
+    const int n_ready = epoll_wait(loop, ready, min(n, EVLOOP_BATCH), timeout_ms);
+    if(n_ready == -1) {
+        if(errno == EINTR) { return 0; }
+        die("Error waiting on epoll");
+    }
+
+    // A descriptor that is both readable and writable yields two events. If
+    // there is no room for the second, epoll will report it again next time.
+    int nev = 0;
+    for(int i = 0; i < n_ready && nev < n; i += 1) {
+        struct watch* watch = ready[i].data.ptr;
+        const uint32_t flags = ready[i].events;
+
+        switch(watch->kind) {
+            case WATCH_FD: {
+                const unsigned short eof = (flags & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))? EVLOOP_EOF : 0;
+                if(watch->reading && (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    set_event(&events[nev++], watch->fd, EVLOOP_READ, eof, 0, watch->read_udata);
+                }
+
+                if(watch->writing && nev < n && (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                    set_event(&events[nev++], watch->fd, EVLOOP_WRITE, eof, 0, watch->write_udata);
+                }
+                break;
+            }
+            case WATCH_TIMER: {
+                uint64_t expirations = 0;
+                if(read(watch->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                    break;
+                }
+
+                set_event(&events[nev++], watch->ident, EVLOOP_TIMER, 0, expirations, watch->read_udata);
+                if(watch->oneshot) { other_del(loop, watch); }
+                break;
+            }
+            case WATCH_PROC: {
+                set_event(&events[nev++], watch->ident, EVLOOP_PROC, EVLOOP_EOF, 0, watch->read_udata);
+                other_del(loop, watch);
+                break;
+            }
+            case WATCH_SIGNAL: {
+                struct signalfd_siginfo info;
+                int64_t count = 0;
+                while(read(watch->fd, &info, sizeof(info)) == sizeof(info)) { count += 1; }
+                if(count == 0) { break; }
+
+                set_event(&events[nev++], watch->ident, EVLOOP_SIGNAL, 0, count, watch->read_udata);
+                break;
+            }
+        }
+    }
+
+    return nev;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/event.h>
+
+#include "util.h"
+
+// kqueue backend for evloop.h. Everything is inlined, so that code written
+// against the event loop compiles to the same kevent(2) calls it would make
+// directly.
+
+#define EVLOOP_READ EVFILT_READ
+#define EVLOOP_WRITE EVFILT_WRITE
+#define EVLOOP_TIMER EVFILT_TIMER
+#define EVLOOP_PROC EVFILT_PROC
+#define EVLOOP_SIGNAL EVFILT_SIGNAL
+
+#define EVLOOP_EOF EV_EOF
+
+#define evloop_event kevent
+
+static inline void evloop_change(int loop,
+                                 uintptr_t ident,
+                                 short filter,
+                                 unsigned short flags,
+                                 unsigned int fflags,
+                                 int64_t data,
+                                 void* udata) {
+    struct kevent change;
+    EV_SET(&change, ident, filter, flags, fflags, data, udata);
+    if(kevent(loop, &change, 1, NULL, 0, NULL) == -1) {
+        // Deleting a watch that has already gone away is harmless
+        if((flags & EV_DELETE) && errno == ENOENT) { return; }
+        die("Failed to change kevent watch");
+    }
+}
+
+static inline int evloop_create(void) {
+    const int kq = kqueue();
+    if(kq == -1) { die("Failed to create kqueue"); }
+    return kq;
+}
+
+static inline void evloop_add_read(int loop, int fd, void* udata) {
+    evloop_change(loop, fd, EVFILT_READ, EV_ADD, 0, 0, udata);
+}
+
+static inline void evloop_del_read(int loop, int fd) {
+    evloop_change(loop, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+}
+
+static inline void evloop_add_write(int loop, int fd, void* udata) {
+    evloop_change(loop, fd, EVFILT_WRITE, EV_ADD, 0, 0, udata);
+}
+
+static inline void evloop_del_write(int loop, int fd) {
+    evloop_change(loop, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+}
+
+// Closing a descriptor removes its knotes, so there is nothing to do here
+static inline void evloop_del_fd(int loop, int fd) {}
+
+static inline void evloop_add_timer(int loop,
+                                    uintptr_t ident,
+                                    unsigned int ms,
+                                    bool oneshot,
+                                    void* udata) {
+    evloop_change(loop, ident, EVFILT_TIMER, EV_ADD | (oneshot? EV_ONESHOT : 0), 0, ms, udata);
+}
+
+static inline void evloop_del_timer(int loop, uintptr_t ident) {
+    evloop_change(loop, ident, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+}
+
+// Watch for a process to exit. Returns false if it has already gone away.
+static inline bool evloop_add_proc(int loop, pid_t pid, void* udata) {
+    struct kevent change;
+    EV_SET(&change, pid, EVFILT_PROC, EV_ADD, NOTE_EXIT, 0, udata);
+    if(kevent(loop, &change, 1, NULL, 0, NULL) == -1) {
+        if(errno == ESRCH) { return false; }
+        die("Failed to add process watch");
+    }
+
+    return true;
+}
+
+static inline void evloop_add_signal(int loop, int signo, void* udata) {
+    evloop_change(loop, signo, EVFILT_SIGNAL, EV_ADD, 0, 0, udata);
+}
+
+// Wait for events, for at most the given number of milliseconds, or forever
+// if negative. Returns 0 if interrupted.
+static inline int evloop_wait(int loop,
+                              struct kevent* events,
+                              int n,
+                              int timeout_ms) {
+    struct timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000};
+    const int nev = kevent(loop, NULL, 0, events, n, (timeout_ms < 0)? NULL : &timeout);
+    if(nev == -1) {
+        if(errno == EINTR) { return 0; }
+        die("Error waiting on kqueue");
+    }
+
+    return nev;
+}
@@ -10,6 +10,7 @@ enum state {
     STATE_NONE,
     STATE_STRING,
     STATE_ESCAPE,
+    STATE_NUMBER,
 };
 
 const char* flatjson_next(const char* text,
@@ -30,8 +31,21 @@ const char* flatjson_next(const char* text,
                     state = STATE_STRING;
                     continue;
                 }
+
+                // Bare numbers are returned as their text
+                if((ch >= '0' && ch <= '9') || ch == '-') {
+                    state = STATE_NUMBER;
+                    PUSH(ch);
+                }
                 break;
             }
+            case STATE_NUMBER: {
+                if((ch >= '0' && ch <= '9') || ch == '.' || ch == 'e' || ch == 'E' || ch == '+' || ch == '-') {
+                    PUSH(ch);
+                }
+
+                return text;
+            }
             case STATE_STRING: {
                 if(ch == '"') {
                     text += 1;
@@ -73,10 +87,14 @@ push:   if(bufi+1 >= buf_len) {
         buf[bufi] = '\0';
     }
 
+    if(state == STATE_NUMBER) { return text; }
     return NULL;
 }
 
 int flatjson_escape(const char* text, char* buf, size_t buf_len) {
+    if(buf_len == 0) { return 1; }
+    buf[0] = '\0';
+
     size_t i = 0;
     char ch;
     while((ch = text[0]) != '\0') {
@@ -87,6 +105,10 @@ int flatjson_escape(const char* text, char* buf, size_t buf_len) {
                 in_escape = true;
                 ch = '"';
                 break;
+            case '\\':
+                in_escape = true;
+                ch = '\\';
+                break;
             case '\n':
                 in_escape = true;
                 ch = 'n';
@@ -125,7 +147,7 @@ void flatjson_send(FILE* f, const char* text, bool* first) {
         return;
     }
 
-    fprintf(f, "\"%s\"", text);
+    fprintf(f, "\"%s\"", escaped);
     *first = false;
 }
 
@@ -0,0 +1,76 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flatjson.h"
+#include "fragments.h"
+#include "util.h"
+#include "validate.h"
+
+void fragments_init(struct fragments* fragments) {
+    fragments->entries = NULL;
+    fragments->len = 0;
+}
+
+void fragments_free(struct fragments* fragments) {
+    for(size_t i = 0; i < fragments->len; i += 1) { free(fragments->entries[i].buf); }
+    free(fragments->entries);
+    fragments_init(fragments);
+}
+
+void fragment_send(FILE* sock, const char* iface, uint32_t mtu, const struct iftable_details* details, bool* first) {
+    char rendered[IF_NAMESIZE + IFCONFIG_KEY_LEN + 2];
+    size_t offset = 0;
+    const char* key;
+    const char* value;
+    for(bool flags = true; iftable_details_next(details, &offset, &key, &value); flags = false) {
+        snprintf(rendered, sizeof(rendered), "%s.%s", iface, key);
+        flatjson_send(sock, rendered, first);
+        flatjson_send(sock, value, first);
+
+        if(flags) {
+            snprintf(rendered, sizeof(rendered), "%s.mtu", iface);
+            flatjson_send(sock, rendered, first);
+            snprintf(rendered, sizeof(rendered), "%" PRIu32, mtu);
+            flatjson_send(sock, rendered, first);
+        }
+    }
+}
+
+void fragment_encode(struct fragment* fragment, const char* iface, uint32_t mtu, const struct iftable_details* details) {
+    free(fragment->buf);
+    fragment->buf = NULL;
+    fragment->len = 0;
+
+    FILE* f = open_memstream(&fragment->buf, &fragment->len);
+    if(f == NULL) { die("Failed to open fragment buffer"); }
+
+    bool first = false;
+    fragment_send(f, iface, mtu, details, &first);
+    fclose(f);
+}
+
+const struct fragment* fragments_get(struct fragments* fragments, const struct iftable* table, uint32_t ifindex, bool* encoded) {
+    const char* iface = iftable_name(table, ifindex);
+    if(iface == NULL) { return NULL; }
+
+    if(ifindex >= fragments->len) {
+        size_t len = (fragments->len > 0)? fragments->len : 16;
+        while(len <= ifindex) { len *= 2; }
+
+        struct fragment* entries = realloc(fragments->entries, len * sizeof(*entries));
+        if(entries == NULL) { die("Failed to allocate fragments"); }
+        memset(entries + fragments->len, 0, (len - fragments->len) * sizeof(*entries));
+        fragments->entries = entries;
+        fragments->len = len;
+    }
+
+    struct fragment* fragment = &fragments->entries[ifindex];
+    *encoded = (fragment->generation != table->generation[ifindex]);
+    if(*encoded) {
+        fragment_encode(fragment, iface, table->mtu[ifindex], &table->details[ifindex]);
+        fragment->generation = table->generation[ifindex];
+    }
+
+    return fragment;
+}
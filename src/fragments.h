@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "iftable.h"
+
+// Each interface's details, encoded once as the key and value pairs that
+// list sends for it, and reused until the interface changes. An encoding is
+// kept per interface index, along with the generation it was made from, so
+// replying to list only costs an encoding for interfaces that have changed
+// since the last one.
+
+struct fragment {
+    // The generation encoded, or 0 if there is no encoding
+    uint32_t generation;
+
+    // The pairs, each preceded by a separator, so that a fragment can follow
+    // any other value in a reply
+    char* buf;
+    size_t len;
+};
+
+struct fragments {
+    struct fragment* entries;
+    size_t len;
+};
+
+void fragments_init(struct fragments*);
+void fragments_free(struct fragments*);
+
+// Send an interface's details as <iface>.<key> and value pairs. The first is
+// always its flags, which are followed by its MTU as in ifconfig's header.
+void fragment_send(FILE*, const char* iface, uint32_t mtu, const struct iftable_details*, bool* first);
+
+// Encode an interface's details into a fragment of its own, replacing any
+// earlier encoding.
+void fragment_encode(struct fragment*, const char* iface, uint32_t mtu, const struct iftable_details*);
+
+// The encoding of the interface on the given index in the table, made afresh
+// if the interface has changed since it was last made. Sets *encoded if it
+// was. Returns NULL if there is no such interface.
+const struct fragment* fragments_get(struct fragments*, const struct iftable*, uint32_t ifindex, bool* encoded);
@@ -1,19 +1,268 @@
+// Fuzz targets for everything that parses untrusted input. Each target takes
+// one input and aborts if it finds an inconsistency; memory errors are left to
+// the sanitizers.
+//
+// Built with FUZZ_LIBFUZZER and FUZZ_TARGET naming one of the targets, this
+// is a libFuzzer target. Otherwise it is a program that runs the target named
+// on its command line in-process: in AFL's persistent mode when built with
+// afl-clang-fast, or else over the given files, repeatedly for the given
+// number of seconds if there is one, reporting executions per second.
+
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command.h"
 #include "flatjson.h"
+#include "payload.h"
+#include "scan.h"
+#include "util.h"
 #include "validate.h"
 
-int main(void) {
-    char buf[2048];
-    const ssize_t n_read = fread(buf, 1, sizeof(buf)-1, stdin);
-    if(n_read < 0) { return 1; }
-    buf[n_read] = '\0';
+#define MAX_INPUT (64 * 1024)
+#define MAX_VALUES 64
+
+// Longest value checked by the round trip. Its escaped form always fits in
+// flatjson_send()'s buffer.
+#define ROUND_TRIP_LEN 1000
+
+// Copy an input into a terminated buffer
+static char* terminate(const uint8_t* data, size_t size) {
+    char* text = malloc(size + 1);
+    if(text == NULL) { abort(); }
+    memcpy(text, data, size);
+    text[size] = '\0';
+    return text;
+}
+
+// Whatever decodes must encode and decode again to the same values
+static int fuzz_flatjson(const uint8_t* data, size_t size) {
+    char* text = terminate(data, size);
+    static char values[MAX_VALUES][ROUND_TRIP_LEN];
+    size_t n = 0;
+    const char* cursor = text;
+    while(n < MAX_VALUES && (cursor = flatjson_next(cursor, values[n], ROUND_TRIP_LEN, NULL)) != NULL) {
+        n += 1;
+    }
+
+    char* encoded = NULL;
+    size_t encoded_len = 0;
+    FILE* f = open_memstream(&encoded, &encoded_len);
+    if(f == NULL) { abort(); }
+    bool first = true;
+    flatjson_start_send(f);
+    for(size_t i = 0; i < n; i += 1) { flatjson_send(f, values[i], &first); }
+    flatjson_finish_send(f);
+    fclose(f);
+
+    char value[ROUND_TRIP_LEN];
+    cursor = encoded;
+    for(size_t i = 0; i < n; i += 1) {
+        cursor = flatjson_next(cursor, value, sizeof(value), NULL);
+        if(cursor == NULL || strcmp(value, values[i]) != 0) { abort(); }
+    }
+    if(flatjson_next(cursor, value, sizeof(value), NULL) != NULL) { abort(); }
+
+    free(encoded);
+    free(text);
+    return 0;
+}
+
+// Lines of ifconfig output, including scan results
+static int fuzz_ifconfig(const uint8_t* data, size_t size) {
+    char* text = terminate(data, size);
+    char* lines = text;
+    char* line;
+    while((line = strsep(&lines, "\n")) != NULL) {
+        char iface[IF_NAMESIZE];
+        char flags[FLAGS_LEN];
+        char key[IFCONFIG_KEY_LEN];
+        char value[IFCONFIG_VALUE_LEN];
+        int mtu;
+
+        // Names taken from headers are used in the interface table
+        if(parse_ifconfig_header(line, iface, flags, &mtu) && !validate_iface(iface)) { abort(); }
+        parse_ifconfig_kv(line, key, value);
+
+        struct scan_result result;
+        scan_parse_line(line, &result);
+    }
+
+    free(text);
+    return 0;
+}
+
+// An interface name, a newline, and a list of pseudo-interface classes
+static int fuzz_pseudo(const uint8_t* data, size_t size) {
+    char* text = terminate(data, size);
+    char* classes = text;
+    const char* iface = strsep(&classes, "\n");
+
+    // Callers only pass names that fit in an ifreq
+    if(classes != NULL && strlen(iface) < IF_NAMESIZE) {
+        char list[PSEUDO_CLASSES_LEN];
+        strlcpy(list, classes, sizeof(list));
+        iface_is_pseudo(iface, list);
+    }
+
+    free(text);
+    return 0;
+}
+
+// A request line, as the parent dispatches it. The services are stood in for
+// by their checks on the payloads they are sent, which must accept whatever
+// the parent accepted. The raw input is also fed to those checks, as if the
+// parent had been compromised.
+static int fuzz_command(const uint8_t* data, size_t size) {
+    char* text = terminate(data, size);
+    static struct command command;
+    const char* error = command_parse(text, &command);
+    if(error == NULL) {
+        if(command.iface.name[0] != '\0' && !payload_iface_valid(&command.iface)) { abort(); }
+
+        if(command.spec->cmd == STATS_CMD_CONFIGURE) {
+            static struct payload_configure sent;
+            static struct payload_configure received;
+            memset(&sent, 0, sizeof(sent));
+            sent.iface = command.iface;
+            sent.n_stanzas = command.n_stanzas;
+            memcpy(sent.stanzas, command.stanzas, sizeof(sent.stanzas));
+            if(!payload_get(&sent, sizeof(sent), &received, sizeof(received)) ||
+               !payload_configure_valid(&received)) {
+                abort();
+            }
+        }
+    } else if(command.spec == NULL && strcmp(error, "unknown command") != 0) {
+        abort();
+    }
+
+    static struct payload_configure configure;
+    struct payload_iface iface;
+    if(payload_get(data, size, &configure, sizeof(configure))) { payload_configure_valid(&configure); }
+    if(payload_get(data, size, &iface, sizeof(iface))) { payload_iface_valid(&iface); }
+
+    free(text);
+    return 0;
+}
+
+struct target {
+    const char* name;
+    int (*f)(const uint8_t*, size_t);
+};
+
+static const struct target targets[] = {
+    {"flatjson", fuzz_flatjson},
+    {"ifconfig", fuzz_ifconfig},
+    {"pseudo", fuzz_pseudo},
+    {"command", fuzz_command},
+    {NULL, NULL}
+};
 
-    char term[2048];
-    char const* cursor = buf;
-    while((cursor = flatjson_next(cursor, term, sizeof(term), NULL)) != NULL) {
-        validate_iface(term);
-        validate_stanza(term);
+static const struct target* find_target(const char* name) {
+    for(const struct target* target = targets; target->name != NULL; target += 1) {
+        if(strcmp(target->name, name) == 0) { return target; }
     }
 
+    return NULL;
+}
+
+#ifdef FUZZ_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static const struct target* target;
+    if(target == NULL && (target = find_target(FUZZ_TARGET)) == NULL) { abort(); }
+    return target->f(data, size);
+}
+#else
+struct input {
+    uint8_t* data;
+    size_t size;
+};
+
+static size_t read_input(FILE* f, uint8_t* buf) {
+    const size_t n = fread(buf, 1, MAX_INPUT, f);
+    if(ferror(f)) { die("Failed to read input"); }
+    return n;
+}
+
+static void usage(void) {
+    fputs("usage: fuzzer [-t seconds] (flatjson | ifconfig | pseudo | command) [file ...]\n", stderr);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    unsigned long seconds = 0;
+    int c;
+    while((c = getopt(argc, argv, "t:")) != -1) {
+        switch(c) {
+            case 't':
+                seconds = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+    if(argc < 1) { usage(); }
+
+    const struct target* target = find_target(argv[0]);
+    if(target == NULL) { usage(); }
+
+    static uint8_t buf[MAX_INPUT];
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+    // Each pass of the loop is one input, without forking a new process
+    while(__AFL_LOOP(10000)) {
+        const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if(n < 0) { die("Failed to read input"); }
+        target->f(buf, n);
+    }
+
+    return 0;
+#endif
+
+    if(argc == 1) {
+        target->f(buf, read_input(stdin, buf));
+        return 0;
+    }
+
+    const size_t n_inputs = argc - 1;
+    struct input* inputs = calloc(n_inputs, sizeof(*inputs));
+    if(inputs == NULL) { die("Failed to allocate inputs"); }
+    for(size_t i = 0; i < n_inputs; i += 1) {
+        FILE* f = fopen(argv[i + 1], "r");
+        if(f == NULL) { die("Failed to open input"); }
+        inputs[i].size = read_input(f, buf);
+        inputs[i].data = malloc(inputs[i].size);
+        if(inputs[i].data == NULL) { die("Failed to allocate input"); }
+        memcpy(inputs[i].data, buf, inputs[i].size);
+        fclose(f);
+    }
+
+    // Run every input at least once, and keep cycling through them until
+    // the time is up
+    const uint64_t start = now_usec();
+    const uint64_t deadline = start + seconds * 1000000;
+    uint64_t execs = 0;
+    do {
+        for(size_t i = 0; i < n_inputs; i += 1) {
+            target->f(inputs[i].data, inputs[i].size);
+        }
+        execs += n_inputs;
+    } while(now_usec() < deadline);
+
+    const uint64_t elapsed = now_usec() - start;
+    fprintf(stderr, "%s: %llu execs in %.2f s, %.0f execs/sec\n",
+            target->name,
+            (unsigned long long)execs,
+            elapsed / 1e6,
+            (elapsed > 0)? execs * 1e6 / elapsed : 0.0);
+
+    for(size_t i = 0; i < n_inputs; i += 1) { free(inputs[i].data); }
+    free(inputs);
     return 0;
 }
+#endif
@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "history.h"
+
+void history_init(struct history* history) {
+    memset(history, 0, sizeof(*history));
+    history->next_seq = 1;
+    history->first_seq = 1;
+}
+
+void history_resume(struct history* history, uint64_t next_seq) {
+    if(next_seq < history->next_seq) { return; }
+    history->next_seq = next_seq;
+    history->first_seq = next_seq;
+}
+
+uint64_t history_record(struct history* history, const struct history_event* event) {
+    const uint64_t seq = history->next_seq++;
+    struct history_event* slot = &history->events[seq % HISTORY_LEN];
+    *slot = *event;
+    slot->seq = seq;
+    return seq;
+}
+
+size_t history_read(const struct history* history,
+                    uint64_t since,
+                    struct history_event* events,
+                    size_t n,
+                    uint64_t* lost) {
+    uint64_t oldest = (history->next_seq > HISTORY_LEN)? history->next_seq - HISTORY_LEN : 1;
+    if(oldest < history->first_seq) { oldest = history->first_seq; }
+
+    if(since >= history->next_seq) { since = 0; }
+
+    *lost = 0;
+    uint64_t seq = since + 1;
+    if(seq < oldest) {
+        *lost = oldest - seq;
+        seq = oldest;
+    }
+
+    size_t copied = 0;
+    for(; seq < history->next_seq && copied < n; seq += 1) {
+        events[copied++] = history->events[seq % HISTORY_LEN];
+    }
+
+    return copied;
+}
+
+const char* history_link_name(enum history_link link) {
+    switch(link) {
+        case HISTORY_LINK_DOWN: return "down";
+        case HISTORY_LINK_UP: return "up";
+        default: return "unknown";
+    }
+}
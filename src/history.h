@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+// The most recent interface events, kept in memory so that clients can catch
+// up on what they missed without parsing the hardware event log. Events are
+// numbered from 1, and read by passing the number of the last one seen.
+#define HISTORY_LEN 1024
+
+enum history_link {
+    HISTORY_LINK_UNKNOWN,
+    HISTORY_LINK_DOWN,
+    HISTORY_LINK_UP
+};
+
+struct history_event {
+    uint64_t seq;
+
+    // Microseconds since the epoch
+    uint64_t timestamp;
+
+    uint32_t ifindex;
+    uint32_t flags;
+    uint8_t old_link;
+    uint8_t new_link;
+    char iface[IF_NAMESIZE];
+};
+
+struct history {
+    struct history_event events[HISTORY_LEN];
+    uint64_t next_seq;
+
+    // The first number recorded in this history. Earlier ones are from
+    // before a restart, and count as lost.
+    uint64_t first_seq;
+};
+
+void history_init(struct history*);
+
+// Carry on numbering events from where a previous history left off.
+void history_resume(struct history*, uint64_t next_seq);
+
+// Record an event, numbering it. Returns its number.
+uint64_t history_record(struct history*, const struct history_event*);
+
+// Copy up to n of the events numbered after the given one, oldest first.
+// Sets *lost to the number of those which have already been overwritten. A
+// number that has not been reached yet is taken to be from before a
+// restart, and reads from the beginning.
+size_t history_read(const struct history*, uint64_t, struct history_event*, size_t, uint64_t* lost);
+
+const char* history_link_name(enum history_link);
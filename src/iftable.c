@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "iftable.h"
+#include "util.h"
+
+#define HASH_TOMBSTONE UINT32_MAX
+
+static uint32_t hash_name(const char* name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(; *name != '\0'; name += 1) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void* grow_array(void* array, size_t old_len, size_t len, size_t size) {
+    char* grown = realloc(array, len * size);
+    if(grown == NULL) { die("Failed to allocate interface table"); }
+    memset(grown + old_len * size, 0, (len - old_len) * size);
+    return grown;
+}
+
+static void grow(struct iftable* table, uint32_t ifindex) {
+    if(ifindex < table->len) { return; }
+
+    size_t len = (table->len > 0)? table->len : 64;
+    while(len <= ifindex) { len *= 2; }
+
+    table->name = grow_array(table->name, table->len, len, sizeof(*table->name));
+    table->flags = grow_array(table->flags, table->len, len, sizeof(*table->flags));
+    table->mtu = grow_array(table->mtu, table->len, len, sizeof(*table->mtu));
+    table->link = grow_array(table->link, table->len, len, sizeof(*table->link));
+    table->generation = grow_array(table->generation, table->len, len, sizeof(*table->generation));
+    table->details = grow_array(table->details, table->len, len, sizeof(*table->details));
+    table->details_generation = grow_array(table->details_generation, table->len, len, sizeof(*table->details_generation));
+    table->len = len;
+}
+
+static void hash_insert(struct iftable* table, uint32_t ifindex) {
+    const size_t mask = table->hash_len - 1;
+    size_t slot = hash_name(table->pool + table->name[ifindex]) & mask;
+    while(table->hash[slot] != 0 && table->hash[slot] != HASH_TOMBSTONE) {
+        slot = (slot + 1) & mask;
+    }
+
+    if(table->hash[slot] == 0) { table->hash_used += 1; }
+    table->hash[slot] = ifindex;
+}
+
+// Rebuild the hash, large enough that it stays at most half full
+static void rehash(struct iftable* table) {
+    size_t len = 64;
+    while(len < (table->count + 1) * 4) { len *= 2; }
+
+    free(table->hash);
+    table->hash = calloc(len, sizeof(*table->hash));
+    if(table->hash == NULL) { die("Failed to allocate interface table"); }
+    table->hash_len = len;
+    table->hash_used = 0;
+
+    for(size_t i = 0; i < table->len; i += 1) {
+        if(table->name[i] != 0) { hash_insert(table, i); }
+    }
+}
+
+static size_t hash_find(const struct iftable* table, const char* name) {
+    const size_t mask = table->hash_len - 1;
+    for(size_t slot = hash_name(name) & mask;; slot = (slot + 1) & mask) {
+        const uint32_t ifindex = table->hash[slot];
+        if(ifindex == 0) { return SIZE_MAX; }
+        if(ifindex != HASH_TOMBSTONE && strcmp(table->pool + table->name[ifindex], name) == 0) {
+            return slot;
+        }
+    }
+}
+
+// Copy live names into a fresh pool, once most of it is garbage
+static void compact(struct iftable* table) {
+    if(table->pool_garbage < 4096 || table->pool_garbage < table->pool_len / 2) { return; }
+
+    const size_t cap = table->pool_len - table->pool_garbage;
+    char* pool = malloc(cap);
+    if(pool == NULL) { die("Failed to allocate interface table"); }
+
+    size_t len = 1;
+    pool[0] = '\0';
+    for(size_t i = 0; i < table->len; i += 1) {
+        if(table->name[i] == 0) { continue; }
+
+        const size_t size = strlen(table->pool + table->name[i]) + 1;
+        memcpy(pool + len, table->pool + table->name[i], size);
+        table->name[i] = len;
+        len += size;
+    }
+
+    free(table->pool);
+    table->pool = pool;
+    table->pool_len = len;
+    table->pool_cap = cap;
+    table->pool_garbage = 0;
+}
+
+static uint32_t intern(struct iftable* table, const char* name) {
+    const size_t size = strlen(name) + 1;
+    if(table->pool_len + size > table->pool_cap) {
+        size_t cap = table->pool_cap * 2;
+        while(cap < table->pool_len + size) { cap *= 2; }
+
+        char* pool = realloc(table->pool, cap);
+        if(pool == NULL) { die("Failed to allocate interface table"); }
+        table->pool = pool;
+        table->pool_cap = cap;
+    }
+
+    const uint32_t offset = table->pool_len;
+    memcpy(table->pool + offset, name, size);
+    table->pool_len += size;
+    return offset;
+}
+
+// Drop an interface's name from the hash and the pool
+static void unname(struct iftable* table, uint32_t ifindex) {
+    const char* name = table->pool + table->name[ifindex];
+    table->hash[hash_find(table, name)] = HASH_TOMBSTONE;
+    table->pool_garbage += strlen(name) + 1;
+    table->name[ifindex] = 0;
+}
+
+void iftable_init(struct iftable* table) {
+    memset(table, 0, sizeof(*table));
+    table->next_generation = 1;
+
+    // Offset 0 is reserved to mean no name
+    table->pool_cap = 1024;
+    table->pool = malloc(table->pool_cap);
+    if(table->pool == NULL) { die("Failed to allocate interface table"); }
+    table->pool[0] = '\0';
+    table->pool_len = 1;
+
+    rehash(table);
+}
+
+void iftable_free(struct iftable* table) {
+    for(size_t i = 0; i < table->len; i += 1) { free(table->details[i].buf); }
+
+    free(table->name);
+    free(table->flags);
+    free(table->mtu);
+    free(table->link);
+    free(table->generation);
+    free(table->details);
+    free(table->details_generation);
+    free(table->pool);
+    free(table->hash);
+    memset(table, 0, sizeof(*table));
+}
+
+static void touch(struct iftable* table, uint32_t ifindex) {
+    table->generation[ifindex] = table->next_generation++;
+}
+
+void iftable_set(struct iftable* table, uint32_t ifindex, const char* name) {
+    if(ifindex == 0 || name[0] == '\0') { return; }
+
+    grow(table, ifindex);
+    if(table->name[ifindex] != 0) {
+        if(strcmp(table->pool + table->name[ifindex], name) == 0) { return; }
+        unname(table, ifindex);
+        table->count -= 1;
+    }
+
+    // Names are unique, so an interface still holding this one is gone
+    const uint32_t stale = iftable_lookup(table, name);
+    if(stale != 0) { iftable_remove(table, stale); }
+
+    table->name[ifindex] = intern(table, name);
+    table->count += 1;
+    if((table->hash_used + 1) * 2 > table->hash_len) { rehash(table); }
+    hash_insert(table, ifindex);
+    touch(table, ifindex);
+    compact(table);
+}
+
+void iftable_remove(struct iftable* table, uint32_t ifindex) {
+    if(ifindex >= table->len || table->name[ifindex] == 0) { return; }
+
+    unname(table, ifindex);
+    table->count -= 1;
+    table->flags[ifindex] = 0;
+    table->mtu[ifindex] = 0;
+    table->link[ifindex] = HISTORY_LINK_UNKNOWN;
+    free(table->details[ifindex].buf);
+    memset(&table->details[ifindex], 0, sizeof(table->details[ifindex]));
+    touch(table, ifindex);
+    compact(table);
+}
+
+uint32_t iftable_lookup(const struct iftable* table, const char* name) {
+    const size_t slot = hash_find(table, name);
+    return (slot == SIZE_MAX)? 0 : table->hash[slot];
+}
+
+const char* iftable_name(const struct iftable* table, uint32_t ifindex) {
+    if(ifindex >= table->len || table->name[ifindex] == 0) { return NULL; }
+    return table->pool + table->name[ifindex];
+}
+
+enum history_link iftable_link(const struct iftable* table, uint32_t ifindex) {
+    if(ifindex >= table->len) { return HISTORY_LINK_UNKNOWN; }
+    return table->link[ifindex];
+}
+
+bool iftable_update(struct iftable* table, uint32_t ifindex, uint32_t flags, uint32_t mtu, enum history_link link) {
+    if(iftable_name(table, ifindex) == NULL) { return false; }
+
+    if(table->flags[ifindex] != flags || table->mtu[ifindex] != mtu || table->link[ifindex] != link) {
+        table->flags[ifindex] = flags;
+        table->mtu[ifindex] = mtu;
+        table->link[ifindex] = link;
+        touch(table, ifindex);
+    }
+
+    return true;
+}
+
+bool iftable_set_mtu(struct iftable* table, uint32_t ifindex, uint32_t mtu) {
+    if(iftable_name(table, ifindex) == NULL) { return false; }
+
+    if(table->mtu[ifindex] != mtu) {
+        table->mtu[ifindex] = mtu;
+        touch(table, ifindex);
+    }
+
+    return true;
+}
+
+const struct iftable_details* iftable_details(const struct iftable* table, uint32_t ifindex) {
+    if(iftable_name(table, ifindex) == NULL) { return NULL; }
+    return &table->details[ifindex];
+}
+
+bool iftable_set_details(struct iftable* table, uint32_t ifindex, const struct iftable_details* details) {
+    if(iftable_name(table, ifindex) == NULL) { return false; }
+
+    struct iftable_details* current = &table->details[ifindex];
+    if(current->len == details->len && (details->len == 0 || memcmp(current->buf, details->buf, details->len) == 0)) {
+        table->details_generation[ifindex] = table->generation[ifindex];
+        return true;
+    }
+
+    iftable_details_clear(current);
+    if(details->len > current->cap) {
+        char* buf = realloc(current->buf, details->len);
+        if(buf == NULL) { die("Failed to allocate interface details"); }
+        current->buf = buf;
+        current->cap = details->len;
+    }
+
+    memcpy(current->buf, details->buf, details->len);
+    current->len = details->len;
+    touch(table, ifindex);
+    table->details_generation[ifindex] = table->generation[ifindex];
+    return true;
+}
+
+bool iftable_details_current(const struct iftable* table, uint32_t ifindex) {
+    return iftable_name(table, ifindex) != NULL && table->details_generation[ifindex] == table->generation[ifindex];
+}
+
+void iftable_expire_details(struct iftable* table, uint32_t ifindex) {
+    if(iftable_name(table, ifindex) != NULL) { touch(table, ifindex); }
+}
+
+void iftable_details_clear(struct iftable_details* details) {
+    details->len = 0;
+}
+
+void iftable_details_add(struct iftable_details* details, const char* key, const char* value) {
+    const size_t key_size = strlen(key) + 1;
+    const size_t value_size = strlen(value) + 1;
+    const size_t len = details->len + key_size + value_size;
+    if(len > details->cap) {
+        size_t cap = (details->cap > 0)? details->cap : 256;
+        while(cap < len) { cap *= 2; }
+
+        char* buf = realloc(details->buf, cap);
+        if(buf == NULL) { die("Failed to allocate interface details"); }
+        details->buf = buf;
+        details->cap = cap;
+    }
+
+    memcpy(details->buf + details->len, key, key_size);
+    memcpy(details->buf + details->len + key_size, value, value_size);
+    details->len = len;
+}
+
+bool iftable_details_next(const struct iftable_details* details,
+                          size_t* offset,
+                          const char** key,
+                          const char** value) {
+    if(*offset >= details->len) { return false; }
+
+    *key = details->buf + *offset;
+    *value = *key + strlen(*key) + 1;
+    *offset = (*value - details->buf) + strlen(*value) + 1;
+    return true;
+}
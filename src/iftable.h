@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "history.h"
+
+// Every interface the kernel has told us about, indexed by ifindex. The
+// fields read on every event are kept in parallel arrays, so that walking
+// thousands of interfaces touches only the fields being walked. Names are
+// interned in one pool, with a hash to look interfaces up by name, and the
+// details shown by list are kept apart from the rest.
+//
+// Each interface's generation changes whenever anything about it does, and
+// is never reused, even by another interface on the same index. Details are
+// current until the interface changes after they were set.
+
+// Details from ifconfig, such as addresses and media, as a packed list of
+// NUL-terminated key and value pairs
+struct iftable_details {
+    char* buf;
+    size_t len;
+    size_t cap;
+};
+
+struct iftable {
+    // Allocated length of each array below
+    size_t len;
+
+    // Offset of each interface's name in the pool, or 0 if there is no
+    // interface on that index
+    uint32_t* name;
+    uint32_t* flags;
+    uint32_t* mtu;
+    uint8_t* link;
+    uint32_t* generation;
+    struct iftable_details* details;
+    uint32_t* details_generation;
+
+    char* pool;
+    size_t pool_len;
+    size_t pool_cap;
+    size_t pool_garbage;
+
+    // Open addressing hash of names to indexes
+    uint32_t* hash;
+    size_t hash_len;
+    size_t hash_used;
+
+    size_t count;
+    uint32_t next_generation;
+};
+
+void iftable_init(struct iftable*);
+void iftable_free(struct iftable*);
+
+// Add an interface, or rename the one on the given index.
+void iftable_set(struct iftable*, uint32_t ifindex, const char* name);
+
+// Forget the interface on the given index.
+void iftable_remove(struct iftable*, uint32_t ifindex);
+
+// The index of the interface with the given name, or 0 if there is none.
+uint32_t iftable_lookup(const struct iftable*, const char* name);
+
+// The name of the interface on the given index, or NULL if there is none.
+const char* iftable_name(const struct iftable*, uint32_t ifindex);
+
+// The last known link state, or HISTORY_LINK_UNKNOWN.
+enum history_link iftable_link(const struct iftable*, uint32_t ifindex);
+
+// Update an interface's hot fields. Returns false if there is no such
+// interface.
+bool iftable_update(struct iftable*, uint32_t ifindex, uint32_t flags, uint32_t mtu, enum history_link);
+bool iftable_set_mtu(struct iftable*, uint32_t ifindex, uint32_t mtu);
+
+// An interface's details, or NULL if there is no such interface.
+const struct iftable_details* iftable_details(const struct iftable*, uint32_t ifindex);
+
+// Replace an interface's details with a copy of the given ones. Returns
+// false if there is no such interface.
+bool iftable_set_details(struct iftable*, uint32_t ifindex, const struct iftable_details*);
+
+// Whether an interface's details were set since it last changed.
+bool iftable_details_current(const struct iftable*, uint32_t ifindex);
+
+// Mark an interface as changed in a way the table does not record, such as
+// its addresses, so that its details are no longer current.
+void iftable_expire_details(struct iftable*, uint32_t ifindex);
+
+void iftable_details_clear(struct iftable_details*);
+void iftable_details_add(struct iftable_details*, const char* key, const char* value);
+
+// Step through the key and value pairs, starting from an offset of zero.
+// Returns false at the end.
+bool iftable_details_next(const struct iftable_details*, size_t* offset, const char** key, const char** value);
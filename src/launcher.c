@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <imsg.h>
+
+#include "evloop.h"
+#include "launcher.h"
+#include "util.h"
+
+// Children that have not yet been reaped. There are only ever as many as
+// service_exec allows jobs, so a list is fine.
+struct child {
+    uint32_t id;
+    pid_t pid;
+    struct child* next;
+};
+
+static struct imsgbuf ibuf;
+static struct child* children;
+
+static void send_int(uint32_t type, uint32_t id, int fd, int value) {
+    if(imsg_compose(&ibuf, type, id, 0, fd, &value, sizeof(value)) == -1) {
+        die("Failed to compose message");
+    }
+}
+
+static void spawn(uint32_t id, char* data, size_t data_len) {
+    // The arguments must be nul-terminated
+    char* argv[LAUNCHER_MAX_ARGS + 1];
+    size_t argc = 0;
+    size_t i = 0;
+    while(i < data_len && argc < LAUNCHER_MAX_ARGS) {
+        const char* end = memchr(data + i, '\0', data_len - i);
+        if(end == NULL) { break; }
+
+        argv[argc++] = data + i;
+        i = (end - data) + 1;
+    }
+    argv[argc] = NULL;
+
+    if(argc == 0) {
+        send_int(LAUNCHER_FAILED, id, -1, EINVAL);
+        return;
+    }
+
+    pid_t pid;
+    int out_fd;
+    int err_fd;
+    const int error = spawn_child(argv, &pid, &out_fd, &err_fd);
+    if(error != 0) {
+        send_int(LAUNCHER_FAILED, id, -1, error);
+        return;
+    }
+
+    struct child* child = malloc(sizeof(struct child));
+    if(child == NULL) { die("Failed to allocate child"); }
+    child->id = id;
+    child->pid = pid;
+    child->next = children;
+    children = child;
+
+    send_int(LAUNCHER_STARTED, id, out_fd, pid);
+    send_int(LAUNCHER_STDERR, id, err_fd, 0);
+}
+
+static void signal_child(uint32_t id, const int* signo, size_t data_len) {
+    if(data_len != sizeof(*signo)) { return; }
+
+    // A child that has already been reaped has nothing left to signal, and
+    // its pid may belong to someone else by now
+    for(struct child* child = children; child != NULL; child = child->next) {
+        if(child->id == id) {
+            kill(-child->pid, *signo);
+            return;
+        }
+    }
+}
+
+static void reap(void) {
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        struct child** link = &children;
+        while(*link != NULL && (*link)->pid != pid) { link = &(*link)->next; }
+        if(*link == NULL) { continue; }
+
+        struct child* child = *link;
+        *link = child->next;
+        send_int(LAUNCHER_EXITED, child->id, -1, status);
+        free(child);
+    }
+}
+
+int main(int argc, char** argv) {
+    imsg_init(&ibuf, LAUNCHER_FD);
+
+    const int loop = evloop_create();
+    evloop_add_read(loop, LAUNCHER_FD, NULL);
+    evloop_add_signal(loop, SIGCHLD, NULL);
+
+    pledge("stdio proc exec sendfd", NULL);
+
+    struct evloop_event events[4];
+    while(1) {
+        const int nev = evloop_wait(loop, events, 4, -1);
+        for(int i = 0; i < nev; i += 1) {
+            if(events[i].filter == EVLOOP_SIGNAL) {
+                reap();
+                continue;
+            }
+
+            const int n = imsg_read(&ibuf);
+            if(n < 0) { die("Error reading ibuf"); }
+            if(n == 0) { return 0; }
+
+            struct imsg imsg;
+            while(imsg_get(&ibuf, &imsg) > 0) {
+                const size_t data_len = imsg.hdr.len - IMSG_HEADER_SIZE;
+                if(imsg.hdr.type == LAUNCHER_SPAWN) {
+                    spawn(imsg.hdr.peerid, imsg.data, data_len);
+                } else if(imsg.hdr.type == LAUNCHER_SIGNAL) {
+                    signal_child(imsg.hdr.peerid, imsg.data, data_len);
+                }
+
+                imsg_free(&imsg);
+            }
+        }
+
+        if(imsg_flush(&ibuf) == -1) { die("Error writing ibuf"); }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// networkd-launcher is a small program which service_exec starts once, and
+// asks to spawn each of its jobs. Forking a process with a tiny address
+// space is far cheaper than forking service_exec.
+//
+// They talk imsg over a socketpair, which is the launcher's standard input.
+// Requests and replies carry the job ID in the peerid.
+
+#define LAUNCHER_FD 0
+#define LAUNCHER_MAX_ARGS 16
+
+enum launcher_type {
+    // A list of nul-terminated arguments, the first being the program path
+    LAUNCHER_SPAWN,
+
+    // An int signal number, sent to the job's process group
+    LAUNCHER_SIGNAL,
+
+    // The job has started. Carries its pid, and its stdout descriptor.
+    LAUNCHER_STARTED,
+
+    // Carries the job's stderr descriptor. Always follows LAUNCHER_STARTED.
+    LAUNCHER_STDERR,
+
+    // Carries an int errno
+    LAUNCHER_FAILED,
+
+    // Carries the int status from waitpid()
+    LAUNCHER_EXITED
+};
+
+// Spawn a program in its own process group, with its stdout and stderr
+// connected to non-blocking pipes. Returns an errno value on failure.
+int spawn_child(char* const[], pid_t*, int*, int*);
+
+// Start the launcher, returning our end of its socket
+int launcher_start(const char*);
+
+// Pack arguments for LAUNCHER_SPAWN. Returns the packed length, or 0 if they
+// do not fit.
+size_t launcher_pack(char* const[], char*, size_t);
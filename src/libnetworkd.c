@@ -0,0 +1,471 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "flatjson.h"
+#include "libnetworkd.h"
+
+#define MAX_ARGS 64
+
+struct request {
+    networkd_reply_cb cb;
+    void* arg;
+};
+
+struct networkd {
+    int fd;
+
+    // Encoded requests that the socket has not yet accepted
+    char* out;
+    size_t out_len;
+    size_t out_cap;
+
+    // Reply data read but not yet handled
+    char* in;
+    size_t in_len;
+    size_t in_cap;
+
+    // Requests waiting on replies, oldest first, in a ring
+    struct request* queue;
+    size_t queue_head;
+    size_t queue_len;
+    size_t queue_cap;
+
+    networkd_event_cb event_cb;
+    void* event_arg;
+
+    // Room for the decoded values of one reply
+    char* values_buf;
+    size_t values_buf_cap;
+    const char** values;
+    size_t values_cap;
+};
+
+static int grow(void* buf, size_t* cap, size_t needed, size_t size) {
+    if(needed <= *cap) { return 0; }
+
+    size_t new_cap = (*cap > 0)? *cap : 16;
+    while(new_cap < needed) { new_cap *= 2; }
+
+    void* grown = realloc(*(void**)buf, new_cap * size);
+    if(grown == NULL) { return -1; }
+    *(void**)buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+struct networkd* networkd_open_fd(int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    if(flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) { return NULL; }
+
+    struct networkd* nd = calloc(1, sizeof(*nd));
+    if(nd == NULL) { return NULL; }
+    nd->fd = fd;
+    return nd;
+}
+
+struct networkd* networkd_open(const char* path) {
+    if(path == NULL) { path = NETWORKD_SOCKET; }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) { return NULL; }
+
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+       connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        const int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+
+    struct networkd* nd = networkd_open_fd(fd);
+    if(nd == NULL) {
+        const int saved = errno;
+        close(fd);
+        errno = saved;
+    }
+
+    return nd;
+}
+
+void networkd_close(struct networkd* nd) {
+    if(nd == NULL) { return; }
+
+    close(nd->fd);
+    free(nd->out);
+    free(nd->in);
+    free(nd->queue);
+    free(nd->values_buf);
+    free(nd->values);
+    free(nd);
+}
+
+int networkd_fd(const struct networkd* nd) {
+    return nd->fd;
+}
+
+bool networkd_want_write(const struct networkd* nd) {
+    return nd->out_len > 0;
+}
+
+size_t networkd_pending(const struct networkd* nd) {
+    return nd->queue_len;
+}
+
+static int flush(struct networkd* nd) {
+    size_t sent = 0;
+    while(sent < nd->out_len) {
+        const ssize_t n = send(nd->fd, nd->out + sent, nd->out_len - sent, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN) { break; }
+            return -1;
+        }
+
+        sent += n;
+    }
+
+    memmove(nd->out, nd->out + sent, nd->out_len - sent);
+    nd->out_len -= sent;
+    return 0;
+}
+
+static int append(struct networkd* nd, const char* text, size_t len) {
+    if(grow(&nd->out, &nd->out_cap, nd->out_len + len, 1) == -1) { return -1; }
+    memcpy(nd->out + nd->out_len, text, len);
+    nd->out_len += len;
+    return 0;
+}
+
+// Append a JSON string, escaped the way networkd unescapes it
+static int append_string(struct networkd* nd, const char* text) {
+    if(append(nd, "\"", 1) == -1) { return -1; }
+
+    for(; *text != '\0'; text += 1) {
+        const char* escape = NULL;
+        switch(*text) {
+            case '"': escape = "\\\""; break;
+            case '\\': escape = "\\\\"; break;
+            case '\n': escape = "\\n"; break;
+            case '\r': escape = "\\r"; break;
+            case '\b': escape = "\\b"; break;
+            default: break;
+        }
+
+        const int result = (escape != NULL)? append(nd, escape, 2) : append(nd, text, 1);
+        if(result == -1) { return -1; }
+    }
+
+    return append(nd, "\"", 1);
+}
+
+static int enqueue(struct networkd* nd, networkd_reply_cb cb, void* arg) {
+    if(nd->queue_len == nd->queue_cap) {
+        // Unroll the ring into the grown array
+        struct request* queue = malloc(((nd->queue_cap > 0)? nd->queue_cap * 2 : 16) * sizeof(*queue));
+        if(queue == NULL) { return -1; }
+        for(size_t i = 0; i < nd->queue_len; i += 1) {
+            queue[i] = nd->queue[(nd->queue_head + i) % nd->queue_cap];
+        }
+
+        free(nd->queue);
+        nd->queue = queue;
+        nd->queue_head = 0;
+        nd->queue_cap = (nd->queue_cap > 0)? nd->queue_cap * 2 : 16;
+    }
+
+    nd->queue[(nd->queue_head + nd->queue_len) % nd->queue_cap] = (struct request){cb, arg};
+    nd->queue_len += 1;
+    return 0;
+}
+
+int networkd_requestv(struct networkd* nd,
+                      networkd_reply_cb cb,
+                      void* arg,
+                      const char* const* argv,
+                      size_t argc) {
+    if(argc == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Leave the queue as it was if the request cannot be encoded in full
+    const size_t out_len = nd->out_len;
+    int result = append(nd, "[", 1);
+    for(size_t i = 0; i < argc && result == 0; i += 1) {
+        if(i > 0) { result = append(nd, ", ", 2); }
+        if(result == 0) { result = append_string(nd, argv[i]); }
+    }
+    if(result == 0) { result = append(nd, "]\n", 2); }
+    if(result == 0) { result = enqueue(nd, cb, arg); }
+
+    if(result == -1) {
+        nd->out_len = out_len;
+        return -1;
+    }
+
+    return flush(nd);
+}
+
+int networkd_request(struct networkd* nd, networkd_reply_cb cb, void* arg, const char* command, ...) {
+    const char* argv[MAX_ARGS];
+    size_t argc = 0;
+    argv[argc++] = command;
+
+    va_list ap;
+    va_start(ap, command);
+    const char* word;
+    while((word = va_arg(ap, const char*)) != NULL) {
+        if(argc == MAX_ARGS) {
+            va_end(ap);
+            errno = E2BIG;
+            return -1;
+        }
+
+        argv[argc++] = word;
+    }
+    va_end(ap);
+
+    return networkd_requestv(nd, cb, arg, argv, argc);
+}
+
+int networkd_subscribe(struct networkd* nd,
+                       uint64_t since,
+                       networkd_event_cb event_cb,
+                       networkd_reply_cb reply_cb,
+                       void* arg) {
+    char cursor[24];
+    snprintf(cursor, sizeof(cursor), "%llu", (unsigned long long)since);
+    const int result = (since == NETWORKD_SUBSCRIBE_NOW)?
+        networkd_request(nd, reply_cb, arg, "subscribe", NULL) :
+        networkd_request(nd, reply_cb, arg, "subscribe", "since", cursor, NULL);
+    if(result == -1) { return -1; }
+
+    nd->event_cb = event_cb;
+    nd->event_arg = arg;
+    return 0;
+}
+
+static void handle_event(struct networkd* nd, const char* const* values, size_t n) {
+    struct networkd_event event;
+    memset(&event, 0, sizeof(event));
+    for(size_t i = 0; i + 1 < n; i += 2) {
+        const char* key = values[i];
+        const char* value = values[i + 1];
+        if(strcmp(key, "seq") == 0) { event.seq = strtoull(value, NULL, 10); }
+        else if(strcmp(key, "time") == 0) { event.time = value; }
+        else if(strcmp(key, "ifindex") == 0) { event.ifindex = strtoul(value, NULL, 10); }
+        else if(strcmp(key, "iface") == 0) { event.iface = value; }
+        else if(strcmp(key, "old") == 0) { event.old_link = value; }
+        else if(strcmp(key, "new") == 0) { event.new_link = value; }
+        else if(strcmp(key, "flags") == 0) { event.flags = value; }
+    }
+
+    nd->event_cb(nd->event_arg, &event);
+}
+
+// Decode one reply line, and hand it to whoever is waiting on it
+static int handle_line(struct networkd* nd, const char* line, size_t len) {
+    if(grow(&nd->values_buf, &nd->values_buf_cap, len + 2, 1) == -1) { return -1; }
+
+    size_t n = 0;
+    size_t used = 0;
+    const char* cursor = line;
+    while(1) {
+        enum flatjson status;
+        char* value = nd->values_buf + used;
+        cursor = flatjson_next(cursor, value, nd->values_buf_cap - used, &status);
+        if(cursor == NULL) {
+            if(status == FLATJSON_OK) { break; }
+            errno = EPROTO;
+            return -1;
+        }
+
+        if(grow(&nd->values, &nd->values_cap, n + 1, sizeof(*nd->values)) == -1) { return -1; }
+        nd->values[n++] = value;
+        used += strlen(value) + 1;
+    }
+
+    if(n == 0) { return 0; }
+
+    if(strcmp(nd->values[0], "event") == 0) {
+        if(nd->event_cb != NULL) { handle_event(nd, nd->values + 1, n - 1); }
+        return 0;
+    }
+
+    // A reply nobody asked for, such as being turned away, is dropped
+    if(nd->queue_len == 0) { return 0; }
+
+    const struct request request = nd->queue[nd->queue_head];
+    nd->queue_head = (nd->queue_head + 1) % nd->queue_cap;
+    nd->queue_len -= 1;
+
+    if(request.cb != NULL) {
+        const struct networkd_reply reply = {
+            strcmp(nd->values[0], "ok") == 0,
+            n - 1,
+            nd->values + 1
+        };
+        request.cb(request.arg, &reply);
+    }
+
+    return 0;
+}
+
+int networkd_dispatch(struct networkd* nd) {
+    if(flush(nd) == -1) { return -1; }
+
+    bool eof = false;
+    while(!eof) {
+        if(grow(&nd->in, &nd->in_cap, nd->in_len + 4096, 1) == -1) { return -1; }
+
+        const ssize_t n = read(nd->fd, nd->in + nd->in_len, nd->in_cap - nd->in_len - 1);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN) { break; }
+            return -1;
+        }
+
+        eof = (n == 0);
+        nd->in_len += n;
+    }
+
+    // Handle every complete line. Callbacks may queue more requests.
+    size_t start = 0;
+    char* newline;
+    while((newline = memchr(nd->in + start, '\n', nd->in_len - start)) != NULL) {
+        *newline = '\0';
+        const size_t len = newline - (nd->in + start);
+        if(handle_line(nd, nd->in + start, len) == -1) { return -1; }
+        start += len + 1;
+    }
+
+    memmove(nd->in, nd->in + start, nd->in_len - start);
+    nd->in_len -= start;
+
+    if(eof) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    return flush(nd);
+}
+
+int networkd_poll(struct networkd* nd, int timeout) {
+    struct pollfd pfd;
+    pfd.fd = nd->fd;
+    pfd.events = POLLIN | (networkd_want_write(nd)? POLLOUT : 0);
+    pfd.revents = 0;
+
+    const int n = poll(&pfd, 1, timeout);
+    if(n < 0) { return (errno == EINTR)? 0 : -1; }
+    if(n == 0) { return 0; }
+
+    return networkd_dispatch(nd);
+}
+
+int networkd_wait(struct networkd* nd) {
+    while(nd->queue_len > 0) {
+        if(networkd_poll(nd, -1) == -1) { return -1; }
+    }
+
+    return 0;
+}
+
+// Give up on a copy after this many attempts, rather than spin for as long
+// as the writer is busy
+#define STATE_READ_ATTEMPTS 64
+
+struct networkd_state {
+    const struct networkd_state_segment* segment;
+};
+
+struct networkd_state* networkd_state_open(const char* path) {
+    const int fd = open((path == NULL)? NETWORKD_STATE : path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return NULL; }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    if(st.st_size < (off_t)sizeof(struct networkd_state_segment)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void* map = mmap(NULL, sizeof(struct networkd_state_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) { return NULL; }
+
+    const struct networkd_state_segment* segment = map;
+    struct networkd_state* state = malloc(sizeof(*state));
+    if(segment->magic != NETWORKD_STATE_MAGIC || segment->version != NETWORKD_STATE_VERSION || state == NULL) {
+        const int saved = (state == NULL)? ENOMEM : EINVAL;
+        free(state);
+        munmap(map, sizeof(struct networkd_state_segment));
+        errno = saved;
+        return NULL;
+    }
+
+    state->segment = segment;
+    return state;
+}
+
+void networkd_state_close(struct networkd_state* state) {
+    if(state == NULL) { return; }
+    munmap((void*)state->segment, sizeof(struct networkd_state_segment));
+    free(state);
+}
+
+int networkd_state_read(const struct networkd_state* state, struct networkd_state_snapshot* snapshot) {
+    const struct networkd_state_segment* segment = state->segment;
+
+    for(int attempt = 0; attempt < STATE_READ_ATTEMPTS; attempt += 1) {
+        const uint32_t seq = __atomic_load_n(&segment->seq, __ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&segment->closed, __ATOMIC_ACQUIRE)) {
+            errno = ESTALE;
+            return -1;
+        }
+
+        if(seq & 1) { continue; }
+        if(seq == snapshot->seq && seq != 0) { return 0; }
+
+        uint32_t count = segment->count;
+        if(count > NETWORKD_STATE_IFACES) { count = NETWORKD_STATE_IFACES; }
+        snapshot->updated = segment->updated;
+        snapshot->count = count;
+        snapshot->truncated = segment->truncated;
+        memcpy(snapshot->ifaces, (const void*)segment->ifaces, count * sizeof(segment->ifaces[0]));
+
+        // The copy is only good if nothing was written while it was taken
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&segment->seq, __ATOMIC_RELAXED) == seq) {
+            snapshot->seq = seq;
+            return 1;
+        }
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Client library for networkd's control socket. A connection stays open
+// across requests, and any number of requests may be sent before their
+// replies arrive. networkd answers each connection's requests in order, so
+// replies are matched to requests by position.
+//
+// Nothing blocks unless asked to. Callers with their own event loop watch
+// networkd_fd() for reading, and for writing while networkd_want_write() is
+// true, and call networkd_dispatch() whenever it is ready. Everyone else can
+// call networkd_wait() or networkd_poll().
+//
+// Strings passed to callbacks are only valid until the callback returns.
+
+#define NETWORKD_SOCKET "/var/run/networkd.sock"
+#define NETWORKD_SUBSCRIBE_NOW UINT64_MAX
+
+struct networkd;
+
+// A reply: whether it was "ok", and the values that followed. The first
+// value of an error reply, if there is one, is the reason.
+struct networkd_reply {
+    bool ok;
+    size_t n_values;
+    const char* const* values;
+};
+
+// An interface event, as delivered to a subscriber
+struct networkd_event {
+    uint64_t seq;
+    const char* time;
+    uint32_t ifindex;
+    const char* iface;
+    const char* old_link;
+    const char* new_link;
+    const char* flags;
+};
+
+typedef void (*networkd_reply_cb)(void*, const struct networkd_reply*);
+typedef void (*networkd_event_cb)(void*, const struct networkd_event*);
+
+// Connect to networkd, at NETWORKD_SOCKET if the path is NULL, or take over
+// a socket that is already connected. Returns NULL with errno set on failure.
+struct networkd* networkd_open(const char*);
+struct networkd* networkd_open_fd(int);
+
+// Close the connection. Requests still waiting on replies are dropped
+// without calling their callbacks.
+void networkd_close(struct networkd*);
+
+int networkd_fd(const struct networkd*);
+bool networkd_want_write(const struct networkd*);
+
+// The number of requests still waiting on replies
+size_t networkd_pending(const struct networkd*);
+
+// Queue a request: a command and its arguments, ending in NULL. The callback,
+// if there is one, is called with the reply. Returns -1 with errno set on
+// failure.
+int networkd_request(struct networkd*, networkd_reply_cb, void*, const char*, ...)
+    __attribute__((sentinel));
+int networkd_requestv(struct networkd*, networkd_reply_cb, void*, const char* const*, size_t);
+
+// Subscribe to interface events numbered after the given one, or only to
+// new ones given NETWORKD_SUBSCRIBE_NOW. Events already in the history are
+// delivered to the event callback, followed by each new event as it happens.
+// The reply callback, if there is one, is called with the subscribe reply,
+// which gives the "cursor" and the number of events "lost" to the history
+// wrapping.
+int networkd_subscribe(struct networkd*, uint64_t, networkd_event_cb, networkd_reply_cb, void*);
+
+// Send queued requests, and handle the replies and events that have arrived,
+// without blocking. Returns -1 with errno set if the connection failed, or
+// EPIPE if networkd closed it.
+int networkd_dispatch(struct networkd*);
+
+// Wait up to the given number of milliseconds, or forever if negative, for
+// the connection to be ready, and dispatch. Returns -1 on failure.
+int networkd_poll(struct networkd*, int);
+
+// Block until every request has been answered. Returns -1 on failure.
+int networkd_wait(struct networkd*);
+
+// Interface state that networkd publishes, when started with -p, into a file
+// that local readers map read-only. Readers take a consistent copy without
+// any system calls, so polling it is far cheaper than running list. The
+// writer bumps seq to an odd number before changing the contents, and to the
+// next even number afterwards; a copy taken while seq was even and unchanged
+// throughout is consistent.
+#define NETWORKD_STATE "/var/run/networkd.state"
+#define NETWORKD_STATE_MAGIC 0x6e776473
+#define NETWORKD_STATE_VERSION 1
+#define NETWORKD_STATE_IFACES 1024
+
+enum networkd_link {
+    NETWORKD_LINK_UNKNOWN,
+    NETWORKD_LINK_DOWN,
+    NETWORKD_LINK_UP
+};
+
+struct networkd_iface_state {
+    uint32_t ifindex;
+    uint32_t flags;
+    uint32_t mtu;
+
+    // Changes whenever anything about the interface does
+    uint32_t generation;
+
+    // An enum networkd_link
+    uint32_t link;
+    char name[16];
+};
+
+struct networkd_state_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;
+
+    // Set once networkd has shut down, after which nothing is updated
+    uint32_t closed;
+
+    // Microseconds since the epoch of the last update
+    uint64_t updated;
+
+    // Interfaces published, and those left out for lack of room
+    uint32_t count;
+    uint32_t truncated;
+    struct networkd_iface_state ifaces[NETWORKD_STATE_IFACES];
+};
+
+// A consistent copy of the published state
+struct networkd_state_snapshot {
+    uint32_t seq;
+    uint64_t updated;
+    uint32_t count;
+    uint32_t truncated;
+    struct networkd_iface_state ifaces[NETWORKD_STATE_IFACES];
+};
+
+struct networkd_state;
+
+// Map the published state, at NETWORKD_STATE if the path is NULL. Returns
+// NULL with errno set on failure.
+struct networkd_state* networkd_state_open(const char*);
+void networkd_state_close(struct networkd_state*);
+
+// Copy the published state if it has changed since the given snapshot was
+// taken, or unconditionally if its seq is zero. Makes no system calls.
+// Returns 1 if the snapshot was updated and 0 if nothing had changed, or -1
+// with errno set to EAGAIN if the writer kept it busy, or ESTALE if networkd
+// has shut down; a restarted networkd publishes into a new file, which must
+// be opened again.
+int networkd_state_read(const struct networkd_state*, struct networkd_state_snapshot*);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "addrindex.h"
+#include "counters.h"
+#include "iftable.h"
+
+// Interface link state monitoring: a routing socket on OpenBSD
+// (monitor_route.c), and rtnetlink on Linux (monitor_netlink.c). The same
+// sources give each interface's traffic counters.
+
+enum link_event_type {
+    LINK_EVENT_CHANGE,
+    LINK_EVENT_ARRIVAL,
+    LINK_EVENT_DEPARTURE,
+
+    // An address other than a link-local one was added to the interface, or
+    // removed from it
+    LINK_EVENT_ADDRESS,
+    LINK_EVENT_ADDRESS_REMOVED,
+
+    // A default route through the interface was added
+    LINK_EVENT_ROUTE
+};
+
+struct link_event {
+    enum link_event_type type;
+    unsigned int ifindex;
+    unsigned int flags;
+    unsigned int mtu;
+    bool up;
+
+    // Empty unless the message carried the name, which on OpenBSD only
+    // arrivals and departures do
+    char name[IF_NAMESIZE];
+
+    // The address and its prefix length, for address events
+    struct addr_prefix address;
+};
+
+// Open a socket that receives link state change notifications, along with
+// new addresses and routes.
+int monitor_ifaces(void);
+
+// Read pending notifications, filling up to n link events. Messages that
+// could not be decoded, or that the kernel dropped, are added to *dropped.
+// Returns the number of events filled in.
+size_t monitor_read(int, struct link_event*, size_t, uint64_t* dropped);
+
+// Encode a link event as the message the kernel would have sent for it, so
+// that storms of events can be made up and replayed through monitor_read().
+// Returns the message's length, or 0 if it does not fit or is not a link
+// change, arrival or departure.
+size_t monitor_encode(const struct link_event*, char*, size_t);
+
+// Prepare to read every interface's details and counters, which must be
+// done before dropping privileges. Returns false on failure.
+bool monitor_init(void);
+
+// Fill in the name, flags, MTU and link state of every interface. Returns
+// false if they could not be read.
+bool monitor_scan(struct iftable*);
+
+// Add every interface's addresses to the index. Returns false if they could
+// not be read.
+bool monitor_addresses(struct addrindex*);
+
+// Record a sample of every interface's traffic counters, as one round.
+// Returns false if the counters could not be read.
+bool monitor_counters(struct counters*);
@@ -0,0 +1,358 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "monitor.h"
+#include "util.h"
+
+// The attributes of a link message that we care about
+struct link_attrs {
+    const char* name;
+    uint32_t mtu;
+    bool up;
+    bool has_stats;
+    struct rtnl_link_stats64 stats;
+};
+
+int monitor_ifaces(void) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(fd < 0) { return -1; }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                     RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void parse_link(struct ifinfomsg* ifi, size_t len, struct link_attrs* attrs) {
+    memset(attrs, 0, sizeof(*attrs));
+
+    // Operational state, if the kernel sent it. Falls back to IFF_RUNNING.
+    attrs->up = (ifi->ifi_flags & IFF_RUNNING) != 0;
+
+    struct rtattr* rta = IFLA_RTA(ifi);
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        const size_t payload = RTA_PAYLOAD(rta);
+        if(rta->rta_type == IFLA_OPERSTATE && payload >= 1) {
+            const unsigned char state = *(unsigned char*)RTA_DATA(rta);
+            attrs->up = state == IF_OPER_UP || state == IF_OPER_UNKNOWN;
+        } else if(rta->rta_type == IFLA_IFNAME && payload > 0 && payload <= IF_NAMESIZE) {
+            attrs->name = RTA_DATA(rta);
+        } else if(rta->rta_type == IFLA_MTU && payload >= sizeof(uint32_t)) {
+            memcpy(&attrs->mtu, RTA_DATA(rta), sizeof(attrs->mtu));
+        } else if(rta->rta_type == IFLA_STATS64 && payload >= sizeof(attrs->stats)) {
+            // Attributes are only 4-byte aligned
+            memcpy(&attrs->stats, RTA_DATA(rta), sizeof(attrs->stats));
+            attrs->has_stats = true;
+        }
+    }
+
+    // The name must be terminated within the attribute
+    if(attrs->name != NULL && memchr(attrs->name, '\0', IF_NAMESIZE) == NULL) {
+        attrs->name = NULL;
+    }
+}
+
+// Read the address from an address message. Returns false if there is none,
+// or if it is a link-local one, which comes with the interface rather than
+// its configuration.
+static bool parse_address(struct ifaddrmsg* ifa, size_t len, struct addr_prefix* addr) {
+    if(ifa->ifa_scope == RT_SCOPE_LINK || (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->family = ifa->ifa_family;
+    addr->len = ifa->ifa_prefixlen;
+    const size_t addr_len = (ifa->ifa_family == AF_INET)? 4 : 16;
+
+    // Point-to-point links give the peer's address as IFA_ADDRESS, and their
+    // own as IFA_LOCAL
+    bool found = false;
+    bool local = false;
+    struct rtattr* rta = IFA_RTA(ifa);
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if((rta->rta_type != IFA_LOCAL && (rta->rta_type != IFA_ADDRESS || local)) || RTA_PAYLOAD(rta) < addr_len) {
+            continue;
+        }
+
+        memcpy(addr->bytes, RTA_DATA(rta), addr_len);
+        found = true;
+        local = (rta->rta_type == IFA_LOCAL);
+    }
+
+    return found && addr->len <= addr_len * 8;
+}
+
+// The interface that a new default route goes through, or 0 if the route is
+// something else
+static unsigned int default_route(struct rtmsg* rtm, size_t len) {
+    if(rtm->rtm_dst_len != 0 || rtm->rtm_table != RT_TABLE_MAIN || rtm->rtm_type != RTN_UNICAST) {
+        return 0;
+    }
+
+    struct rtattr* rta = RTM_RTA(rtm);
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        uint32_t oif;
+        if(rta->rta_type == RTA_OIF && RTA_PAYLOAD(rta) >= sizeof(oif)) {
+            memcpy(&oif, RTA_DATA(rta), sizeof(oif));
+            return oif;
+        }
+    }
+
+    return 0;
+}
+
+// Turn an address or route message into an event. Returns false if there is
+// nothing of interest in it, such as a route other than a default one.
+static bool parse_other(struct nlmsghdr* nlh, struct link_event* event) {
+    memset(event, 0, sizeof(*event));
+    if((nlh->nlmsg_type == RTM_NEWADDR || nlh->nlmsg_type == RTM_DELADDR) &&
+       nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+        struct ifaddrmsg* ifa = NLMSG_DATA(nlh);
+        event->type = (nlh->nlmsg_type == RTM_NEWADDR)? LINK_EVENT_ADDRESS : LINK_EVENT_ADDRESS_REMOVED;
+        event->ifindex = ifa->ifa_index;
+        return parse_address(ifa, nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)), &event->address);
+    }
+
+    if(nlh->nlmsg_type == RTM_NEWROUTE && nlh->nlmsg_len >= NLMSG_LENGTH(sizeof(struct rtmsg))) {
+        struct rtmsg* rtm = NLMSG_DATA(nlh);
+        event->type = LINK_EVENT_ROUTE;
+        event->ifindex = default_route(rtm, nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*rtm)));
+        return event->ifindex != 0;
+    }
+
+    return false;
+}
+
+size_t monitor_read(int monitor, struct link_event* events, size_t n, uint64_t* dropped) {
+    // Netlink batches several messages into one datagram
+    char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+    const ssize_t n_read = recv(monitor, buf, sizeof(buf), MSG_DONTWAIT);
+    if(n_read < 0) {
+        // Includes ENOBUFS, where the kernel has dropped messages on us
+        if(errno != EAGAIN && errno != EINTR) { *dropped += 1; }
+        return 0;
+    }
+
+    size_t n_events = 0;
+    size_t len = n_read;
+    for(struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+        if(nlh->nlmsg_type == NLMSG_DONE) { break; }
+
+        // Removed routes, and routes other than default ones, are of no
+        // interest
+        if(nlh->nlmsg_type == RTM_NEWADDR || nlh->nlmsg_type == RTM_DELADDR ||
+           nlh->nlmsg_type == RTM_NEWROUTE || nlh->nlmsg_type == RTM_DELROUTE) {
+            struct link_event event;
+            if(!parse_other(nlh, &event)) { continue; }
+            if(n_events == n) {
+                *dropped += 1;
+                continue;
+            }
+
+            events[n_events] = event;
+            n_events += 1;
+            continue;
+        }
+
+        if((nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK) ||
+           nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+            *dropped += 1;
+            continue;
+        }
+
+        if(n_events == n) {
+            *dropped += 1;
+            continue;
+        }
+
+        struct ifinfomsg* ifi = NLMSG_DATA(nlh);
+        struct link_attrs attrs;
+        parse_link(ifi, nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)), &attrs);
+
+        struct link_event* event = &events[n_events];
+        memset(event, 0, sizeof(*event));
+        event->type = (nlh->nlmsg_type == RTM_DELLINK)? LINK_EVENT_DEPARTURE : LINK_EVENT_CHANGE;
+        event->ifindex = ifi->ifi_index;
+        event->flags = ifi->ifi_flags;
+        event->mtu = attrs.mtu;
+        event->up = attrs.up;
+        if(attrs.name != NULL) { strlcpy(event->name, attrs.name, sizeof(event->name)); }
+        n_events += 1;
+    }
+
+    return n_events;
+}
+
+static void put_attr(struct nlmsghdr* nlh, unsigned short type, const void* data, size_t len) {
+    struct rtattr* rta = (struct rtattr*)((char*)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+size_t monitor_encode(const struct link_event* event, char* buf, size_t len) {
+    if(event->type == LINK_EVENT_ADDRESS || event->type == LINK_EVENT_ADDRESS_REMOVED ||
+       event->type == LINK_EVENT_ROUTE) {
+        return 0;
+    }
+
+    const size_t name_len = strlen(event->name);
+    const size_t needed = NLMSG_SPACE(sizeof(struct ifinfomsg)) +
+                          RTA_SPACE(name_len + 1) + RTA_SPACE(sizeof(uint32_t)) + RTA_SPACE(1);
+    if(needed > len) { return 0; }
+    memset(buf, 0, needed);
+
+    // Every link message carries the name, so arrivals are plain changes
+    struct nlmsghdr* nlh = (struct nlmsghdr*)buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    nlh->nlmsg_type = (event->type == LINK_EVENT_DEPARTURE)? RTM_DELLINK : RTM_NEWLINK;
+
+    struct ifinfomsg* ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = event->ifindex;
+    ifi->ifi_flags = event->flags;
+
+    const uint32_t mtu = event->mtu;
+    const unsigned char state = event->up? IF_OPER_UP : IF_OPER_DOWN;
+    if(name_len > 0) { put_attr(nlh, IFLA_IFNAME, event->name, name_len + 1); }
+    put_attr(nlh, IFLA_MTU, &mtu, sizeof(mtu));
+    put_attr(nlh, IFLA_OPERSTATE, &state, sizeof(state));
+    return nlh->nlmsg_len;
+}
+
+static int dump_fd = -1;
+static uint32_t dump_seq;
+
+bool monitor_init(void) {
+    dump_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    return dump_fd >= 0;
+}
+
+// Ask for every link or address, as given by the request type, and call the
+// given function on each message of the dump
+static bool dump(uint16_t type, size_t body_len, void(*f)(void*, struct nlmsghdr*), void* ctx) {
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg body;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = NLMSG_LENGTH(body_len);
+    request.nlh.nlmsg_type = type;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nlh.nlmsg_seq = ++dump_seq;
+
+    // The family comes first in every request, and AF_UNSPEC asks for all
+    if(send(dump_fd, &request, request.nlh.nlmsg_len, 0) != (ssize_t)request.nlh.nlmsg_len) { return false; }
+
+    // The kernel answers a dump at once, in as many datagrams as it takes
+    static char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+    while(1) {
+        const ssize_t n_read = recv(dump_fd, buf, sizeof(buf), 0);
+        if(n_read < 0) {
+            if(errno == EINTR) { continue; }
+            return false;
+        }
+
+        size_t len = n_read;
+        for(struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            // Skip what is left of an earlier dump that was given up on
+            if(nlh->nlmsg_seq != dump_seq) { continue; }
+
+            if(nlh->nlmsg_type == NLMSG_DONE) { return true; }
+            if(nlh->nlmsg_type == NLMSG_ERROR) { return false; }
+            f(ctx, nlh);
+        }
+    }
+}
+
+struct link_dump {
+    void(*f)(void*, struct ifinfomsg*, const struct link_attrs*);
+    void* ctx;
+};
+
+static void each_link(void* ctx, struct nlmsghdr* nlh) {
+    const struct link_dump* dump_ctx = ctx;
+    if(nlh->nlmsg_type != RTM_NEWLINK || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) { return; }
+
+    struct ifinfomsg* ifi = NLMSG_DATA(nlh);
+    struct link_attrs attrs;
+    parse_link(ifi, nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)), &attrs);
+    dump_ctx->f(dump_ctx->ctx, ifi, &attrs);
+}
+
+// Ask for every link, and call the given function on each one
+static bool dump_links(void(*f)(void*, struct ifinfomsg*, const struct link_attrs*), void* ctx) {
+    struct link_dump dump_ctx = {f, ctx};
+    return dump(RTM_GETLINK, sizeof(struct ifinfomsg), each_link, &dump_ctx);
+}
+
+static void scan_link(void* ctx, struct ifinfomsg* ifi, const struct link_attrs* attrs) {
+    struct iftable* table = ctx;
+    if(attrs->name == NULL) { return; }
+
+    iftable_set(table, ifi->ifi_index, attrs->name);
+    iftable_update(table, ifi->ifi_index, ifi->ifi_flags, attrs->mtu,
+                   attrs->up? HISTORY_LINK_UP : HISTORY_LINK_DOWN);
+}
+
+bool monitor_scan(struct iftable* table) {
+    return dump_links(scan_link, table);
+}
+
+static void index_address(void* ctx, struct nlmsghdr* nlh) {
+    if(nlh->nlmsg_type != RTM_NEWADDR || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) { return; }
+
+    struct ifaddrmsg* ifa = NLMSG_DATA(nlh);
+    struct addr_prefix addr;
+    if(parse_address(ifa, nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)), &addr)) {
+        addrindex_add(ctx, ifa->ifa_index, &addr);
+    }
+}
+
+bool monitor_addresses(struct addrindex* index) {
+    return dump(RTM_GETADDR, sizeof(struct ifaddrmsg), index_address, index);
+}
+
+struct counters_dump {
+    struct counters* counters;
+    uint64_t now;
+};
+
+static void record_link(void* ctx, struct ifinfomsg* ifi, const struct link_attrs* attrs) {
+    struct counters_dump* dump = ctx;
+    if(attrs->name == NULL || !attrs->has_stats) { return; }
+
+    struct counter_sample sample;
+    sample.time = dump->now;
+    sample.values[COUNTER_IBYTES] = attrs->stats.rx_bytes;
+    sample.values[COUNTER_OBYTES] = attrs->stats.tx_bytes;
+    sample.values[COUNTER_IPACKETS] = attrs->stats.rx_packets;
+    sample.values[COUNTER_OPACKETS] = attrs->stats.tx_packets;
+    sample.values[COUNTER_IERRORS] = attrs->stats.rx_errors;
+    sample.values[COUNTER_OERRORS] = attrs->stats.tx_errors;
+    counters_record(dump->counters, ifi->ifi_index, attrs->name, &sample);
+}
+
+bool monitor_counters(struct counters* counters) {
+    struct counters_dump dump = {counters, now_usec()};
+    counters_begin(counters);
+    if(!dump_links(record_link, &dump)) { return false; }
+
+    counters_end(counters);
+    return true;
+}
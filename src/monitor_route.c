@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#include <net/if.h>
+#include <net/if_dl.h>
+#include <net/route.h>
+#include <netinet/in.h>
+
+#include "monitor.h"
+#include "util.h"
+
+int monitor_ifaces(void) {
+    int rt_fd = socket(PF_ROUTE, SOCK_RAW, 0);
+    unsigned int rtfilter = ROUTE_FILTER(RTM_IFINFO) | ROUTE_FILTER(RTM_IFANNOUNCE) |
+                            ROUTE_FILTER(RTM_NEWADDR) | ROUTE_FILTER(RTM_DELADDR) | ROUTE_FILTER(RTM_ADD);
+    setsockopt(rt_fd, PF_ROUTE, ROUTE_MSGFILTER, &rtfilter, sizeof(rtfilter));
+
+    rtfilter = RTABLE_ANY;
+    setsockopt(rt_fd, PF_ROUTE, ROUTE_TABLEFILTER, &rtfilter, sizeof(rtfilter));
+
+    return rt_fd;
+}
+
+// Addresses following a routing message's header are each padded to a long
+#define ROUNDUP(len) (((len) > 0)? (1 + (((len) - 1) | (sizeof(long) - 1))) : sizeof(long))
+
+// Copy out the addresses following a routing message's header, leaving the
+// family of those not present as AF_UNSPEC. Returns false if they run past
+// the end of the message.
+static bool get_addrs(int addrs, const char* cursor, const char* end, struct sockaddr_storage sa[RTAX_MAX]) {
+    memset(sa, 0, sizeof(*sa) * RTAX_MAX);
+    for(int i = 0; i < RTAX_MAX; i += 1) {
+        if((addrs & (1 << i)) == 0) { continue; }
+        if(cursor + 2 > end) { return false; }
+
+        const unsigned char len = (unsigned char)cursor[0];
+        if(cursor + len > end) { return false; }
+        memcpy(&sa[i], cursor, min(len, sizeof(sa[i])));
+        cursor += ROUNDUP(len);
+    }
+
+    return true;
+}
+
+static bool addr_unspecified(const struct sockaddr_storage* sa) {
+    if(sa->ss_family == AF_INET) {
+        return ((const struct sockaddr_in*)sa)->sin_addr.s_addr == INADDR_ANY;
+    }
+    if(sa->ss_family == AF_INET6) {
+        return IN6_IS_ADDR_UNSPECIFIED(&((const struct sockaddr_in6*)sa)->sin6_addr);
+    }
+
+    return false;
+}
+
+// The number of leading one bits in a netmask, which the kernel trims of
+// trailing zero bytes
+static uint8_t mask_len(const uint8_t* mask, size_t len) {
+    uint8_t bits = 0;
+    for(size_t i = 0; i < len * 8 && (mask[i / 8] & (0x80 >> (i % 8))) != 0; i += 1) { bits += 1; }
+    return bits;
+}
+
+// Read the address from an address message. Returns false if there is none,
+// or if it is a link-local one, which comes with the interface rather than
+// its configuration.
+static bool parse_address(const char* buf, size_t len, uint32_t* ifindex, struct addr_prefix* addr) {
+    struct sockaddr_storage sa[RTAX_MAX];
+    struct ifa_msghdr ifam;
+    if(len < sizeof(ifam)) { return false; }
+    memcpy(&ifam, buf, sizeof(ifam));
+    if(ifam.ifam_hdrlen > len || !get_addrs(ifam.ifam_addrs, buf + ifam.ifam_hdrlen, buf + len, sa)) {
+        return false;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    *ifindex = ifam.ifam_index;
+    const struct sockaddr_storage* ifa = &sa[RTAX_IFA];
+    if(ifa->ss_family == AF_INET) {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)ifa;
+        addr->family = AF_INET;
+        memcpy(addr->bytes, &sin->sin_addr, 4);
+        addr->len = ((ifam.ifam_addrs & RTA_NETMASK) != 0)?
+                    mask_len((const uint8_t*)&((const struct sockaddr_in*)&sa[RTAX_NETMASK])->sin_addr, 4) : 32;
+        return true;
+    }
+
+    if(ifa->ss_family == AF_INET6) {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)ifa;
+        if(IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) { return false; }
+
+        addr->family = AF_INET6;
+        memcpy(addr->bytes, &sin6->sin6_addr, 16);
+        addr->len = ((ifam.ifam_addrs & RTA_NETMASK) != 0)?
+                    mask_len((const uint8_t*)&((const struct sockaddr_in6*)&sa[RTAX_NETMASK])->sin6_addr, 16) : 128;
+        return true;
+    }
+
+    return false;
+}
+
+// Turn an address or route message into an event. Returns false if there is
+// nothing of interest in it, such as a route other than a default one.
+static bool parse_other(const char* buf, size_t len, struct link_event* event) {
+    struct sockaddr_storage sa[RTAX_MAX];
+    const struct rt_msghdr* rtm = (const struct rt_msghdr*)buf;
+    if(rtm->rtm_type == RTM_NEWADDR || rtm->rtm_type == RTM_DELADDR) {
+        uint32_t ifindex;
+        if(!parse_address(buf, len, &ifindex, &event->address)) { return false; }
+
+        event->type = (rtm->rtm_type == RTM_NEWADDR)? LINK_EVENT_ADDRESS : LINK_EVENT_ADDRESS_REMOVED;
+        event->ifindex = ifindex;
+        return true;
+    }
+
+    if(rtm->rtm_type == RTM_ADD && len >= sizeof(struct rt_msghdr)) {
+        struct rt_msghdr add;
+        memcpy(&add, buf, sizeof(add));
+        if(add.rtm_errno != 0 || (add.rtm_flags & RTF_GATEWAY) == 0 || add.rtm_hdrlen > len ||
+           !get_addrs(add.rtm_addrs, buf + add.rtm_hdrlen, buf + len, sa) || !addr_unspecified(&sa[RTAX_DST])) {
+            return false;
+        }
+
+        event->type = LINK_EVENT_ROUTE;
+        event->ifindex = add.rtm_index;
+        return true;
+    }
+
+    return false;
+}
+
+size_t monitor_read(int monitor, struct link_event* events, size_t n, uint64_t* dropped) {
+    char buf[2048];
+    const ssize_t n_read = read(monitor, buf, sizeof(buf));
+    if(n_read < (ssize_t)sizeof(struct if_announcemsghdr)) {
+        // Includes ENOBUFS, where the kernel has dropped messages on us
+        *dropped += 1;
+        return 0;
+    }
+
+    struct rt_msghdr* rtm = (struct rt_msghdr*)&buf;
+    if(rtm->rtm_version != RTM_VERSION) {
+        *dropped += 1;
+        return 0;
+    }
+
+    if(n == 0) { return 0; }
+    memset(&events[0], 0, sizeof(events[0]));
+
+    // Only arrivals and departures carry the name
+    if(rtm->rtm_type == RTM_IFANNOUNCE) {
+        struct if_announcemsghdr ifan;
+        memcpy(&ifan, rtm, sizeof(ifan));
+
+        events[0].type = (ifan.ifan_what == IFAN_DEPARTURE)? LINK_EVENT_DEPARTURE : LINK_EVENT_ARRIVAL;
+        events[0].ifindex = ifan.ifan_index;
+        strlcpy(events[0].name, ifan.ifan_name, sizeof(events[0].name));
+        return 1;
+    }
+
+    if(rtm->rtm_type == RTM_NEWADDR || rtm->rtm_type == RTM_DELADDR || rtm->rtm_type == RTM_ADD) {
+        return parse_other(buf, n_read, &events[0])? 1 : 0;
+    }
+
+    if(rtm->rtm_type != RTM_IFINFO || n_read < (ssize_t)sizeof(struct if_msghdr)) {
+        *dropped += 1;
+        return 0;
+    }
+
+    struct if_msghdr ifm;
+    memcpy(&ifm, rtm, sizeof(ifm));
+
+    events[0].type = LINK_EVENT_CHANGE;
+    events[0].ifindex = ifm.ifm_index;
+    events[0].flags = ifm.ifm_flags;
+    events[0].mtu = ifm.ifm_data.ifi_mtu;
+    events[0].up = LINK_STATE_IS_UP(ifm.ifm_data.ifi_link_state);
+    return 1;
+}
+
+size_t monitor_encode(const struct link_event* event, char* buf, size_t len) {
+    if(event->type == LINK_EVENT_ADDRESS || event->type == LINK_EVENT_ADDRESS_REMOVED ||
+       event->type == LINK_EVENT_ROUTE) {
+        return 0;
+    }
+
+    if(event->type != LINK_EVENT_CHANGE) {
+        struct if_announcemsghdr ifan;
+        if(len < sizeof(ifan)) { return 0; }
+        memset(&ifan, 0, sizeof(ifan));
+        ifan.ifan_msglen = sizeof(ifan);
+        ifan.ifan_version = RTM_VERSION;
+        ifan.ifan_type = RTM_IFANNOUNCE;
+        ifan.ifan_index = event->ifindex;
+        ifan.ifan_what = (event->type == LINK_EVENT_DEPARTURE)? IFAN_DEPARTURE : IFAN_ARRIVAL;
+        strlcpy(ifan.ifan_name, event->name, sizeof(ifan.ifan_name));
+        memcpy(buf, &ifan, sizeof(ifan));
+        return sizeof(ifan);
+    }
+
+    struct if_msghdr ifm;
+    if(len < sizeof(ifm)) { return 0; }
+    memset(&ifm, 0, sizeof(ifm));
+    ifm.ifm_msglen = sizeof(ifm);
+    ifm.ifm_version = RTM_VERSION;
+    ifm.ifm_type = RTM_IFINFO;
+    ifm.ifm_hdrlen = sizeof(ifm);
+    ifm.ifm_index = event->ifindex;
+    ifm.ifm_flags = event->flags;
+    ifm.ifm_data.ifi_mtu = event->mtu;
+    ifm.ifm_data.ifi_link_state = event->up? LINK_STATE_UP : LINK_STATE_DOWN;
+    memcpy(buf, &ifm, sizeof(ifm));
+    return sizeof(ifm);
+}
+
+bool monitor_init(void) {
+    return true;
+}
+
+// The interface name from the link address following an RTM_IFINFO header
+static bool link_name(const struct if_msghdr* ifm, const char* end, char name[IF_NAMESIZE]) {
+    if((ifm->ifm_addrs & RTA_IFP) == 0) { return false; }
+
+    const struct sockaddr_dl* sdl = (const struct sockaddr_dl*)((const char*)ifm + ifm->ifm_hdrlen);
+    if((const char*)sdl + sizeof(*sdl) > end || sdl->sdl_family != AF_LINK) { return false; }
+    if(sdl->sdl_nlen == 0 || sdl->sdl_nlen >= IF_NAMESIZE) { return false; }
+
+    memcpy(name, sdl->sdl_data, sdl->sdl_nlen);
+    name[sdl->sdl_nlen] = '\0';
+    return true;
+}
+
+// Read every interface and its addresses in one sysctl, and call the given
+// function on each message
+static bool dump_iflist(void(*f)(void*, const struct rt_msghdr*, const char*), void* ctx) {
+    // Kept between dumps, so that sampling does not allocate
+    static char* buf;
+    static size_t buf_len;
+
+    int mib[6] = {CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0};
+    size_t len = 0;
+    while(1) {
+        if(sysctl(mib, 6, NULL, &len, NULL, 0) == -1) { return false; }
+
+        // Leave room for interfaces that show up in between
+        len += len / 8;
+        if(len > buf_len) {
+            char* grown = realloc(buf, len);
+            if(grown == NULL) { return false; }
+            buf = grown;
+            buf_len = len;
+        }
+
+        len = buf_len;
+        if(sysctl(mib, 6, buf, &len, NULL, 0) == 0) { break; }
+        if(errno != ENOMEM) { return false; }
+    }
+
+    const char* end = buf + len;
+    for(const char* next = buf; next < end;) {
+        const struct rt_msghdr* rtm = (const struct rt_msghdr*)next;
+        if(rtm->rtm_msglen == 0) { break; }
+        next += rtm->rtm_msglen;
+
+        if(rtm->rtm_version != RTM_VERSION || next > end) { continue; }
+        f(ctx, rtm, next);
+    }
+
+    return true;
+}
+
+struct link_dump {
+    void(*f)(void*, const struct if_msghdr*, const char*);
+    void* ctx;
+};
+
+static void each_link(void* ctx, const struct rt_msghdr* rtm, const char* end) {
+    const struct link_dump* dump = ctx;
+    if(rtm->rtm_type != RTM_IFINFO || rtm->rtm_msglen < sizeof(struct if_msghdr)) { return; }
+
+    char name[IF_NAMESIZE];
+    const struct if_msghdr* ifm = (const struct if_msghdr*)rtm;
+    if(link_name(ifm, end, name)) { dump->f(dump->ctx, ifm, name); }
+}
+
+// Read every interface, and call the given function on each
+static bool dump_links(void(*f)(void*, const struct if_msghdr*, const char*), void* ctx) {
+    struct link_dump dump = {f, ctx};
+    return dump_iflist(each_link, &dump);
+}
+
+static void scan_link(void* ctx, const struct if_msghdr* ifm, const char* name) {
+    struct iftable* table = ctx;
+    iftable_set(table, ifm->ifm_index, name);
+    iftable_update(table, ifm->ifm_index, ifm->ifm_flags, ifm->ifm_data.ifi_mtu,
+                   LINK_STATE_IS_UP(ifm->ifm_data.ifi_link_state)? HISTORY_LINK_UP : HISTORY_LINK_DOWN);
+}
+
+bool monitor_scan(struct iftable* table) {
+    return dump_links(scan_link, table);
+}
+
+static void index_address(void* ctx, const struct rt_msghdr* rtm, const char* end) {
+    if(rtm->rtm_type != RTM_NEWADDR) { return; }
+
+    uint32_t ifindex;
+    struct addr_prefix addr;
+    if(parse_address((const char*)rtm, end - (const char*)rtm, &ifindex, &addr)) { addrindex_add(ctx, ifindex, &addr); }
+}
+
+bool monitor_addresses(struct addrindex* index) {
+    return dump_iflist(index_address, index);
+}
+
+struct counters_dump {
+    struct counters* counters;
+    uint64_t now;
+};
+
+static void record_link(void* ctx, const struct if_msghdr* ifm, const char* name) {
+    struct counters_dump* dump = ctx;
+
+    struct counter_sample sample;
+    sample.time = dump->now;
+    sample.values[COUNTER_IBYTES] = ifm->ifm_data.ifi_ibytes;
+    sample.values[COUNTER_OBYTES] = ifm->ifm_data.ifi_obytes;
+    sample.values[COUNTER_IPACKETS] = ifm->ifm_data.ifi_ipackets;
+    sample.values[COUNTER_OPACKETS] = ifm->ifm_data.ifi_opackets;
+    sample.values[COUNTER_IERRORS] = ifm->ifm_data.ifi_ierrors;
+    sample.values[COUNTER_OERRORS] = ifm->ifm_data.ifi_oerrors;
+    counters_record(dump->counters, ifm->ifm_index, name, &sample);
+}
+
+bool monitor_counters(struct counters* counters) {
+    struct counters_dump dump = {counters, now_usec()};
+    counters_begin(counters);
+    if(!dump_links(record_link, &dump)) { return false; }
+
+    counters_end(counters);
+    return true;
+}
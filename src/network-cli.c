@@ -0,0 +1,341 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libnetworkd.h"
+
+#define MAX_WORDS 64
+
+static const char* usage_text =
+    "usage: network-cli [-s socket] [command [argument ...]]\n"
+    "       network-cli -p state-file\n"
+    "    list\n"
+    "    connect <interface> [(link | address | route) [<timeout-ms>]]\n"
+    "    disconnect <interface>\n"
+    "    configure <interface> <stanza>...\n"
+    "    stats\n"
+    "    trace-dump\n"
+    "    jobs\n"
+    "    cancel <job>\n"
+    "    events [<since> [<limit>]]\n"
+    "    counters [<interface>]\n"
+    "    subscribe [<since>]\n"
+    "    scan <interface> [<max-age>]\n"
+    "    lookup <address>[/<prefix-length>]\n"
+    "With no command, commands are read from standard input, one per line.\n"
+    "With -p, the interface state networkd publishes is printed instead.\n";
+
+static bool failed = false;
+
+struct pair {
+    const char* key;
+    const char* value;
+};
+
+static int compare_pairs(const void* a, const void* b) {
+    return strcmp(((const struct pair*)a)->key, ((const struct pair*)b)->key);
+}
+
+// Report an error reply, and return true if there was one
+static bool check(const struct networkd_reply* reply) {
+    if(reply->ok) { return false; }
+
+    if(reply->n_values > 0) {
+        fprintf(stderr, "Failed: %s\n", reply->values[0]);
+    } else {
+        fputs("Failed\n", stderr);
+    }
+
+    failed = true;
+    return true;
+}
+
+static void print_nothing(void* arg, const struct networkd_reply* reply) {
+    check(reply);
+}
+
+static void print_pairs(void* arg, const struct networkd_reply* reply) {
+    if(check(reply)) { return; }
+
+    const int width = *(const int*)arg;
+    for(size_t i = 0; i + 1 < reply->n_values; i += 2) {
+        printf("%-*s%s\n", width, reply->values[i], reply->values[i + 1]);
+    }
+}
+
+static void print_sorted(void* arg, const struct networkd_reply* reply) {
+    if(check(reply)) { return; }
+
+    const size_t n = reply->n_values / 2;
+    struct pair* pairs = calloc(n + 1, sizeof(*pairs));
+    if(pairs == NULL) {
+        fputs("Failed to allocate reply\n", stderr);
+        exit(1);
+    }
+
+    for(size_t i = 0; i < n; i += 1) {
+        pairs[i] = (struct pair){reply->values[i * 2], reply->values[i * 2 + 1]};
+    }
+
+    qsort(pairs, n, sizeof(*pairs), compare_pairs);
+    for(size_t i = 0; i < n; i += 1) {
+        printf("%-20s%s\n", pairs[i].key, pairs[i].value);
+    }
+
+    free(pairs);
+}
+
+static void print_trace(void* arg, const struct networkd_reply* reply) {
+    if(check(reply)) { return; }
+
+    fputs("{\"traceEvents\": [\n", stdout);
+    for(size_t i = 0; i < reply->n_values; i += 1) {
+        printf("%s%s", (i > 0)? ",\n" : "", reply->values[i]);
+    }
+    fputs("\n]}\n", stdout);
+}
+
+static void print_subscribed(void* arg, const struct networkd_reply* reply) {
+    if(check(reply)) { exit(1); }
+
+    for(size_t i = 0; i + 1 < reply->n_values; i += 2) {
+        if(strcmp(reply->values[i], "lost") == 0) {
+            fprintf(stderr, "Lost %s events\n", reply->values[i + 1]);
+        }
+    }
+}
+
+static void print_event(void* arg, const struct networkd_event* event) {
+    printf("%-8" PRIu64 "%-24s%-16s%s -> %s\n",
+           event->seq,
+           (event->time != NULL)? event->time : "",
+           (event->iface != NULL)? event->iface : "",
+           (event->old_link != NULL)? event->old_link : "",
+           (event->new_link != NULL)? event->new_link : "");
+    fflush(stdout);
+}
+
+struct command {
+    const char* name;
+    size_t min_args;
+    size_t max_args;
+    networkd_reply_cb print;
+    int width;
+};
+
+static struct command commands[] = {
+    {"list", 0, 0, print_sorted, 20},
+    {"connect", 1, 3, print_nothing, 0},
+    {"disconnect", 1, 1, print_nothing, 0},
+    {"configure", 2, MAX_WORDS, print_nothing, 0},
+    {"stats", 0, 0, print_pairs, 32},
+    {"trace-dump", 0, 0, print_trace, 0},
+    {"jobs", 0, 0, print_pairs, 20},
+    {"cancel", 1, 1, print_nothing, 0},
+    {"events", 0, 2, print_pairs, 20},
+    {"counters", 0, 1, print_pairs, 32},
+    {"subscribe", 0, 1, NULL, 0},
+    {"scan", 1, 2, print_pairs, 20},
+    {"lookup", 1, 1, print_pairs, 20},
+    {NULL, 0, 0, NULL, 0}
+};
+
+static void lost(void) {
+    fprintf(stderr, "Lost connection to networkd: %s\n", strerror(errno));
+    exit(1);
+}
+
+// Stream events until networkd goes away
+static void subscribe(struct networkd* nd, const char* since) {
+    uint64_t cursor = NETWORKD_SUBSCRIBE_NOW;
+    if(since != NULL) {
+        char* end;
+        cursor = strtoull(since, &end, 10);
+        if(since[0] == '\0' || *end != '\0') {
+            fputs(usage_text, stderr);
+            exit(1);
+        }
+    }
+
+    if(networkd_subscribe(nd, cursor, print_event, print_subscribed, NULL) == -1) { lost(); }
+
+    while(1) {
+        if(networkd_poll(nd, -1) == -1) { lost(); }
+    }
+}
+
+// Print the interface state published by networkd -p, without asking networkd
+static int print_state(const char* path) {
+    struct networkd_state* state = networkd_state_open(path);
+    if(state == NULL) {
+        fprintf(stderr, "Failed to open state: %s\n", strerror(errno));
+        return 1;
+    }
+
+    static struct networkd_state_snapshot snapshot;
+    if(networkd_state_read(state, &snapshot) == -1) {
+        fprintf(stderr, "Failed to read state: %s\n", strerror(errno));
+        networkd_state_close(state);
+        return 1;
+    }
+
+    static const char* links[] = {"unknown", "down", "up"};
+    for(uint32_t i = 0; i < snapshot.count; i += 1) {
+        const struct networkd_iface_state* iface = &snapshot.ifaces[i];
+        printf("%-16s%-8" PRIu32 "%-8s%-8" PRIu32 "0x%" PRIx32 "\n",
+               iface->name,
+               iface->ifindex,
+               (iface->link <= NETWORKD_LINK_UP)? links[iface->link] : "unknown",
+               iface->mtu,
+               iface->flags);
+    }
+
+    if(snapshot.truncated > 0) { fprintf(stderr, "%" PRIu32 " more not published\n", snapshot.truncated); }
+    networkd_state_close(state);
+    return 0;
+}
+
+// Queue one command. Returns false if it was not understood.
+static bool run(struct networkd* nd, size_t argc, const char** argv) {
+    struct command* command = commands;
+    for(; command->name != NULL; command += 1) {
+        if(strcmp(command->name, argv[0]) == 0) { break; }
+    }
+
+    if(command->name == NULL) {
+        fprintf(stderr, "Unknown command: %s\n", argv[0]);
+        return false;
+    }
+
+    const size_t n_args = argc - 1;
+    if(n_args < command->min_args || n_args > command->max_args) {
+        fputs(usage_text, stderr);
+        return false;
+    }
+
+    if(strcmp(command->name, "subscribe") == 0) {
+        subscribe(nd, (n_args > 0)? argv[1] : NULL);
+    }
+
+    const char* request[MAX_WORDS + 3];
+    size_t n = 0;
+    char stanzas[4096];
+    if(strcmp(command->name, "configure") == 0) {
+        // Stanzas are sent as one space-separated argument
+        stanzas[0] = '\0';
+        for(size_t i = 2; i < argc; i += 1) {
+            if(i > 2) { strlcat(stanzas, " ", sizeof(stanzas)); }
+            if(strlcat(stanzas, argv[i], sizeof(stanzas)) >= sizeof(stanzas)) {
+                fputs("Configuration too long\n", stderr);
+                return false;
+            }
+        }
+
+        request[n++] = argv[0];
+        request[n++] = argv[1];
+        request[n++] = stanzas;
+    } else if(strcmp(command->name, "events") == 0) {
+        request[n++] = argv[0];
+        request[n++] = "since";
+        request[n++] = (n_args > 0)? argv[1] : "0";
+        if(n_args > 1) { request[n++] = argv[2]; }
+    } else {
+        for(size_t i = 0; i < argc; i += 1) { request[n++] = argv[i]; }
+    }
+
+    if(networkd_requestv(nd, command->print, &command->width, request, n) == -1) { lost(); }
+    return true;
+}
+
+// Split a line into words on whitespace
+static size_t split(char* line, const char** words, size_t max) {
+    size_t n = 0;
+    for(char* word = strtok(line, " \t\r\n"); word != NULL; word = strtok(NULL, " \t\r\n")) {
+        if(n == max) { return 0; }
+        words[n++] = word;
+    }
+
+    return n;
+}
+
+// Run commands from standard input over the one connection. At a terminal,
+// each command is answered before the next prompt. Otherwise, commands are
+// sent without waiting on replies.
+static void run_input(struct networkd* nd) {
+    const bool interactive = isatty(STDIN_FILENO);
+    char* line = NULL;
+    size_t line_cap = 0;
+
+    while(1) {
+        if(interactive) {
+            fputs("network> ", stdout);
+            fflush(stdout);
+        }
+
+        if(getline(&line, &line_cap, stdin) < 0) { break; }
+
+        const char* words[MAX_WORDS];
+        const size_t n = split(line, words, MAX_WORDS);
+        if(n == 0) { continue; }
+        if(!run(nd, n, words)) {
+            failed = true;
+            continue;
+        }
+
+        if(interactive) {
+            if(networkd_wait(nd) == -1) { lost(); }
+            fflush(stdout);
+        } else if(networkd_dispatch(nd) == -1) {
+            lost();
+        }
+    }
+
+    if(interactive) { fputs("\n", stdout); }
+    free(line);
+}
+
+int main(int argc, char** argv) {
+    const char* path = NETWORKD_SOCKET;
+
+    int c;
+    while((c = getopt(argc, argv, "hs:p:")) != -1) {
+        switch(c) {
+            case 's':
+                path = optarg;
+                break;
+            case 'p':
+                return print_state(optarg);
+            case 'h':
+            default:
+                fputs(usage_text, stderr);
+                return (c == 'h')? 0 : 1;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    struct networkd* nd = networkd_open(path);
+    if(nd == NULL) {
+        fprintf(stderr, "Failed to connect to networkd: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if(argc > 0) {
+        if((size_t)argc > MAX_WORDS) {
+            fputs(usage_text, stderr);
+            return 1;
+        }
+
+        if(!run(nd, argc, (const char**)argv)) { return 1; }
+    } else {
+        run_input(nd);
+    }
+
+    if(networkd_wait(nd) == -1) { lost(); }
+    networkd_close(nd);
+    return failed? 1 : 0;
+}
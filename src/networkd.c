@@ -4,25 +4,271 @@
 #include <grp.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/queue.h>
 #include <sys/uio.h>
 #include <sys/un.h>
-#include <sys/event.h>
 #include <sys/stat.h>
-#include <net/route.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <imsg.h>
 
+#include "addrindex.h"
+#include "command.h"
+#include "counters.h"
+#include "evloop.h"
 #include "flatjson.h"
+#include "fragments.h"
+#include "history.h"
+#include "iftable.h"
+#include "monitor.h"
+#include "paths.h"
+#include "payload.h"
+#include "publish.h"
+#include "ratelimit.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 #include "validate.h"
+#include "wheel.h"
 #include "service_exec.h"
+#include "service_ifconfig.h"
 #include "service_write.h"
 
-void handle_list(FILE*, bool);
+#define CONN_BUF_LEN 2048
+
+// Commands handled per pass of the event loop, before checking for I/O again
+#define SCHED_BATCH 64
+
+// How many changed interfaces list asks ifconfig about one at a time, before
+// listing every interface instead
+#define LIST_REFRESH_MAX 8
+
+// Rate limits are off unless asked for, since one batch of commands from
+// network-cli or a script can easily exceed any limit that suits a person at
+// a prompt. A rate given without a burst allows bursts of twice the rate.
+#define DEFAULT_CONN_RATE 0
+#define DEFAULT_USER_RATE 0
+#define DEFAULT_BURST_FACTOR 2
+
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_MAX_CONNECTIONS 1024
+#define DEFAULT_IDLE_TIMEOUT 300
+
+#define EVENT_BATCH 64
+
+// Events returned by the events command when no limit is given
+#define EVENTS_DEFAULT_LIMIT 100
+
+// Bytes of unwritten events after which a subscriber is dropped
+#define SUBSCRIBER_BACKLOG (1024 * 1024)
+
+// Share of the time that sampling interface counters may take, in percent
+#define COUNTERS_BUDGET 1
+
+// Timer identifiers, which share a namespace with nothing else
+#define TIMER_IDLE 1
+#define TIMER_COUNTERS 2
+
+// Deadlines of connect commands waiting for an interface to be ready, each
+// offset by its request ID
+#define TIMER_WAIT_BASE 16
+
+// How long connect waits for an interface to be ready, in milliseconds, if
+// no timeout is given
+#define CONNECT_WAIT_TIMEOUT 30000
+
+// Rate limiting shared by every connection from one user. Entries outlive
+// their connections, so that reconnecting does not refill the bucket; there
+// are only as many as there are users allowed on the socket.
+struct user {
+    uid_t uid;
+    struct bucket bucket;
+    struct user* next;
+};
+
+struct conn {
+    int fd;
+    bool closed;
+    bool eof;
+    bool discarding;
+
+    // Partial command line read from the client
+    char in[CONN_BUF_LEN];
+    size_t in_len;
+
+    // Reply data that the socket has not yet accepted
+    char* out;
+    size_t out_len;
+    bool watching_write;
+
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+
+    // The command waiting on service_exec, if any. Later commands are not
+    // handled until it is answered, so that replies stay in order.
+    struct pending* pending;
+
+    // Set while the connection has complete commands waiting their turn.
+    // Reading stops until they have all been handled.
+    bool ready;
+    TAILQ_ENTRY(conn) ready_entry;
+
+    struct bucket bucket;
+    struct user* user;
+
+    // Set once the client has subscribed to interface events, which are
+    // pushed to it as they happen
+    bool subscribed;
+    LIST_ENTRY(conn) subscriber_entry;
+
+    // Closed if no command arrives before the deadline, which a client
+    // cannot put off by trickling in a byte at a time
+    struct wheel_entry idle;
+
+    struct conn* next_closed;
+};
+
+struct pending;
+typedef bool(*pending_complete)(struct pending*, FILE*, int32_t, const char*);
+
+// A command waiting on service_exec, which runs jobs concurrently and so
+// may answer requests in any order. Replies are matched up by request ID.
+struct pending {
+    uint32_t request;
+    struct conn* conn;
+    enum stats_command cmd;
+    uint64_t start;
+    uint64_t sent_at;
+
+    // Called with the job's result to render the reply. Returns false if it
+    // started another job instead, or is still waiting on something else.
+    pending_complete complete;
+
+    // The job's output, collected from EXEC_RESPONSE_DATA messages
+    char* output;
+    size_t output_len;
+
+    bool details;
+
+    // A scan job, and the commands waiting on it besides the one that
+    // started it. Waiting commands have no job of their own.
+    struct scan* scan;
+    struct pending* waiters;
+    struct pending* next_waiter;
+
+    // A connect waiting for the interface to be ready, which may happen
+    // before its job has finished, and whether its deadline has passed
+    enum command_wait wait;
+    struct payload_iface iface;
+    bool ready;
+    bool job_done;
+    bool timed_out;
+
+    struct pending* next;
+};
+
+// A reply that arrived while waiting on another one
+struct deferred_imsg {
+    struct imsg imsg;
+    struct deferred_imsg* next;
+};
+
+struct stats_reply {
+    FILE* sock;
+    bool first;
+};
+
+static void conn_write(struct conn*, const char*, size_t);
+static void reply_write(struct conn*, char*, size_t);
+static void gather_reset(void);
+static void conn_resume(struct conn*);
+
+static uint64_t service_sent_at[STATS_SERVICE_MAX];
+
+static struct pending* pending_requests;
+static struct deferred_imsg* deferred_head;
+static struct deferred_imsg** deferred_tail = &deferred_head;
+
+static int kq = -1;
+
+static TAILQ_HEAD(, conn) ready_conns = TAILQ_HEAD_INITIALIZER(ready_conns);
+static struct user* users;
+static LIST_HEAD(, conn) subscribers = LIST_HEAD_INITIALIZER(subscribers);
+static struct wheel idle_wheel;
+
+static struct history history;
+
+// Interface traffic counters, and the interval between samples asked for on
+// the command line, in milliseconds. Zero means no sampling.
+static struct counters counters;
+static uint32_t counters_period;
+
+// Every interface, kept up to date by the interface monitor
+static struct iftable ifaces;
+
+// The latest wireless scan of each interface that has been scanned
+static struct scans scans;
+
+// Which interface each address belongs to, kept up to date like ifaces
+static struct addrindex addresses;
+
+// Each interface's details as list sends them, and the fragments gathered
+// for the reply being built. Gathered fragments are written after the text
+// the reply's handler wrote, straight from where they are kept, so the first
+// slot is left for that text. Fragments encoded for one reply alone, for
+// interfaces the table does not know, are kept in scratch until it is sent.
+static struct fragments fragments;
+static struct iovec* gather;
+static size_t gather_len;
+static size_t gather_cap;
+static struct fragment* scratch;
+static size_t scratch_len;
+static size_t scratch_cap;
+
+// Where the interface table is saved on shutdown, and whether the details
+// loaded from it have yet to be listed afresh
+static int snapshot_fd = -1;
+static bool ifaces_stale;
+
+// The interface classes that list leaves out, once ifconfig has said
+static char pseudo_classes[PSEUDO_CLASSES_LEN];
+static bool pseudo_classes_known;
+
+// Link events waiting to be written to the hardware event log, as a ring
+// that grows as needed, and whether the oldest is being logged. Events are
+// logged one at a time, so that they land in order, and outside the budget
+// of jobs that clients share.
+static struct payload_logevent* hwevents;
+static size_t hwevents_head;
+static size_t hwevents_cap;
+static bool hwevent_logging;
+
+// Where to publish the interface table for local readers, if anywhere
+static const char* publish_path;
+
+// A descriptor to read interface events from in place of the routing
+// socket, such as one end of a socketpair fed with recorded messages
+static int monitor_fd = -1;
+
+// A spare descriptor, given up to accept and turn away connections when we
+// have run out
+static int reserve_fd = -1;
+
+// Connections closed while handling the current batch of events. They are
+// freed once the batch is done, since later events may still refer to them.
+static struct conn* closed_conns;
+
+// Every command and interface event gets a request ID, which is carried to
+// the services in the imsg peerid so that trace points can be correlated.
+static uint32_t current_request;
+static uint32_t next_request = 1;
 
 void sighandler(int signo) {
     write(2, "Received signal\n", 16);
@@ -30,267 +276,1857 @@ void sighandler(int signo) {
     _exit(0);
 }
 
-static int monitor_ifaces(void) {
-    int rt_fd = socket(PF_ROUTE, SOCK_RAW, 0);
-    unsigned int rtfilter = ROUTE_FILTER(RTM_IFINFO);
-    setsockopt(rt_fd, PF_ROUTE, ROUTE_MSGFILTER, &rtfilter, sizeof(rtfilter));
+void spawn_service(struct imsgbuf* ibuf, void(*f)(struct imsgbuf*)) {
+    struct imsgbuf child_ibuf;
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, fds) == -1) {
+        die("Failed to set up socketpair");
+    }
+
+    switch(fork()) {
+      case -1: die("Failed to fork service"); break;
+      case 0:
+        // Child
+        close(fds[0]);
+        imsg_init(&child_ibuf, fds[1]);
+        f(&child_ibuf);
+        exit(0);
+      default:
+        // Parent
+        close(fds[1]);
+        imsg_init(ibuf, fds[0]);
+        break;
+    }
+}
+
+static enum stats_service service_id(const struct imsgbuf* ibuf) {
+    if(ibuf == &service_write_ibuf) { return STATS_SERVICE_WRITE; }
+    if(ibuf == &service_ifconfig_ibuf) { return STATS_SERVICE_IFCONFIG; }
+    return STATS_SERVICE_EXEC;
+}
+
+void service_send(struct imsgbuf* ibuf, u_int32_t type, const void* data, size_t len) {
+    TRACE_POINT(TRACE_IMSG_SEND, current_request);
+    imsg_compose(ibuf, type, current_request, 0, -1, data, len);
+    imsg_flush(ibuf);
+    service_sent_at[service_id(ibuf)] = now_usec();
+}
+
+// Wait for the reply to the current request, recording the round-trip time
+// since the last service_send(). Replies to other requests that arrive
+// first are set aside for exec_drain().
+static int32_t service_get(struct imsgbuf* ibuf, struct imsg* imsg) {
+    while(1) {
+        int n = imsg_get(ibuf, imsg);
+        if(n < 0) { die("Error getting message"); }
+        if(n == 0) {
+            n = imsg_read(ibuf);
+            if(n < 0) { die("Error reading"); }
+            if(n == 0) { return -1; }
+            continue;
+        }
+
+        if(imsg->hdr.peerid == current_request) { break; }
+
+        struct deferred_imsg* deferred = malloc(sizeof(struct deferred_imsg));
+        if(deferred == NULL) { die("Failed to allocate message"); }
+        deferred->imsg = *imsg;
+        deferred->next = NULL;
+        *deferred_tail = deferred;
+        deferred_tail = &deferred->next;
+    }
+
+    TRACE_POINT(TRACE_IMSG_RECEIVE, imsg->hdr.peerid);
+
+    const enum stats_service id = service_id(ibuf);
+    hist_record(&stats.services[id], now_usec() - service_sent_at[id]);
+    return imsg->hdr.type;
+}
+
+int32_t service_pop(struct imsgbuf* ibuf, char* buf, size_t buf_len) {
+    if(buf != NULL) { buf[0] = '\0'; }
+
+    struct imsg imsg;
+    if(service_get(ibuf, &imsg) < 0) { return -1; }
+
+    if(buf != NULL && imsg.data != NULL) {
+        // We should only ever pass strings, but just to be safe, always
+        // make sure that the buffer we return is nul-terminated.
+        const size_t data_len = imsg.hdr.len - IMSG_HEADER_SIZE;
+        strlcpy(buf, imsg.data, min(buf_len, data_len));
+    }
+
+    u_int32_t type = imsg.hdr.type;
+    imsg_free(&imsg);
+    return type;
+}
+
+// Like service_pop(), but for binary replies. Returns -1 if the reply does
+// not fit into the given buffer.
+int32_t service_pop_data(struct imsgbuf* ibuf,
+                         void* buf,
+                         size_t buf_len,
+                         size_t* data_len) {
+    *data_len = 0;
+
+    struct imsg imsg;
+    if(service_get(ibuf, &imsg) < 0) { return -1; }
+
+    const size_t len = imsg.hdr.len - IMSG_HEADER_SIZE;
+    u_int32_t type = imsg.hdr.type;
+    if(len > buf_len) {
+        type = -1;
+    } else if(imsg.data != NULL) {
+        memcpy(buf, imsg.data, len);
+        *data_len = len;
+    }
+
+    imsg_free(&imsg);
+    return type;
+}
+
+static void exec_send(struct pending* pending, enum exec_type type, const void* data, size_t len) {
+    TRACE_POINT(TRACE_IMSG_SEND, pending->request);
+    imsg_compose(&service_exec_ibuf, type, pending->request, 0, -1, data, len);
+    imsg_flush(&service_exec_ibuf);
+    pending->sent_at = now_usec();
+}
+
+// Hold the connection's later commands until the current request is
+// answered. The connection may be NULL.
+static struct pending* pending_add(struct conn* conn, pending_complete complete) {
+    struct pending* pending = calloc(1, sizeof(struct pending));
+    if(pending == NULL) { die("Failed to allocate request"); }
+
+    pending->request = current_request;
+    pending->conn = conn;
+    pending->cmd = STATS_CMD_UNKNOWN;
+    pending->start = now_usec();
+    pending->complete = complete;
+    pending->next = pending_requests;
+    pending_requests = pending;
+    if(conn != NULL) { conn->pending = pending; }
+    return pending;
+}
+
+// Start a job on behalf of the current request, and hold the connection's
+// later commands until it finishes. The connection may be NULL.
+static struct pending* exec_start(struct conn* conn,
+                                  enum exec_type type,
+                                  const void* data,
+                                  size_t len,
+                                  pending_complete complete) {
+    struct pending* pending = pending_add(conn, complete);
+    exec_send(pending, type, data, len);
+    return pending;
+}
+
+static void send_error(FILE* sock, const char* msg) {
+    if(msg == NULL || msg[0] == '\0') {
+        flatjson_send_singleton(sock, "error");
+    } else {
+        bool first = true;
+        flatjson_start_send(sock);
+        flatjson_send(sock, "error", &first);
+        flatjson_send(sock, msg, &first);
+        flatjson_finish_send(sock);
+    }
+
+    fputs("\n", sock);
+}
+
+static void pending_finish(struct pending* pending, char* reply, size_t reply_len) {
+    struct pending** link = &pending_requests;
+    while(*link != pending) { link = &(*link)->next; }
+    *link = pending->next;
+
+    struct conn* conn = pending->conn;
+    if(conn != NULL) {
+        reply_write(conn, reply, reply_len);
+        TRACE_POINT(TRACE_REPLY_FLUSH, pending->request);
+        hist_record(&stats.commands[pending->cmd], now_usec() - pending->start);
+        conn_resume(conn);
+    }
+
+    gather_reset();
+    free(pending->output);
+    free(pending);
+}
+
+// Handle a message from service_exec. Output is collected until the final
+// message, which completes the request.
+static void exec_reply(struct imsg* imsg) {
+    struct pending* pending = pending_requests;
+    while(pending != NULL && pending->request != imsg->hdr.peerid) {
+        pending = pending->next;
+    }
+
+    if(pending == NULL) {
+        warn("Reply to unknown request");
+        return;
+    }
+
+    const size_t data_len = imsg->hdr.len - IMSG_HEADER_SIZE;
+    if(imsg->hdr.type == EXEC_RESPONSE_DATA) {
+        if(pending->output_len + data_len >= EXEC_BUF_LEN) { return; }
+
+        char* output = realloc(pending->output, pending->output_len + data_len + 1);
+        if(output == NULL) { die("Failed to allocate output buffer"); }
+        memcpy(output + pending->output_len, imsg->data, data_len);
+        pending->output = output;
+        pending->output_len += data_len;
+        pending->output[pending->output_len] = '\0';
+        return;
+    }
+
+    TRACE_POINT(TRACE_IMSG_RECEIVE, pending->request);
+    hist_record(&stats.services[STATS_SERVICE_EXEC], now_usec() - pending->sent_at);
+
+    // Make sure that the message is a nul-terminated string
+    char msg[EXEC_STDERR_LEN];
+    msg[0] = '\0';
+    if(imsg->data != NULL) { strlcpy(msg, imsg->data, min(sizeof(msg), data_len)); }
+
+    char* reply = NULL;
+    size_t reply_len = 0;
+    FILE* f = open_memstream(&reply, &reply_len);
+    if(f == NULL) { die("Failed to open reply buffer"); }
+
+    const bool done = pending->complete(pending, f, imsg->hdr.type, msg);
+    fclose(f);
+    if(done) { pending_finish(pending, reply, reply_len); }
+    free(reply);
+}
+
+// Handle every complete message from service_exec that has been read so far.
+// Deferred messages were read first, so they are handled first.
+static void exec_drain(void) {
+    while(1) {
+        struct imsg imsg;
+        if(deferred_head != NULL) {
+            struct deferred_imsg* deferred = deferred_head;
+            deferred_head = deferred->next;
+            if(deferred_head == NULL) { deferred_tail = &deferred_head; }
+            imsg = deferred->imsg;
+            free(deferred);
+        } else {
+            const int n = imsg_get(&service_exec_ibuf, &imsg);
+            if(n < 0) { die("Error getting message"); }
+            if(n == 0) { break; }
+        }
+
+        exec_reply(&imsg);
+        imsg_free(&imsg);
+    }
+}
+
+void drop_permissions(const char* username) {
+    struct passwd* passwd = getpwnam(username);
+    if(passwd == NULL) { die("Failed to get user information"); }
+    struct group* group = getgrnam(username);
+    if(group == NULL) { die("Failed to get group information"); }
+
+    if(chroot("/var/empty") != 0) { die("Failed to chroot"); }
+    if(chdir("/") != 0) { die("Failed to chdir"); }
+
+    if(setgroups(0, NULL) == -1) { die("Failed to set supplementary groups"); }
+    if(setgid(group->gr_gid) == -1) { die("Failed to set group"); }
+    if(setuid(passwd->pw_uid) == -1) { die("Failed to set user"); }
+
+    // Reading interface counters needs the routing sysctls
+    pledge((counters_period > 0)? "stdio unix route" : "stdio unix", NULL);
+}
+
+static void gather_add(const char* buf, size_t len) {
+    if(gather_len + 1 >= gather_cap) {
+        const size_t cap = (gather_cap > 0)? gather_cap * 2 : 64;
+        struct iovec* grown = realloc(gather, cap * sizeof(*grown));
+        if(grown == NULL) { die("Failed to allocate reply fragments"); }
+        gather = grown;
+        gather_cap = cap;
+    }
+
+    gather_len += 1;
+    gather[gather_len].iov_base = (void*)buf;
+    gather[gather_len].iov_len = len;
+}
+
+static void gather_reset(void) {
+    for(size_t i = 0; i < scratch_len; i += 1) { free(scratch[i].buf); }
+    scratch_len = 0;
+    gather_len = 0;
+}
+
+// Gather an interface's details, from the cache if it is in the table, or
+// as given if its index is 0
+static void list_iface_gather(uint32_t ifindex, const char* iface, uint32_t mtu, const struct iftable_details* details) {
+    bool encoded = true;
+    const struct fragment* fragment = (ifindex != 0)? fragments_get(&fragments, &ifaces, ifindex, &encoded) : NULL;
+    if(fragment == NULL) {
+        if(scratch_len == scratch_cap) {
+            const size_t cap = (scratch_cap > 0)? scratch_cap * 2 : 8;
+            struct fragment* grown = realloc(scratch, cap * sizeof(*grown));
+            if(grown == NULL) { die("Failed to allocate reply fragments"); }
+            scratch = grown;
+            scratch_cap = cap;
+        }
+
+        struct fragment* made = &scratch[scratch_len];
+        scratch_len += 1;
+        memset(made, 0, sizeof(*made));
+        fragment_encode(made, iface, mtu, details);
+        fragment = made;
+    }
+
+    if(encoded) {
+        stats.list_encoded += 1;
+    } else {
+        stats.list_cached += 1;
+    }
+
+    gather_add(fragment->buf, fragment->len);
+}
+
+// Finish listing an interface. Interfaces that the table knows about keep
+// their details there, and are sent under their interned names. Any others,
+// such as one the monitor has not heard about yet, are sent as parsed. The
+// reply may be NULL, to only bring the table up to date.
+static void list_iface(FILE* sock, const char* iface, int mtu, const struct iftable_details* parsed) {
+    const uint32_t ifindex = iftable_lookup(&ifaces, iface);
+    if(ifindex != 0) {
+        iftable_set_mtu(&ifaces, ifindex, mtu);
+        iftable_set_details(&ifaces, ifindex, parsed);
+    }
+
+    if(sock != NULL) { list_iface_gather(ifindex, iface, mtu, parsed); }
+}
+
+// End a list reply, after any fragments gathered for it
+static void list_finish(FILE* sock) {
+    if(gather_len > 0) {
+        gather_add("]\n", 2);
+        return;
+    }
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+// Read the interfaces in ifconfig's output, leaving out pseudo interfaces
+static void list_parse(FILE* sock, char* output, bool details, bool* first_message) {
+    static struct iftable_details parsed;
+
+    char* cursor;
+    char listed[IF_NAMESIZE];
+    int listed_mtu = 0;
+    bool listing = false;
+    while((cursor = strsep(&output, "\n")) != NULL) {
+        char iface[IF_NAMESIZE];
+        char key[IFCONFIG_KEY_LEN];
+        char flags[FLAGS_LEN];
+        int mtu;
+        if(parse_ifconfig_header(cursor, iface, flags, &mtu)) {
+            if(listing) { list_iface(sock, listed, listed_mtu, &parsed); }
+            listing = false;
+
+            if(iface_is_pseudo(iface, pseudo_classes)) { continue; }
+            if(!details) {
+                if(sock != NULL) { flatjson_send(sock, iface, first_message); }
+                continue;
+            }
+
+            listing = true;
+            strlcpy(listed, iface, sizeof(listed));
+            listed_mtu = mtu;
+            iftable_details_clear(&parsed);
+            iftable_details_add(&parsed, "flags", flags);
+            continue;
+        }
+
+        if(listing && parse_ifconfig_kv(cursor, key, flags)) {
+            iftable_details_add(&parsed, key, flags);
+        }
+    }
+
+    if(listing) { list_iface(sock, listed, listed_mtu, &parsed); }
+}
+
+static bool list_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    // Whether or not it worked, later lists run ifconfig for themselves
+    ifaces_stale = false;
+    if(result != EXEC_RESPONSE_OK) {
+        send_error(sock, msg);
+        return true;
+    }
+
+    bool first_message = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first_message);
+    list_parse(sock, (pending->output == NULL)? "" : pending->output, pending->details, &first_message);
+    list_finish(sock);
+    return true;
+}
+
+// Pseudo interfaces are left out of the listing, so find out which interface
+// classes are pseudo interfaces first. They are only asked for once.
+static bool list_pseudo_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    if(result != EXEC_RESPONSE_OK) {
+        warn("Failed to enumerate pseudo classes");
+        ifaces_stale = false;
+        send_error(sock, msg);
+        return true;
+    }
+
+    if(pending->output != NULL) {
+        strlcpy(pseudo_classes, chomp(pending->output), sizeof(pseudo_classes));
+    }
+    pseudo_classes_known = true;
+
+    free(pending->output);
+    pending->output = NULL;
+    pending->output_len = 0;
+    pending->complete = list_complete;
+    exec_send(pending, EXEC_IFCONFIG_LIST_INTERFACES, NULL, 0);
+    stats.list_ifconfig += 1;
+    return false;
+}
+
+static bool result_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    if(result == EXEC_RESPONSE_OK) {
+        flatjson_send_singleton(sock, "ok");
+        fputs("\n", sock);
+    } else {
+        send_error(sock, msg);
+    }
+
+    return true;
+}
+
+// Reply with the details kept in the table, marked as stale if they were
+// loaded from a snapshot and have not been listed afresh since
+static void list_table(FILE* sock, bool stale) {
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    if(stale) {
+        flatjson_send(sock, "stale", &first);
+        flatjson_send(sock, "true", &first);
+    }
+
+    for(size_t i = 0; i < ifaces.len; i += 1) {
+        const struct iftable_details* details = iftable_details(&ifaces, i);
+        if(details == NULL || details->len == 0) { continue; }
+        list_iface_gather(i, iftable_name(&ifaces, i), ifaces.mtu[i], details);
+    }
+
+    list_finish(sock);
+}
+
+// List interfaces with ifconfig. The connection may be NULL, to only bring
+// the table up to date.
+static void list_start(struct conn* conn, bool details) {
+    struct pending* pending;
+    if(pseudo_classes_known) {
+        pending = exec_start(conn, EXEC_IFCONFIG_LIST_INTERFACES, NULL, 0, list_complete);
+        stats.list_ifconfig += 1;
+    } else {
+        pending = exec_start(conn, EXEC_IFCONFIG_LIST_PSEUDO_INTERFACES, NULL, 0, list_pseudo_complete);
+        stats.list_ifconfig += 1;
+    }
+
+    pending->details = details;
+}
+
+// Whether the interface on an index is one that list shows, but whose
+// details have changed since ifconfig last listed it
+static bool list_missing(uint32_t ifindex) {
+    const char* iface = iftable_name(&ifaces, ifindex);
+    return iface != NULL && !iftable_details_current(&ifaces, ifindex) && !iface_is_pseudo(iface, pseudo_classes);
+}
+
+// Ask ifconfig for the next interface missing details, from the given index
+// on. Returns false if there are none left.
+static bool list_refresh_next(struct pending* pending, uint32_t from) {
+    for(uint32_t i = from; i < ifaces.len; i += 1) {
+        if(!list_missing(i)) { continue; }
+
+        pending->iface.ifindex = i;
+        strlcpy(pending->iface.name, iftable_name(&ifaces, i), sizeof(pending->iface.name));
+        exec_send(pending, EXEC_IFCONFIG_LIST_INTERFACES, &pending->iface, sizeof(pending->iface));
+        stats.list_ifconfig += 1;
+        return true;
+    }
+
+    return false;
+}
+
+// An interface missing details has been listed. One that could not be, such
+// as one that has since gone away, is left out of the reply. One that
+// ifconfig had nothing to say about is left out until it changes again.
+static bool list_refresh_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    if(result == EXEC_RESPONSE_OK) {
+        bool first = true;
+        list_parse(NULL, (pending->output == NULL)? "" : pending->output, true, &first);
+
+        static const struct iftable_details none;
+        if(list_missing(pending->iface.ifindex)) { iftable_set_details(&ifaces, pending->iface.ifindex, &none); }
+    }
+
+    free(pending->output);
+    pending->output = NULL;
+    pending->output_len = 0;
+    if(list_refresh_next(pending, pending->iface.ifindex + 1)) { return false; }
+
+    list_table(sock, false);
+    return true;
+}
+
+// Until the details from a snapshot have been listed afresh, clients are
+// answered from the snapshot instead. Otherwise, the table's details are
+// kept, and only interfaces that have changed since they were last listed
+// are asked about. Once more than LIST_REFRESH_MAX have changed, running
+// ifconfig once for all of them is cheaper.
+static void handle_list(struct conn* conn, FILE* sock, const struct command* command) {
+    if(ifaces_stale) {
+        list_table(sock, true);
+        return;
+    }
+
+    if(!pseudo_classes_known) {
+        list_start(conn, true);
+        return;
+    }
+
+    size_t missing = 0;
+    for(uint32_t i = 1; i < ifaces.len && missing <= LIST_REFRESH_MAX; i += 1) {
+        if(list_missing(i)) { missing += 1; }
+    }
+
+    if(missing == 0) {
+        list_table(sock, false);
+    } else if(missing > LIST_REFRESH_MAX) {
+        list_start(conn, true);
+    } else {
+        list_refresh_next(pending_add(conn, list_refresh_complete), 1);
+    }
+}
+
+static void handle_configure(struct conn* conn, FILE* sock, const struct command* command) {
+    static struct payload_configure payload;
+    memset(&payload, 0, sizeof(payload));
+    payload.iface = command->iface;
+    payload.n_stanzas = command->n_stanzas;
+    memcpy(payload.stanzas, command->stanzas, sizeof(payload.stanzas));
+
+    service_send(&service_write_ibuf, WRITE_WRITE, &payload, sizeof(payload));
+    int32_t result = service_pop(&service_write_ibuf, NULL, 0);
+    if(result == WRITE_RESPONSE_OK) {
+        flatjson_send_singleton(sock, "ok");
+    } else {
+        flatjson_send_singleton(sock, "error");
+    }
+
+    fputs("\n", sock);
+}
+
+// Try to make an interface change natively. Returns false if it has to be
+// left to the external programs.
+static bool ifconfig_native(enum ifconfig_type type, const struct payload_iface* iface) {
+    service_send(&service_ifconfig_ibuf, type, iface, sizeof(*iface));
+    if(service_pop(&service_ifconfig_ibuf, NULL, 0) == IFCONFIG_RESPONSE_OK) {
+        stats.ifconfig_native += 1;
+        return true;
+    }
+
+    stats.ifconfig_fallback += 1;
+    return false;
+}
+
+// Whether an interface is ready already. Only the link state is known;
+// addresses and routes have to be waited for.
+static bool iface_ready(enum command_wait wait, const char* iface) {
+    if(wait == COMMAND_WAIT_NONE) { return true; }
+    if(wait != COMMAND_WAIT_LINK) { return false; }
+
+    const uint32_t ifindex = iftable_lookup(&ifaces, iface);
+    return ifindex != 0 && iftable_link(&ifaces, ifindex) == HISTORY_LINK_UP;
+}
+
+static bool connect_ready(const struct pending* pending) {
+    return pending->ready || iface_ready(pending->wait, pending->iface.name);
+}
+
+// Answer a waiting connect, once its job has finished
+static void connect_finish(struct pending* pending, const char* error) {
+    evloop_del_timer(kq, TIMER_WAIT_BASE + pending->request);
+
+    char* reply = NULL;
+    size_t reply_len = 0;
+    FILE* f = open_memstream(&reply, &reply_len);
+    if(f == NULL) { die("Failed to open reply buffer"); }
+    if(error == NULL) {
+        flatjson_send_singleton(f, "ok");
+        fputs("\n", f);
+    } else {
+        send_error(f, error);
+    }
+    fclose(f);
+
+    pending_finish(pending, reply, reply_len);
+    free(reply);
+}
+
+// Once netstart has finished, answer at once if it failed, if the interface
+// is ready, or if the deadline has passed. Otherwise, keep waiting.
+static bool connect_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    pending->job_done = true;
+
+    // netstart may change details that the kernel does not announce
+    iftable_expire_details(&ifaces, iftable_lookup(&ifaces, pending->iface.name));
+    if(result != EXEC_RESPONSE_OK || connect_ready(pending)) {
+        if(pending->wait != COMMAND_WAIT_NONE) { evloop_del_timer(kq, TIMER_WAIT_BASE + pending->request); }
+        return result_complete(pending, sock, result, msg);
+    }
+
+    if(pending->timed_out) {
+        send_error(sock, "timed out");
+        return true;
+    }
+
+    return false;
+}
+
+// An interface became ready in some way. Waiting connects that are done with
+// their jobs are answered, and the rest will be once their jobs finish.
+static void connect_notify(enum command_wait wait, uint32_t ifindex) {
+    const char* iface = iftable_name(&ifaces, ifindex);
+    if(iface == NULL) { return; }
+
+    struct pending* next;
+    for(struct pending* pending = pending_requests; pending != NULL; pending = next) {
+        next = pending->next;
+        if(pending->wait != wait || strcmp(pending->iface.name, iface) != 0) { continue; }
+
+        pending->ready = true;
+        if(pending->job_done) { connect_finish(pending, NULL); }
+    }
+}
+
+// A waiting connect's deadline has passed
+static void connect_timeout(uint32_t request) {
+    struct pending* pending = pending_requests;
+    while(pending != NULL && (pending->request != request || pending->wait == COMMAND_WAIT_NONE)) {
+        pending = pending->next;
+    }
+    if(pending == NULL) { return; }
+
+    pending->timed_out = true;
+    if(pending->job_done) { connect_finish(pending, "timed out"); }
+}
+
+// With a condition, the reply is held until the interface is ready as well
+// as configured: until its link is up, it has an address, or a default route
+// goes through it, as the kernel reports. Other clients carry on meanwhile.
+static void handle_connect(struct conn* conn, FILE* sock, const struct command* command) {
+    const struct payload_iface* iface = &command->iface;
+
+    // Attempt to autoconfigure, if there is no current configuration
+    service_send(&service_write_ibuf, WRITE_AUTOCONFIGURE, iface, sizeof(*iface));
+    service_pop(&service_write_ibuf, NULL, 0);
+
+    // Static configurations are applied directly, and the rest by netstart
+    const bool native = ifconfig_native(IFCONFIG_CONNECT, iface);
+    if(native && iface_ready(command->wait, iface->name)) {
+        flatjson_send_singleton(sock, "ok");
+        fputs("\n", sock);
+        return;
+    }
+
+    struct pending* pending;
+    if(native) {
+        pending = pending_add(conn, connect_complete);
+        pending->job_done = true;
+    } else {
+        pending = exec_start(conn, EXEC_NETSTART, iface, sizeof(*iface), connect_complete);
+    }
+
+    pending->wait = command->wait;
+    pending->iface = *iface;
+    if(pending->wait != COMMAND_WAIT_NONE) {
+        const uint32_t timeout = (command->timeout > 0)? command->timeout : CONNECT_WAIT_TIMEOUT;
+        evloop_add_timer(kq, TIMER_WAIT_BASE + pending->request, timeout, true, NULL);
+    }
+}
+
+static void handle_disconnect(struct conn* conn, FILE* sock, const struct command* command) {
+    const struct payload_iface* iface = &command->iface;
+    if(ifconfig_native(IFCONFIG_DOWN, iface)) {
+        flatjson_send_singleton(sock, "ok");
+        fputs("\n", sock);
+        return;
+    }
+
+    exec_start(conn, EXEC_IFCONFIG_DOWN, iface, sizeof(*iface), result_complete);
+}
+
+// Send an interface's scan results as <n>.<field> key and value pairs,
+// following their age in seconds
+static void send_scan(FILE* sock, const struct scan* scan) {
+    char key[24];
+    char value[24];
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    flatjson_send(sock, "age", &first);
+    snprintf(value, sizeof(value), "%" PRIu64, (now_usec() - scan->updated) / 1000000);
+    flatjson_send(sock, value, &first);
+
+    for(size_t i = 0; i < scan->n_results; i += 1) {
+        const struct scan_result* result = &scan->results[i];
+        snprintf(key, sizeof(key), "%zu.nwid", i);
+        flatjson_send(sock, key, &first);
+        flatjson_send(sock, result->nwid, &first);
+
+        snprintf(key, sizeof(key), "%zu.bssid", i);
+        flatjson_send(sock, key, &first);
+        flatjson_send(sock, result->bssid, &first);
+
+        snprintf(key, sizeof(key), "%zu.chan", i);
+        snprintf(value, sizeof(value), "%" PRIu32, result->chan);
+        flatjson_send(sock, key, &first);
+        flatjson_send(sock, value, &first);
+
+        snprintf(key, sizeof(key), "%zu.signal", i);
+        flatjson_send(sock, key, &first);
+        flatjson_send(sock, result->signal, &first);
+    }
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+static void send_scan_result(FILE* sock, const struct scan* scan, int32_t result, const char* msg) {
+    if(result == EXEC_RESPONSE_OK) {
+        send_scan(sock, scan);
+    } else {
+        send_error(sock, msg);
+    }
+}
+
+// Keep the results, and answer everyone who was waiting on them. A failed
+// scan leaves any earlier results in place.
+static bool scan_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
+    struct scan* scan = pending->scan;
+    scan->request = 0;
+    if(result == EXEC_RESPONSE_OK) { scan_update(scan, pending->output, now_usec()); }
+
+    send_scan_result(sock, scan, result, msg);
+    while(pending->waiters != NULL) {
+        struct pending* waiter = pending->waiters;
+        pending->waiters = waiter->next_waiter;
+
+        char* reply = NULL;
+        size_t reply_len = 0;
+        FILE* f = open_memstream(&reply, &reply_len);
+        if(f == NULL) { die("Failed to open reply buffer"); }
+        send_scan_result(f, scan, result, msg);
+        fclose(f);
+        pending_finish(waiter, reply, reply_len);
+        free(reply);
+    }
+
+    // Don't hold on to interfaces that have never been scanned
+    if(scan->updated == 0) { scans_remove(&scans, scan); }
+    return true;
+}
+
+// Reply with an interface's wireless networks, scanning for them unless the
+// last scan is no older than the given number of seconds. Commands arriving
+// while a scan runs wait on it rather than starting another.
+static void handle_scan(struct conn* conn, FILE* sock, const struct command* command) {
+    struct scan* scan = scans_get(&scans, command->iface.name);
+    if(scan_fresh(scan, now_usec(), (uint64_t)command->age * 1000000)) {
+        stats.scan_cached += 1;
+        send_scan(sock, scan);
+        return;
+    }
+
+    if(scan->request != 0) {
+        struct pending* job = pending_requests;
+        while(job->request != scan->request) { job = job->next; }
+
+        struct pending* waiter = pending_add(conn, NULL);
+        waiter->next_waiter = job->waiters;
+        job->waiters = waiter;
+        stats.scan_shared += 1;
+        return;
+    }
+
+    struct pending* pending = exec_start(conn, EXEC_IFCONFIG_SCAN, &command->iface, sizeof(command->iface), scan_complete);
+    pending->scan = scan;
+    scan->request = pending->request;
+}
+
+// Reply with the interface whose address or network most closely covers the
+// given address or prefix, and the prefix that matched
+static void handle_lookup(struct conn* conn, FILE* sock, const struct command* command) {
+    uint32_t ifindex;
+    struct addr_prefix match;
+    if(!addrindex_lookup(&addresses, &command->prefix, &ifindex, &match)) {
+        send_error(sock, "no match");
+        return;
+    }
+
+    const char* iface = iftable_name(&ifaces, ifindex);
+    if(iface == NULL) {
+        send_error(sock, "unknown interface");
+        return;
+    }
+
+    char prefix[ADDR_PREFIX_STRLEN];
+    addr_prefix_format(&match, prefix);
+
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    flatjson_send(sock, "iface", &first);
+    flatjson_send(sock, iface, &first);
+    flatjson_send(sock, "prefix", &first);
+    flatjson_send(sock, prefix, &first);
+    flatjson_finish_send(sock);
+    fprintf(sock, "\n");
+}
+
+// List the jobs that service_exec is running. Each job's ID is that of the
+// request that started it, and can be given to cancel.
+static void handle_jobs(struct conn* conn, FILE* sock, const struct command* command) {
+    static struct exec_job_info info[EXEC_MAX_RUNNING];
+    size_t len;
+    service_send(&service_exec_ibuf, EXEC_JOBS, NULL, 0);
+    int32_t result = service_pop_data(&service_exec_ibuf, info, sizeof(info), &len);
+    if(result != EXEC_RESPONSE_OK) {
+        send_error(sock, NULL);
+        return;
+    }
+
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    for(size_t i = 0; i < len / sizeof(info[0]); i += 1) {
+        char rendered[24];
+        char description[EXEC_DESCRIPTION_LEN];
+        strlcpy(description, info[i].description, sizeof(description));
+
+        snprintf(rendered, sizeof(rendered), "%u.command", info[i].id);
+        flatjson_send(sock, rendered, &first);
+        flatjson_send(sock, description, &first);
+        snprintf(rendered, sizeof(rendered), "%u.elapsed_ms", info[i].id);
+        flatjson_send(sock, rendered, &first);
+        snprintf(rendered, sizeof(rendered), "%u", info[i].elapsed_ms);
+        flatjson_send(sock, rendered, &first);
+    }
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+// Send an event's fields as key and value pairs, with the given key prefix
+static void send_history_event(FILE* sock, const char* prefix, const struct history_event* event, bool* first) {
+    char key[32];
+    char value[32];
+    snprintf(key, sizeof(key), "%stime", prefix);
+    snprintf(value, sizeof(value), "%" PRIu64 ".%06" PRIu64,
+             event->timestamp / 1000000, event->timestamp % 1000000);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, value, first);
+
+    snprintf(key, sizeof(key), "%sifindex", prefix);
+    snprintf(value, sizeof(value), "%u", event->ifindex);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, value, first);
+
+    snprintf(key, sizeof(key), "%siface", prefix);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, event->iface, first);
+
+    snprintf(key, sizeof(key), "%sold", prefix);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, history_link_name(event->old_link), first);
+
+    snprintf(key, sizeof(key), "%snew", prefix);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, history_link_name(event->new_link), first);
+
+    snprintf(key, sizeof(key), "%sflags", prefix);
+    snprintf(value, sizeof(value), "0x%x", event->flags);
+    flatjson_send(sock, key, first);
+    flatjson_send(sock, value, first);
+}
+
+// Reply with interface events after the given cursor, oldest first, as
+// <seq>.<field> key and value pairs. The reply starts with the cursor to pass
+// next time, and the number of events lost to the ring wrapping, if any.
+static void handle_events(struct conn* conn, FILE* sock, const struct command* command) {
+    static struct history_event events[HISTORY_LEN];
+    const uint64_t since = (command->n_cursors > 0)? command->cursors[0] : 0;
+    const uint64_t limit = (command->n_cursors > 1)? command->cursors[1] : EVENTS_DEFAULT_LIMIT;
+
+    uint64_t lost;
+    const size_t max = (limit < HISTORY_LEN)? limit : HISTORY_LEN;
+    const size_t n = history_read(&history, since, events, max, &lost);
+    const uint64_t next = (n > 0)? events[n - 1].seq : since + lost;
+
+    char value[32];
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    flatjson_send(sock, "cursor", &first);
+    snprintf(value, sizeof(value), "%" PRIu64, next);
+    flatjson_send(sock, value, &first);
+    if(lost > 0) {
+        flatjson_send(sock, "lost", &first);
+        snprintf(value, sizeof(value), "%" PRIu64, lost);
+        flatjson_send(sock, value, &first);
+    }
+
+    for(size_t i = 0; i < n; i += 1) {
+        char prefix[24];
+        snprintf(prefix, sizeof(prefix), "%" PRIu64 ".", events[i].seq);
+        send_history_event(sock, prefix, &events[i], &first);
+    }
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+// Send each of a subscriber's events as its own line, with the same fields as
+// the events command, starting with "event" rather than "ok" or "error"
+static void send_pushed_event(FILE* sock, const struct history_event* event) {
+    char value[24];
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "event", &first);
+    flatjson_send(sock, "seq", &first);
+    snprintf(value, sizeof(value), "%" PRIu64, event->seq);
+    flatjson_send(sock, value, &first);
+    send_history_event(sock, "", event, &first);
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+// Reply like the events command without the events themselves, which follow
+// as pushed lines, and then keep pushing new events as they happen
+static void handle_subscribe(struct conn* conn, FILE* sock, const struct command* command) {
+    static struct history_event events[HISTORY_LEN];
+    const uint64_t since = (command->n_cursors > 0)? command->cursors[0] : history.next_seq - 1;
+
+    uint64_t lost;
+    const size_t n = history_read(&history, since, events, HISTORY_LEN, &lost);
+
+    char value[24];
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    flatjson_send(sock, "cursor", &first);
+    snprintf(value, sizeof(value), "%" PRIu64, (n > 0)? events[n - 1].seq : since + lost);
+    flatjson_send(sock, value, &first);
+    if(lost > 0) {
+        flatjson_send(sock, "lost", &first);
+        snprintf(value, sizeof(value), "%" PRIu64, lost);
+        flatjson_send(sock, value, &first);
+    }
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+
+    for(size_t i = 0; i < n; i += 1) { send_pushed_event(sock, &events[i]); }
+
+    if(!conn->subscribed) {
+        conn->subscribed = true;
+        LIST_INSERT_HEAD(&subscribers, conn, subscriber_entry);
+    }
+}
+
+static void send_counters(FILE* sock, const char* prefix, const uint64_t values[COUNTER_MAX], const char* suffix, bool* first) {
+    char key[64];
+    char value[24];
+    for(size_t i = 0; i < COUNTER_MAX; i += 1) {
+        snprintf(key, sizeof(key), "%s.%s%s", prefix, counter_name(i), suffix);
+        snprintf(value, sizeof(value), "%" PRIu64, values[i]);
+        flatjson_send(sock, key, first);
+        flatjson_send(sock, value, first);
+    }
+}
+
+// Reply with each interface's traffic counters, as <iface>.<counter> pairs,
+// and their rates per second over the last interval, as
+// <iface>.<counter>_rate pairs. Given an interface, reply with only that one,
+// along with its rates over each earlier interval, as
+// <iface>.<age>.<counter>_rate pairs.
+static void handle_counters(struct conn* conn, FILE* sock, const struct command* command) {
+    if(counters_period == 0) {
+        send_error(sock, "counters disabled");
+        return;
+    }
+
+    const char* name = command->iface.name;
+    size_t begin = 0;
+    size_t end = counters.len;
+    if(name[0] != '\0') {
+        begin = command->iface.ifindex;
+        end = begin + 1;
+        if(counters_get(&counters, begin) == NULL) {
+            send_error(sock, "unknown interface");
+            return;
+        }
+    }
+
+    char value[24];
+    bool first = true;
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &first);
+    flatjson_send(sock, "interval_ms", &first);
+    snprintf(value, sizeof(value), "%" PRIu32, stats.counters_interval);
+    flatjson_send(sock, value, &first);
+
+    for(size_t i = begin; i < end; i += 1) {
+        const struct counters_iface* iface = counters_get(&counters, i);
+        if(iface == NULL) { continue; }
+
+        send_counters(sock, iface->name, counters_sample(iface, 0)->values, "", &first);
+
+        uint64_t rates[COUNTER_MAX];
+        if(counters_rate(iface, 0, rates)) {
+            send_counters(sock, iface->name, rates, "_rate", &first);
+        }
+
+        if(name[0] == '\0') { continue; }
+
+        char prefix[IF_NAMESIZE + 8];
+        for(size_t age = 1; counters_rate(iface, age, rates); age += 1) {
+            snprintf(prefix, sizeof(prefix), "%s.%zu", iface->name, age);
+            send_counters(sock, prefix, rates, "_rate", &first);
+        }
+    }
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+static void handle_cancel(struct conn* conn, FILE* sock, const struct command* command) {
+    const struct payload_job job = {command->job};
+    char msg[64];
+    service_send(&service_exec_ibuf, EXEC_CANCEL, &job, sizeof(job));
+    int32_t result = service_pop(&service_exec_ibuf, msg, sizeof(msg));
+    if(result == EXEC_RESPONSE_OK) {
+        flatjson_send_singleton(sock, "ok");
+        fputs("\n", sock);
+    } else {
+        send_error(sock, msg);
+    }
+}
+
+static void send_stat(void* ctx, const char* key, const char* value) {
+    struct stats_reply* reply = ctx;
+    flatjson_send(reply->sock, key, &reply->first);
+    flatjson_send(reply->sock, value, &reply->first);
+}
+
+static void print_stat(void* ctx, const char* key, const char* value) {
+    fprintf((FILE*)ctx, "%s %s\n", key, value);
+}
+
+static bool fetch_spawn_stats(struct spawn_stats* spawn) {
+    size_t len;
+    service_send(&service_exec_ibuf, EXEC_STATS, NULL, 0);
+    int32_t result = service_pop_data(&service_exec_ibuf, spawn, sizeof(*spawn), &len);
+    return result == EXEC_RESPONSE_OK && len == sizeof(*spawn);
+}
+
+static void handle_stats(struct conn* conn, FILE* sock, const struct command* command) {
+    static struct spawn_stats spawn;
+    const bool have_spawn = fetch_spawn_stats(&spawn);
+
+    struct stats_reply reply = {sock, true};
+    flatjson_start_send(sock);
+    flatjson_send(sock, "ok", &reply.first);
+    stats_foreach(&stats, have_spawn? &spawn : NULL, send_stat, &reply);
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+static void dump_stats(void) {
+    static struct spawn_stats spawn;
+    current_request = next_request++;
+    const bool have_spawn = fetch_spawn_stats(&spawn);
+    stats_foreach(&stats, have_spawn? &spawn : NULL, print_stat, stderr);
+}
+
+#ifdef TRACE
+static size_t fetch_trace(struct imsgbuf* ibuf,
+                          u_int32_t type,
+                          int32_t ok,
+                          struct trace_record* records) {
+    size_t len;
+    service_send(ibuf, type, NULL, 0);
+    int32_t result = service_pop_data(ibuf, records, sizeof(*records) * TRACE_RING_LEN, &len);
+    if(result != ok) {
+        warn("Failed to fetch service trace");
+        return 0;
+    }
+
+    return len / sizeof(*records);
+}
+
+static int compare_trace_records(const void* a, const void* b) {
+    const struct trace_record* ra = a;
+    const struct trace_record* rb = b;
+    if(ra->timestamp == rb->timestamp) { return 0; }
+    return (ra->timestamp < rb->timestamp)? -1 : 1;
+}
+#endif
+
+// Reply with every recorded trace point from all four processes, merged
+// into a single timeline. Each element is a Chrome trace event object.
+static void handle_trace_dump(struct conn* conn, FILE* sock, const struct command* command) {
+    bool first = true;
+    flatjson_start_send(sock);
+
+#ifdef TRACE
+    static struct trace_record records[TRACE_PROCESS_MAX * TRACE_RING_LEN];
+    size_t n = trace_copy(records, TRACE_RING_LEN);
+    n += fetch_trace(&service_exec_ibuf, EXEC_TRACE_DUMP, EXEC_RESPONSE_OK, records + n);
+    n += fetch_trace(&service_write_ibuf, WRITE_TRACE_DUMP, WRITE_RESPONSE_OK, records + n);
+    n += fetch_trace(&service_ifconfig_ibuf, IFCONFIG_TRACE_DUMP, IFCONFIG_RESPONSE_OK, records + n);
+    qsort(records, n, sizeof(records[0]), compare_trace_records);
+
+    char rendered[200];
+    flatjson_send(sock, "ok", &first);
+    for(int i = 0; i < TRACE_PROCESS_MAX; i += 1) {
+        trace_render_process(i, rendered, sizeof(rendered));
+        flatjson_send(sock, rendered, &first);
+    }
+
+    for(size_t i = 0; i < n; i += 1) {
+        if(trace_render(&records[i], rendered, sizeof(rendered)) == 0) {
+            flatjson_send(sock, rendered, &first);
+        }
+    }
+#else
+    flatjson_send(sock, "error", &first);
+    flatjson_send(sock, "tracing disabled", &first);
+#endif
+
+    flatjson_finish_send(sock);
+    fputs("\n", sock);
+}
+
+static struct user* user_get(uid_t uid) {
+    for(struct user* user = users; user != NULL; user = user->next) {
+        if(user->uid == uid) { return user; }
+    }
+
+    struct user* user = calloc(1, sizeof(struct user));
+    if(user == NULL) { die("Failed to allocate user"); }
+    user->uid = uid;
+    bucket_init(&user->bucket, &stats.user_limit, now_usec());
+    user->next = users;
+    users = user;
+    return user;
+}
 
-    rtfilter = RTABLE_ANY;
-    setsockopt(rt_fd, PF_ROUTE, ROUTE_TABLEFILTER, &rtfilter, sizeof(rtfilter));
+// Push back the connection's idle deadline
+static void conn_touch(struct conn* conn) {
+    if(stats.idle_timeout == 0) { return; }
 
-    return rt_fd;
+    wheel_schedule(&idle_wheel, &conn->idle, now_usec() / 1000000 + stats.idle_timeout);
 }
 
-void spawn_service(struct imsgbuf* ibuf, void(*f)(struct imsgbuf*)) {
-    struct imsgbuf child_ibuf;
-    int fds[2];
-    if(socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, fds) == -1) {
-        die("Failed to set up socketpair");
+static struct conn* conn_open(int fd) {
+    struct conn* conn = calloc(1, sizeof(struct conn));
+    if(conn == NULL) { die("Failed to allocate connection"); }
+    conn->fd = fd;
+
+    uid_t uid;
+    gid_t gid;
+    if(getpeereid(fd, &uid, &gid) == -1) {
+        warn("Failed to get peer credentials");
+        uid = (uid_t)-1;
     }
 
-    switch(fork()) {
-      case -1: die("Failed to fork service"); break;
-      case 0:
-        // Child
-        close(fds[0]);
-        imsg_init(&child_ibuf, fds[1]);
-        f(&child_ibuf);
-        exit(0);
-      default:
-        // Parent
-        close(fds[1]);
-        imsg_init(ibuf, fds[0]);
-        break;
+    conn->user = user_get(uid);
+    bucket_init(&conn->bucket, &stats.conn_limit, now_usec());
+    conn->idle.owner = conn;
+    conn_touch(conn);
+
+    stats.connections_current += 1;
+    stats.connections_total += 1;
+    return conn;
+}
+
+static void conn_close(struct conn* conn) {
+    if(conn->closed) { return; }
+
+    hist_record(&stats.conn_bytes_in, conn->bytes_in);
+    hist_record(&stats.conn_bytes_out, conn->bytes_out);
+    stats.connections_current -= 1;
+
+    if(conn->ready) {
+        TAILQ_REMOVE(&ready_conns, conn, ready_entry);
+        conn->ready = false;
+    }
+    if(conn->subscribed) {
+        LIST_REMOVE(conn, subscriber_entry);
+        conn->subscribed = false;
     }
+    wheel_cancel(&idle_wheel, &conn->idle);
+
+    evloop_del_fd(kq, conn->fd);
+    close(conn->fd);
+    free(conn->out);
+    conn->out = NULL;
+    conn->out_len = 0;
+    conn->closed = true;
+    conn->next_closed = closed_conns;
+    closed_conns = conn;
 }
 
-void service_send(struct imsgbuf* ibuf, u_int32_t type, const char* msg) {
-    const size_t msg_len = (msg == NULL)? 0 : (strlen(msg) + 1);
-    imsg_compose(ibuf, type, 0, 0, -1, msg, msg_len);
-    imsg_flush(ibuf);
+// The connection's idle deadline has passed
+static void conn_expire(void* owner) {
+    struct conn* conn = owner;
+
+    // A command waiting on a job is covered by the job's own deadline, and
+    // subscribers wait on events by design
+    if(conn->pending != NULL || conn->subscribed) {
+        conn_touch(conn);
+        return;
+    }
+
+    stats.connections_reaped += 1;
+    conn_close(conn);
 }
 
-int32_t service_pop(struct imsgbuf* ibuf, char* buf, size_t buf_len) {
-    if(buf != NULL) { buf[0] = '\0'; }
+// Turn away a connection that we have no room for
+static void conn_reject(int fd) {
+    static const char msg[] = "[\"error\", \"too many connections\"]\n";
+    write(fd, msg, sizeof(msg) - 1);
+    close(fd);
+    stats.connections_rejected += 1;
+}
+
+// Accept every connection waiting on the listening socket
+static void accept_all(int sockfd) {
+    while(1) {
+        const int fd = accept(sockfd, NULL, NULL);
+        if(fd == -1) {
+            if(errno == EINTR || errno == ECONNABORTED) { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+
+            stats.accept_errors += 1;
+            if((errno != EMFILE && errno != ENFILE) || reserve_fd < 0) {
+                warn("Error accepting connection");
+                return;
+            }
 
-    int n = imsg_read(ibuf);
-    if(n < 0) { die("Error reading"); }
-    if(n == 0) { return -1; }
+            // Otherwise the connection would wake us up forever. Running out
+            // can also be reported when nothing is waiting to be accepted.
+            close(reserve_fd);
+            const int rejected = accept(sockfd, NULL, NULL);
+            if(rejected >= 0) { conn_reject(rejected); }
+            reserve_fd = dup(sockfd);
+            if(rejected < 0) { return; }
+            continue;
+        }
 
-    struct imsg imsg;
-    n = imsg_get(ibuf, &imsg);
-    if(n <= 0) { die("Got no message"); }
+        TRACE_POINT(TRACE_ACCEPT, 0);
+        if(stats.connections_max > 0 && stats.connections_current >= stats.connections_max) {
+            conn_reject(fd);
+            continue;
+        }
 
-    if(buf != NULL && imsg.data != NULL) {
-        // We should only ever pass strings, but just to be safe, always
-        // make sure that the buffer we return is nul-terminated.
-        const size_t data_len = imsg.hdr.len - IMSG_HEADER_SIZE;
-        strlcpy(buf, imsg.data, min(buf_len, data_len));
+        if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            die("Error changing to non-blocking mode");
+        }
+
+        evloop_add_read(kq, fd, conn_open(fd));
     }
+}
 
-    u_int32_t type = imsg.hdr.type;
-    imsg_free(&imsg);
-    return type;
+static void conn_free_closed(void) {
+    while(closed_conns != NULL) {
+        struct conn* next = closed_conns->next_closed;
+
+        // A job's reply has nowhere to go, but the job still runs to the end
+        if(closed_conns->pending != NULL) { closed_conns->pending->conn = NULL; }
+        free(closed_conns);
+        closed_conns = next;
+    }
 }
 
-int list_pseudo_classes(char* buf, size_t buf_len) {
-    buf[0] = '\0';
-    service_send(&service_exec_ibuf, EXEC_IFCONFIG_LIST_PSEUDO_INTERFACES, NULL);
-    int32_t result = service_pop(&service_exec_ibuf, buf, buf_len);
-    if(result != EXEC_RESPONSE_OK) {
-        return 1;
+static void conn_watch_write(struct conn* conn, bool watch_write) {
+    if(conn->watching_write == watch_write) { return; }
+
+    if(watch_write) {
+        evloop_add_write(kq, conn->fd, conn);
+    } else {
+        evloop_del_write(kq, conn->fd);
     }
 
-    return 0;
+    conn->watching_write = watch_write;
 }
 
-void drop_permissions(const char* username) {
-    struct passwd* passwd = getpwnam(username);
-    if(passwd == NULL) { die("Failed to get user information"); }
-    struct group* group = getgrnam(username);
-    if(group == NULL) { die("Failed to get group information"); }
+// Write as much of the given data as the socket will accept. Returns the
+// number of bytes written, or -1 if the connection was closed.
+static ssize_t conn_send(struct conn* conn, const char* buf, size_t len) {
+    size_t written = 0;
+    while(written < len) {
+        ssize_t n = write(conn->fd, buf + written, len - written);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN) { break; }
+            conn_close(conn);
+            return -1;
+        }
 
-    if(chroot("/var/empty") != 0) { die("Failed to chroot"); }
-    if(chdir("/") != 0) { die("Failed to chdir"); }
+        conn->bytes_out += n;
+        stats.bytes_out += n;
+        written += n;
+    }
 
-    if(setgroups(0, NULL) == -1) { die("Failed to set supplementary groups"); }
-    if(setgid(group->gr_gid) == -1) { die("Failed to set group"); }
-    if(setuid(passwd->pw_uid) == -1) { die("Failed to set user"); }
+    return written;
+}
+
+static void conn_flush(struct conn* conn) {
+    const ssize_t n = conn_send(conn, conn->out, conn->out_len);
+    if(n < 0) { return; }
+
+    conn->out_len -= n;
+    memmove(conn->out, conn->out + n, conn->out_len);
+    conn_watch_write(conn, conn->out_len > 0);
+
+    if(conn->out_len == 0 && conn->eof && conn->pending == NULL && !conn->ready) {
+        conn_close(conn);
+    }
+}
+
+// Queue data until the socket is writable
+static void conn_queue(struct conn* conn, const char* buf, size_t len) {
+    if(len == 0) { return; }
 
-    pledge("stdio unix", NULL);
+    char* out = realloc(conn->out, conn->out_len + len);
+    if(out == NULL) { die("Failed to allocate output buffer"); }
+    memcpy(out + conn->out_len, buf, len);
+    conn->out = out;
+    conn->out_len += len;
+    conn_watch_write(conn, true);
 }
 
-void handle_list(FILE* sock, bool details) {
-    char pseudo_classes[PSEUDO_CLASSES_LEN];
-    if(list_pseudo_classes(pseudo_classes, sizeof(pseudo_classes))) {
-        die("Failed to enumerate pseudo classes");
+static void conn_write(struct conn* conn, const char* buf, size_t len) {
+    if(conn->closed) { return; }
+
+    if(conn->out_len == 0) {
+        const ssize_t n = conn_send(conn, buf, len);
+        if(n < 0) { return; }
+        buf += n;
+        len -= n;
     }
 
-    char* output_text = malloc(1024 * 1024);
-    if(output_text == NULL) { die("Allocating output buffer failed"); }
+    // The socket is full, so queue whatever is left
+    conn_queue(conn, buf, len);
+}
 
-    service_send(&service_exec_ibuf, EXEC_IFCONFIG_LIST_INTERFACES, NULL);
-    int32_t result = service_pop(&service_exec_ibuf, output_text, 1024 * 1024);
-    if(result != EXEC_RESPONSE_OK) {
-        flatjson_send_singleton(sock, "error");
-        fputs("\n", sock);
-        free(output_text);
+// Write several buffers in turn, with as few system calls as the socket
+// allows. The buffers are adjusted past whatever was written.
+static void conn_writev(struct conn* conn, struct iovec* iov, size_t n) {
+    if(conn->closed) { return; }
+
+    size_t i = 0;
+    while(conn->out_len == 0 && i < n) {
+        const ssize_t written = writev(conn->fd, iov + i, min(n - i, IOV_MAX));
+        if(written < 0) {
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN) { break; }
+            conn_close(conn);
+            return;
+        }
+
+        conn->bytes_out += written;
+        stats.bytes_out += written;
+
+        size_t left = written;
+        while(i < n && left >= iov[i].iov_len) {
+            left -= iov[i].iov_len;
+            i += 1;
+        }
+
+        if(i < n) {
+            iov[i].iov_base = (char*)iov[i].iov_base + left;
+            iov[i].iov_len -= left;
+        }
+    }
+
+    for(; i < n; i += 1) { conn_queue(conn, iov[i].iov_base, iov[i].iov_len); }
+}
+
+// Write a reply, followed by any fragments gathered for it, and forget them
+static void reply_write(struct conn* conn, char* reply, size_t reply_len) {
+    if(gather_len == 0) {
+        conn_write(conn, reply, reply_len);
         return;
     }
 
-    bool first_message = true;
-    flatjson_start_send(sock);
-    flatjson_send(sock, "ok", &first_message);
+    gather[0].iov_base = reply;
+    gather[0].iov_len = reply_len;
+    conn_writev(conn, gather, gather_len + 1);
+    gather_reset();
+}
 
-    char* cursor;
-    char iface[IF_NAMESIZE];
-    bool skipping = false;
-    while((cursor = strsep(&output_text, "\n")) != NULL) {
-        char rendered[IF_NAMESIZE + 10];
-        char key[IFCONFIG_KEY_LEN];
-        char flags[FLAGS_LEN];
-        int mtu;
-        if(parse_ifconfig_header(cursor, iface, flags, &mtu)) {
-            if(iface_is_pseudo(iface, pseudo_classes)) {
-                skipping = true;
-                continue;
-            } else {
-                if(!details) {
-                    flatjson_send(sock, iface, &first_message);
-                    continue;
-                }
-                skipping = false;
-            }
+// The client will send nothing more. Close once all replies are written.
+static void conn_eof(struct conn* conn) {
+    if(conn->closed) { return; }
 
-            snprintf(rendered, sizeof(rendered), "%s.flags", iface);
-            flatjson_send(sock, rendered, &first_message);
-            flatjson_send(sock, flags, &first_message);
-            snprintf(rendered, sizeof(rendered), "%s.mtu", iface);
-            flatjson_send(sock, rendered, &first_message);
-            snprintf(rendered, sizeof(rendered), "%d", mtu);
-            flatjson_send(sock, rendered, &first_message);
-            continue;
-        }
+    evloop_del_read(kq, conn->fd);
+    conn->eof = true;
+    if(conn->out_len == 0 && conn->pending == NULL && !conn->ready) { conn_close(conn); }
+}
 
-        if(!skipping && details && parse_ifconfig_kv(cursor, key, flags)) {
-            snprintf(rendered, sizeof(rendered), "%s.%s", iface, key);
-            flatjson_send(sock, rendered, &first_message);
-            flatjson_send(sock, flags, &first_message);
+// Refuse a command that would exceed the client's rate limits. The user's
+// limit is checked first, so that a refused command costs the connection
+// nothing.
+static bool conn_admit(struct conn* conn, uint64_t now) {
+    if(!bucket_ready(&conn->bucket, &stats.conn_limit, now)) {
+        stats.busy_conn += 1;
+    } else if(!bucket_take(&conn->user->bucket, &stats.user_limit, now)) {
+        stats.busy_user += 1;
+    } else {
+        bucket_take(&conn->bucket, &stats.conn_limit, now);
+        return true;
+    }
+
+    conn_write(conn, "[\"error\", \"busy\"]\n", 18);
+    return false;
+}
+
+typedef void (*command_handler)(struct conn*, FILE*, const struct command*);
+
+static const command_handler handlers[STATS_CMD_MAX] = {
+    [STATS_CMD_LIST] = handle_list,
+    [STATS_CMD_CONFIGURE] = handle_configure,
+    [STATS_CMD_CONNECT] = handle_connect,
+    [STATS_CMD_DISCONNECT] = handle_disconnect,
+    [STATS_CMD_STATS] = handle_stats,
+    [STATS_CMD_TRACE_DUMP] = handle_trace_dump,
+    [STATS_CMD_JOBS] = handle_jobs,
+    [STATS_CMD_CANCEL] = handle_cancel,
+    [STATS_CMD_EVENTS] = handle_events,
+    [STATS_CMD_COUNTERS] = handle_counters,
+    [STATS_CMD_SUBSCRIBE] = handle_subscribe,
+    [STATS_CMD_SCAN] = handle_scan,
+    [STATS_CMD_LOOKUP] = handle_lookup
+};
+
+static void handle_command(struct conn* conn, char* line) {
+    // Ignore blank lines
+    if(line[strspn(line, " \t\r")] == '\0') { return; }
+
+    const uint64_t start = now_usec();
+    if(!conn_admit(conn, start)) { return; }
+
+    char* reply = NULL;
+    size_t reply_len = 0;
+    FILE* f = open_memstream(&reply, &reply_len);
+    if(f == NULL) { die("Failed to open reply buffer"); }
+
+    current_request = next_request++;
+    TRACE_POINT(TRACE_PARSE, current_request);
+
+    static struct command command;
+    const char* error = command_parse(chomp(line), &command);
+    const enum stats_command cmd = (command.spec != NULL)? command.spec->cmd : STATS_CMD_UNKNOWN;
+    TRACE_POINT(TRACE_DISPATCH, current_request);
+    if(error != NULL) {
+        if(command.spec == NULL) { warn("Unknown command"); }
+        send_error(f, error);
+    } else {
+        if(command.iface.name[0] != '\0') {
+            command.iface.ifindex = iftable_lookup(&ifaces, command.iface.name);
         }
+
+        handlers[cmd](conn, f, &command);
     }
 
-    flatjson_finish_send(sock);
-    fprintf(sock, "\n");
-    free(output_text);
+    fclose(f);
+
+    // Replies from service_exec are written once the job finishes
+    if(conn->pending != NULL) {
+        conn->pending->cmd = cmd;
+        conn->pending->start = start;
+        free(reply);
+        return;
+    }
+
+    reply_write(conn, reply, reply_len);
+    TRACE_POINT(TRACE_REPLY_FLUSH, current_request);
+    free(reply);
+    hist_record(&stats.commands[cmd], now_usec() - start);
 }
 
-void handle_configure(FILE* sock, const char* args) {
-    service_send(&service_write_ibuf, WRITE_WRITE, args);
-    int32_t result = service_pop(&service_write_ibuf, NULL, 0);
-    if(result == WRITE_RESPONSE_OK) {
-        flatjson_send_singleton(sock, "ok");
+// Return true if a complete command line has been read from a client
+static bool conn_has_line(const struct conn* conn) {
+    return memchr(conn->in, '\n', conn->in_len) != NULL;
+}
+
+// Handle the first complete command line read from a client. A line with a
+// NUL in it is refused rather than cut short.
+static void conn_next(struct conn* conn) {
+    char* newline = memchr(conn->in, '\n', conn->in_len);
+    if(newline == NULL) { return; }
+
+    *newline = '\0';
+    if(conn->discarding) {
+        conn->discarding = false;
+    } else if(memchr(conn->in, '\0', newline - conn->in) != NULL) {
+        warn("Command contains NUL");
+        conn_write(conn, "[\"error\"]\n", 10);
     } else {
-        flatjson_send_singleton(sock, "error");
+        handle_command(conn, conn->in);
     }
 
-    fputs("\n", sock);
+    if(conn->closed) { return; }
+
+    conn->in_len -= newline + 1 - conn->in;
+    memmove(conn->in, newline + 1, conn->in_len + 1);
 }
 
-void handle_connect(FILE* sock, const char* args) {
-    // Attempt to autoconfigure, if there is no current configuration
-    service_send(&service_write_ibuf, WRITE_AUTOCONFIGURE, args);
-    service_pop(&service_write_ibuf, NULL, 0);
-    
-    service_send(&service_exec_ibuf, EXEC_NETSTART, args);
-    int32_t result = service_pop(&service_exec_ibuf, NULL, 0);
-    if(result == EXEC_RESPONSE_OK) {
-        flatjson_send_singleton(sock, "ok");
+// Queue a connection's commands to be handled in turn with everyone else's
+static void conn_schedule(struct conn* conn) {
+    if(conn->ready) { return; }
+
+    TAILQ_INSERT_TAIL(&ready_conns, conn, ready_entry);
+    conn->ready = true;
+}
+
+// Every command read so far has been handled. Read more, or close if the
+// client has hung up and has nothing left to be written.
+static void conn_wait(struct conn* conn) {
+    if(!conn->eof) {
+        evloop_add_read(kq, conn->fd, conn);
+    } else if(conn->out_len == 0) {
+        conn_close(conn);
+    }
+}
+
+// The command that the connection was waiting on has been answered. Carry on
+// with any that arrived in the meantime, and then resume reading.
+static void conn_resume(struct conn* conn) {
+    conn->pending = NULL;
+    if(conn->closed) { return; }
+
+    conn_touch(conn);
+    if(conn_has_line(conn)) {
+        conn_schedule(conn);
     } else {
-        flatjson_send_singleton(sock, "error");
+        conn_wait(conn);
     }
+}
 
-    fputs("\n", sock);
+// Handle one command from each waiting connection in turn, so that a client
+// pipelining many commands cannot hold up the others. Returns true if
+// commands are still waiting after SCHED_BATCH of them.
+static bool sched_run(void) {
+    for(size_t i = 0; i < SCHED_BATCH && !TAILQ_EMPTY(&ready_conns); i += 1) {
+        struct conn* conn = TAILQ_FIRST(&ready_conns);
+        TAILQ_REMOVE(&ready_conns, conn, ready_entry);
+        conn->ready = false;
+
+        conn_next(conn);
+        if(conn->closed || conn->pending != NULL) { continue; }
+
+        if(conn_has_line(conn)) {
+            conn_schedule(conn);
+        } else {
+            conn_wait(conn);
+        }
+    }
+
+    return !TAILQ_EMPTY(&ready_conns);
+}
+
+// Read from a client until a complete command line arrives, and queue it to
+// be handled. Returns false once the client has hung up.
+bool handle(struct conn* conn) {
+    while(!conn->closed) {
+        const size_t space = sizeof(conn->in) - conn->in_len - 1;
+        const ssize_t n_read = read(conn->fd, conn->in + conn->in_len, space);
+        if(n_read < 0) { return errno == EAGAIN || errno == EINTR; }
+        if(n_read == 0) { return false; }
+
+        conn->bytes_in += n_read;
+        stats.bytes_in += n_read;
+        conn->in_len += n_read;
+        conn->in[conn->in_len] = '\0';
+
+        if(memchr(conn->in + conn->in_len - n_read, '\n', n_read) != NULL) {
+            conn_touch(conn);
+            evloop_del_read(kq, conn->fd);
+            conn_schedule(conn);
+            return true;
+        }
+
+        // Drop the rest of any command too long for our buffer
+        if(conn->in_len == sizeof(conn->in) - 1) {
+            warn("Command too long");
+            conn->in_len = 0;
+            if(!conn->discarding) { conn_write(conn, "[\"error\"]\n", 10); }
+            conn->discarding = true;
+        }
+    }
+
+    return false;
+}
+
+
+// Record a link event in the history, along with the state it replaced, and
+// bring the interface table up to date
+static void record_link_event(const struct link_event* link, const char* iface) {
+    struct history_event event;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = wall_usec();
+    event.ifindex = link->ifindex;
+    event.flags = link->flags;
+    event.old_link = iftable_link(&ifaces, link->ifindex);
+    event.new_link = link->up? HISTORY_LINK_UP : HISTORY_LINK_DOWN;
+    if(iface != NULL) { strlcpy(event.iface, iface, sizeof(event.iface)); }
+
+    iftable_update(&ifaces, link->ifindex, link->flags, link->mtu, event.new_link);
+    event.seq = history_record(&history, &event);
+    if(LIST_EMPTY(&subscribers)) { return; }
+
+    char* line = NULL;
+    size_t line_len = 0;
+    FILE* f = open_memstream(&line, &line_len);
+    if(f == NULL) { die("Failed to open event buffer"); }
+    send_pushed_event(f, &event);
+    fclose(f);
+
+    // Subscribers that cannot keep up are dropped, and can catch up from
+    // the history when they subscribe again
+    struct conn* next;
+    for(struct conn* conn = LIST_FIRST(&subscribers); conn != NULL; conn = next) {
+        next = LIST_NEXT(conn, subscriber_entry);
+        if(conn->out_len > SUBSCRIBER_BACKLOG) {
+            warn("Dropping slow subscriber");
+            stats.subscribers_dropped += 1;
+            conn_close(conn);
+            continue;
+        }
+
+        conn_write(conn, line, line_len);
+    }
+
+    free(line);
 }
 
-void handle_disconnect(FILE* sock, const char* args) {
-    char iface[IF_NAMESIZE];
-    strlcpy(iface, args, sizeof(iface));
+static bool logevent_complete(struct pending*, FILE*, int32_t, const char*);
+
+// Start logging the oldest link event waiting, unless one is being logged
+static void hwevent_next(void) {
+    if(hwevent_logging || stats.hwevents_queued == 0) { return; }
+
+    current_request = next_request++;
+    hwevent_logging = true;
+    exec_start(NULL, EXEC_LOGEVENT, &hwevents[hwevents_head], sizeof(hwevents[0]), logevent_complete);
+}
 
-    service_send(&service_exec_ibuf, EXEC_IFCONFIG_DOWN, args);
-    int32_t result = service_pop(&service_exec_ibuf, iface, strlen(iface));
+static bool logevent_complete(struct pending* pending, FILE* sock, int32_t result, const char* msg) {
     if(result == EXEC_RESPONSE_OK) {
-        flatjson_send_singleton(sock, "ok");
+        stats.hwevents_logged += 1;
     } else {
-        flatjson_send_singleton(sock, "error");
+        warn("Failed to log iface change");
+        stats.hwevents_failed += 1;
     }
 
-    fputs("\n", sock);
+    hwevents_head = (hwevents_head + 1) % hwevents_cap;
+    stats.hwevents_queued -= 1;
+    hwevent_logging = false;
+    hwevent_next();
+    return true;
 }
 
-void handle(int fd) {
-    char buf[200];
-    ssize_t n_read;
-    while((n_read = read(fd, buf, sizeof(buf))) > 0) {
-        buf[n_read-1] = '\0';
-        
-        char* bufp = buf;
-        char* cursor;
-        while((cursor = strsep(&bufp, "\n")) != NULL) {
-            int fdd = dup(fd);
-            FILE* f = fdopen(fdd, "a");
-
-            char command[20];
-            char const* const remainder = flatjson_next(chomp(buf), command, sizeof(command), NULL);
-            if(strcmp(command, "list") == 0) {
-                handle_list(f, true);
-            } else if(strcmp(command, "configure") == 0) {
-                handle_configure(f, remainder);
-            } else if(strcmp(command, "connect") == 0) {
-                handle_connect(f, remainder);
-            } else if(strcmp(command, "disconnect") == 0) {
-                handle_disconnect(f, remainder);
-            } else {
-                warn("Unknown command");
-            }
-
-            fclose(f);
+// Log a link event to the hardware event log, once those before it have
+// been. However many arrive at once, none are dropped.
+static void log_link_event(const struct link_event* link, const char* iface) {
+    if(stats.hwevents_queued == hwevents_cap) {
+        const size_t cap = (hwevents_cap > 0)? hwevents_cap * 2 : 64;
+        struct payload_logevent* grown = malloc(cap * sizeof(*grown));
+        if(grown == NULL) { die("Failed to allocate hardware events"); }
+        for(size_t i = 0; i < stats.hwevents_queued; i += 1) {
+            grown[i] = hwevents[(hwevents_head + i) % hwevents_cap];
         }
+
+        free(hwevents);
+        hwevents = grown;
+        hwevents_head = 0;
+        hwevents_cap = cap;
     }
+
+    struct payload_logevent* payload = &hwevents[(hwevents_head + stats.hwevents_queued) % hwevents_cap];
+    memset(payload, 0, sizeof(*payload));
+    payload->iface.ifindex = link->ifindex;
+    strlcpy(payload->iface.name, iface, sizeof(payload->iface.name));
+    payload->up = link->up;
+    stats.hwevents_queued += 1;
+    if(stats.hwevents_queued > stats.hwevents_queued_max) { stats.hwevents_queued_max = stats.hwevents_queued; }
+    hwevent_next();
 }
 
 void handle_iface_change(int monitor) {
-    char buf[2048];
-    read(monitor, buf, sizeof(buf));
-    
-    struct rt_msghdr* rtm = (struct rt_msghdr*)&buf;
-    struct if_msghdr ifm;
-    memcpy(&ifm, rtm, sizeof(ifm));
-
-    char iface[IF_NAMESIZE];
-    if(if_indextoname(ifm.ifm_index, iface) == NULL) {
-        warn("Failed to look up iface by index");
-        return;
+    struct link_event events[16];
+    const size_t n_events = monitor_read(monitor, events, 16, &stats.rtmsgs_dropped);
+
+    for(size_t i = 0; i < n_events; i += 1) {
+        // Addresses are among the details that list shows
+        if(events[i].type == LINK_EVENT_ADDRESS || events[i].type == LINK_EVENT_ADDRESS_REMOVED) {
+            iftable_expire_details(&ifaces, events[i].ifindex);
+        }
+
+        if(events[i].type == LINK_EVENT_ADDRESS_REMOVED) {
+            addrindex_remove(&addresses, events[i].ifindex, &events[i].address);
+            stats.rtmsgs_processed += 1;
+            continue;
+        }
+
+        if(events[i].type == LINK_EVENT_ADDRESS) { addrindex_add(&addresses, events[i].ifindex, &events[i].address); }
+        if(events[i].type == LINK_EVENT_ADDRESS || events[i].type == LINK_EVENT_ROUTE) {
+            connect_notify((events[i].type == LINK_EVENT_ADDRESS)? COMMAND_WAIT_ADDRESS : COMMAND_WAIT_ROUTE,
+                           events[i].ifindex);
+            stats.rtmsgs_processed += 1;
+            continue;
+        }
+
+        if(events[i].type == LINK_EVENT_DEPARTURE) {
+            iftable_remove(&ifaces, events[i].ifindex);
+            addrindex_remove_iface(&addresses, events[i].ifindex);
+            stats.rtmsgs_processed += 1;
+            continue;
+        }
+
+        if(events[i].name[0] != '\0') { iftable_set(&ifaces, events[i].ifindex, events[i].name); }
+        if(events[i].type == LINK_EVENT_ARRIVAL) {
+            stats.rtmsgs_processed += 1;
+            continue;
+        }
+
+        const char* iface = iftable_name(&ifaces, events[i].ifindex);
+        record_link_event(&events[i], iface);
+
+        if(iface == NULL) {
+            warn("Failed to look up iface by index");
+            stats.rtmsgs_dropped += 1;
+            continue;
+        }
+
+        stats.rtmsgs_processed += 1;
+        log_link_event(&events[i], iface);
+        if(events[i].up) { connect_notify(COMMAND_WAIT_LINK, events[i].ifindex); }
     }
-    
-    bool up = LINK_STATE_IS_UP(ifm.ifm_data.ifi_link_state);
-    const char* term = up? "up" : "down";
+}
 
-    snprintf(buf, sizeof(buf), "%s %s", term, iface);
-    service_send(&service_exec_ibuf, EXEC_LOGEVENT, buf);
-    int32_t result = service_pop(&service_exec_ibuf, NULL, 0);
-    if(result != EXEC_RESPONSE_OK) {
-        warn("Failed to log iface change");
+// Sample every interface's traffic counters. Whenever a sample takes longer
+// than COUNTERS_BUDGET percent of the interval, the interval is stretched to
+// match, and it returns to the one asked for once sampling is cheap again.
+// Wall time is used, which bounds the CPU time taken from above.
+static void sample_counters(void) {
+    const uint64_t start = now_usec();
+    if(!monitor_counters(&counters)) { stats.counters_failures += 1; }
+    const uint64_t cost = now_usec() - start;
+    hist_record(&stats.counters_sample, cost);
+
+    uint64_t interval = (cost * (100 / COUNTERS_BUDGET) + 999) / 1000;
+    if(interval < counters_period) { interval = counters_period; }
+    if(interval > UINT32_MAX) { interval = UINT32_MAX; }
+
+    if(interval != stats.counters_interval) {
+        stats.counters_interval = interval;
+        evloop_add_timer(kq, TIMER_COUNTERS, interval, false, NULL);
+    }
+}
+
+// Load the snapshot left by the last clean shutdown, if there is one, and
+// bring it up to date with the kernel. Link changes missed while networkd was
+// down are recorded and logged like any other. Otherwise, read the kernel's
+// interfaces from scratch.
+static void warm_start(void) {
+    snapshot_fd = open(PATH_SNAPSHOT, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if(snapshot_fd < 0) { warn("Failed to open snapshot"); }
+
+    struct snapshot_info info;
+    if(snapshot_fd < 0 || !snapshot_load(snapshot_fd, &ifaces, &info)) {
+        if(!monitor_scan(&ifaces)) { die("Failed to read ifaces"); }
         return;
     }
+
+    // Each snapshot is used once, in case the next shutdown is not clean
+    if(ftruncate(snapshot_fd, 0) == -1) { warn("Failed to clear snapshot"); }
+
+    history_resume(&history, info.next_seq);
+    stats.snapshot_ifaces = info.count;
+    const uint64_t now = wall_usec();
+    stats.snapshot_age = (now > info.saved_at)? (now - info.saved_at) / 1000000 : 0;
+
+    struct iftable scanned;
+    iftable_init(&scanned);
+    if(!monitor_scan(&scanned)) { die("Failed to read ifaces"); }
+
+    // Forget interfaces that are gone, or whose index has been reused
+    for(size_t i = 0; i < ifaces.len; i += 1) {
+        const char* name = iftable_name(&ifaces, i);
+        const char* current = iftable_name(&scanned, i);
+        if(name != NULL && (current == NULL || strcmp(name, current) != 0)) { iftable_remove(&ifaces, i); }
+    }
+
+    for(size_t i = 0; i < scanned.len; i += 1) {
+        const char* name = iftable_name(&scanned, i);
+        if(name == NULL) { continue; }
+
+        const bool known = (iftable_name(&ifaces, i) != NULL);
+        iftable_set(&ifaces, i, name);
+        if(ifaces.details[i].len > 0) { ifaces_stale = true; }
+
+        struct link_event link;
+        memset(&link, 0, sizeof(link));
+        link.ifindex = i;
+        link.flags = scanned.flags[i];
+        link.mtu = scanned.mtu[i];
+        link.up = (scanned.link[i] == HISTORY_LINK_UP);
+        if(!known || iftable_link(&ifaces, i) == scanned.link[i]) {
+            iftable_update(&ifaces, i, link.flags, link.mtu, scanned.link[i]);
+            continue;
+        }
+
+        record_link_event(&link, name);
+        log_link_event(&link, name);
+        stats.snapshot_changes += 1;
+    }
+
+    iftable_free(&scanned);
+}
+
+// Save a snapshot for the next start, and exit
+static void shut_down(void) {
+    warn("Shutting down");
+    if(snapshot_fd >= 0 && !snapshot_save(snapshot_fd, &ifaces, history.next_seq)) {
+        warn("Failed to save snapshot");
+    }
+
+    publish_close();
+    cleanup();
+    exit(0);
 }
 
 void serve(const char* sockpath, const char* username) {
     int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
     if(sockfd < 0) { die("Failed to create socket"); }
 
-    struct sockaddr_storage client_addr;
-    socklen_t client_socklen = sizeof(client_addr);
-
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
@@ -305,84 +2141,161 @@ void serve(const char* sockpath, const char* username) {
         die("Failed to set socket permissions");
     }
 
-    struct group* group = getgrnam("network");
-    if(group == NULL) { die("Failed to get network group information"); }
-
-    if(chown(sockpath, 0, group->gr_gid) == -1) {
-        die("Failed to set socket ownership");
+    // Unprivileged instances, such as the benchmark build, can neither hand
+    // the socket to the network group nor drop privileges.
+    const bool privileged = (geteuid() == 0);
+    gid_t network_gid = (gid_t)-1;
+    if(privileged) {
+        struct group* group = getgrnam("network");
+        if(group == NULL) { die("Failed to get network group information"); }
+        network_gid = group->gr_gid;
+
+        if(chown(sockpath, 0, network_gid) == -1) {
+            die("Failed to set socket ownership");
+        }
     }
 
-    int monitor = monitor_ifaces();
+    int monitor = (monitor_fd >= 0)? monitor_fd : monitor_ifaces();
     if(monitor < 0) { die("Failed to monitor ifaces"); }
+    if(!monitor_init()) { die("Failed to read ifaces"); }
+    warm_start();
+    if(!monitor_addresses(&addresses)) { die("Failed to read addresses"); }
+
+    // The file lives outside the chroot, so it is created now and written
+    // through its mapping from then on
+    if(publish_path != NULL) {
+        if(!publish_open(publish_path, network_gid)) { die("Failed to create state file"); }
+        publish_update(&ifaces);
+    }
 
-    drop_permissions(username);
+    if(privileged) {
+        drop_permissions(username);
+    } else {
+        warn("Not running as root; not dropping privileges");
+    }
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
 
-    if(listen(sockfd, 5) == -1) {
+    if(listen(sockfd, stats.listen_backlog) == -1) {
         die("Error listening");
     }
 
-    const int kq = kqueue();
-    if(kq == -1) { die("Failed to create kqueue"); }
-
-    struct kevent event_set[10];
-    struct kevent watch;
-    EV_SET(&watch, sockfd, EVFILT_READ, EV_ADD, 0, 0, NULL);
-    if(kevent(kq, &watch, 1, NULL, 0, NULL) == -1) {
-        die("Failed to add kevent watch");
+    if(fcntl(sockfd, F_SETFL, O_NONBLOCK) < 0) {
+        die("Error changing to non-blocking mode");
     }
 
-    EV_SET(&watch, monitor, EVFILT_READ, EV_ADD, 0, 0, NULL);
-    if(kevent(kq, &watch, 1, NULL, 0, NULL) == -1) {
-        die("Failed to add kevent watch");
-    }    
+    // Any descriptor will do as the reserve
+    reserve_fd = dup(sockfd);
+    if(reserve_fd < 0) { die("Failed to reserve descriptor"); }
+
+    kq = evloop_create();
+    evloop_add_read(kq, sockfd, NULL);
+    evloop_add_read(kq, monitor, NULL);
+    evloop_add_read(kq, service_exec_ibuf.fd, NULL);
+
+    // Dump statistics to stderr on SIGUSR1, and shut down cleanly on SIGINT
+    // and SIGTERM
+    evloop_add_signal(kq, SIGUSR1, NULL);
+    evloop_add_signal(kq, SIGINT, NULL);
+    evloop_add_signal(kq, SIGTERM, NULL);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+
+    wheel_init(&idle_wheel, now_usec() / 1000000);
+    if(stats.idle_timeout > 0) { evloop_add_timer(kq, TIMER_IDLE, 1000, false, NULL); }
+
+    // The first sample starts the timer
+    counters_init(&counters);
+    if(counters_period > 0) { sample_counters(); }
+
+    // List the interfaces from the snapshot afresh in the background
+    if(ifaces_stale) {
+        current_request = next_request++;
+        list_start(NULL, true);
+    }
 
+    struct evloop_event event_set[EVENT_BATCH];
+    bool backlog = false;
     printf("Listening\n");
     while(1) {
-        const int nev = kevent(kq, NULL, 0, event_set, 10, NULL);
+        // Commands left waiting by the scheduler are handled again as soon
+        // as any new I/O has been checked
+        const int nev = evloop_wait(kq, event_set, EVENT_BATCH, backlog? 0 : -1);
 
-        if(nev < 1) { die("Error waiting on kqueue"); }
         for(int i = 0; i < nev; i += 1) {
-            struct kevent* event = &event_set[i];
-            if(event->flags & EV_EOF) {
-               EV_SET(&watch, event->ident, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-               if(kevent(kq, &watch, 1, NULL, 0, NULL) == -1) {
-                   die("Error removing connection from watch");
-               }
-               close(event->ident);
+            struct evloop_event* event = &event_set[i];
+            if(event->filter == EVLOOP_SIGNAL && event->ident == SIGUSR1) {
+                dump_stats();
+            } else if(event->filter == EVLOOP_SIGNAL) {
+                shut_down();
+            } else if(event->filter == EVLOOP_TIMER && event->ident == TIMER_COUNTERS) {
+                sample_counters();
+            } else if(event->filter == EVLOOP_TIMER && event->ident >= TIMER_WAIT_BASE) {
+                connect_timeout(event->ident - TIMER_WAIT_BASE);
+            } else if(event->filter == EVLOOP_TIMER) {
+                wheel_advance(&idle_wheel, now_usec() / 1000000, conn_expire);
+            } else if(event->udata != NULL) {
+                struct conn* conn = event->udata;
+                if(conn->closed) { continue; }
+
+                if(event->filter == EVLOOP_WRITE) {
+                    conn_flush(conn);
+                } else if(!handle(conn) || ((event->flags & EVLOOP_EOF) && conn->pending == NULL && !conn->ready)) {
+                    conn_eof(conn);
+                }
+            } else if((int)event->ident == service_exec_ibuf.fd) {
+                const int n = imsg_read(&service_exec_ibuf);
+                if(n < 0) { die("Error reading from service_exec"); }
+                if(n == 0) { die("service_exec exited"); }
             } else if((int)event->ident == monitor) {
                 handle_iface_change(monitor);
             } else if((int)event->ident == sockfd) {
-                int fd = accept(sockfd, (struct sockaddr*)&client_addr, &client_socklen);
-                if(fd == -1) { die("Error accepting connection"); }
-                if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
-                    die("Error changing to non-blocking mode");
-                }
-
-                EV_SET(&watch, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
-                if(kevent(kq, &watch, 1, NULL, 0, NULL) == -1) {
-                    die("Error adding watch on new connection");
-                }
-            } else {
-                handle((int)event->ident);
+                accept_all(sockfd);
             }
         }
+
+        exec_drain();
+        backlog = sched_run();
+        conn_free_closed();
+        publish_update(&ifaces);
     }
 }
 
+static void default_burst(struct ratelimit* limit) {
+    if(limit->burst > 0) { return; }
+    limit->burst = (limit->rate > UINT32_MAX / DEFAULT_BURST_FACTOR)? UINT32_MAX : limit->rate * DEFAULT_BURST_FACTOR;
+}
+
 void usage(void) {
-    printf("usage: networkd [-s <sockpath>] [-u <user>]\n");
+    printf("usage: networkd [-s <sockpath>] [-u <user>] [-r <rate>] [-b <burst>]\n"
+           "                [-R <rate>] [-B <burst>] [-l <backlog>] [-c <connections>]\n"
+           "                [-t <seconds>] [-i <seconds>] [-m <fd>] [-p <path>]\n");
     exit(1);
 }
 
+static uint32_t parse_limit(const char* arg) {
+    char* end;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if(end == arg || *end != '\0' || value > UINT32_MAX) { usage(); }
+    return value;
+}
+
 int main(int argc, char** argv) {
+#ifdef __OpenBSD__
     // Harden our malloc flags
     extern char *malloc_options;
     malloc_options = "SC";
+#endif
 
     char* sockpath = "/var/run/networkd.sock";
     char* username = "_networkd";
+    stats.conn_limit = (struct ratelimit){DEFAULT_CONN_RATE, 0};
+    stats.user_limit = (struct ratelimit){DEFAULT_USER_RATE, 0};
+    stats.listen_backlog = DEFAULT_BACKLOG;
+    stats.connections_max = DEFAULT_MAX_CONNECTIONS;
+    stats.idle_timeout = DEFAULT_IDLE_TIMEOUT;
     char flag = '\0';
     for(int i = 1; i < argc; i += 1) {
         char* arg = argv[i];
@@ -399,6 +2312,41 @@ int main(int argc, char** argv) {
             case 'u':
                 username = arg;
                 break;
+            case 'r':
+                stats.conn_limit.rate = parse_limit(arg);
+                break;
+            case 'b':
+                stats.conn_limit.burst = parse_limit(arg);
+                break;
+            case 'R':
+                stats.user_limit.rate = parse_limit(arg);
+                break;
+            case 'B':
+                stats.user_limit.burst = parse_limit(arg);
+                break;
+            case 'l':
+                stats.listen_backlog = parse_limit(arg);
+                break;
+            case 'c':
+                stats.connections_max = parse_limit(arg);
+                break;
+            case 't':
+                stats.idle_timeout = parse_limit(arg);
+                break;
+            case 'i':
+                counters_period = parse_limit(arg);
+                if(counters_period > UINT32_MAX / 1000) { usage(); }
+                counters_period *= 1000;
+                break;
+            case 'm': {
+                const uint32_t fd = parse_limit(arg);
+                if(fd > INT_MAX || fcntl(fd, F_GETFD) == -1) { usage(); }
+                monitor_fd = fd;
+                break;
+            }
+            case 'p':
+                publish_path = arg;
+                break;
             default:
                 usage();
                 break;
@@ -409,9 +2357,22 @@ int main(int argc, char** argv) {
 
     if(flag != '\0') { usage(); }
 
+    // A limited bucket must be able to hold at least one command
+    default_burst(&stats.conn_limit);
+    default_burst(&stats.user_limit);
+    if(stats.listen_backlog == 0 || stats.listen_backlog > INT_MAX) { usage(); }
+
+    trace_init(TRACE_PROCESS_PARENT);
+    history_init(&history);
+    iftable_init(&ifaces);
+    scans_init(&scans);
+    addrindex_init(&addresses);
+    fragments_init(&fragments);
+
     // Start child workers for privsep
     spawn_service(&service_exec_ibuf, service_exec);
     spawn_service(&service_write_ibuf, service_write);
+    spawn_service(&service_ifconfig_ibuf, service_ifconfig);
 
     // Main loop
     serve(sockpath, username);
@@ -0,0 +1,32 @@
+#pragma once
+
+// Programs and files used by networkd and its services. Each may be overridden at build
+// time, which the benchmark build uses to substitute stub programs.
+
+#ifndef PATH_IFCONFIG
+#define PATH_IFCONFIG "/sbin/ifconfig"
+#endif
+
+#ifndef PATH_SH
+#define PATH_SH "/bin/sh"
+#endif
+
+#ifndef PATH_NETSTART
+#define PATH_NETSTART "/etc/netstart"
+#endif
+
+#ifndef PATH_LOGHWEVENT
+#define PATH_LOGHWEVENT "/usr/libexec/loghwevent"
+#endif
+
+#ifndef PATH_HOSTNAME_PREFIX
+#define PATH_HOSTNAME_PREFIX "/etc/hostname."
+#endif
+
+#ifndef PATH_SNAPSHOT
+#define PATH_SNAPSHOT "/var/run/networkd.snapshot"
+#endif
+
+#ifndef PATH_LAUNCHER
+#define PATH_LAUNCHER "/usr/local/libexec/networkd-launcher"
+#endif
@@ -0,0 +1,30 @@
+#include <string.h>
+
+#include "payload.h"
+#include "validate.h"
+
+bool payload_get(const void* data, size_t data_len, void* payload, size_t len) {
+    if(data == NULL || data_len != len) { return false; }
+
+    memcpy(payload, data, len);
+    return true;
+}
+
+bool payload_iface_valid(const struct payload_iface* iface) {
+    return memchr(iface->name, '\0', sizeof(iface->name)) != NULL && validate_iface(iface->name);
+}
+
+bool payload_configure_valid(const struct payload_configure* configure) {
+    if(!payload_iface_valid(&configure->iface) || configure->n_stanzas > PAYLOAD_MAX_STANZAS) {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < configure->n_stanzas; i += 1) {
+        const char* stanza = configure->stanzas[i];
+        if(memchr(stanza, '\0', PAYLOAD_STANZA_LEN) == NULL || !validate_stanza(stanza)) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+// Fixed-layout imsg payloads sent from the parent to the services. Commands
+// are parsed and validated once, in the parent, and the services only check
+// that what arrives is well formed before acting on it.
+#define PAYLOAD_MAX_STANZAS 16
+#define PAYLOAD_STANZA_LEN 200
+
+struct payload_iface {
+    // Zero if the parent does not know the interface
+    uint32_t ifindex;
+    char name[IF_NAMESIZE];
+};
+
+// WRITE_WRITE
+struct payload_configure {
+    struct payload_iface iface;
+    uint32_t n_stanzas;
+    char stanzas[PAYLOAD_MAX_STANZAS][PAYLOAD_STANZA_LEN];
+};
+
+// EXEC_LOGEVENT
+struct payload_logevent {
+    struct payload_iface iface;
+    uint8_t up;
+};
+
+// EXEC_CANCEL
+struct payload_job {
+    uint32_t id;
+};
+
+// Copy a payload out of a message, if it is exactly the expected size
+bool payload_get(const void*, size_t, void*, size_t);
+
+// Check that a payload's strings are terminated and valid
+bool payload_iface_valid(const struct payload_iface*);
+bool payload_configure_valid(const struct payload_configure*);
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "prefix.h"
+
+size_t addr_family_bytes(uint8_t family) {
+    return (family == AF_INET)? 4 : ADDR_MAX_BYTES;
+}
+
+bool addr_prefix_parse(const char* text, struct addr_prefix* prefix) {
+    char addr[INET6_ADDRSTRLEN];
+    const char* slash = strchr(text, '/');
+    const size_t addr_len = (slash != NULL)? (size_t)(slash - text) : strlen(text);
+    if(addr_len >= sizeof(addr)) { return false; }
+    memcpy(addr, text, addr_len);
+    addr[addr_len] = '\0';
+
+    memset(prefix, 0, sizeof(*prefix));
+    if(inet_pton(AF_INET, addr, prefix->bytes) == 1) {
+        prefix->family = AF_INET;
+    } else if(inet_pton(AF_INET6, addr, prefix->bytes) == 1) {
+        prefix->family = AF_INET6;
+    } else {
+        return false;
+    }
+
+    const size_t max_len = addr_family_bytes(prefix->family) * 8;
+    prefix->len = max_len;
+    if(slash == NULL) { return true; }
+
+    // Plain decimal, without signs or leading zeros
+    const char* len_text = slash + 1;
+    size_t len = 0;
+    if(len_text[0] == '\0' || (len_text[0] == '0' && len_text[1] != '\0')) { return false; }
+    for(const char* c = len_text; *c != '\0'; c += 1) {
+        if(*c < '0' || *c > '9') { return false; }
+        len = len * 10 + (*c - '0');
+        if(len > max_len) { return false; }
+    }
+
+    prefix->len = len;
+    return true;
+}
+
+void addr_prefix_format(const struct addr_prefix* prefix, char buf[ADDR_PREFIX_STRLEN]) {
+    char addr[INET6_ADDRSTRLEN];
+    if(inet_ntop(prefix->family, prefix->bytes, addr, sizeof(addr)) == NULL) { addr[0] = '\0'; }
+    snprintf(buf, ADDR_PREFIX_STRLEN, "%s/%u", addr, (unsigned int)prefix->len);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADDR_MAX_BYTES 16
+
+// Long enough for a formatted IPv6 address and prefix length
+#define ADDR_PREFIX_STRLEN 50
+
+struct addr_prefix {
+    // AF_INET or AF_INET6
+    uint8_t family;
+    uint8_t len;
+    uint8_t bytes[ADDR_MAX_BYTES];
+};
+
+// The number of address bytes in a family
+size_t addr_family_bytes(uint8_t family);
+
+// Parse an address with an optional prefix length, such as "10.1.2.3" or
+// "2001:db8::/32". Returns false if it is neither an IPv4 nor an IPv6 one.
+bool addr_prefix_parse(const char*, struct addr_prefix*);
+void addr_prefix_format(const struct addr_prefix*, char buf[ADDR_PREFIX_STRLEN]);
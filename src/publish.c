@@ -0,0 +1,98 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libnetworkd.h"
+#include "publish.h"
+#include "util.h"
+
+static struct networkd_state_segment* segment;
+
+// The table's next_generation when it was last copied. Every change to the
+// table takes a new generation, so an unchanged one means nothing to copy.
+static uint32_t published_generation;
+
+static void* map_file(int fd, gid_t gid, mode_t mode) {
+    if(ftruncate(fd, sizeof(*segment)) == -1) { return NULL; }
+    if(gid != (gid_t)-1 && fchown(fd, 0, gid) == -1) { return NULL; }
+    if(fchmod(fd, mode) == -1) { return NULL; }
+
+    void* map = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (map == MAP_FAILED)? NULL : map;
+}
+
+bool publish_open(const char* path, gid_t gid) {
+    // Readers still mapping an old file keep it, instead of faulting when it
+    // is truncated underneath them
+    char tmp_path[PATH_MAX];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.new", path) >= (int)sizeof(tmp_path)) { return false; }
+    unlink(tmp_path);
+
+    const mode_t mode = (gid == (gid_t)-1)? S_IRUSR|S_IWUSR : S_IRUSR|S_IWUSR|S_IRGRP;
+    const int fd = open(tmp_path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+    if(fd < 0) { return false; }
+
+    struct networkd_state_segment* map = map_file(fd, gid, mode);
+    close(fd);
+    if(map != NULL) {
+        map->magic = NETWORKD_STATE_MAGIC;
+        map->version = NETWORKD_STATE_VERSION;
+    }
+
+    if(map == NULL || rename(tmp_path, path) == -1) {
+        if(map != NULL) { munmap(map, sizeof(*segment)); }
+        unlink(tmp_path);
+        return false;
+    }
+
+    segment = map;
+    published_generation = 0;
+    return true;
+}
+
+void publish_update(const struct iftable* table) {
+    if(segment == NULL || table->next_generation == published_generation) { return; }
+
+    // An odd sequence number tells readers that a copy is under way. The
+    // fence keeps the contents from being written before it is seen.
+    const uint32_t seq = segment->seq;
+    __atomic_store_n(&segment->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    uint32_t count = 0;
+    uint32_t truncated = 0;
+    for(size_t i = 0; i < table->len; i += 1) {
+        const char* name = iftable_name(table, i);
+        if(name == NULL) { continue; }
+        if(count == NETWORKD_STATE_IFACES) {
+            truncated += 1;
+            continue;
+        }
+
+        struct networkd_iface_state* iface = &segment->ifaces[count];
+        iface->ifindex = i;
+        iface->flags = table->flags[i];
+        iface->mtu = table->mtu[i];
+        iface->generation = table->generation[i];
+        iface->link = table->link[i];
+        strlcpy(iface->name, name, sizeof(iface->name));
+        count += 1;
+    }
+
+    segment->count = count;
+    segment->truncated = truncated;
+    segment->updated = wall_usec();
+    __atomic_store_n(&segment->seq, seq + 2, __ATOMIC_RELEASE);
+    published_generation = table->next_generation;
+}
+
+void publish_close(void) {
+    if(segment == NULL) { return; }
+    __atomic_store_n(&segment->closed, 1, __ATOMIC_RELEASE);
+    munmap(segment, sizeof(*segment));
+    segment = NULL;
+}
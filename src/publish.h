@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "iftable.h"
+
+// Publishes the interface table into a file that local readers map, laid out
+// as a struct networkd_state_segment and guarded by its sequence counter.
+// Readers need nothing but read access to the file; see libnetworkd.h.
+
+// Create the file, replacing any left by an earlier run, readable by the
+// given group, or only by its owner if the group is -1. Returns false on
+// failure.
+bool publish_open(const char* path, gid_t);
+
+// Copy the table into the file if it has changed since it was last copied.
+// Does nothing if no file is open.
+void publish_update(const struct iftable*);
+
+// Mark the file as abandoned, so that readers know to stop using it.
+void publish_close(void);
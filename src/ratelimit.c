@@ -0,0 +1,36 @@
+#include "ratelimit.h"
+
+void bucket_init(struct bucket* bucket, const struct ratelimit* limit, uint64_t now) {
+    bucket->tokens = limit->burst * BUCKET_TOKEN;
+    bucket->updated = now;
+}
+
+static void bucket_refill(struct bucket* bucket, const struct ratelimit* limit, uint64_t now) {
+    const uint64_t capacity = limit->burst * BUCKET_TOKEN;
+    const uint64_t elapsed = (now > bucket->updated)? now - bucket->updated : 0;
+    bucket->updated = now;
+
+    // Anything longer than it takes to fill up from empty would overflow
+    if(elapsed >= capacity / limit->rate) {
+        bucket->tokens = capacity;
+        return;
+    }
+
+    bucket->tokens += elapsed * limit->rate;
+    if(bucket->tokens > capacity) { bucket->tokens = capacity; }
+}
+
+bool bucket_ready(struct bucket* bucket, const struct ratelimit* limit, uint64_t now) {
+    if(limit->rate == 0) { return true; }
+
+    bucket_refill(bucket, limit, now);
+    return bucket->tokens >= BUCKET_TOKEN;
+}
+
+bool bucket_take(struct bucket* bucket, const struct ratelimit* limit, uint64_t now) {
+    if(!bucket_ready(bucket, limit, now)) { return false; }
+    if(limit->rate == 0) { return true; }
+
+    bucket->tokens -= BUCKET_TOKEN;
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A token bucket refilled at `rate` tokens per second, holding at most
+// `burst`. A rate of zero means no limit.
+struct ratelimit {
+    uint32_t rate;
+    uint32_t burst;
+};
+
+// Tokens are counted in millionths, so that refilling by the microsecond
+// needs no division.
+#define BUCKET_TOKEN 1000000ULL
+
+struct bucket {
+    uint64_t tokens;
+    uint64_t updated;
+};
+
+// Start a bucket full
+void bucket_init(struct bucket*, const struct ratelimit*, uint64_t);
+
+// Return true if the bucket has a token, without taking it
+bool bucket_ready(struct bucket*, const struct ratelimit*, uint64_t);
+
+// Take a token, returning false if there is none
+bool bucket_take(struct bucket*, const struct ratelimit*, uint64_t);
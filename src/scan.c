@@ -0,0 +1,87 @@
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+#include "util.h"
+
+static bool scan_pat_init;
+static regex_t scan_pat;
+
+void scans_init(struct scans* scans) {
+    scans->head = NULL;
+}
+
+void scans_free(struct scans* scans) {
+    while(scans->head != NULL) {
+        struct scan* next = scans->head->next;
+        free(scans->head);
+        scans->head = next;
+    }
+}
+
+struct scan* scans_get(struct scans* scans, const char* iface) {
+    for(struct scan* scan = scans->head; scan != NULL; scan = scan->next) {
+        if(strcmp(scan->iface, iface) == 0) { return scan; }
+    }
+
+    struct scan* scan = calloc(1, sizeof(struct scan));
+    if(scan == NULL) { die("Failed to allocate scan"); }
+    strlcpy(scan->iface, iface, sizeof(scan->iface));
+    scan->next = scans->head;
+    scans->head = scan;
+    return scan;
+}
+
+void scans_remove(struct scans* scans, struct scan* scan) {
+    struct scan** link = &scans->head;
+    while(*link != scan) { link = &(*link)->next; }
+    *link = scan->next;
+    free(scan);
+}
+
+bool scan_fresh(const struct scan* scan, uint64_t now, uint64_t max_age) {
+    return scan->updated != 0 && now - scan->updated <= max_age;
+}
+
+static void copy_match(const char* text, const regmatch_t* match, char* buf, size_t buf_len) {
+    const size_t value_len = min(buf_len, match->rm_eo - match->rm_so + 1);
+    strlcpy(buf, text + match->rm_so, value_len);
+}
+
+// Networks are listed beneath the interface as, for example:
+//     nwid "home net" chan 6 bssid 00:11:22:33:44:55 -58dBm HT-MCS15 privacy,wpa2
+// with the ID quoted if it has spaces, and in hex if it is not printable.
+bool scan_parse_line(const char* text, struct scan_result* result) {
+    if(!scan_pat_init) {
+        int reti = regcomp(&scan_pat,
+                           "^[ \t]+nwid (\"([^\"]*)\"|[^ \"]+) chan ([0-9]+) bssid ([0-9a-fA-F:]+) (-?[0-9]+dBm|[0-9]+%)( |$)",
+                           REG_EXTENDED);
+        if(reti) { die("Failed to compile scan regex"); }
+        scan_pat_init = true;
+    }
+
+    regmatch_t matches[6];
+    if(regexec(&scan_pat, text, sizeof(matches) / sizeof(regmatch_t), matches, 0) != 0) {
+        return false;
+    }
+
+    if(result == NULL) { return true; }
+
+    const regmatch_t* nwid = (matches[2].rm_so >= 0)? &matches[2] : &matches[1];
+    copy_match(text, nwid, result->nwid, sizeof(result->nwid));
+    copy_match(text, &matches[4], result->bssid, sizeof(result->bssid));
+    copy_match(text, &matches[5], result->signal, sizeof(result->signal));
+    result->chan = strtoul(text + matches[3].rm_so, NULL, 10);
+    return true;
+}
+
+void scan_update(struct scan* scan, char* output, uint64_t now) {
+    scan->n_results = 0;
+    scan->updated = now;
+
+    char* line;
+    while((line = strsep(&output, "\n")) != NULL && scan->n_results < SCAN_MAX_RESULTS) {
+        if(scan_parse_line(line, &scan->results[scan->n_results])) { scan->n_results += 1; }
+    }
+}
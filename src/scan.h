@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+// Wireless scan results, kept per interface so that clients choosing a
+// network can be answered from a recent scan instead of waiting seconds for
+// a new one. At most one scan runs on an interface at a time.
+#define SCAN_MAX_RESULTS 64
+
+// Network IDs are up to 32 bytes, which ifconfig prints in hex if they are
+// not printable
+#define SCAN_NWID_LEN 67
+#define SCAN_BSSID_LEN 18
+#define SCAN_SIGNAL_LEN 12
+
+struct scan_result {
+    char nwid[SCAN_NWID_LEN];
+    char bssid[SCAN_BSSID_LEN];
+    uint32_t chan;
+
+    // As ifconfig gives it: in dBm, such as "-58dBm", or as a percentage
+    char signal[SCAN_SIGNAL_LEN];
+};
+
+struct scan {
+    char iface[IF_NAMESIZE];
+
+    // When the results were last replaced, in now_usec() time, or 0 if
+    // there are none yet
+    uint64_t updated;
+
+    // The request running a scan, or 0 if none is
+    uint32_t request;
+
+    size_t n_results;
+    struct scan_result results[SCAN_MAX_RESULTS];
+
+    struct scan* next;
+};
+
+struct scans {
+    struct scan* head;
+};
+
+void scans_init(struct scans*);
+void scans_free(struct scans*);
+
+// Find an interface's scan, adding an empty one if there is none.
+struct scan* scans_get(struct scans*, const char* iface);
+
+// Forget an interface's scan.
+void scans_remove(struct scans*, struct scan*);
+
+// Whether the results are no older than the given number of microseconds
+bool scan_fresh(const struct scan*, uint64_t now, uint64_t max_age);
+
+// Parse one network from the output of ifconfig <iface> scan. Returns false
+// if the line does not describe one.
+bool scan_parse_line(const char*, struct scan_result*);
+
+// Replace the results with every network in the output of ifconfig <iface>
+// scan, which is consumed.
+void scan_update(struct scan*, char* output, uint64_t now);
@@ -1,147 +1,468 @@
-#include <fcntl.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <spawn.h>
 #include <sys/wait.h>
 
-#include "flatjson.h"
+#include "evloop.h"
+#include "launcher.h"
+#include "paths.h"
+#include "payload.h"
 #include "service_exec.h"
-#include "validate.h"
+#include "stats.h"
+#include "trace.h"
 #include "util.h"
 
-static int run(char* const[], pid_t* pid, bool);
-static int run_and_read(char* const[], char*);
+// A running child process. Jobs are identified by the request that started
+// them, and answered once the child has exited.
+struct job {
+    uint32_t id;
+    char description[EXEC_DESCRIPTION_LEN];
+    uint64_t start;
 
-static int run(char* const commands[], pid_t* pid, bool include_stderr) {
-    if(commands == NULL) { return 0; }
-    if(pid == NULL) { die("Given NULL pid"); }
+    // Output beyond the buffer sizes is read and discarded
+    int out_fd;
+    char* out;
+    size_t out_len;
+    int err_fd;
+    char err[EXEC_STDERR_LEN];
+    size_t err_len;
 
-    int fds[2];
-    if(pipe(fds)) {
-        die("Failed to open pipe");
+    // The signal most recently sent to the child, if any
+    int signal_sent;
+    bool timed_out;
+    bool cancelled;
+    bool finished;
+
+    // Whether the job counts towards EXEC_MAX_JOBS
+    bool budgeted;
+
+    struct job* next;
+};
+
+static struct spawn_stats spawn_stats;
+static struct imsgbuf launcher;
+static int loop = -1;
+static struct job* jobs;
+static size_t n_jobs;
+
+// Jobs finished while handling the current batch of events. They are freed
+// once the batch is done, since later events may still refer to them.
+static struct job* finished_jobs;
+
+static void describe(char* const commands[], char* buf, size_t buf_len) {
+    buf[0] = '\0';
+    for(size_t i = 0; commands[i] != NULL; i += 1) {
+        if(i > 0) { strlcat(buf, " ", buf_len); }
+        strlcat(buf, commands[i], buf_len);
     }
+}
 
-    posix_spawn_file_actions_t action;
-    posix_spawn_file_actions_init(&action);
-    posix_spawn_file_actions_addclose(&action, fds[0]);
-    posix_spawn_file_actions_adddup2(&action, fds[1], 1);
-    posix_spawn_file_actions_addclose(&action, fds[1]);
+static void reply(struct imsgbuf* ibuf, int32_t status, uint32_t request, const char* msg) {
+    TRACE_POINT(TRACE_IMSG_SEND, request);
+    imsg_compose(ibuf, status, request, 0, -1, msg, strlen(msg) + 1);
+    imsg_flush(ibuf);
+}
 
-    if(include_stderr) {
-        posix_spawn_file_actions_adddup2(&action, 1, 2);
+static void launcher_send(uint32_t type, uint32_t id, const void* data, size_t len) {
+    if(imsg_compose(&launcher, type, id, 0, -1, data, len) == -1 ||
+       imsg_flush(&launcher) == -1) {
+        die("Error writing to launcher");
     }
+}
 
-    int status = posix_spawn(pid, commands[0],
-                             &action,
-                             NULL,
-                             commands,
-                             NULL);
-    if(status != 0) {
-        die("Failed to spawn process");
+static void job_signal(struct job* job, int signo) {
+    // The launcher signals the whole process group
+    launcher_send(LAUNCHER_SIGNAL, job->id, &signo, sizeof(signo));
+    job->signal_sent = signo;
+
+    if(signo == SIGTERM) {
+        evloop_add_timer(loop, job->id, EXEC_KILL_GRACE, true, job);
     }
-    close(fds[1]);
+}
 
-    return fds[0];
+// Read whatever is available from one of the job's pipes. Returns false once
+// the write end has been closed.
+static bool job_read(struct job* job, int fd) {
+    char discard[4096];
+    while(1) {
+        char* buf = discard;
+        size_t space = sizeof(discard);
+        size_t* len = NULL;
+        if(fd == job->out_fd && job->out_len < EXEC_BUF_LEN - 1) {
+            buf = job->out + job->out_len;
+            space = EXEC_BUF_LEN - 1 - job->out_len;
+            len = &job->out_len;
+        } else if(fd == job->err_fd && job->err_len < EXEC_STDERR_LEN - 1) {
+            buf = job->err + job->err_len;
+            space = EXEC_STDERR_LEN - 1 - job->err_len;
+            len = &job->err_len;
+        }
+
+        const ssize_t n = read(fd, buf, space);
+        if(n < 0) { return errno == EAGAIN || errno == EINTR; }
+        if(n == 0) { return false; }
+        if(len != NULL) { *len += n; }
+    }
+}
+
+static void job_close_pipe(int* fd) {
+    if(*fd < 0) { return; }
+    evloop_del_fd(loop, *fd);
+    close(*fd);
+    *fd = -1;
+}
+
+// Unlink a job, to be freed once the current batch of events is done
+static void job_free(struct job* job) {
+    struct job** link = &jobs;
+    while(*link != job) { link = &(*link)->next; }
+    *link = job->next;
+    if(job->budgeted) { n_jobs -= 1; }
+
+    job->finished = true;
+    job->next = finished_jobs;
+    finished_jobs = job;
 }
 
-static int run_and_read(char* const commands[], char* buf) {
-    if(buf == NULL) { die("Got null buffer"); }
-    pid_t pid;
-    int status;
+static void job_finish(struct imsgbuf* ibuf, struct job* job, int status) {
+    TRACE_POINT(TRACE_CHILD_EXIT, job->id);
+
+    // Anything the child wrote before exiting is still in the pipes. A
+    // background grandchild may hold them open, so don't wait for EOF.
+    job_read(job, job->out_fd);
+    job_read(job, job->err_fd);
+    job_close_pipe(&job->out_fd);
+    job_close_pipe(&job->err_fd);
+    evloop_del_timer(loop, job->id);
 
-    int fd = run(commands, &pid, false);
-    FILE* f = fdopen(fd, "r");
-    if(f == NULL) {
-        close(fd);
-        waitpid(pid, NULL, 0);
-        die("Failed to open read pipe");
+    hist_record(&spawn_stats.duration, now_usec() - job->start);
+    if(job->timed_out) { spawn_stats.timeouts += 1; }
+    if(job->cancelled) { spawn_stats.cancellations += 1; }
+
+    const bool ok = (status == 0) && !job->timed_out && !job->cancelled;
+    if(!ok) { spawn_stats.failures += 1; }
+
+    job->out[job->out_len] = '\0';
+    for(size_t i = 0; i < job->out_len; i += EXEC_CHUNK_LEN) {
+        const size_t len = min(EXEC_CHUNK_LEN, job->out_len - i);
+        imsg_compose(ibuf, EXEC_RESPONSE_DATA, job->id, 0, -1, job->out + i, len);
+        imsg_flush(ibuf);
     }
 
-    ssize_t n_read = fread(buf, 1, EXEC_BUF_LEN-1, f);
-    buf[n_read] = '\0';
+    // Errors carry a short explanation, preferring what the child said
+    char msg[EXEC_STDERR_LEN];
+    msg[0] = '\0';
+    if(job->timed_out) {
+        strlcpy(msg, "timed out", sizeof(msg));
+    } else if(job->cancelled) {
+        strlcpy(msg, "cancelled", sizeof(msg));
+    } else if(!ok && job->err_len > 0) {
+        job->err[job->err_len] = '\0';
+        strlcpy(msg, chomp(job->err), sizeof(msg));
+    } else if(!ok && WIFSIGNALED(status)) {
+        snprintf(msg, sizeof(msg), "killed by signal %d", WTERMSIG(status));
+    } else if(!ok) {
+        snprintf(msg, sizeof(msg), "exited with status %d", WEXITSTATUS(status));
+    }
 
-    // If we overflow the buffer, count on SIGPIPE to terminate the child.
-    fclose(f);
-    waitpid(pid, &status, 0);
-    return status;
+    reply(ibuf, ok? EXEC_RESPONSE_OK : EXEC_RESPONSE_ERROR, job->id, msg);
+
+    job_free(job);
 }
 
-static void dispatch(struct imsgbuf* ibuf, enum exec_type program, char* msg) {
-    int32_t status = EXEC_RESPONSE_OK;
-    char iface[IF_NAMESIZE] = {0};
-    static char* buf = NULL;
-    if(buf == NULL) { buf = malloc(EXEC_BUF_LEN); }
-    if(buf == NULL) { die("Failed to allocate buffer"); }
-    buf[0] = '\0';
+// Start a job. Jobs outside the budget are limited by the parent instead,
+// such as the one hardware event it logs at a time.
+static void start_job(struct imsgbuf* ibuf,
+                      uint32_t request,
+                      char* const commands[],
+                      unsigned int timeout_ms,
+                      bool budgeted) {
+    if(budgeted && n_jobs >= EXEC_MAX_JOBS) {
+        reply(ibuf, EXEC_RESPONSE_ERROR, request, "too many jobs");
+        return;
+    }
+
+    char packed[MAX_IMSGSIZE - IMSG_HEADER_SIZE];
+    const size_t packed_len = launcher_pack(commands, packed, sizeof(packed));
+    if(packed_len == 0) {
+        reply(ibuf, EXEC_RESPONSE_ERROR, request, "arguments too long");
+        return;
+    }
+
+    struct job* job = calloc(1, sizeof(struct job));
+    if(job == NULL) { die("Failed to allocate job"); }
+    job->out = malloc(EXEC_BUF_LEN);
+    if(job->out == NULL) { die("Failed to allocate buffer"); }
+
+    job->id = request;
+    job->start = now_usec();
+    job->out_fd = -1;
+    job->err_fd = -1;
+    describe(commands, job->description, sizeof(job->description));
+
+    job->budgeted = budgeted;
+    job->next = jobs;
+    jobs = job;
+    if(budgeted) { n_jobs += 1; }
+
+    // The launcher replies with the child's pipes, and again once it exits
+    TRACE_POINT(TRACE_SPAWN, job->id);
+    launcher_send(LAUNCHER_SPAWN, job->id, packed, packed_len);
+    evloop_add_timer(loop, job->id, timeout_ms, true, job);
+}
+
+static void start(struct imsgbuf* ibuf,
+                  uint32_t request,
+                  char* const commands[],
+                  unsigned int timeout_ms) {
+    start_job(ibuf, request, commands, timeout_ms, true);
+}
+
+static struct job* find_job(uint32_t id) {
+    for(struct job* job = jobs; job != NULL; job = job->next) {
+        if(job->id == id) { return job; }
+    }
+
+    return NULL;
+}
+
+static void list_jobs(struct imsgbuf* ibuf, uint32_t request) {
+    static struct exec_job_info info[EXEC_MAX_RUNNING];
+    const uint64_t now = now_usec();
+
+    size_t n = 0;
+    for(struct job* job = jobs; job != NULL && n < EXEC_MAX_RUNNING; job = job->next) {
+        info[n].id = job->id;
+        info[n].elapsed_ms = (now - job->start) / 1000;
+        strlcpy(info[n].description, job->description, sizeof(info[n].description));
+        n += 1;
+    }
+
+    imsg_compose(ibuf, EXEC_RESPONSE_OK, request, 0, -1, info, n * sizeof(info[0]));
+    imsg_flush(ibuf);
+}
+
+static void cancel(struct imsgbuf* ibuf, uint32_t request, const void* data, size_t data_len) {
+    struct payload_job id;
+    struct job* job = NULL;
+    if(payload_get(data, data_len, &id, sizeof(id))) { job = find_job(id.id); }
+
+    if(job == NULL) {
+        reply(ibuf, EXEC_RESPONSE_ERROR, request, "no such job");
+        return;
+    }
+
+    if(job->signal_sent == 0) {
+        job->cancelled = true;
+        job_signal(job, SIGTERM);
+    }
+
+    reply(ibuf, EXEC_RESPONSE_OK, request, "");
+}
+
+static void dispatch(struct imsgbuf* ibuf,
+                     enum exec_type program,
+                     uint32_t request,
+                     const void* data,
+                     size_t data_len) {
+    TRACE_POINT(TRACE_IMSG_RECEIVE, request);
 
     // Check if we were provided an interface on which to operate
-    bool have_iface = (msg != NULL) &&
-                      (msg = (char*)flatjson_next(msg, iface, sizeof(iface), NULL)) != NULL &&
-                      validate_iface(iface);
+    struct payload_iface payload;
+    const bool have_iface = payload_get(data, data_len, &payload, sizeof(payload)) &&
+                            payload_iface_valid(&payload);
+    char* const iface = payload.name;
 
     switch(program) {
         case EXEC_IFCONFIG_LIST_INTERFACES: {
-            char* const args[] = {"/sbin/ifconfig", NULL};
-            if(run_and_read(args, buf) > 0) { status = EXEC_RESPONSE_ERROR; }
+            // Given an interface, list only that one
+            char* const args[] = {PATH_IFCONFIG, have_iface? iface : NULL, NULL};
+            start(ibuf, request, args, EXEC_TIMEOUT_IFCONFIG);
             break;
         }
         case EXEC_IFCONFIG_LIST_PSEUDO_INTERFACES: {
-            char* const args[] = {"/sbin/ifconfig", "-C", NULL};
-            if(run_and_read(args, buf) > 0) { status = EXEC_RESPONSE_ERROR; }
+            char* const args[] = {PATH_IFCONFIG, "-C", NULL};
+            start(ibuf, request, args, EXEC_TIMEOUT_IFCONFIG);
             break;
         }
         case EXEC_IFCONFIG_DOWN: {
             if(!have_iface) {
-                status = EXEC_RESPONSE_ERROR;
+                reply(ibuf, EXEC_RESPONSE_ERROR, request, "invalid interface");
                 break;
             }
 
-            char* const args[] = {"/sbin/ifconfig", iface, "down", NULL};
-            if(run_and_read(args, buf) > 0) { status = EXEC_RESPONSE_ERROR; }
+            char* const args[] = {PATH_IFCONFIG, iface, "down", NULL};
+            start(ibuf, request, args, EXEC_TIMEOUT_IFCONFIG);
+            break;
+        }
+        case EXEC_IFCONFIG_SCAN: {
+            if(!have_iface) {
+                reply(ibuf, EXEC_RESPONSE_ERROR, request, "invalid interface");
+                break;
+            }
+
+            char* const args[] = {PATH_IFCONFIG, iface, "scan", NULL};
+            start(ibuf, request, args, EXEC_TIMEOUT_SCAN);
             break;
         }
         case EXEC_NETSTART: {
             if(!have_iface) {
-                status = EXEC_RESPONSE_ERROR;
+                reply(ibuf, EXEC_RESPONSE_ERROR, request, "invalid interface");
                 break;
             }
 
-            char* const args[] = {"/bin/sh", "/etc/netstart", iface, NULL};
-            if(run_and_read(args, buf) > 0) { status = EXEC_RESPONSE_ERROR; }
+            char* const args[] = {PATH_SH, PATH_NETSTART, iface, NULL};
+            start(ibuf, request, args, EXEC_TIMEOUT_NETSTART);
             break;
         }
         case EXEC_LOGEVENT: {
-            char* const args[] = {"/usr/libexec/loghwevent", msg, NULL};
-            if(run_and_read(args, buf) > 0) { status = EXEC_RESPONSE_ERROR; }
+            struct payload_logevent event;
+            if(!payload_get(data, data_len, &event, sizeof(event)) || !payload_iface_valid(&event.iface)) {
+                reply(ibuf, EXEC_RESPONSE_ERROR, request, "invalid interface");
+                break;
+            }
+
+            char message[IF_NAMESIZE + 8];
+            snprintf(message, sizeof(message), "%s %s", event.up? "up" : "down", event.iface.name);
+            char* const args[] = {PATH_LOGHWEVENT, message, NULL};
+            start_job(ibuf, request, args, EXEC_TIMEOUT_LOGHWEVENT, false);
+            break;
+        }
+        case EXEC_STATS: {
+            imsg_compose(ibuf, EXEC_RESPONSE_OK, request, 0, -1, &spawn_stats, sizeof(spawn_stats));
+            imsg_flush(ibuf);
+            break;
+        }
+        case EXEC_TRACE_DUMP: {
+            static struct trace_record records[TRACE_RING_LEN];
+            const size_t n = trace_copy(records, TRACE_RING_LEN);
+            imsg_compose(ibuf, EXEC_RESPONSE_OK, request, 0, -1, records, n * sizeof(records[0]));
+            imsg_flush(ibuf);
             break;
         }
+        case EXEC_JOBS:
+            list_jobs(ibuf, request);
+            break;
+        case EXEC_CANCEL:
+            cancel(ibuf, request, data, data_len);
+            break;
         default:
             warn("Unknown exec mode");
+            reply(ibuf, EXEC_RESPONSE_ERROR, request, "");
             break;
     }
+}
 
-    imsg_compose(ibuf, status, 0, 0, -1, buf, strlen(buf) + 1);
-    imsg_flush(ibuf);
+static void handle_job_event(struct imsgbuf* ibuf, struct job* job, struct evloop_event* event) {
+    if(job->finished) { return; }
+
+    switch(event->filter) {
+        case EVLOOP_READ:
+            if((int)event->ident != job->out_fd && (int)event->ident != job->err_fd) { break; }
+            if(!job_read(job, event->ident)) {
+                job_close_pipe(((int)event->ident == job->out_fd)? &job->out_fd : &job->err_fd);
+            }
+            break;
+        case EVLOOP_TIMER:
+            // The deadline passed, or the grace period after SIGTERM did
+            if(job->signal_sent == 0) {
+                job->timed_out = true;
+                job_signal(job, SIGTERM);
+            } else {
+                job_signal(job, SIGKILL);
+            }
+            break;
+    }
+}
+
+static void handle_launcher(struct imsgbuf* ibuf, struct imsg* imsg) {
+    struct job* job = find_job(imsg->hdr.peerid);
+    int value = 0;
+    if(imsg->hdr.len - IMSG_HEADER_SIZE == sizeof(value)) {
+        memcpy(&value, imsg->data, sizeof(value));
+    }
+
+    if(job == NULL) {
+        if(imsg->fd >= 0) { close(imsg->fd); }
+        return;
+    }
+
+    switch(imsg->hdr.type) {
+        case LAUNCHER_STARTED:
+            job->out_fd = imsg->fd;
+            if(job->out_fd >= 0) { evloop_add_read(loop, job->out_fd, job); }
+            break;
+        case LAUNCHER_STDERR:
+            job->err_fd = imsg->fd;
+            if(job->err_fd >= 0) { evloop_add_read(loop, job->err_fd, job); }
+            break;
+        case LAUNCHER_FAILED:
+            errno = value;
+            warn("Failed to spawn process");
+            spawn_stats.failures += 1;
+            evloop_del_timer(loop, job->id);
+            reply(ibuf, EXEC_RESPONSE_ERROR, job->id, "failed to spawn");
+            job_free(job);
+            break;
+        case LAUNCHER_EXITED:
+            job_finish(ibuf, job, value);
+            break;
+    }
 }
 
 void service_exec(struct imsgbuf* ibuf) {
-    pledge("stdio proc exec", NULL);
+    trace_init(TRACE_PROCESS_EXEC);
+    imsg_init(&launcher, launcher_start(PATH_LAUNCHER));
+    pledge("stdio recvfd", NULL);
 
+    loop = evloop_create();
+    evloop_add_read(loop, ibuf->fd, NULL);
+    evloop_add_read(loop, launcher.fd, &launcher);
+
+    struct evloop_event events[16];
     while(1) {
-        int n = imsg_read(ibuf);
-        if(n < 0) { die("Error reading ibuf"); }
-        if(n == 0) { break; }
+        const int nev = evloop_wait(loop, events, 16, -1);
+        for(int i = 0; i < nev; i += 1) {
+            if(events[i].udata == &launcher) {
+                const int n = imsg_read(&launcher);
+                if(n < 0) { die("Error reading from launcher"); }
+                if(n == 0) { die("Launcher exited"); }
+
+                struct imsg imsg;
+                while(imsg_get(&launcher, &imsg) > 0) {
+                    handle_launcher(ibuf, &imsg);
+                    imsg_free(&imsg);
+                }
+                continue;
+            }
 
-        while(1) {
-            struct imsg imsg;
-            n = imsg_get(ibuf, &imsg);
-            if(n <= 0) { break; }
+            if(events[i].udata != NULL) {
+                handle_job_event(ibuf, events[i].udata, &events[i]);
+                continue;
+            }
+
+            int n = imsg_read(ibuf);
+            if(n < 0) { die("Error reading ibuf"); }
+            if(n == 0) { return; }
+
+            while(1) {
+                struct imsg imsg;
+                n = imsg_get(ibuf, &imsg);
+                if(n <= 0) { break; }
+
+                dispatch(ibuf, imsg.hdr.type, imsg.hdr.peerid, imsg.data, imsg.hdr.len - IMSG_HEADER_SIZE);
+                imsg_free(&imsg);
+            }
+        }
 
-            dispatch(ibuf, imsg.hdr.type, (char* const)imsg.data);
-            imsg_free(&imsg);
+        while(finished_jobs != NULL) {
+            struct job* next = finished_jobs->next;
+            free(finished_jobs->out);
+            free(finished_jobs);
+            finished_jobs = next;
         }
     }
 }
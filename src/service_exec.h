@@ -1,11 +1,41 @@
 #pragma once
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/queue.h>
 #include <sys/uio.h>
 #include <imsg.h>
 
 #define EXEC_BUF_LEN (1024 * 1024)
+#define EXEC_STDERR_LEN 4096
+#define EXEC_MAX_JOBS 64
+
+// Jobs that may be running at once, counting the hardware event being logged
+// outside the budget
+#define EXEC_MAX_RUNNING (EXEC_MAX_JOBS + 1)
+#define EXEC_DESCRIPTION_LEN 64
+
+// Output is returned in EXEC_RESPONSE_DATA messages of at most this size,
+// ahead of the final EXEC_RESPONSE_OK or EXEC_RESPONSE_ERROR.
+#define EXEC_CHUNK_LEN 8192
+
+// How long each kind of job may run, in milliseconds, before it is sent
+// SIGTERM, and how long after that before it is sent SIGKILL.
+#ifndef EXEC_TIMEOUT_IFCONFIG
+#define EXEC_TIMEOUT_IFCONFIG 10000
+#endif
+#ifndef EXEC_TIMEOUT_NETSTART
+#define EXEC_TIMEOUT_NETSTART 60000
+#endif
+#ifndef EXEC_TIMEOUT_LOGHWEVENT
+#define EXEC_TIMEOUT_LOGHWEVENT 10000
+#endif
+#ifndef EXEC_TIMEOUT_SCAN
+#define EXEC_TIMEOUT_SCAN 30000
+#endif
+#ifndef EXEC_KILL_GRACE
+#define EXEC_KILL_GRACE 2000
+#endif
 
 enum exec_type {
     EXEC_IFCONFIG_LIST_INTERFACES,
@@ -13,9 +43,22 @@ enum exec_type {
     EXEC_IFCONFIG_DOWN,
     EXEC_LOGEVENT,
     EXEC_NETSTART,
+    EXEC_STATS,
+    EXEC_TRACE_DUMP,
+    EXEC_JOBS,
+    EXEC_CANCEL,
+    EXEC_IFCONFIG_SCAN,
 
     EXEC_RESPONSE_OK,
-    EXEC_RESPONSE_ERROR
+    EXEC_RESPONSE_ERROR,
+    EXEC_RESPONSE_DATA
+};
+
+// One entry of the reply to EXEC_JOBS
+struct exec_job_info {
+    uint32_t id;
+    uint32_t elapsed_ms;
+    char description[EXEC_DESCRIPTION_LEN];
 };
 
 void service_exec(struct imsgbuf*);
@@ -0,0 +1,501 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#ifdef __OpenBSD__
+#include <net/if_dl.h>
+#include <net/route.h>
+#include <netinet/in_var.h>
+#include <netinet6/in6_var.h>
+#include <netinet6/nd6.h>
+#endif
+
+#include "paths.h"
+#include "payload.h"
+#include "service_ifconfig.h"
+#include "trace.h"
+#include "util.h"
+
+// Applies interface configuration with ioctls and routing messages, rather
+// than by running ifconfig(8) or netstart. Only the simplest cases are
+// handled here: anything else, or any failure, is answered with
+// IFCONFIG_RESPONSE_FALLBACK so that the external programs can do the job
+// and report any error as they always have.
+
+enum stanza_type {
+    STANZA_INET,
+    STANZA_INET6,
+    STANZA_DEST
+};
+
+struct stanza {
+    enum stanza_type type;
+    int family;
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+    } addr;
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+    } mask;
+    struct in_addr broadcast;
+    bool have_broadcast;
+};
+
+static int sock = -1;
+static int sock6 = -1;
+#ifdef __OpenBSD__
+static int rt_sock = -1;
+#endif
+
+static bool set_up(const char* iface, bool up) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strlcpy(ifr.ifr_name, iface, sizeof(ifr.ifr_name));
+
+    if(ioctl(sock, SIOCGIFFLAGS, &ifr) == -1) { return false; }
+    if(up) {
+        ifr.ifr_flags |= IFF_UP;
+    } else {
+        ifr.ifr_flags &= ~IFF_UP;
+    }
+
+    return ioctl(sock, SIOCSIFFLAGS, &ifr) == 0;
+}
+
+static bool parse_prefixlen6(const char* text, struct in6_addr* mask) {
+    char* end;
+    const unsigned long len = strtoul(text, &end, 10);
+    if(end == text || *end != '\0' || len > 128) {
+        // Not a prefix length, so it should be a mask
+        return inet_pton(AF_INET6, text, mask) == 1;
+    }
+
+    memset(mask, 0, sizeof(*mask));
+    for(unsigned long i = 0; i < len; i += 1) {
+        mask->s6_addr[i / 8] |= 0x80 >> (i % 8);
+    }
+
+    return true;
+}
+
+// Parse one hostname.if line. Returns false for anything but a static
+// address or destination.
+static bool parse_stanza(char* line, struct stanza* stanza) {
+    memset(stanza, 0, sizeof(*stanza));
+
+    char* fields[4] = {NULL};
+    size_t n_fields = 0;
+    char* cursor;
+    while(n_fields < 4 && (cursor = strsep(&line, " \t")) != NULL) {
+        if(cursor[0] != '\0') { fields[n_fields++] = cursor; }
+    }
+
+    if(n_fields == 0 || line != NULL) { return false; }
+
+    if(strcmp(fields[0], "inet") == 0 && n_fields >= 3) {
+        stanza->type = STANZA_INET;
+        stanza->family = AF_INET;
+        if(inet_pton(AF_INET, fields[1], &stanza->addr.v4) != 1) { return false; }
+        if(inet_pton(AF_INET, fields[2], &stanza->mask.v4) != 1) { return false; }
+        if(n_fields == 4 && strcmp(fields[3], "NONE") != 0) {
+            if(inet_pton(AF_INET, fields[3], &stanza->broadcast) != 1) { return false; }
+            stanza->have_broadcast = true;
+        }
+
+        return true;
+    }
+
+    if(strcmp(fields[0], "inet6") == 0 && n_fields >= 3) {
+        stanza->type = STANZA_INET6;
+        stanza->family = AF_INET6;
+        if(inet_pton(AF_INET6, fields[1], &stanza->addr.v6) != 1) { return false; }
+        return parse_prefixlen6(fields[2], &stanza->mask.v6);
+    }
+
+    if(strcmp(fields[0], "dest") == 0 && n_fields == 2) {
+        stanza->type = STANZA_DEST;
+        if(inet_pton(AF_INET, fields[1], &stanza->addr.v4) == 1) {
+            stanza->family = AF_INET;
+            return true;
+        }
+
+        stanza->family = AF_INET6;
+        return inet_pton(AF_INET6, fields[1], &stanza->addr.v6) == 1;
+    }
+
+    return false;
+}
+
+// Read the interface's hostname.if file. Returns the number of stanzas, or
+// -1 if any line is not one that we can apply natively.
+static int read_config(const char* iface, struct stanza stanzas[IFCONFIG_MAX_STANZAS]) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), PATH_HOSTNAME_PREFIX "%s", iface);
+
+    FILE* f = fopen(path, "r");
+    if(f == NULL) { return -1; }
+
+    int n = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), f) != NULL) {
+        chomp(line);
+        if(line[strspn(line, " \t")] == '\0') { continue; }
+
+        if(n == IFCONFIG_MAX_STANZAS || !parse_stanza(line, &stanzas[n])) {
+            n = -1;
+            break;
+        }
+
+        n += 1;
+    }
+
+    fclose(f);
+    return n;
+}
+
+// What applying a stanza changed, so that it can be undone if a later one
+// fails: whether it added an address or route that was not there before, and
+// the primary IPv4 address that it replaced, if any
+struct applied {
+    bool added;
+    bool replaced;
+    struct sockaddr_in old_addr;
+    struct sockaddr_in old_mask;
+    struct sockaddr_in old_broadcast;
+};
+
+#ifdef __OpenBSD__
+static void inet_request(const char* iface,
+                         struct in_aliasreq* req,
+                         const struct sockaddr_in* addr,
+                         const struct sockaddr_in* mask,
+                         const struct sockaddr_in* broadcast) {
+    memset(req, 0, sizeof(*req));
+    strlcpy(req->ifra_name, iface, sizeof(req->ifra_name));
+    req->ifra_addr = *addr;
+    req->ifra_mask = *mask;
+    req->ifra_broadaddr = *broadcast;
+}
+
+static void inet_sockaddr(struct sockaddr_in* sin, struct in_addr addr) {
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_len = sizeof(*sin);
+    sin->sin_addr = addr;
+}
+
+// Read the interface's primary IPv4 address, with its netmask and its
+// broadcast or destination address. Returns false if it has none.
+static bool get_inet(const char* iface, struct applied* applied) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strlcpy(ifr.ifr_name, iface, sizeof(ifr.ifr_name));
+    if(ioctl(sock, SIOCGIFADDR, &ifr) == -1) { return false; }
+    memcpy(&applied->old_addr, &ifr.ifr_addr, sizeof(applied->old_addr));
+
+    memset(&applied->old_mask, 0, sizeof(applied->old_mask));
+    if(ioctl(sock, SIOCGIFNETMASK, &ifr) == 0) { memcpy(&applied->old_mask, &ifr.ifr_addr, sizeof(applied->old_mask)); }
+
+    memset(&applied->old_broadcast, 0, sizeof(applied->old_broadcast));
+    if(ioctl(sock, SIOCGIFBRDADDR, &ifr) == 0) {
+        memcpy(&applied->old_broadcast, &ifr.ifr_broadaddr, sizeof(applied->old_broadcast));
+    } else if(ioctl(sock, SIOCGIFDSTADDR, &ifr) == 0) {
+        memcpy(&applied->old_broadcast, &ifr.ifr_dstaddr, sizeof(applied->old_broadcast));
+    }
+
+    return true;
+}
+
+static bool del_inet(const char* iface, const struct sockaddr_in* addr) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strlcpy(ifr.ifr_name, iface, sizeof(ifr.ifr_name));
+    memcpy(&ifr.ifr_addr, addr, sizeof(*addr));
+    return ioctl(sock, SIOCDIFADDR, &ifr) == 0;
+}
+
+// Replace the primary address, as ifconfig does for inet without alias
+static bool add_inet(const char* iface, const struct stanza* stanza, struct applied* applied) {
+    struct sockaddr_in addr;
+    struct sockaddr_in mask;
+    struct sockaddr_in broadcast;
+    inet_sockaddr(&addr, stanza->addr.v4);
+    inet_sockaddr(&mask, stanza->mask.v4);
+    memset(&broadcast, 0, sizeof(broadcast));
+    if(stanza->have_broadcast) { inet_sockaddr(&broadcast, stanza->broadcast); }
+
+    applied->replaced = get_inet(iface, applied);
+    if(applied->replaced && !del_inet(iface, &applied->old_addr)) { return false; }
+
+    struct in_aliasreq req;
+    inet_request(iface, &req, &addr, &mask, &broadcast);
+    if(ioctl(sock, SIOCAIFADDR, &req) == 0) {
+        applied->added = true;
+        return true;
+    }
+
+    // Put back what was there
+    if(applied->replaced) {
+        inet_request(iface, &req, &applied->old_addr, &applied->old_mask, &applied->old_broadcast);
+        if(ioctl(sock, SIOCAIFADDR, &req) == -1) { warn("Failed to restore address"); }
+    }
+
+    return false;
+}
+
+static void inet6_request(const char* iface, struct in6_ifreq* ifr, const struct stanza* stanza) {
+    memset(ifr, 0, sizeof(*ifr));
+    strlcpy(ifr->ifr_name, iface, sizeof(ifr->ifr_name));
+    ifr->ifr_addr.sin6_family = AF_INET6;
+    ifr->ifr_addr.sin6_len = sizeof(ifr->ifr_addr);
+    ifr->ifr_addr.sin6_addr = stanza->addr.v6;
+}
+
+// IPv6 addresses are added alongside any others, as ifconfig does for inet6
+static bool add_inet6(const char* iface, const struct stanza* stanza, struct applied* applied) {
+    struct in6_ifreq ifr;
+    inet6_request(iface, &ifr, stanza);
+    const bool existed = (ioctl(sock6, SIOCGIFAFLAG_IN6, &ifr) == 0);
+
+    struct in6_aliasreq req;
+    memset(&req, 0, sizeof(req));
+    strlcpy(req.ifra_name, iface, sizeof(req.ifra_name));
+
+    req.ifra_addr.sin6_family = AF_INET6;
+    req.ifra_addr.sin6_len = sizeof(req.ifra_addr);
+    req.ifra_addr.sin6_addr = stanza->addr.v6;
+    req.ifra_prefixmask.sin6_family = AF_INET6;
+    req.ifra_prefixmask.sin6_len = sizeof(req.ifra_prefixmask);
+    req.ifra_prefixmask.sin6_addr = stanza->mask.v6;
+    req.ifra_lifetime.ia6t_vltime = ND6_INFINITE_LIFETIME;
+    req.ifra_lifetime.ia6t_pltime = ND6_INFINITE_LIFETIME;
+
+    if(ioctl(sock6, SIOCAIFADDR_IN6, &req) == -1) { return false; }
+    applied->added = !existed;
+    return true;
+}
+
+static bool del_inet6(const char* iface, const struct stanza* stanza) {
+    struct in6_ifreq ifr;
+    inet6_request(iface, &ifr, stanza);
+    return ioctl(sock6, SIOCDIFADDR_IN6, &ifr) == 0;
+}
+
+#define ROUNDUP(a) ((a) > 0? (1 + (((a) - 1) | (sizeof(long) - 1))) : sizeof(long))
+
+// Add or delete a host route to the destination through the interface, as
+// `route add -host <dest> -link -iface <if>` would.
+static bool route_dest(int type, const char* iface, const struct stanza* stanza) {
+    static int seq;
+
+    struct {
+        struct rt_msghdr hdr;
+        char space[512];
+    } msg;
+    memset(&msg, 0, sizeof(msg));
+
+    msg.hdr.rtm_type = type;
+    msg.hdr.rtm_version = RTM_VERSION;
+    msg.hdr.rtm_hdrlen = sizeof(msg.hdr);
+    msg.hdr.rtm_flags = RTF_UP | RTF_HOST | RTF_STATIC;
+    msg.hdr.rtm_addrs = RTA_DST | RTA_GATEWAY;
+    msg.hdr.rtm_seq = ++seq;
+
+    char* cursor = msg.space;
+    if(stanza->family == AF_INET) {
+        struct sockaddr_in dst;
+        memset(&dst, 0, sizeof(dst));
+        dst.sin_family = AF_INET;
+        dst.sin_len = sizeof(dst);
+        dst.sin_addr = stanza->addr.v4;
+        memcpy(cursor, &dst, sizeof(dst));
+        cursor += ROUNDUP(sizeof(dst));
+    } else {
+        struct sockaddr_in6 dst;
+        memset(&dst, 0, sizeof(dst));
+        dst.sin6_family = AF_INET6;
+        dst.sin6_len = sizeof(dst);
+        dst.sin6_addr = stanza->addr.v6;
+        memcpy(cursor, &dst, sizeof(dst));
+        cursor += ROUNDUP(sizeof(dst));
+    }
+
+    struct sockaddr_dl gateway;
+    memset(&gateway, 0, sizeof(gateway));
+    gateway.sdl_family = AF_LINK;
+    gateway.sdl_len = sizeof(gateway);
+    gateway.sdl_index = if_nametoindex(iface);
+    if(gateway.sdl_index == 0) { return false; }
+    memcpy(cursor, &gateway, sizeof(gateway));
+    cursor += ROUNDUP(sizeof(gateway));
+
+    msg.hdr.rtm_msglen = cursor - (char*)&msg;
+    return write(rt_sock, &msg, msg.hdr.rtm_msglen) != -1;
+}
+
+static bool add_dest(const char* iface, const struct stanza* stanza, struct applied* applied) {
+    if(route_dest(RTM_ADD, iface, stanza)) {
+        applied->added = true;
+        return true;
+    }
+
+    return errno == EEXIST;
+}
+
+// Whether a stanza can be applied, before anything is
+static bool check(const struct stanza* stanza) {
+    return stanza->type != STANZA_INET6 || sock6 >= 0;
+}
+
+static bool apply(const char* iface, const struct stanza* stanza, struct applied* applied) {
+    memset(applied, 0, sizeof(*applied));
+    switch(stanza->type) {
+        case STANZA_INET: return add_inet(iface, stanza, applied);
+        case STANZA_INET6: return add_inet6(iface, stanza, applied);
+        case STANZA_DEST: return add_dest(iface, stanza, applied);
+    }
+
+    return false;
+}
+
+static void undo(const char* iface, const struct stanza* stanza, const struct applied* applied) {
+    bool ok = true;
+    switch(stanza->type) {
+        case STANZA_INET: {
+            struct sockaddr_in addr;
+            inet_sockaddr(&addr, stanza->addr.v4);
+            if(applied->added) { ok = del_inet(iface, &addr); }
+            if(applied->replaced) {
+                struct in_aliasreq req;
+                inet_request(iface, &req, &applied->old_addr, &applied->old_mask, &applied->old_broadcast);
+                ok = (ioctl(sock, SIOCAIFADDR, &req) == 0) && ok;
+            }
+            break;
+        }
+        case STANZA_INET6:
+            if(applied->added) { ok = del_inet6(iface, stanza); }
+            break;
+        case STANZA_DEST:
+            if(applied->added) { ok = route_dest(RTM_DELETE, iface, stanza); }
+            break;
+    }
+
+    if(!ok) { warn("Failed to undo configuration"); }
+}
+#else
+// Addresses and routes are only applied natively on OpenBSD
+static bool check(const struct stanza* stanza) {
+    return false;
+}
+
+static bool apply(const char* iface, const struct stanza* stanza, struct applied* applied) {
+    return false;
+}
+
+static void undo(const char* iface, const struct stanza* stanza, const struct applied* applied) {}
+#endif
+
+// Every stanza is checked before any is applied. If one still fails, those
+// already applied are undone, so that netstart starts from where we did.
+static enum ifconfig_type connect_iface(const char* iface) {
+    struct stanza stanzas[IFCONFIG_MAX_STANZAS];
+    const int n = read_config(iface, stanzas);
+    if(n <= 0 || if_nametoindex(iface) == 0) { return IFCONFIG_RESPONSE_FALLBACK; }
+
+    for(int i = 0; i < n; i += 1) {
+        if(!check(&stanzas[i])) { return IFCONFIG_RESPONSE_FALLBACK; }
+    }
+
+    struct applied applied[IFCONFIG_MAX_STANZAS];
+    int n_applied = 0;
+    while(n_applied < n && apply(iface, &stanzas[n_applied], &applied[n_applied])) { n_applied += 1; }
+
+    if(n_applied == n && set_up(iface, true)) { return IFCONFIG_RESPONSE_OK; }
+
+    while(n_applied > 0) {
+        n_applied -= 1;
+        undo(iface, &stanzas[n_applied], &applied[n_applied]);
+    }
+
+    return IFCONFIG_RESPONSE_FALLBACK;
+}
+
+static void dispatch(struct imsgbuf* ibuf,
+                     enum ifconfig_type type,
+                     uint32_t request,
+                     const void* data,
+                     size_t data_len) {
+    TRACE_POINT(TRACE_IMSG_RECEIVE, request);
+
+    if(type == IFCONFIG_TRACE_DUMP) {
+        static struct trace_record records[TRACE_RING_LEN];
+        const size_t n = trace_copy(records, TRACE_RING_LEN);
+        imsg_compose(ibuf, IFCONFIG_RESPONSE_OK, request, 0, -1, records, n * sizeof(records[0]));
+        imsg_flush(ibuf);
+        return;
+    }
+
+    enum ifconfig_type result = IFCONFIG_RESPONSE_FALLBACK;
+    struct payload_iface iface;
+    if(payload_get(data, data_len, &iface, sizeof(iface)) && payload_iface_valid(&iface)) {
+        switch(type) {
+            case IFCONFIG_DOWN:
+                if(set_up(iface.name, false)) { result = IFCONFIG_RESPONSE_OK; }
+                break;
+            case IFCONFIG_CONNECT:
+                result = connect_iface(iface.name);
+                break;
+            default:
+                warn("Unknown ifconfig mode");
+                break;
+        }
+    }
+
+    TRACE_POINT(TRACE_IMSG_SEND, request);
+    imsg_compose(ibuf, result, request, 0, -1, NULL, 0);
+    imsg_flush(ibuf);
+}
+
+void service_ifconfig(struct imsgbuf* ibuf) {
+    trace_init(TRACE_PROCESS_IFCONFIG);
+
+    // pledge(2) does not permit the ioctls that configure interfaces, so
+    // this process stays unpledged. It is kept small for that reason.
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0) { die("Failed to create socket"); }
+
+    // Without IPv6, inet6 stanzas are left to netstart
+    sock6 = socket(AF_INET6, SOCK_DGRAM, 0);
+    if(sock6 < 0) { warn("Failed to create IPv6 socket"); }
+#ifdef __OpenBSD__
+    rt_sock = socket(PF_ROUTE, SOCK_RAW, 0);
+    if(rt_sock < 0) { die("Failed to create routing socket"); }
+#endif
+
+    while(1) {
+        int n = imsg_read(ibuf);
+        if(n < 0) { die("Error reading ibuf"); }
+        if(n == 0) { return; }
+
+        while(1) {
+            struct imsg imsg;
+            n = imsg_get(ibuf, &imsg);
+            if(n <= 0) { break; }
+
+            dispatch(ibuf, imsg.hdr.type, imsg.hdr.peerid, imsg.data, imsg.hdr.len - IMSG_HEADER_SIZE);
+            imsg_free(&imsg);
+        }
+    }
+}
+
+struct imsgbuf service_ifconfig_ibuf;
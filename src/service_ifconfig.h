@@ -0,0 +1,25 @@
+#pragma once
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/uio.h>
+#include <imsg.h>
+
+// Stanzas that service_ifconfig will apply from a hostname.if file
+#define IFCONFIG_MAX_STANZAS 16
+
+enum ifconfig_type {
+    IFCONFIG_DOWN,
+    IFCONFIG_CONNECT,
+    IFCONFIG_TRACE_DUMP,
+
+    IFCONFIG_RESPONSE_OK,
+
+    // The request could not be handled natively, and should be carried out
+    // by the external programs instead
+    IFCONFIG_RESPONSE_FALLBACK
+};
+
+void service_ifconfig(struct imsgbuf*);
+
+extern struct imsgbuf service_ifconfig_ibuf;
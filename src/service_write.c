@@ -2,27 +2,23 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 
 #include "service_write.h"
-#include "flatjson.h"
+#include "paths.h"
+#include "payload.h"
+#include "trace.h"
 #include "util.h"
-#include "validate.h"
 
-static enum write_type configure(const char* interface, char const* args) {
-    char path[50];
-    char stanza[200];
-    snprintf(path, sizeof(path), "/etc/hostname.%s", interface);
+static enum write_type configure(const struct payload_configure* configure) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), PATH_HOSTNAME_PREFIX "%s", configure->iface.name);
 
     FILE* f = fopen(path, "w");
     if(f == NULL) { return WRITE_RESPONSE_ERROR; }
 
-    while((args = flatjson_next(args, stanza, sizeof(stanza), NULL)) != NULL) {
-        if(!validate_stanza(stanza)) {
-            warn("Illegal stanza");
-            continue;
-        }
-
-        if(fprintf(f, "%s\n", stanza) < 0) {
+    for(uint32_t i = 0; i < configure->n_stanzas; i += 1) {
+        if(fprintf(f, "%s\n", configure->stanzas[i]) < 0) {
             warn("Writing error");
         }
     }
@@ -32,8 +28,8 @@ static enum write_type configure(const char* interface, char const* args) {
 }
 
 static enum write_type autoconfigure(const char* interface) {
-    char path[50];
-    snprintf(path, sizeof(path), "/etc/hostname.%s", interface);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), PATH_HOSTNAME_PREFIX "%s", interface);
 
     FILE* f = fopen(path, "wx");
     if(f == NULL) { return WRITE_RESPONSE_OK; }
@@ -42,33 +38,49 @@ static enum write_type autoconfigure(const char* interface) {
     return WRITE_RESPONSE_OK;
 }
 
-static void dispatch(struct imsgbuf* ibuf, enum write_type type, const char* msg) {
-    char interface[IF_NAMESIZE] = {0};
-    flatjson_next(msg, interface, sizeof(interface), NULL);
-    if(!validate_iface(interface)) {
-        imsg_compose(ibuf, WRITE_RESPONSE_ERROR, 0, 0, -1, NULL, 0);
+static void dispatch(struct imsgbuf* ibuf,
+                     enum write_type type,
+                     uint32_t request,
+                     const void* data,
+                     size_t data_len) {
+    TRACE_POINT(TRACE_IMSG_RECEIVE, request);
+
+    if(type == WRITE_TRACE_DUMP) {
+        static struct trace_record records[TRACE_RING_LEN];
+        const size_t n = trace_copy(records, TRACE_RING_LEN);
+        imsg_compose(ibuf, WRITE_RESPONSE_OK, request, 0, -1, records, n * sizeof(records[0]));
         imsg_flush(ibuf);
         return;
     }
 
-    enum write_type result = 0;
+    // The parent has validated the request, but it is checked again here,
+    // where the privilege to act on it is held
+    static struct payload_configure config;
+    struct payload_iface iface;
+    enum write_type result = WRITE_RESPONSE_ERROR;
     switch(type) {
         case WRITE_WRITE:
-            result = configure(interface, msg);
+            if(payload_get(data, data_len, &config, sizeof(config)) && payload_configure_valid(&config)) {
+                result = configure(&config);
+            }
             break;
         case WRITE_AUTOCONFIGURE:
-            result = autoconfigure(interface);
+            if(payload_get(data, data_len, &iface, sizeof(iface)) && payload_iface_valid(&iface)) {
+                result = autoconfigure(iface.name);
+            }
             break;
         default:
             warn("Unknown write mode");
             return;
     }
 
-    imsg_compose(ibuf, result, 0, 0, -1, NULL, 0);
+    TRACE_POINT(TRACE_IMSG_SEND, request);
+    imsg_compose(ibuf, result, request, 0, -1, NULL, 0);
     imsg_flush(ibuf);
 }
 
 void service_write(struct imsgbuf* ibuf) {
+    trace_init(TRACE_PROCESS_WRITE);
     pledge("stdio wpath cpath", NULL);
 
     while(1) {
@@ -81,7 +93,7 @@ void service_write(struct imsgbuf* ibuf) {
             n = imsg_get(ibuf, &imsg);
             if(n <= 0) { break; }
 
-            dispatch(ibuf, imsg.hdr.type, (const char*)imsg.data);
+            dispatch(ibuf, imsg.hdr.type, imsg.hdr.peerid, imsg.data, imsg.hdr.len - IMSG_HEADER_SIZE);
             imsg_free(&imsg);
         }
     }
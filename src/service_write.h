@@ -10,6 +10,7 @@
 enum write_type {
     WRITE_WRITE,
     WRITE_AUTOCONFIGURE,
+    WRITE_TRACE_DUMP,
 
     WRITE_RESPONSE_OK,
     WRITE_RESPONSE_ERROR
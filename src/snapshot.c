@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "util.h"
+
+#define SNAPSHOT_MAGIC "NWDSNAP"
+#define SNAPSHOT_VERSION 1
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t next_seq;
+    uint64_t saved_at;
+
+    // Length and checksum of the records that follow
+    uint64_t len;
+    uint64_t checksum;
+};
+
+// One interface. It is followed by its name, without a terminator, and then
+// its packed details.
+struct record {
+    uint32_t ifindex;
+    uint32_t flags;
+    uint32_t mtu;
+    uint32_t details_len;
+    uint8_t link;
+    uint8_t name_len;
+    uint8_t pad[2];
+};
+
+static uint64_t checksum(const char* buf, size_t len) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < len; i += 1) {
+        hash ^= (unsigned char)buf[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// Check every record before any is loaded, so that a bad snapshot leaves
+// nothing behind
+static bool check(const char* body, size_t len, uint32_t count) {
+    size_t offset = 0;
+    for(uint32_t i = 0; i < count; i += 1) {
+        struct record record;
+        if(len - offset < sizeof(record)) { return false; }
+        memcpy(&record, body + offset, sizeof(record));
+        offset += sizeof(record);
+
+        if(record.ifindex == 0 || record.link > HISTORY_LINK_UP) { return false; }
+        if(record.name_len == 0 || record.name_len >= IF_NAMESIZE || len - offset < record.name_len) { return false; }
+        if(memchr(body + offset, '\0', record.name_len) != NULL) { return false; }
+        offset += record.name_len;
+
+        // Details must be whole key and value pairs
+        if(len - offset < record.details_len) { return false; }
+        size_t strings = 0;
+        for(size_t j = 0; j < record.details_len; j += 1) {
+            if(body[offset + j] == '\0') { strings += 1; }
+        }
+
+        if(record.details_len > 0 && (body[offset + record.details_len - 1] != '\0' || strings % 2 != 0)) {
+            return false;
+        }
+
+        offset += record.details_len;
+    }
+
+    return offset == len;
+}
+
+static bool load(const char* map, size_t size, struct iftable* table, struct snapshot_info* info) {
+    struct header header;
+    memcpy(&header, map, sizeof(header));
+    const char* body = map + sizeof(header);
+    if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != SNAPSHOT_VERSION ||
+       header.len != size - sizeof(header) ||
+       checksum(body, header.len) != header.checksum ||
+       !check(body, header.len, header.count)) {
+        return false;
+    }
+
+    size_t offset = 0;
+    for(uint32_t i = 0; i < header.count; i += 1) {
+        struct record record;
+        memcpy(&record, body + offset, sizeof(record));
+        offset += sizeof(record);
+
+        char name[IF_NAMESIZE];
+        memcpy(name, body + offset, record.name_len);
+        name[record.name_len] = '\0';
+        offset += record.name_len;
+
+        // The table takes a copy of the details
+        const struct iftable_details details = {(char*)body + offset, record.details_len, record.details_len};
+        offset += record.details_len;
+
+        iftable_set(table, record.ifindex, name);
+        iftable_update(table, record.ifindex, record.flags, record.mtu, record.link);
+        iftable_set_details(table, record.ifindex, &details);
+    }
+
+    info->next_seq = header.next_seq;
+    info->saved_at = header.saved_at;
+    info->count = header.count;
+    return true;
+}
+
+bool snapshot_load(int fd, struct iftable* table, struct snapshot_info* info) {
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct header)) { return false; }
+
+    const size_t size = st.st_size;
+    const char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) { return false; }
+
+    const bool loaded = load(map, size, table, info);
+    munmap((void*)map, size);
+    return loaded;
+}
+
+bool snapshot_save(int fd, const struct iftable* table, uint64_t next_seq) {
+    struct header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.next_seq = next_seq;
+    header.saved_at = wall_usec();
+
+    for(size_t i = 0; i < table->len; i += 1) {
+        const char* name = iftable_name(table, i);
+        if(name == NULL) { continue; }
+
+        header.count += 1;
+        header.len += sizeof(struct record) + strlen(name) + table->details[i].len;
+    }
+
+    const size_t size = sizeof(header) + header.len;
+    char* buf = malloc(size);
+    if(buf == NULL) { return false; }
+
+    char* cursor = buf + sizeof(header);
+    for(size_t i = 0; i < table->len; i += 1) {
+        const char* name = iftable_name(table, i);
+        if(name == NULL) { continue; }
+
+        struct record record;
+        memset(&record, 0, sizeof(record));
+        record.ifindex = i;
+        record.flags = table->flags[i];
+        record.mtu = table->mtu[i];
+        record.details_len = table->details[i].len;
+        record.link = table->link[i];
+        record.name_len = strlen(name);
+
+        memcpy(cursor, &record, sizeof(record));
+        cursor += sizeof(record);
+        memcpy(cursor, name, record.name_len);
+        cursor += record.name_len;
+        if(record.details_len > 0) { memcpy(cursor, table->details[i].buf, record.details_len); }
+        cursor += record.details_len;
+    }
+
+    header.checksum = checksum(buf + sizeof(header), header.len);
+    memcpy(buf, &header, sizeof(header));
+
+    size_t written = 0;
+    while(written < size) {
+        const ssize_t n = pwrite(fd, buf + written, size - written, written);
+        if(n <= 0) { break; }
+        written += n;
+    }
+
+    free(buf);
+    return written == size && ftruncate(fd, size) == 0;
+}
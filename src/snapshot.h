@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "iftable.h"
+
+// The interface table and the next event number, saved on a clean shutdown
+// so that a restarted networkd can answer straight away. The file is
+// checksummed, and only ever read by the same build on the same machine.
+
+struct snapshot_info {
+    uint64_t next_seq;
+
+    // Microseconds since the epoch when it was saved
+    uint64_t saved_at;
+
+    uint32_t count;
+};
+
+// Read the snapshot in the given file into an empty interface table.
+// Returns false, leaving the table untouched, if there is no valid snapshot.
+bool snapshot_load(int fd, struct iftable*, struct snapshot_info*);
+
+// Replace the file's contents with a snapshot. Returns false on failure.
+bool snapshot_save(int fd, const struct iftable*, uint64_t next_seq);
@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/socket.h>
+
+#include "launcher.h"
+#include "util.h"
+
+static void set_nonblocking(int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        die("Error changing to non-blocking mode");
+    }
+}
+
+int spawn_child(char* const commands[], pid_t* pid, int* out_fd, int* err_fd) {
+    int out[2];
+    int err[2];
+    if(pipe(out)) { return errno; }
+    if(pipe(err)) {
+        const int saved = errno;
+        close(out[0]);
+        close(out[1]);
+        return saved;
+    }
+
+    posix_spawn_file_actions_t action;
+    posix_spawn_file_actions_init(&action);
+    // The launcher's standard input is its socket, which must not leak
+    posix_spawn_file_actions_addopen(&action, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addclose(&action, out[0]);
+    posix_spawn_file_actions_addclose(&action, err[0]);
+    posix_spawn_file_actions_adddup2(&action, out[1], 1);
+    posix_spawn_file_actions_adddup2(&action, err[1], 2);
+    posix_spawn_file_actions_addclose(&action, out[1]);
+    posix_spawn_file_actions_addclose(&action, err[1]);
+
+    // Give the child its own process group, so that a deadline can take
+    // down anything it starts too, and undo any signal handling of ours.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    const int status = posix_spawn(pid, commands[0], &action, &attr, commands, NULL);
+    posix_spawn_file_actions_destroy(&action);
+    posix_spawnattr_destroy(&attr);
+    close(out[1]);
+    close(err[1]);
+
+    if(status != 0) {
+        close(out[0]);
+        close(err[0]);
+        return status;
+    }
+
+    set_nonblocking(out[0]);
+    set_nonblocking(err[0]);
+    *out_fd = out[0];
+    *err_fd = err[0];
+    return 0;
+}
+
+int launcher_start(const char* path) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, PF_UNSPEC, fds) == -1) {
+        die("Failed to set up socketpair");
+    }
+
+    posix_spawn_file_actions_t action;
+    posix_spawn_file_actions_init(&action);
+    posix_spawn_file_actions_addclose(&action, fds[0]);
+    posix_spawn_file_actions_adddup2(&action, fds[1], LAUNCHER_FD);
+    posix_spawn_file_actions_addclose(&action, fds[1]);
+
+    char* const args[] = {(char*)path, NULL};
+    pid_t pid;
+    const int status = posix_spawn(&pid, path, &action, NULL, args, NULL);
+    posix_spawn_file_actions_destroy(&action);
+    close(fds[1]);
+
+    if(status != 0) {
+        errno = status;
+        die("Failed to start launcher");
+    }
+
+    return fds[0];
+}
+
+size_t launcher_pack(char* const commands[], char* buf, size_t buf_len) {
+    size_t len = 0;
+    for(size_t i = 0; commands[i] != NULL; i += 1) {
+        if(i == LAUNCHER_MAX_ARGS) { return 0; }
+
+        const size_t arg_len = strlen(commands[i]) + 1;
+        if(len + arg_len > buf_len) { return 0; }
+        memcpy(buf + len, commands[i], arg_len);
+        len += arg_len;
+    }
+
+    return len;
+}
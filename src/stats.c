@@ -0,0 +1,175 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+static const char* const command_names[STATS_CMD_MAX] = {
+    "list",
+    "configure",
+    "connect",
+    "disconnect",
+    "stats",
+    "trace-dump",
+    "jobs",
+    "cancel",
+    "events",
+    "counters",
+    "subscribe",
+    "scan",
+    "lookup",
+    "unknown"
+};
+
+static const char* const service_names[STATS_SERVICE_MAX] = {
+    "exec",
+    "write",
+    "ifconfig"
+};
+
+static size_t hist_index(uint64_t value) {
+    if(value < HIST_SUB_BUCKETS) { return value; }
+
+    const int msb = 63 - __builtin_clzll(value);
+    if(msb >= HIST_MAX_BITS) { return HIST_BUCKETS - 1; }
+
+    const size_t sub = (value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+    return HIST_SUB_BUCKETS + (msb - HIST_SUB_BITS) * HIST_SUB_BUCKETS + sub;
+}
+
+// Return the largest value that would be recorded into the given bucket.
+static uint64_t hist_bucket_value(size_t i) {
+    if(i < HIST_SUB_BUCKETS) { return i; }
+
+    const int msb = (i - HIST_SUB_BUCKETS) / HIST_SUB_BUCKETS + HIST_SUB_BITS;
+    const uint64_t sub = (i - HIST_SUB_BUCKETS) % HIST_SUB_BUCKETS;
+    const uint64_t width = 1ULL << (msb - HIST_SUB_BITS);
+    return (1ULL << msb) + (sub * width) + (width - 1);
+}
+
+void hist_record(struct hist* hist, uint64_t value) {
+    hist->count += 1;
+    hist->sum += value;
+    if(value > hist->max) { hist->max = value; }
+    hist->buckets[hist_index(value)] += 1;
+}
+
+uint64_t hist_percentile(const struct hist* hist, double percentile) {
+    if(hist->count == 0) { return 0; }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * hist->count + 0.5);
+    if(target < 1) { target = 1; }
+
+    uint64_t seen = 0;
+    for(size_t i = 0; i < HIST_BUCKETS; i += 1) {
+        seen += hist->buckets[i];
+        if(seen >= target) {
+            if(i == HIST_BUCKETS - 1) { return hist->max; }
+            const uint64_t value = hist_bucket_value(i);
+            return (value > hist->max)? hist->max : value;
+        }
+    }
+
+    return hist->max;
+}
+
+static void emit_u64(void(*f)(void*, const char*, const char*),
+                     void* ctx,
+                     const char* key,
+                     uint64_t value) {
+    char rendered[24];
+    snprintf(rendered, sizeof(rendered), "%" PRIu64, value);
+    f(ctx, key, rendered);
+}
+
+static void emit_hist(void(*f)(void*, const char*, const char*),
+                      void* ctx,
+                      const char* prefix,
+                      const struct hist* hist) {
+    static const struct {
+        const char* name;
+        double percentile;
+    } percentiles[] = {
+        {"p50", 50.0},
+        {"p90", 90.0},
+        {"p99", 99.0},
+        {"p999", 99.9}
+    };
+
+    char key[64];
+    snprintf(key, sizeof(key), "%s.count", prefix);
+    emit_u64(f, ctx, key, hist->count);
+    snprintf(key, sizeof(key), "%s.mean", prefix);
+    emit_u64(f, ctx, key, (hist->count > 0)? (hist->sum / hist->count) : 0);
+
+    for(size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i += 1) {
+        snprintf(key, sizeof(key), "%s.%s", prefix, percentiles[i].name);
+        emit_u64(f, ctx, key, hist_percentile(hist, percentiles[i].percentile));
+    }
+
+    snprintf(key, sizeof(key), "%s.max", prefix);
+    emit_u64(f, ctx, key, hist->max);
+}
+
+void stats_foreach(const struct stats* s,
+                   const struct spawn_stats* spawn,
+                   void(*f)(void*, const char*, const char*),
+                   void* ctx) {
+    char prefix[32];
+    for(size_t i = 0; i < STATS_CMD_MAX; i += 1) {
+        snprintf(prefix, sizeof(prefix), "cmd.%s", command_names[i]);
+        emit_hist(f, ctx, prefix, &s->commands[i]);
+    }
+
+    for(size_t i = 0; i < STATS_SERVICE_MAX; i += 1) {
+        snprintf(prefix, sizeof(prefix), "service.%s", service_names[i]);
+        emit_hist(f, ctx, prefix, &s->services[i]);
+    }
+
+    if(spawn != NULL) {
+        emit_u64(f, ctx, "spawn.failures", spawn->failures);
+        emit_u64(f, ctx, "spawn.timeouts", spawn->timeouts);
+        emit_u64(f, ctx, "spawn.cancellations", spawn->cancellations);
+        emit_hist(f, ctx, "spawn", &spawn->duration);
+    }
+
+    emit_u64(f, ctx, "conn.current", s->connections_current);
+    emit_u64(f, ctx, "conn.total", s->connections_total);
+    emit_u64(f, ctx, "conn.rejected", s->connections_rejected);
+    emit_u64(f, ctx, "conn.reaped", s->connections_reaped);
+    emit_u64(f, ctx, "accept.errors", s->accept_errors);
+    emit_u64(f, ctx, "bytes.in", s->bytes_in);
+    emit_u64(f, ctx, "bytes.out", s->bytes_out);
+    emit_hist(f, ctx, "conn.bytes_in", &s->conn_bytes_in);
+    emit_hist(f, ctx, "conn.bytes_out", &s->conn_bytes_out);
+    emit_u64(f, ctx, "route.processed", s->rtmsgs_processed);
+    emit_u64(f, ctx, "route.dropped", s->rtmsgs_dropped);
+    emit_u64(f, ctx, "subscribers.dropped", s->subscribers_dropped);
+    emit_u64(f, ctx, "hwevents.logged", s->hwevents_logged);
+    emit_u64(f, ctx, "hwevents.failed", s->hwevents_failed);
+    emit_u64(f, ctx, "hwevents.queued", s->hwevents_queued);
+    emit_u64(f, ctx, "hwevents.queued_max", s->hwevents_queued_max);
+    emit_u64(f, ctx, "snapshot.ifaces", s->snapshot_ifaces);
+    emit_u64(f, ctx, "snapshot.age", s->snapshot_age);
+    emit_u64(f, ctx, "snapshot.changes", s->snapshot_changes);
+    emit_u64(f, ctx, "ifconfig.native", s->ifconfig_native);
+    emit_u64(f, ctx, "ifconfig.fallback", s->ifconfig_fallback);
+    emit_u64(f, ctx, "scan.cached", s->scan_cached);
+    emit_u64(f, ctx, "scan.shared", s->scan_shared);
+    emit_u64(f, ctx, "list.cached", s->list_cached);
+    emit_u64(f, ctx, "list.encoded", s->list_encoded);
+    emit_u64(f, ctx, "list.ifconfig", s->list_ifconfig);
+    emit_u64(f, ctx, "busy.conn", s->busy_conn);
+    emit_u64(f, ctx, "busy.user", s->busy_user);
+    emit_u64(f, ctx, "limit.conn.rate", s->conn_limit.rate);
+    emit_u64(f, ctx, "limit.conn.burst", s->conn_limit.burst);
+    emit_u64(f, ctx, "limit.user.rate", s->user_limit.rate);
+    emit_u64(f, ctx, "limit.user.burst", s->user_limit.burst);
+    emit_u64(f, ctx, "limit.conn.max", s->connections_max);
+    emit_u64(f, ctx, "limit.idle_timeout", s->idle_timeout);
+    emit_u64(f, ctx, "limit.backlog", s->listen_backlog);
+    emit_u64(f, ctx, "counters.interval_ms", s->counters_interval);
+    emit_u64(f, ctx, "counters.failures", s->counters_failures);
+    emit_hist(f, ctx, "counters.sample", &s->counters_sample);
+}
+
+struct stats stats;
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ratelimit.h"
+
+// HDR-style histogram. Values below HIST_SUB_BUCKETS are recorded exactly;
+// above that, every power of two is split into HIST_SUB_BUCKETS linear
+// buckets, which keeps the relative error under 1/HIST_SUB_BUCKETS in a
+// fixed amount of memory. Values of 2^HIST_MAX_BITS and up are clamped.
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+enum stats_command {
+    STATS_CMD_LIST,
+    STATS_CMD_CONFIGURE,
+    STATS_CMD_CONNECT,
+    STATS_CMD_DISCONNECT,
+    STATS_CMD_STATS,
+    STATS_CMD_TRACE_DUMP,
+    STATS_CMD_JOBS,
+    STATS_CMD_CANCEL,
+    STATS_CMD_EVENTS,
+    STATS_CMD_COUNTERS,
+    STATS_CMD_SUBSCRIBE,
+    STATS_CMD_SCAN,
+    STATS_CMD_LOOKUP,
+    STATS_CMD_UNKNOWN,
+
+    STATS_CMD_MAX
+};
+
+enum stats_service {
+    STATS_SERVICE_EXEC,
+    STATS_SERVICE_WRITE,
+    STATS_SERVICE_IFCONFIG,
+
+    STATS_SERVICE_MAX
+};
+
+// Counters kept by service_exec, and shipped to the parent on request.
+struct spawn_stats {
+    uint64_t failures;
+    uint64_t timeouts;
+    uint64_t cancellations;
+    struct hist duration;
+};
+
+struct stats {
+    struct hist commands[STATS_CMD_MAX];
+    struct hist services[STATS_SERVICE_MAX];
+
+    // Per-connection byte counts, recorded when each connection closes
+    struct hist conn_bytes_in;
+    struct hist conn_bytes_out;
+
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connections_current;
+    uint64_t connections_total;
+    uint64_t connections_rejected;
+    uint64_t connections_reaped;
+    uint64_t accept_errors;
+    uint64_t rtmsgs_processed;
+    uint64_t rtmsgs_dropped;
+
+    // Event subscribers closed for falling too far behind
+    uint64_t subscribers_dropped;
+
+    // Link events written to the hardware event log, those that could not
+    // be, and those waiting their turn, now and at most
+    uint64_t hwevents_logged;
+    uint64_t hwevents_failed;
+    uint64_t hwevents_queued;
+    uint64_t hwevents_queued_max;
+
+    // The snapshot loaded at startup: how many interfaces it held, how old
+    // it was in seconds, and how many link changes it had missed
+    uint64_t snapshot_ifaces;
+    uint64_t snapshot_age;
+    uint64_t snapshot_changes;
+
+    // Interface changes made by service_ifconfig, and those left to the
+    // external programs
+    uint64_t ifconfig_native;
+    uint64_t ifconfig_fallback;
+
+    // Wireless scans answered from the cache, and those that waited on a
+    // scan another client had already started
+    uint64_t scan_cached;
+    uint64_t scan_shared;
+
+    // Interfaces listed from their cached encodings, and those encoded
+    // because they had changed since, and the ifconfig runs made for list
+    uint64_t list_cached;
+    uint64_t list_encoded;
+    uint64_t list_ifconfig;
+
+    // Commands refused as busy, by which limit refused them, and the limits
+    // themselves
+    uint64_t busy_conn;
+    uint64_t busy_user;
+    struct ratelimit conn_limit;
+    struct ratelimit user_limit;
+
+    // Listening socket and connection limits. An idle timeout, in seconds,
+    // or a connection limit of zero means none.
+    uint32_t listen_backlog;
+    uint32_t connections_max;
+    uint32_t idle_timeout;
+
+    // Interface counter sampling: the time each sample takes, samples that
+    // failed, and the current interval in milliseconds, or zero if off
+    struct hist counters_sample;
+    uint64_t counters_failures;
+    uint32_t counters_interval;
+};
+
+void hist_record(struct hist*, uint64_t);
+uint64_t hist_percentile(const struct hist*, double);
+
+// Call the given function once for every rendered statistic, in a stable
+// order. Latencies are given in microseconds.
+void stats_foreach(const struct stats*,
+                   const struct spawn_stats*,
+                   void(*)(void*, const char*, const char*),
+                   void*);
+
+extern struct stats stats;
@@ -0,0 +1,86 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+static const char* const process_names[TRACE_PROCESS_MAX] = {
+    "parent",
+    "exec",
+    "write",
+    "ifconfig"
+};
+
+static const char* const point_names[TRACE_POINT_MAX] = {
+    "accept",
+    "parse",
+    "dispatch",
+    "imsg-send",
+    "imsg-receive",
+    "spawn",
+    "child-exit",
+    "reply-flush"
+};
+
+// Each process only has a single writer, but the head is advanced
+// atomically so that a record is never torn if a trace point is ever
+// reached from a signal handler.
+static struct trace_record ring[TRACE_RING_LEN];
+static uint64_t ring_head;
+static enum trace_process ring_process;
+
+void trace_init(enum trace_process process) {
+    ring_process = process;
+    ring_head = 0;
+}
+
+void trace_point(enum trace_point point, uint32_t request) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    const uint64_t slot = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    struct trace_record* record = &ring[slot & (TRACE_RING_LEN - 1)];
+    record->timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record->request = request;
+    record->point = point;
+    record->process = ring_process;
+}
+
+size_t trace_copy(struct trace_record* buf, size_t buf_len) {
+    const uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    uint64_t start = (head > TRACE_RING_LEN)? head - TRACE_RING_LEN : 0;
+    if(head - start > buf_len) { start = head - buf_len; }
+
+    size_t n = 0;
+    for(uint64_t i = start; i < head; i += 1) {
+        buf[n++] = ring[i & (TRACE_RING_LEN - 1)];
+    }
+
+    return n;
+}
+
+int trace_render(const struct trace_record* record, char* buf, size_t buf_len) {
+    if(record->point >= TRACE_POINT_MAX || record->process >= TRACE_PROCESS_MAX) {
+        return 1;
+    }
+
+    // Chrome traces use microseconds; each request gets its own track
+    const int n = snprintf(buf, buf_len,
+        "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ".%03" PRIu64 ","
+        "\"pid\":%u,\"tid\":%" PRIu32 "}",
+        point_names[record->point],
+        record->timestamp / 1000,
+        record->timestamp % 1000,
+        record->process,
+        record->request);
+    return (n < 0 || (size_t)n >= buf_len);
+}
+
+int trace_render_process(enum trace_process process, char* buf, size_t buf_len) {
+    const int n = snprintf(buf, buf_len,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+        "\"args\":{\"name\":\"%s\"}}",
+        process,
+        process_names[process]);
+    return (n < 0 || (size_t)n >= buf_len);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compile with -DTRACE to record trace points. Otherwise TRACE_POINT()
+// compiles to nothing.
+
+#define TRACE_RING_LEN 512
+
+enum trace_process {
+    TRACE_PROCESS_PARENT,
+    TRACE_PROCESS_EXEC,
+    TRACE_PROCESS_WRITE,
+    TRACE_PROCESS_IFCONFIG,
+
+    TRACE_PROCESS_MAX
+};
+
+enum trace_point {
+    TRACE_ACCEPT,
+    TRACE_PARSE,
+    TRACE_DISPATCH,
+    TRACE_IMSG_SEND,
+    TRACE_IMSG_RECEIVE,
+    TRACE_SPAWN,
+    TRACE_CHILD_EXIT,
+    TRACE_REPLY_FLUSH,
+
+    TRACE_POINT_MAX
+};
+
+struct trace_record {
+    uint64_t timestamp;
+    uint32_t request;
+    uint16_t point;
+    uint16_t process;
+};
+
+#ifdef TRACE
+#define TRACE_POINT(point, request) trace_point((point), (request))
+#else
+#define TRACE_POINT(point, request) do {} while(0)
+#endif
+
+void trace_init(enum trace_process);
+void trace_point(enum trace_point, uint32_t);
+
+// Copy the ring's contents, oldest first, into the given buffer. Returns the
+// number of records copied.
+size_t trace_copy(struct trace_record*, size_t);
+
+// Render a record as a Chrome trace event object.
+int trace_render(const struct trace_record*, char*, size_t);
+int trace_render_process(enum trace_process, char*, size_t);
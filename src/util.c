@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include "util.h"
 
 void cleanup(void) {}
@@ -30,3 +31,15 @@ char* chomp(char* text) {
 int min(int a, int b) {
     return (a < b)? a : b;
 }
+
+uint64_t now_usec(void) {
+    struct timespec ts;
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) { die("Failed to read clock"); }
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint64_t wall_usec(void) {
+    struct timespec ts;
+    if(clock_gettime(CLOCK_REALTIME, &ts) != 0) { die("Failed to read clock"); }
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
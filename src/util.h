@@ -1,8 +1,16 @@
 #pragma once
 
+#include <stdint.h>
+
 void cleanup(void);
 void die(const char* msg) __attribute__ ((noreturn));
 void warn(const char* msg);
 
 char* chomp(char*);
 int min(int, int);
+
+// Microseconds on the monotonic clock
+uint64_t now_usec(void);
+
+// Microseconds since the epoch
+uint64_t wall_usec(void);
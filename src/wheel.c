@@ -0,0 +1,65 @@
+#include "wheel.h"
+
+void wheel_init(struct wheel* wheel, uint64_t now) {
+    for(size_t i = 0; i < WHEEL_SLOTS; i += 1) {
+        TAILQ_INIT(&wheel->slots[i]);
+    }
+
+    wheel->now = now;
+}
+
+static void wheel_insert(struct wheel* wheel, struct wheel_entry* entry) {
+    entry->slot = entry->deadline % WHEEL_SLOTS;
+    TAILQ_INSERT_TAIL(&wheel->slots[entry->slot], entry, entries);
+    entry->queued = true;
+}
+
+void wheel_schedule(struct wheel* wheel, struct wheel_entry* entry, uint64_t deadline) {
+    // A later deadline is picked up when the entry's current slot comes up
+    if(entry->queued && deadline >= entry->deadline) {
+        entry->deadline = deadline;
+        return;
+    }
+
+    wheel_cancel(wheel, entry);
+    entry->deadline = deadline;
+    wheel_insert(wheel, entry);
+}
+
+void wheel_cancel(struct wheel* wheel, struct wheel_entry* entry) {
+    if(!entry->queued) { return; }
+
+    TAILQ_REMOVE(&wheel->slots[entry->slot], entry, entries);
+    entry->queued = false;
+}
+
+size_t wheel_advance(struct wheel* wheel, uint64_t now, void(*expire)(void*)) {
+    size_t expired = 0;
+
+    // Every slot is visited at most once, however far the clock has jumped
+    uint64_t tick = wheel->now + 1;
+    if(now >= WHEEL_SLOTS && tick < now - WHEEL_SLOTS + 1) { tick = now - WHEEL_SLOTS + 1; }
+
+    for(; tick <= now; tick += 1) {
+        // Entries may go back into this same slot, so work from a copy
+        struct wheel_slot due;
+        TAILQ_INIT(&due);
+        TAILQ_CONCAT(&due, &wheel->slots[tick % WHEEL_SLOTS], entries);
+
+        struct wheel_entry* entry;
+        while((entry = TAILQ_FIRST(&due)) != NULL) {
+            TAILQ_REMOVE(&due, entry, entries);
+            entry->queued = false;
+
+            if(entry->deadline <= now) {
+                expired += 1;
+                expire(entry->owner);
+            } else {
+                wheel_insert(wheel, entry);
+            }
+        }
+    }
+
+    if(now > wheel->now) { wheel->now = now; }
+    return expired;
+}
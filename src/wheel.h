@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+// Hashed timer wheel with one-second ticks. Each entry sits in the slot for
+// its deadline, modulo the number of slots, and is checked when the wheel
+// turns past that slot. Deadlines further out than the wheel's span simply
+// go round again.
+//
+// Pushing a deadline back is the common case, and is free: the entry stays
+// where it is until its old slot comes up, and is then moved. Entries
+// remember which slot they are in, since it may no longer match their
+// deadline.
+#define WHEEL_SLOTS 64
+
+struct wheel_entry {
+    uint64_t deadline;
+    void* owner;
+    size_t slot;
+    bool queued;
+    TAILQ_ENTRY(wheel_entry) entries;
+};
+
+TAILQ_HEAD(wheel_slot, wheel_entry);
+
+struct wheel {
+    struct wheel_slot slots[WHEEL_SLOTS];
+    uint64_t now;
+};
+
+void wheel_init(struct wheel*, uint64_t);
+
+// Set an entry's deadline, in seconds, queueing it if need be
+void wheel_schedule(struct wheel*, struct wheel_entry*, uint64_t);
+
+void wheel_cancel(struct wheel*, struct wheel_entry*);
+
+// Turn the wheel to the given time, calling the given function with the
+// owner of each entry whose deadline has passed. Expired entries are
+// removed before the call. Returns the number expired.
+size_t wheel_advance(struct wheel*, uint64_t, void(*)(void*));
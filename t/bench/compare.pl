@@ -0,0 +1,63 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+
+use Pod::Usage;
+use Getopt::Long;
+
+# Compare two microbench result files, and fail if any benchmark slowed down
+# by more than the given threshold.
+
+sub load {
+    my ($path) = @_;
+    my %results = ();
+
+    open my $fh, '<', $path or die "Failed to open $path: $!\n";
+    while(my $line = <$fh>) {
+        chomp $line;
+        next if $line =~ /^\#/xms;
+
+        my ($name, $iterations, $ns_per_op) = split /\t/xms, $line;
+        next if !defined $ns_per_op;
+        $results{$name} = $ns_per_op;
+    }
+    close $fh or die "Failed to close $path: $!\n";
+
+    return %results;
+}
+
+sub main {
+    my $threshold = 10;
+    GetOptions('threshold=f' => \$threshold) or pod2usage(2);
+    pod2usage(1) if $#ARGV != 1;
+
+    my %old = load($ARGV[0]);
+    my %new = load($ARGV[1]);
+
+    my $regressions = 0;
+    foreach my $name (sort keys %new) {
+        next if !exists $old{$name} || $old{$name} <= 0;
+
+        my $change = 100 * ($new{$name} - $old{$name}) / $old{$name};
+        my $flag = ($change > $threshold)? 'REGRESSION' : '';
+        if($flag) { $regressions += 1; }
+
+        printf("%-32s%12.1f%12.1f%+9.1f%%  %s\n", $name, $old{$name}, $new{$name}, $change, $flag);
+    }
+
+    return $regressions? 1 : 0;
+}
+
+exit main();
+
+__END__
+
+=head1 NAME
+
+compare.pl - Compare microbench results
+
+=head1 SYNOPSIS
+
+compare.pl [--threshold <percent>] <old.tsv> <new.tsv>
+
+=cut
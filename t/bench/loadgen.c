@@ -0,0 +1,292 @@
+// Load generator for networkd's control socket. Opens a number of concurrent
+// connections, keeps a fixed number of requests in flight on each, and
+// reports throughput and latency percentiles.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+#include "util.h"
+
+#define MAX_DEPTH 64
+#define MAX_CONNECTIONS 1024
+
+enum command {
+    COMMAND_LIST,
+    COMMAND_CONFIGURE,
+    COMMAND_CONNECT,
+    COMMAND_DISCONNECT,
+    COMMAND_STATS,
+
+    COMMAND_MAX
+};
+
+static const char* const command_names[COMMAND_MAX] = {
+    "list",
+    "configure",
+    "connect",
+    "disconnect",
+    "stats"
+};
+
+struct client {
+    int fd;
+
+    // Replies arrive in request order, so outstanding requests form a queue
+    uint64_t sent_at[MAX_DEPTH];
+    enum command sent[MAX_DEPTH];
+    size_t head;
+    size_t outstanding;
+
+    // Start of the reply line currently being read, to tell ok from error
+    char line[8];
+    size_t line_len;
+
+    char out[MAX_DEPTH * 64];
+    size_t out_len;
+};
+
+static struct hist latency;
+static struct hist command_latency[COMMAND_MAX];
+static uint64_t errors;
+static int weights[COMMAND_MAX];
+static int total_weight;
+static const char* iface = "em0";
+
+static void usage(void) {
+    fprintf(stderr, "usage: loadgen [-s sockpath] [-c connections] [-p depth] "
+                    "[-d seconds] [-m command=weight,...] [-i iface]\n");
+    exit(1);
+}
+
+static void parse_mix(char* mix) {
+    memset(weights, 0, sizeof(weights));
+    total_weight = 0;
+
+    char* cursor;
+    while((cursor = strsep(&mix, ",")) != NULL) {
+        char* weight = strchr(cursor, '=');
+        if(weight != NULL) { *weight++ = '\0'; }
+
+        int i;
+        for(i = 0; i < COMMAND_MAX; i += 1) {
+            if(strcmp(cursor, command_names[i]) == 0) { break; }
+        }
+
+        if(i == COMMAND_MAX) { usage(); }
+        weights[i] = (weight == NULL)? 1 : atoi(weight);
+        total_weight += weights[i];
+    }
+
+    if(total_weight <= 0) { usage(); }
+}
+
+static enum command pick_command(void) {
+    int r = random() % total_weight;
+    for(int i = 0; i < COMMAND_MAX; i += 1) {
+        if(r < weights[i]) { return i; }
+        r -= weights[i];
+    }
+
+    return COMMAND_LIST;
+}
+
+static int connect_socket(const char* sockpath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sockpath, sizeof(addr.sun_path)-1);
+
+    // The daemon may still be starting up
+    for(int attempt = 0; attempt < 50; attempt += 1) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) { die("Failed to create socket"); }
+
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            if(fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+                die("Error changing to non-blocking mode");
+            }
+            return fd;
+        }
+
+        close(fd);
+        struct timespec ts = {0, 100 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+
+    die("Failed to connect");
+}
+
+static void client_flush(struct client* client) {
+    while(client->out_len > 0) {
+        ssize_t n = write(client->fd, client->out, client->out_len);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR) { return; }
+            die("Error writing request");
+        }
+
+        client->out_len -= n;
+        memmove(client->out, client->out + n, client->out_len);
+    }
+}
+
+static void client_fill(struct client* client, size_t depth) {
+    while(client->outstanding < depth) {
+        const enum command command = pick_command();
+        char* out = client->out + client->out_len;
+        const size_t space = sizeof(client->out) - client->out_len;
+
+        int n;
+        if(command == COMMAND_CONFIGURE) {
+            n = snprintf(out, space, "[\"configure\", \"%s\", \"dhcp\"]\n", iface);
+        } else if(command == COMMAND_CONNECT || command == COMMAND_DISCONNECT) {
+            n = snprintf(out, space, "[\"%s\", \"%s\"]\n", command_names[command], iface);
+        } else {
+            n = snprintf(out, space, "[\"%s\"]\n", command_names[command]);
+        }
+
+        if(n < 0 || (size_t)n >= space) { break; }
+        client->out_len += n;
+
+        const size_t slot = (client->head + client->outstanding) % MAX_DEPTH;
+        client->sent[slot] = command;
+        client->sent_at[slot] = now_usec();
+        client->outstanding += 1;
+    }
+
+    client_flush(client);
+}
+
+static void client_reply(struct client* client, uint64_t now) {
+    if(client->outstanding == 0) { die("Unexpected reply"); }
+
+    const size_t slot = client->head;
+    const uint64_t elapsed = now - client->sent_at[slot];
+    hist_record(&latency, elapsed);
+    hist_record(&command_latency[client->sent[slot]], elapsed);
+
+    if(client->line_len < 5 || strncmp(client->line, "[\"ok\"", 5) != 0) {
+        errors += 1;
+    }
+
+    client->head = (client->head + 1) % MAX_DEPTH;
+    client->outstanding -= 1;
+    client->line_len = 0;
+}
+
+static bool client_read(struct client* client) {
+    char buf[8192];
+    ssize_t n_read;
+    while((n_read = read(client->fd, buf, sizeof(buf))) > 0) {
+        const uint64_t now = now_usec();
+        for(ssize_t i = 0; i < n_read; i += 1) {
+            if(buf[i] == '\n') {
+                client_reply(client, now);
+            } else if(client->line_len < sizeof(client->line)) {
+                client->line[client->line_len++] = buf[i];
+            }
+        }
+    }
+
+    if(n_read == 0) { return false; }
+    return errno == EAGAIN || errno == EINTR;
+}
+
+static void report_hist(const char* name, const struct hist* hist) {
+    if(hist->count == 0) { return; }
+
+    printf("%-12s count %-8" PRIu64 " p50 %-8" PRIu64 " p99 %-8" PRIu64
+           " p999 %-8" PRIu64 " max %" PRIu64 "\n",
+           name,
+           hist->count,
+           hist_percentile(hist, 50.0),
+           hist_percentile(hist, 99.0),
+           hist_percentile(hist, 99.9),
+           hist->max);
+}
+
+int main(int argc, char** argv) {
+    const char* sockpath = "/var/run/networkd.sock";
+    int n_clients = 8;
+    int depth = 4;
+    int seconds = 10;
+    char default_mix[] = "list=4,configure=1,connect=1,disconnect=1";
+    parse_mix(default_mix);
+
+    int ch;
+    while((ch = getopt(argc, argv, "s:c:p:d:m:i:")) != -1) {
+        switch(ch) {
+            case 's': sockpath = optarg; break;
+            case 'c': n_clients = atoi(optarg); break;
+            case 'p': depth = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'm': parse_mix(optarg); break;
+            case 'i': iface = optarg; break;
+            default: usage();
+        }
+    }
+
+    if(n_clients < 1 || n_clients > MAX_CONNECTIONS) { usage(); }
+    if(depth < 1 || depth > MAX_DEPTH) { usage(); }
+    if(seconds < 1) { usage(); }
+
+    static struct client clients[MAX_CONNECTIONS];
+    static struct pollfd pollfds[MAX_CONNECTIONS];
+    for(int i = 0; i < n_clients; i += 1) {
+        clients[i].fd = connect_socket(sockpath);
+        pollfds[i].fd = clients[i].fd;
+        client_fill(&clients[i], depth);
+    }
+
+    const uint64_t start = now_usec();
+    const uint64_t deadline = start + (uint64_t)seconds * 1000000;
+    uint64_t now = start;
+    while(now < deadline) {
+        for(int i = 0; i < n_clients; i += 1) {
+            pollfds[i].events = POLLIN | ((clients[i].out_len > 0)? POLLOUT : 0);
+        }
+
+        if(poll(pollfds, n_clients, 100) < 0 && errno != EINTR) {
+            die("Error polling");
+        }
+
+        for(int i = 0; i < n_clients; i += 1) {
+            if(pollfds[i].revents & (POLLIN | POLLHUP)) {
+                if(!client_read(&clients[i])) { die("Server hung up"); }
+            }
+
+            client_fill(&clients[i], depth);
+        }
+
+        now = now_usec();
+    }
+
+    const double elapsed = (now - start) / 1000000.0;
+    printf("connections  %d\n", n_clients);
+    printf("depth        %d\n", depth);
+    printf("seconds      %.2f\n", elapsed);
+    printf("requests     %" PRIu64 "\n", latency.count);
+    printf("errors       %" PRIu64 "\n", errors);
+    printf("throughput   %.1f req/s\n", latency.count / elapsed);
+    printf("latency (us)\n");
+    report_hist("all", &latency);
+    for(int i = 0; i < COMMAND_MAX; i += 1) {
+        report_hist(command_names[i], &command_latency[i]);
+    }
+
+    for(int i = 0; i < n_clients; i += 1) {
+        close(clients[i].fd);
+    }
+
+    return 0;
+}
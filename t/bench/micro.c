@@ -0,0 +1,239 @@
+// Microbenchmarks for the parsing and encoding functions on every request's
+// path. Output is tab-separated, one benchmark per line, so that runs from
+// different commits can be compared with t/bench/compare.pl.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "flatjson.h"
+#include "util.h"
+#include "validate.h"
+
+#define ESCAPED_LEN (64 * 1024)
+#define DUMP_IFACES 4096
+
+struct bench {
+    const char* name;
+    void(*setup)(void);
+    void(*f)(void);
+    size_t bytes;
+};
+
+static const char request[] = "[\"configure\", \"em0\", \"inet 192.168.1.5 255.255.255.0 192.168.1.255\", \"rtsol\"]";
+static const char iface_good[] = "vlan1234";
+static const char iface_bad[] = "../etc/passwd";
+static const char stanza_inet[] = "inet 192.168.1.5 255.255.255.0 192.168.1.255";
+static const char stanza_inet6[] = "inet6 2001:db8::1 ffff:ffff:ffff:ffff:: 2001:db8::ffff";
+static const char stanza_bad[] = "!run /bin/sh";
+
+// Results are folded into here so that the compiler cannot discard the work
+static volatile uintptr_t sink;
+
+static char* escaped_json;
+static char* escape_input;
+static char* escape_output;
+static char* unescape_output;
+static char* dump;
+static char* dump_copy;
+static size_t dump_len;
+static char pseudo_classes[PSEUDO_CLASSES_LEN];
+
+static void setup_escaped(void) {
+    // A single JSON string where every fourth character is escaped
+    escaped_json = malloc(ESCAPED_LEN + 3);
+    unescape_output = malloc(ESCAPED_LEN);
+    if(escaped_json == NULL || unescape_output == NULL) { die("Failed to allocate corpus"); }
+
+    size_t i = 0;
+    escaped_json[i++] = '"';
+    while(i < ESCAPED_LEN - 2) {
+        const char* chunk = ((i / 5) % 2 == 0)? "ab\\nc" : "de\\\"f";
+        memcpy(escaped_json + i, chunk, 5);
+        i += 5;
+    }
+    escaped_json[i++] = '"';
+    escaped_json[i] = '\0';
+}
+
+static void setup_escape(void) {
+    escape_input = malloc(ESCAPED_LEN + 1);
+    escape_output = malloc(ESCAPED_LEN * 2 + 2);
+    if(escape_input == NULL || escape_output == NULL) { die("Failed to allocate corpus"); }
+
+    for(size_t i = 0; i < ESCAPED_LEN; i += 1) {
+        escape_input[i] = (i % 8 == 0)? '"' : (i % 8 == 4)? '\n' : 'a' + (i % 26);
+    }
+    escape_input[ESCAPED_LEN] = '\0';
+}
+
+static void setup_dump(void) {
+    size_t cap = DUMP_IFACES * 512;
+    dump = malloc(cap);
+    dump_copy = malloc(cap);
+    if(dump == NULL || dump_copy == NULL) { die("Failed to allocate corpus"); }
+
+    size_t len = 0;
+    for(int i = 0; i < DUMP_IFACES; i += 1) {
+        const int n = snprintf(dump + len, cap - len,
+            "vlan%d: flags=8843<UP,BROADCAST,RUNNING,SIMPLEX,MULTICAST> mtu 1500\n"
+            "\tlladdr 00:1b:21:3c:%02x:%02x\n"
+            "\tindex %d priority 0 llprio 3\n"
+            "\tencap: vnetid %d parent em0 txprio packet rxprio outer\n"
+            "\tgroups: vlan\n"
+            "\tmedia: Ethernet autoselect (1000baseT full-duplex)\n"
+            "\tstatus: active\n"
+            "\tinet 10.%d.%d.1 netmask 0xffffff00 broadcast 10.%d.%d.255\n"
+            "\tinet6 fe80::21b:21ff:fe3c:%x%%vlan%d prefixlen 64 scopeid 0x%x\n"
+            "\tinet6 2001:db8:%x::1 prefixlen 64\n",
+            i, (i >> 8) & 0xff, i & 0xff, i + 5, i + 1,
+            (i >> 8) & 0xff, i & 0xff, (i >> 8) & 0xff, i & 0xff,
+            i, i, i + 5, i);
+        if(n < 0 || (size_t)n >= cap - len) { die("Corpus overflow"); }
+        len += n;
+    }
+
+    dump_len = len;
+}
+
+static void setup_pseudo(void) {
+    // Fill the list to its limit, with the class we look for at the very end
+    size_t len = 0;
+    for(int i = 0; len + 8 < sizeof(pseudo_classes); i += 1) {
+        len += snprintf(pseudo_classes + len, sizeof(pseudo_classes) - len,
+                        "%s%c%c%c", (i == 0)? "" : " ",
+                        'a' + (i % 26), 'a' + ((i / 26) % 26), 'q');
+    }
+
+    strlcat(pseudo_classes, " vlan", sizeof(pseudo_classes));
+}
+
+static void bench_flatjson_next_request(void) {
+    char buf[64];
+    const char* cursor = request;
+    while((cursor = flatjson_next(cursor, buf, sizeof(buf), NULL)) != NULL) {
+        sink += buf[0];
+    }
+}
+
+static void bench_command_parse(void) {
+    static struct command command;
+    sink += (uintptr_t)command_parse(request, &command);
+    sink += command.n_stanzas;
+}
+
+static void bench_flatjson_next_escaped(void) {
+    sink += (uintptr_t)flatjson_next(escaped_json, unescape_output, ESCAPED_LEN, NULL);
+}
+
+static void bench_flatjson_escape(void) {
+    sink += flatjson_escape(escape_input, escape_output, ESCAPED_LEN * 2 + 2);
+}
+
+static void bench_validate_iface(void) {
+    sink += validate_iface(iface_good);
+    sink += validate_iface(iface_bad);
+}
+
+static void bench_validate_stanza(void) {
+    sink += validate_stanza(stanza_inet);
+    sink += validate_stanza(stanza_inet6);
+    sink += validate_stanza(stanza_bad);
+}
+
+static void bench_parse_ifconfig(void) {
+    char iface[IF_NAMESIZE];
+    char flags[FLAGS_LEN];
+    char key[IFCONFIG_KEY_LEN];
+    int mtu;
+
+    memcpy(dump_copy, dump, dump_len + 1);
+    char* text = dump_copy;
+    char* cursor;
+    while((cursor = strsep(&text, "\n")) != NULL) {
+        if(parse_ifconfig_header(cursor, iface, flags, &mtu)) {
+            sink += mtu;
+        } else if(parse_ifconfig_kv(cursor, key, flags)) {
+            sink += key[0];
+        }
+    }
+}
+
+static void bench_iface_is_pseudo_hit(void) {
+    sink += iface_is_pseudo("vlan1234", pseudo_classes);
+}
+
+static void bench_iface_is_pseudo_miss(void) {
+    sink += iface_is_pseudo("em0", pseudo_classes);
+}
+
+static const struct bench benches[] = {
+    {"flatjson_next/request", NULL, bench_flatjson_next_request, sizeof(request) - 1},
+    {"command_parse/configure", NULL, bench_command_parse, sizeof(request) - 1},
+    {"flatjson_next/escaped-64k", setup_escaped, bench_flatjson_next_escaped, ESCAPED_LEN},
+    {"flatjson_escape/64k", setup_escape, bench_flatjson_escape, ESCAPED_LEN},
+    {"validate_iface", NULL, bench_validate_iface,
+        sizeof(iface_good) + sizeof(iface_bad) - 2},
+    {"validate_stanza", NULL, bench_validate_stanza,
+        sizeof(stanza_inet) + sizeof(stanza_inet6) + sizeof(stanza_bad) - 3},
+    {"parse_ifconfig/4096-ifaces", setup_dump, bench_parse_ifconfig, 0},
+    {"iface_is_pseudo/hit", setup_pseudo, bench_iface_is_pseudo_hit, PSEUDO_CLASSES_LEN},
+    {"iface_is_pseudo/miss", setup_pseudo, bench_iface_is_pseudo_miss, PSEUDO_CLASSES_LEN},
+};
+
+static void run(const struct bench* bench, uint64_t min_usec) {
+    if(bench->setup != NULL) { bench->setup(); }
+    const size_t bytes = (bench->bytes > 0)? bench->bytes : dump_len;
+
+    // Warm up, then keep doubling the iteration count until a run takes
+    // long enough to time reliably.
+    bench->f();
+
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    while(1) {
+        const uint64_t start = now_usec();
+        for(uint64_t i = 0; i < iterations; i += 1) {
+            bench->f();
+        }
+        elapsed = now_usec() - start;
+
+        if(elapsed >= min_usec) { break; }
+        iterations *= 2;
+    }
+
+    const double ns_per_op = (elapsed * 1000.0) / iterations;
+    const double bytes_per_sec = (bytes * iterations) / (elapsed / 1000000.0);
+    printf("%s\t%" PRIu64 "\t%.1f\t%.0f\n", bench->name, iterations, ns_per_op, bytes_per_sec);
+    fflush(stdout);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: microbench [-t min-milliseconds] [filter]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    uint64_t min_usec = 200 * 1000;
+
+    int ch;
+    while((ch = getopt(argc, argv, "t:")) != -1) {
+        switch(ch) {
+            case 't': min_usec = strtoull(optarg, NULL, 10) * 1000; break;
+            default: usage();
+        }
+    }
+
+    const char* filter = (optind < argc)? argv[optind] : NULL;
+
+    printf("# name\titerations\tns/op\tbytes/sec\n");
+    for(size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i += 1) {
+        if(filter != NULL && strstr(benches[i].name, filter) == NULL) { continue; }
+        run(&benches[i], min_usec);
+    }
+
+    return 0;
+}
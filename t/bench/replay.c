@@ -0,0 +1,566 @@
+// Record and replay interface event storms. Recording saves the raw messages
+// read from the routing socket, with their timing, into a trace. Replaying
+// starts networkd with one end of a socketpair standing in for the routing
+// socket, writes the trace into the other end at its original pace or faster,
+// and reports how quickly the events came back out to a subscriber.
+//
+// A trace is a header followed by one record per message: the microseconds
+// since the previous message and the message's length, both as LEB128
+// varints, and then the message itself. Traces start with an arrival for
+// every interface that was present when recording began, so that networkd
+// knows their names. Traces can only be replayed on the system they were
+// recorded on, since the messages are in its own format.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#include "iftable.h"
+#include "libnetworkd.h"
+#include "monitor.h"
+#include "stats.h"
+#include "util.h"
+
+#define TRACE_MAGIC "NWDRTTR"
+#define TRACE_VERSION 1
+
+// Large enough for any one routing message, or one batch of netlink messages
+#define MESSAGE_LEN 8192
+
+// How long to wait for events still owed once the trace has been written
+#define DRAIN_TIMEOUT_MS 2000
+
+// How long to wait for networkd to log the events to the hardware event log,
+// once they have all been received
+#define LOG_TIMEOUT_MS 60000
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    char sysname[16];
+};
+
+struct message {
+    // Microseconds from the start of the trace
+    uint64_t offset;
+    const char* data;
+    size_t len;
+
+    // Link changes in the message, each of which networkd turns into an event
+    size_t events;
+};
+
+static volatile sig_atomic_t interrupted;
+
+static struct hist latency;
+
+// When each event that networkd owes a subscriber was written, oldest first
+static uint64_t* owed;
+static size_t owed_head;
+static size_t owed_len;
+static uint64_t unexpected;
+
+// The hardware event log's statistics, from the last stats reply
+static uint64_t hwevents_logged;
+static uint64_t hwevents_failed;
+static uint64_t hwevents_queued;
+
+static void usage(void) {
+    fputs("usage: rtreplay record [-d seconds] <trace>\n"
+          "       rtreplay synth [-i ifaces] [-f flaps] [-p usec] <trace>\n"
+          "       rtreplay replay [-x speed] [-n networkd] [-s sockpath] [-l log] <trace>\n",
+          stderr);
+    exit(1);
+}
+
+static void on_interrupt(int signo) {
+    interrupted = 1;
+}
+
+static void write_varint(FILE* f, uint64_t value) {
+    do {
+        const unsigned char byte = (value & 0x7f) | ((value > 0x7f)? 0x80 : 0);
+        fputc(byte, f);
+        value >>= 7;
+    } while(value > 0);
+}
+
+static bool read_varint(const char** cursor, const char* end, uint64_t* value) {
+    *value = 0;
+    for(unsigned int shift = 0; shift < 64; shift += 7) {
+        if(*cursor == end) { return false; }
+
+        const unsigned char byte = **cursor;
+        *cursor += 1;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0) { return true; }
+    }
+
+    return false;
+}
+
+static FILE* trace_create(const char* path) {
+    FILE* f = fopen(path, "w");
+    if(f == NULL) { die("Failed to create trace"); }
+
+    struct utsname name;
+    if(uname(&name) == -1) { die("Failed to get system name"); }
+
+    struct trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    strlcpy(header.sysname, name.sysname, sizeof(header.sysname));
+    fwrite(&header, sizeof(header), 1, f);
+    return f;
+}
+
+static void trace_write(FILE* f, uint64_t delta, const char* data, size_t len) {
+    write_varint(f, delta);
+    write_varint(f, len);
+    fwrite(data, 1, len, f);
+}
+
+static void trace_write_event(FILE* f, uint64_t delta, const struct link_event* event) {
+    static char buf[MESSAGE_LEN] __attribute__((aligned(8)));
+    const size_t len = monitor_encode(event, buf, sizeof(buf));
+    if(len == 0) { die("Failed to encode event"); }
+    trace_write(f, delta, buf, len);
+}
+
+// Announce every interface that is already present
+static size_t trace_write_ifaces(FILE* f) {
+    if(!monitor_init()) { die("Failed to read ifaces"); }
+
+    struct iftable table;
+    iftable_init(&table);
+    if(!monitor_scan(&table)) { die("Failed to read ifaces"); }
+
+    size_t n = 0;
+    for(size_t i = 0; i < table.len; i += 1) {
+        const char* name = iftable_name(&table, i);
+        if(name == NULL) { continue; }
+
+        struct link_event event;
+        memset(&event, 0, sizeof(event));
+        event.type = LINK_EVENT_ARRIVAL;
+        event.ifindex = i;
+        event.flags = table.flags[i];
+        event.mtu = table.mtu[i];
+        event.up = table.link[i] == HISTORY_LINK_UP;
+        strlcpy(event.name, name, sizeof(event.name));
+        trace_write_event(f, 0, &event);
+        n += 1;
+    }
+
+    iftable_free(&table);
+    return n;
+}
+
+static int record(int argc, char** argv) {
+    unsigned long seconds = 0;
+    int c;
+    while((c = getopt(argc, argv, "d:")) != -1) {
+        switch(c) {
+            case 'd': seconds = strtoul(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if(optind != argc - 1) { usage(); }
+
+    const int monitor = monitor_ifaces();
+    if(monitor < 0) { die("Failed to monitor ifaces"); }
+
+    FILE* f = trace_create(argv[optind]);
+    const size_t n_ifaces = trace_write_ifaces(f);
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    const uint64_t start = now_usec();
+    const uint64_t deadline = start + (uint64_t)seconds * 1000000;
+    uint64_t last = start;
+    uint64_t n = 0;
+    while(!interrupted && (seconds == 0 || now_usec() < deadline)) {
+        struct pollfd pfd = {monitor, POLLIN, 0};
+        if(poll(&pfd, 1, 100) <= 0) { continue; }
+
+        static char buf[MESSAGE_LEN];
+        const ssize_t len = recv(monitor, buf, sizeof(buf), MSG_DONTWAIT);
+        if(len <= 0) { continue; }
+
+        const uint64_t now = now_usec();
+        trace_write(f, now - last, buf, len);
+        last = now;
+        n += 1;
+    }
+
+    if(fclose(f) != 0) { die("Failed to write trace"); }
+    printf("ifaces       %zu\n", n_ifaces);
+    printf("messages     %" PRIu64 "\n", n);
+    printf("seconds      %.2f\n", (now_usec() - start) / 1000000.0);
+    return 0;
+}
+
+// Make up a trace of interfaces flapping in turn
+static int synth(int argc, char** argv) {
+    unsigned long n_ifaces = 64;
+    unsigned long flaps = 100;
+    unsigned long period = 100;
+    int c;
+    while((c = getopt(argc, argv, "i:f:p:")) != -1) {
+        switch(c) {
+            case 'i': n_ifaces = strtoul(optarg, NULL, 10); break;
+            case 'f': flaps = strtoul(optarg, NULL, 10); break;
+            case 'p': period = strtoul(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if(optind != argc - 1 || n_ifaces == 0 || n_ifaces > 10000) { usage(); }
+
+    FILE* f = trace_create(argv[optind]);
+
+    // Indexes well clear of any real interface's
+    struct link_event event;
+    memset(&event, 0, sizeof(event));
+    event.mtu = 1500;
+    for(unsigned long i = 0; i < n_ifaces; i += 1) {
+        event.type = LINK_EVENT_ARRIVAL;
+        event.ifindex = 10000 + i;
+        event.flags = IFF_UP | IFF_BROADCAST | IFF_RUNNING | IFF_MULTICAST;
+        event.up = true;
+        snprintf(event.name, sizeof(event.name), "flap%lu", i);
+        trace_write_event(f, 0, &event);
+    }
+
+    event.type = LINK_EVENT_CHANGE;
+    event.name[0] = '\0';
+    for(unsigned long flap = 0; flap < flaps; flap += 1) {
+        event.up = (flap % 2) == 1;
+        event.flags = IFF_UP | IFF_BROADCAST | IFF_MULTICAST | (event.up? IFF_RUNNING : 0);
+        for(unsigned long i = 0; i < n_ifaces; i += 1) {
+            event.ifindex = 10000 + i;
+            trace_write_event(f, period, &event);
+        }
+    }
+
+    if(fclose(f) != 0) { die("Failed to write trace"); }
+    printf("messages     %lu\n", n_ifaces * (flaps + 1));
+    return 0;
+}
+
+static char* read_file(const char* path, size_t* len) {
+    FILE* f = fopen(path, "r");
+    if(f == NULL) { die("Failed to open trace"); }
+
+    size_t cap = 65536;
+    char* buf = malloc(cap);
+    *len = 0;
+    while(buf != NULL) {
+        *len += fread(buf + *len, 1, cap - *len, f);
+        if(*len < cap) { break; }
+
+        cap *= 2;
+        buf = realloc(buf, cap);
+    }
+
+    if(buf == NULL || ferror(f)) { die("Failed to read trace"); }
+    fclose(f);
+    return buf;
+}
+
+// Count the link changes in each message, by reading it back the way
+// networkd will
+static size_t count_events(const struct message* message) {
+    static int pair[2] = {-1, -1};
+    if(pair[0] < 0 && socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) == -1) {
+        die("Failed to create socketpair");
+    }
+
+    if(send(pair[0], message->data, message->len, 0) != (ssize_t)message->len) {
+        die("Failed to decode message");
+    }
+
+    struct link_event events[16];
+    uint64_t dropped = 0;
+    const size_t n = monitor_read(pair[1], events, 16, &dropped);
+
+    size_t changes = 0;
+    for(size_t i = 0; i < n; i += 1) {
+        if(events[i].type == LINK_EVENT_CHANGE) { changes += 1; }
+    }
+
+    return changes;
+}
+
+static struct message* load(const char* path, size_t* n_messages) {
+    size_t len;
+    const char* buf = read_file(path, &len);
+    const char* end = buf + len;
+
+    struct trace_header header;
+    struct utsname name;
+    if(len < sizeof(header) || uname(&name) == -1) { die("Invalid trace"); }
+    memcpy(&header, buf, sizeof(header));
+    if(memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION) {
+        die("Invalid trace");
+    }
+    if(strncmp(header.sysname, name.sysname, sizeof(header.sysname)) != 0) {
+        die("Trace was recorded on another system");
+    }
+
+    size_t cap = 1024;
+    struct message* messages = malloc(cap * sizeof(*messages));
+    *n_messages = 0;
+    uint64_t offset = 0;
+    for(const char* cursor = buf + sizeof(header); cursor < end;) {
+        uint64_t delta;
+        uint64_t message_len;
+        if(!read_varint(&cursor, end, &delta) || !read_varint(&cursor, end, &message_len) ||
+           message_len > MESSAGE_LEN || message_len > (uint64_t)(end - cursor)) {
+            die("Truncated trace");
+        }
+
+        if(*n_messages == cap) {
+            cap *= 2;
+            messages = realloc(messages, cap * sizeof(*messages));
+        }
+        if(messages == NULL) { die("Failed to allocate messages"); }
+
+        offset += delta;
+        struct message* message = &messages[*n_messages];
+        message->offset = offset;
+        message->data = cursor;
+        message->len = message_len;
+        message->events = count_events(message);
+        cursor += message_len;
+        *n_messages += 1;
+    }
+
+    return messages;
+}
+
+static pid_t start_networkd(const char* path, const char* sockpath, const char* log, int fd) {
+    const pid_t pid = fork();
+    if(pid < 0) { die("Failed to fork"); }
+    if(pid > 0) { return pid; }
+
+    const int log_fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(log_fd < 0) { die("Failed to open log"); }
+    dup2(log_fd, STDOUT_FILENO);
+    dup2(log_fd, STDERR_FILENO);
+
+    // Rate limits would only get in the way of the subscriber
+    char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fd);
+    execl(path, path, "-s", sockpath, "-m", fd_arg, "-r", "0", "-R", "0", (char*)NULL);
+    die("Failed to start networkd");
+    return -1;
+}
+
+static struct networkd* connect_networkd(pid_t pid, const char* sockpath) {
+    for(int i = 0; i < 500; i += 1) {
+        struct networkd* nd = networkd_open(sockpath);
+        if(nd != NULL) { return nd; }
+        if(waitpid(pid, NULL, WNOHANG) == pid) { die("networkd exited; see its log"); }
+        usleep(10000);
+    }
+
+    die("Failed to connect to networkd");
+    return NULL;
+}
+
+static void on_event(void* arg, const struct networkd_event* event) {
+    if(owed_head == owed_len) {
+        unexpected += 1;
+        return;
+    }
+
+    hist_record(&latency, now_usec() - owed[owed_head]);
+    owed_head += 1;
+}
+
+static void on_subscribed(void* arg, const struct networkd_reply* reply) {
+    if(!reply->ok) { die("Failed to subscribe"); }
+}
+
+static void read_stats(void* arg, const struct networkd_reply* reply) {
+    if(!reply->ok) { die("Failed to fetch stats"); }
+
+    const bool print = *(const bool*)arg;
+    for(size_t i = 0; i + 1 < reply->n_values; i += 2) {
+        const char* key = reply->values[i];
+        const char* value = reply->values[i + 1];
+        if(strcmp(key, "hwevents.logged") == 0) { hwevents_logged = strtoull(value, NULL, 10); }
+        if(strcmp(key, "hwevents.failed") == 0) { hwevents_failed = strtoull(value, NULL, 10); }
+        if(strcmp(key, "hwevents.queued") == 0) { hwevents_queued = strtoull(value, NULL, 10); }
+
+        if(print && (strncmp(key, "route.", 6) == 0 || strncmp(key, "spawn.", 6) == 0 ||
+                     strncmp(key, "subscribers.", 12) == 0 || strncmp(key, "hwevents.", 9) == 0)) {
+            printf("%-24s%s\n", key, value);
+        }
+    }
+}
+
+static void fetch_stats(struct networkd* nd, bool print) {
+    if(networkd_request(nd, read_stats, &print, "stats", NULL) == -1 || networkd_wait(nd) == -1) {
+        die("Failed to fetch stats");
+    }
+}
+
+// Wait until the message can be written, handling events in the meantime
+static void feed(struct networkd* nd, int fd, const struct message* message) {
+    while(1) {
+        if(send(fd, message->data, message->len, MSG_DONTWAIT) == (ssize_t)message->len) { return; }
+        if(errno != EAGAIN && errno != ENOBUFS) { die("Failed to write message"); }
+
+        struct pollfd pfds[2] = {{fd, POLLOUT, 0}, {networkd_fd(nd), POLLIN, 0}};
+        if(poll(pfds, 2, 100) < 0 && errno != EINTR) { die("Error polling"); }
+        if(pfds[1].revents != 0 && networkd_dispatch(nd) == -1) { die("Lost networkd"); }
+    }
+}
+
+static int replay(int argc, char** argv) {
+    double speed = 1.0;
+    const char* networkd = "./networkd-bench";
+    const char* log = "/dev/null";
+    char sockpath[64];
+    snprintf(sockpath, sizeof(sockpath), "/tmp/rtreplay.%d.sock", (int)getpid());
+    int c;
+    while((c = getopt(argc, argv, "x:n:s:l:")) != -1) {
+        switch(c) {
+            case 'x': speed = strtod(optarg, NULL); break;
+            case 'n': networkd = optarg; break;
+            case 's': strlcpy(sockpath, optarg, sizeof(sockpath)); break;
+            case 'l': log = optarg; break;
+            default: usage();
+        }
+    }
+    if(optind != argc - 1 || speed < 0) { usage(); }
+
+    size_t n_messages;
+    const struct message* messages = load(argv[optind], &n_messages);
+    size_t n_events = 0;
+    for(size_t i = 0; i < n_messages; i += 1) { n_events += messages[i].events; }
+    owed = calloc(n_events + 1, sizeof(*owed));
+    if(owed == NULL) { die("Failed to allocate events"); }
+
+    int pair[2];
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, pair) == -1) { die("Failed to create socketpair"); }
+    const int sndbuf = 1024 * 1024;
+    setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+
+    unlink(sockpath);
+    const pid_t pid = start_networkd(networkd, sockpath, log, pair[1]);
+    close(pair[1]);
+
+    struct networkd* nd = connect_networkd(pid, sockpath);
+    if(networkd_subscribe(nd, NETWORKD_SUBSCRIBE_NOW, on_event, on_subscribed, NULL) == -1 ||
+       networkd_wait(nd) == -1) {
+        die("Failed to subscribe");
+    }
+
+    // A speed of zero writes the trace as fast as networkd will take it
+    const uint64_t start = now_usec();
+    for(size_t i = 0; i < n_messages; i += 1) {
+        const struct message* message = &messages[i];
+        if(speed > 0) {
+            const uint64_t due = start + (uint64_t)(message->offset / speed);
+            uint64_t now;
+            while((now = now_usec()) < due) {
+                const int timeout = (due - now + 999) / 1000;
+                if(networkd_poll(nd, timeout) == -1) { die("Lost networkd"); }
+            }
+        }
+
+        feed(nd, pair[0], message);
+        const uint64_t sent = now_usec();
+        for(size_t j = 0; j < message->events; j += 1) { owed[owed_len++] = sent; }
+        if(networkd_dispatch(nd) == -1) { die("Lost networkd"); }
+    }
+
+    const uint64_t written = now_usec();
+    size_t last_head = owed_head;
+    uint64_t last_progress = written;
+    while(owed_head < owed_len && now_usec() - last_progress < DRAIN_TIMEOUT_MS * 1000) {
+        if(networkd_poll(nd, 100) == -1) { die("Lost networkd"); }
+        if(owed_head != last_head) {
+            last_head = owed_head;
+            last_progress = now_usec();
+        }
+    }
+
+    const double elapsed = ((owed_head > 0)? last_progress : written) - start;
+    const double span = (n_messages > 0)? messages[n_messages - 1].offset : 0;
+    printf("messages     %zu\n", n_messages);
+    printf("events       %zu\n", n_events);
+    printf("received     %zu\n", owed_head);
+    printf("missing      %zu\n", n_events - owed_head);
+    printf("unexpected   %" PRIu64 "\n", unexpected);
+    printf("trace        %.3f s\n", span / 1000000.0);
+    printf("replayed     %.3f s\n", (written - start) / 1000000.0);
+    printf("throughput   %.1f events/s\n", (elapsed > 0)? owed_head * 1000000.0 / elapsed : 0.0);
+    if(latency.count > 0) {
+        printf("latency (us) p50 %-8" PRIu64 " p99 %-8" PRIu64 " p999 %-8" PRIu64 " max %" PRIu64 "\n",
+               hist_percentile(&latency, 50.0),
+               hist_percentile(&latency, 99.0),
+               hist_percentile(&latency, 99.9),
+               latency.max);
+    }
+
+    // Every event should reach the hardware event log as well, in time
+    const uint64_t logging = now_usec();
+    fetch_stats(nd, false);
+    while(hwevents_queued > 0 && now_usec() - logging < LOG_TIMEOUT_MS * 1000) {
+        usleep(100000);
+        fetch_stats(nd, false);
+    }
+    fetch_stats(nd, true);
+
+    networkd_close(nd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(sockpath);
+
+    // Events lost anywhere along the way fail the run
+    bool failed = false;
+    if(owed_head < n_events) {
+        fprintf(stderr, "%zu events were not delivered\n", n_events - owed_head);
+        failed = true;
+    }
+    if(hwevents_logged != owed_head) {
+        fprintf(stderr, "%" PRIu64 " events were logged, of %zu\n", hwevents_logged, owed_head);
+        failed = true;
+    }
+    if(hwevents_failed > 0) {
+        fprintf(stderr, "%" PRIu64 " events failed to be logged\n", hwevents_failed);
+        failed = true;
+    }
+
+    return failed? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) { usage(); }
+
+    const char* mode = argv[1];
+    argc -= 1;
+    argv += 1;
+    if(strcmp(mode, "record") == 0) { return record(argc, argv); }
+    if(strcmp(mode, "synth") == 0) { return synth(argc, argv); }
+    if(strcmp(mode, "replay") == 0) { return replay(argc, argv); }
+    usage();
+    return 1;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Start a networkd built against the stub programs, and run the load
+# generator against it. Arguments are passed through to loadgen.
+
+set -e
+cd "$(dirname "$0")/../.."
+
+SOCK="${TMPDIR:-/tmp}/networkd-bench.$$.sock"
+mkdir -p t/bench/out
+
+# Rate limits would cap the very throughput being measured
+./networkd-bench -s "$SOCK" -r 0 -R 0 > t/bench/out/networkd.log 2>&1 &
+PID=$!
+trap 'kill $PID 2>/dev/null; rm -f "$SOCK"' EXIT INT TERM
+
+./loadgen -s "$SOCK" "$@"
@@ -0,0 +1,188 @@
+// Compares the cost of starting a job directly from a process with a large
+// heap, as service_exec once did, against asking networkd-launcher to do it.
+// Plain fork(2) is included to show what a fork-based posix_spawn(3) pays.
+// Reports throughput for whole start-to-reap cycles, and the latency of
+// the start itself.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <imsg.h>
+
+#include "launcher.h"
+#include "stats.h"
+#include "util.h"
+
+static struct hist hist;
+
+static void usage(void) {
+    fprintf(stderr, "usage: spawnbench [-l launcher] [-m heap-megabytes] [-n count] program\n");
+    exit(1);
+}
+
+// Read one of the child's non-blocking pipes until it is closed
+static void drain(int fd) {
+    char buf[4096];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    while(1) {
+        const ssize_t n = read(fd, buf, sizeof(buf));
+        if(n == 0) { break; }
+        if(n < 0 && errno != EAGAIN && errno != EINTR) { die("Error reading pipe"); }
+        if(n < 0) { poll(&pfd, 1, -1); }
+    }
+
+    close(fd);
+}
+
+static void bench_direct(char* const args[], int count) {
+    for(int i = 0; i < count; i += 1) {
+        const uint64_t start = now_usec();
+        pid_t pid;
+        int out_fd;
+        int err_fd;
+        const int error = spawn_child(args, &pid, &out_fd, &err_fd);
+        if(error != 0) {
+            errno = error;
+            die("Failed to spawn");
+        }
+        hist_record(&hist, now_usec() - start);
+
+        drain(out_fd);
+        drain(err_fd);
+        while(waitpid(pid, NULL, 0) == -1 && errno == EINTR) {}
+    }
+}
+
+// What posix_spawn(3) costs where it is built on fork(2), as on OpenBSD:
+// the whole address space is copied, however little of it the child uses.
+static void bench_fork(char* const args[], int count) {
+    for(int i = 0; i < count; i += 1) {
+        const uint64_t start = now_usec();
+        const pid_t pid = fork();
+        if(pid == -1) { die("Failed to fork"); }
+        if(pid == 0) {
+            const int null = open("/dev/null", O_RDWR);
+            dup2(null, 0);
+            dup2(null, 1);
+            dup2(null, 2);
+            execv(args[0], args);
+            _exit(127);
+        }
+        hist_record(&hist, now_usec() - start);
+
+        while(waitpid(pid, NULL, 0) == -1 && errno == EINTR) {}
+    }
+}
+
+// Wait for the next message from the launcher
+static void next_imsg(struct imsgbuf* ibuf, struct imsg* imsg) {
+    while(imsg_get(ibuf, imsg) == 0) {
+        const int n = imsg_read(ibuf);
+        if(n < 0 && errno != EAGAIN) { die("Error reading from launcher"); }
+        if(n == 0) { die("Launcher exited"); }
+    }
+}
+
+static void bench_launcher(const char* path, char* const args[], int count) {
+    struct imsgbuf ibuf;
+    imsg_init(&ibuf, launcher_start(path));
+
+    char packed[MAX_IMSGSIZE - IMSG_HEADER_SIZE];
+    const size_t packed_len = launcher_pack(args, packed, sizeof(packed));
+    if(packed_len == 0) { die("Arguments too long"); }
+
+    for(int i = 0; i < count; i += 1) {
+        const uint64_t start = now_usec();
+        imsg_compose(&ibuf, LAUNCHER_SPAWN, i, 0, -1, packed, packed_len);
+        if(imsg_flush(&ibuf) == -1) { die("Error writing to launcher"); }
+
+        bool exited = false;
+        while(!exited) {
+            struct imsg imsg;
+            next_imsg(&ibuf, &imsg);
+            switch(imsg.hdr.type) {
+                case LAUNCHER_STARTED:
+                    hist_record(&hist, now_usec() - start);
+                    drain(imsg.fd);
+                    break;
+                case LAUNCHER_STDERR:
+                    drain(imsg.fd);
+                    break;
+                case LAUNCHER_FAILED:
+                    die("Failed to spawn");
+                case LAUNCHER_EXITED:
+                    exited = true;
+                    break;
+            }
+
+            imsg_free(&imsg);
+        }
+    }
+
+    close(ibuf.fd);
+}
+
+static void report(const char* name, int count, uint64_t elapsed) {
+    printf("%-9s spawns/sec %-9.1f p50 %-6" PRIu64 " p99 %-6" PRIu64 " max %" PRIu64 "\n",
+           name,
+           count / (elapsed / 1000000.0),
+           hist_percentile(&hist, 50.0),
+           hist_percentile(&hist, 99.0),
+           hist.max);
+    memset(&hist, 0, sizeof(hist));
+}
+
+int main(int argc, char** argv) {
+    const char* launcher = NULL;
+    size_t heap_mb = 256;
+    int count = 2000;
+
+    int ch;
+    while((ch = getopt(argc, argv, "l:m:n:")) != -1) {
+        switch(ch) {
+            case 'l': launcher = optarg; break;
+            case 'm': heap_mb = strtoul(optarg, NULL, 10); break;
+            case 'n': count = atoi(optarg); break;
+            default: usage();
+        }
+    }
+
+    if(optind != argc - 1 || count < 1) { usage(); }
+    char* const args[] = {argv[optind], NULL};
+
+    // Stand in for service_exec's output buffers. Touch every page, so that
+    // they are really mapped.
+    const size_t heap_len = heap_mb * 1024 * 1024;
+    char* heap = malloc(heap_len);
+    if(heap == NULL) { die("Failed to allocate heap"); }
+    for(size_t i = 0; i < heap_len; i += 4096) { heap[i] = 1; }
+
+    printf("# %d spawns of %s, %zu MB heap, latency in us\n", count, args[0], heap_mb);
+
+    uint64_t start = now_usec();
+    bench_fork(args, count);
+    report("fork", count, now_usec() - start);
+
+    start = now_usec();
+    bench_direct(args, count);
+    report("direct", count, now_usec() - start);
+
+    if(launcher != NULL) {
+        start = now_usec();
+        bench_launcher(launcher, args, count);
+        report("launcher", count, now_usec() - start);
+    }
+
+    free(heap);
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Stand-in for the programs that networkd's exec service runs, so that the
+// daemon can be benchmarked on an unprivileged build machine. The role is
+// chosen by the name the stub is invoked as, and each role sleeps for a
+// delay in microseconds that is fixed at build time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef STUB_DELAY_IFCONFIG
+#define STUB_DELAY_IFCONFIG 0
+#endif
+
+#ifndef STUB_DELAY_NETSTART
+#define STUB_DELAY_NETSTART 0
+#endif
+
+#ifndef STUB_DELAY_LOGHWEVENT
+#define STUB_DELAY_LOGHWEVENT 0
+#endif
+
+#ifndef STUB_DELAY_SCAN
+#define STUB_DELAY_SCAN 0
+#endif
+
+#ifndef STUB_IFACES
+#define STUB_IFACES 4
+#endif
+
+static void delay(long usec) {
+    struct timespec ts = {usec / 1000000, (usec % 1000000) * 1000};
+    while(nanosleep(&ts, &ts) != 0) {}
+}
+
+// Every interface, or only the one named
+static void list_ifaces(const char* only) {
+    if(only == NULL || strcmp(only, "lo0") == 0) {
+        printf("lo0: flags=8049<UP,LOOPBACK,RUNNING,MULTICAST> mtu 32768\n"
+               "\tindex 3 priority 0 llprio 3\n"
+               "\tgroups: lo\n"
+               "\tinet 127.0.0.1 netmask 0xff000000\n");
+    }
+
+    for(int i = 0; i < STUB_IFACES; i += 1) {
+        char name[16];
+        snprintf(name, sizeof(name), "em%d", i);
+        if(only != NULL && strcmp(only, name) != 0) { continue; }
+
+        printf("%s: flags=8843<UP,BROADCAST,RUNNING,SIMPLEX,MULTICAST> mtu 1500\n"
+               "\tlladdr 00:1b:21:00:%02x:%02x\n"
+               "\tindex %d priority 0 llprio 3\n"
+               "\tgroups: egress\n"
+               "\tmedia: Ethernet autoselect (1000baseT full-duplex)\n"
+               "\tstatus: active\n"
+               "\tinet 10.%d.%d.1 netmask 0xffffff00 broadcast 10.%d.%d.255\n",
+               name, (i >> 8) & 0xff, i & 0xff, i + 4,
+               (i >> 8) & 0xff, i & 0xff, (i >> 8) & 0xff, i & 0xff);
+    }
+
+    if(only == NULL || strcmp(only, "vlan0") == 0) {
+        printf("vlan0: flags=8843<UP,BROADCAST,RUNNING,SIMPLEX,MULTICAST> mtu 1500\n"
+               "\tlladdr 00:1b:21:00:00:00\n"
+               "\tstatus: active\n");
+    }
+}
+
+// The interface, followed by the networks it found
+static void scan(const char* iface) {
+    delay(STUB_DELAY_SCAN);
+    printf("%s: flags=8843<UP,BROADCAST,RUNNING,SIMPLEX,MULTICAST> mtu 1500\n"
+           "\tmedia: IEEE802.11 autoselect (HT-MCS15 mode 11n)\n"
+           "\tstatus: active\n"
+           "\t\tnwid home chan 6 bssid 00:1b:21:01:00:01 -58dBm HT-MCS15 privacy,short_slottime,wpa2\n"
+           "\t\tnwid \"cafe wifi\" chan 11 bssid 00:1b:21:01:00:02 -71dBm 54M short_preamble\n"
+           "\t\tnwid 0x0001feff chan 149 bssid 00:1b:21:01:00:03 40%% VHT-MCS9 privacy,wpa2\n",
+           iface);
+}
+
+static int ifconfig(int argc, char** argv) {
+    delay(STUB_DELAY_IFCONFIG);
+
+    if(argc == 1) {
+        list_ifaces(NULL);
+    } else if(argc == 2 && strcmp(argv[1], "-C") == 0) {
+        printf("bridge carp enc gif gre lo pflog pfsync svlan tun vlan\n");
+    } else if(argc == 2) {
+        list_ifaces(argv[1]);
+    } else if(argc == 3 && strcmp(argv[2], "scan") == 0) {
+        scan(argv[1]);
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* name = strrchr(argv[0], '/');
+    name = (name == NULL)? argv[0] : name + 1;
+
+    if(strcmp(name, "stub-ifconfig") == 0) {
+        return ifconfig(argc, argv);
+    } else if(strcmp(name, "stub-sh") == 0) {
+        // Invoked as sh /etc/netstart <iface>
+        delay(STUB_DELAY_NETSTART);
+        return 0;
+    } else if(strcmp(name, "stub-loghwevent") == 0) {
+        delay(STUB_DELAY_LOGHWEVENT);
+        return 0;
+    }
+
+    fprintf(stderr, "stub: unknown role %s\n", name);
+    return 1;
+}
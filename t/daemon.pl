@@ -0,0 +1,70 @@
+#!/usr/bin/perl
+use strict;
+use warnings;
+
+use IO::Socket::UNIX;
+use POSIX qw(:sys_wait_h);
+use Time::HiRes qw(usleep);
+
+# Start a networkd built against the stub programs, send it malformed
+# command lines, and check that it still answers afterwards.
+
+my $networkd = shift @ARGV || './networkd-bench';
+my $sock_path = ($ENV{TMPDIR} || '/tmp') . "/networkd-test.$$.sock";
+my $failed = 0;
+
+sub check {
+    my ($name, $ok) = @_;
+    print(($ok? 'ok' : 'not ok') . " - $name\n");
+    $failed = 1 if !$ok;
+    return;
+}
+
+sub open_conn {
+    for (1 .. 100) {
+        my $conn = IO::Socket::UNIX->new(Type => SOCK_STREAM(), Peer => $sock_path);
+        return $conn if $conn;
+        usleep(50_000);
+    }
+    die "Failed to connect to networkd: $!\n";
+}
+
+# Send raw bytes, and return the next reply line
+sub request {
+    my ($conn, $bytes) = @_;
+    print {$conn} $bytes or return '';
+    $conn->flush();
+    my $reply = <$conn>;
+    return defined $reply? $reply : '';
+}
+
+sub main {
+    # A crashed networkd is reported as a failed check, not a dead script
+    local $SIG{PIPE} = 'IGNORE';
+    mkdir 't/bench/out';
+    my $pid = fork();
+    die "Failed to fork: $!\n" if !defined $pid;
+    if ($pid == 0) {
+        open STDOUT, '>', 't/bench/out/daemon.log' or die "Failed to open log: $!\n";
+        open STDERR, '>&', \*STDOUT or die "Failed to redirect stderr: $!\n";
+        exec $networkd, '-s', $sock_path, '-r', '0', '-R', '0' or die "Failed to exec $networkd: $!\n";
+    }
+
+    my $conn = open_conn();
+    check('line with a NUL is refused', request($conn, "[\"jobs\"]\0\n") =~ /^\["error"/xms);
+    check('same connection still answers', request($conn, "[\"stats\"]\n") =~ /^\["ok"/xms);
+    check('NUL mid-line refuses the whole line',
+          request($conn, "[\"jobs\"]\0[\"stats\"]\n[\"stats\"]\n") =~ /^\["error"/xms);
+    check('the following line is handled', request($conn, '') =~ /^\["ok"/xms);
+    close $conn;
+
+    check('new connections still answer', request(open_conn(), "[\"stats\"]\n") =~ /^\["ok"/xms);
+    check('networkd is still running', waitpid($pid, WNOHANG) == 0);
+
+    kill 'TERM', $pid;
+    waitpid $pid, 0;
+    unlink $sock_path;
+    return $failed;
+}
+
+exit main();
@@ -1,9 +1,27 @@
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
+#include "addrindex.h"
+#include "command.h"
+#include "counters.h"
 #include "flatjson.h"
+#include "fragments.h"
+#include "history.h"
+#include "iftable.h"
+#include "libnetworkd.h"
+#include "payload.h"
+#include "publish.h"
+#include "ratelimit.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 #include "validate.h"
+#include "wheel.h"
 #include "util.h"
 
 int tests_passed = -1;
@@ -64,12 +82,39 @@ static void test_unescape_escapes(void) {
     assert("", strcmp("f\no\\o bar", buf) == 0);
 }
 
+static void test_unescape_numbers(void) {
+    test();
+
+    char buf[100];
+    const char* result = flatjson_next("[\"events\", 42, -1.5e3]", buf, sizeof(buf), NULL);
+    result = flatjson_next(result, buf, sizeof(buf), NULL);
+    assert("", result != NULL);
+    assert("", strcmp("42", buf) == 0);
+
+    result = flatjson_next(result, buf, sizeof(buf), NULL);
+    assert("", result != NULL);
+    assert("", strcmp("-1.5e3", buf) == 0);
+
+    result = flatjson_next(result, buf, sizeof(buf), NULL);
+    assert("", result == NULL);
+
+    // A number running to the end of the text is still complete
+    assert("", flatjson_next("7", buf, sizeof(buf), NULL) != NULL);
+    assert("", strcmp("7", buf) == 0);
+}
+
 static void test_escape_simple(void) {
     test();
 
     char buf[100];
     assert("", flatjson_escape("f\"oo ba\nr", buf, sizeof(buf)) == 0);
     assert("", strcmp("f\\\"oo ba\\nr", buf) == 0);
+
+    assert("", flatjson_escape("a\\b", buf, sizeof(buf)) == 0);
+    assert("", strcmp("a\\\\b", buf) == 0);
+
+    assert("", flatjson_escape("", buf, sizeof(buf)) == 0);
+    assert("", buf[0] == '\0');
 }
 
 static void test_escape_overflow(void) {
@@ -100,6 +145,72 @@ static void test_validate_stanza(void) {
     assert("", !validate_stanza("inet6 200g:0db8:::::: ::::90a::: :::0db::::"));
 }
 
+static void test_command(void) {
+    test();
+
+    // Every command hashes to its own slot
+    const char* names[] = {"list", "configure", "connect", "disconnect", "stats", "trace-dump",
+                           "jobs", "cancel", "events", "counters", "subscribe", "scan", "lookup"};
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i += 1) {
+        const struct command_spec* spec = command_lookup(names[i]);
+        assert(names[i], spec != NULL && strcmp(spec->name, names[i]) == 0);
+    }
+    assert("", command_lookup("lost") == NULL);
+    assert("", command_lookup("") == NULL);
+
+    struct command command;
+    assert("", command_parse("[\"list\"]", &command) == NULL);
+    assert("", command.spec->cmd == STATS_CMD_LIST);
+    assert("", strcmp(command_parse("[\"lsit\"]", &command), "unknown command") == 0);
+    assert("", command.spec == NULL);
+    assert("", strcmp(command_parse("[\"list\", \"em0\"]", &command), "too many arguments") == 0);
+
+    assert("", command_parse("[\"configure\", \"em0\", \"dhcp\", \"rtsol\"]", &command) == NULL);
+    assert("", strcmp(command.iface.name, "em0") == 0);
+    assert("", command.n_stanzas == 2 && strcmp(command.stanzas[1], "rtsol") == 0);
+    assert("", strcmp(command_parse("[\"configure\", \"em0\", \"!run /bin/sh\"]", &command), "invalid stanza") == 0);
+    assert("", strcmp(command_parse("[\"connect\", \"../etc/passwd\"]", &command), "invalid interface") == 0);
+    assert("", strcmp(command_parse("[\"connect\", \"averyveryverylongname0\"]", &command), "invalid interface") == 0);
+    assert("", strcmp(command_parse("[\"connect\"]", &command), "missing argument") == 0);
+    assert("", command_parse("[\"connect\", \"em0\"]", &command) == NULL);
+    assert("", command.wait == COMMAND_WAIT_NONE);
+    assert("", command_parse("[\"connect\", \"em0\", \"address\", 5000]", &command) == NULL);
+    assert("", command.wait == COMMAND_WAIT_ADDRESS && command.timeout == 5000);
+    assert("", strcmp(command_parse("[\"connect\", \"em0\", \"carrier\"]", &command), "invalid condition") == 0);
+    assert("", strcmp(command_parse("[\"connect\", \"em0\", \"link\", 600001]", &command), "invalid timeout") == 0);
+
+    assert("", command_parse("[\"cancel\", 42]", &command) == NULL);
+    assert("", command.job == 42);
+    assert("", strcmp(command_parse("[\"cancel\", \"-1\"]", &command), "invalid job") == 0);
+    assert("", strcmp(command_parse("[\"cancel\", \"4294967296\"]", &command), "invalid job") == 0);
+
+    assert("", command_parse("[\"events\", \"since\", \"7\", 3]", &command) == NULL);
+    assert("", command.n_cursors == 2 && command.cursors[0] == 7 && command.cursors[1] == 3);
+    assert("", strcmp(command_parse("[\"events\", \"7\"]", &command), "expected since") == 0);
+    assert("", strcmp(command_parse("[\"events\", \"since\", \"x\"]", &command), "invalid cursor") == 0);
+    assert("", strcmp(command_parse("[\"subscribe\", \"since\", 1, 2]", &command), "too many arguments") == 0);
+
+    assert("", command_parse("[\"scan\", \"iwm0\", 30]", &command) == NULL);
+    assert("", command.age == 30);
+    assert("", command_parse("[\"scan\", \"iwm0\"]", &command) == NULL);
+    assert("", command.age == 0);
+    assert("", strcmp(command_parse("[\"scan\", \"iwm0\", \"soon\"]", &command), "invalid age") == 0);
+
+    assert("", command_parse("[\"lookup\", \"2001:db8::/32\"]", &command) == NULL);
+    assert("", command.prefix.family == AF_INET6 && command.prefix.len == 32);
+    assert("", strcmp(command_parse("[\"lookup\", \"10.0.0.0/33\"]", &command), "invalid address") == 0);
+
+    // Payloads are only accepted at their exact size
+    struct payload_iface iface = {1, "em0"};
+    struct payload_iface copy;
+    assert("", payload_get(&iface, sizeof(iface), &copy, sizeof(copy)));
+    assert("", payload_iface_valid(&copy));
+    assert("", !payload_get(&iface, sizeof(iface) - 1, &copy, sizeof(copy)));
+    assert("", !payload_get(NULL, 0, &copy, sizeof(copy)));
+    memset(copy.name, 'a', sizeof(copy.name));
+    assert("", !payload_iface_valid(&copy));
+}
+
 static void test_parse_ifconfig_kv(void) {
     test();
 
@@ -120,22 +231,725 @@ static void test_iface_is_pseudo(void) {
     assert("", iface_is_pseudo("bridge", pseudo));
 }
 
+static void test_hist(void) {
+    test();
+
+    static struct hist hist;
+    assert("", hist_percentile(&hist, 50.0) == 0);
+
+    for(uint64_t i = 1; i <= 1000; i += 1) {
+        hist_record(&hist, i);
+    }
+
+    assert("", hist.count == 1000);
+    assert("", hist.max == 1000);
+    assert("", hist_percentile(&hist, 100.0) == 1000);
+
+    // Buckets are within 1/16th of the recorded value
+    const uint64_t p50 = hist_percentile(&hist, 50.0);
+    assert("", p50 >= 500 && p50 <= 500 + 500 / 16);
+    const uint64_t p99 = hist_percentile(&hist, 99.0);
+    assert("", p99 >= 990 && p99 <= 1000);
+
+    // Small values are exact, and huge values are clamped
+    static struct hist small;
+    hist_record(&small, 3);
+    assert("", hist_percentile(&small, 50.0) == 3);
+    hist_record(&small, UINT64_MAX);
+    assert("", small.max == UINT64_MAX);
+    assert("", hist_percentile(&small, 100.0) == UINT64_MAX);
+}
+
+static void test_trace_ring(void) {
+    test();
+
+    static struct trace_record records[TRACE_RING_LEN];
+    trace_init(TRACE_PROCESS_EXEC);
+    assert("", trace_copy(records, TRACE_RING_LEN) == 0);
+
+    trace_point(TRACE_SPAWN, 1);
+    trace_point(TRACE_CHILD_EXIT, 1);
+    assert("", trace_copy(records, TRACE_RING_LEN) == 2);
+    assert("", records[0].point == TRACE_SPAWN);
+    assert("", records[1].process == TRACE_PROCESS_EXEC);
+    assert("", records[0].timestamp <= records[1].timestamp);
+
+    // Wrap around, and make sure that we get the newest records, oldest first
+    for(uint32_t i = 0; i < TRACE_RING_LEN + 10; i += 1) {
+        trace_point(TRACE_PARSE, i);
+    }
+
+    assert("", trace_copy(records, TRACE_RING_LEN) == TRACE_RING_LEN);
+    assert("", records[0].request == 10);
+    assert("", records[TRACE_RING_LEN - 1].request == TRACE_RING_LEN + 9);
+
+    assert("", trace_copy(records, 5) == 5);
+    assert("", records[0].request == TRACE_RING_LEN + 5);
+
+    char rendered[200];
+    assert("", trace_render(&records[0], rendered, sizeof(rendered)) == 0);
+    assert("", strstr(rendered, "\"name\":\"parse\"") != NULL);
+    assert("", trace_render(&records[0], rendered, 10) != 0);
+}
+
+static void test_bucket(void) {
+    test();
+
+    const struct ratelimit limit = {10, 3};
+    struct bucket bucket;
+    bucket_init(&bucket, &limit, 1000);
+
+    // A full bucket allows a burst, and then one token every 100ms
+    for(int i = 0; i < 3; i += 1) {
+        assert("", bucket_take(&bucket, &limit, 1000));
+    }
+    assert("", !bucket_take(&bucket, &limit, 1000));
+    assert("", !bucket_ready(&bucket, &limit, 1000 + 99999));
+    assert("", bucket_ready(&bucket, &limit, 1000 + 100000));
+    assert("", bucket_take(&bucket, &limit, 1000 + 100000));
+    assert("", !bucket_take(&bucket, &limit, 1000 + 100000));
+
+    // A long idle refills it to the burst size, and no further
+    for(int i = 0; i < 3; i += 1) {
+        assert("", bucket_take(&bucket, &limit, UINT64_MAX / 2));
+    }
+    assert("", !bucket_take(&bucket, &limit, UINT64_MAX / 2));
+
+    // A rate of zero never refuses
+    const struct ratelimit unlimited = {0, 0};
+    bucket_init(&bucket, &unlimited, 0);
+    assert("", bucket_take(&bucket, &unlimited, 0));
+}
+
+static int wheel_fired[4];
+
+static void wheel_fire(void* owner) {
+    wheel_fired[(int*)owner - wheel_fired] += 1;
+}
+
+static void test_wheel(void) {
+    test();
+
+    static struct wheel wheel;
+    struct wheel_entry entries[4];
+    memset(entries, 0, sizeof(entries));
+    wheel_init(&wheel, 100);
+    for(int i = 0; i < 4; i += 1) { entries[i].owner = &wheel_fired[i]; }
+
+    wheel_schedule(&wheel, &entries[0], 105);
+    wheel_schedule(&wheel, &entries[1], 105);
+    wheel_schedule(&wheel, &entries[2], 100 + WHEEL_SLOTS * 2 + 5);
+    wheel_schedule(&wheel, &entries[3], 110);
+
+    // Pushing a deadline back, and cancelling
+    wheel_schedule(&wheel, &entries[1], 120);
+    wheel_cancel(&wheel, &entries[3]);
+
+    assert("", wheel_advance(&wheel, 104, wheel_fire) == 0);
+    assert("", wheel_advance(&wheel, 105, wheel_fire) == 1);
+    assert("", wheel_fired[0] == 1 && wheel_fired[1] == 0);
+    assert("", wheel_advance(&wheel, 119, wheel_fire) == 0);
+    assert("", wheel_advance(&wheel, 120, wheel_fire) == 1);
+    assert("", wheel_fired[1] == 1 && wheel_fired[3] == 0);
+
+    // A deadline beyond the wheel's span goes round until it is due, even
+    // when the clock jumps
+    assert("", wheel_advance(&wheel, 100 + WHEEL_SLOTS + 5, wheel_fire) == 0);
+    assert("", wheel_advance(&wheel, 100 + WHEEL_SLOTS * 5, wheel_fire) == 1);
+    assert("", wheel_fired[2] == 1);
+    assert("", !entries[2].queued);
+
+    // Cancelling an entry whose deadline was pushed back takes it out of the
+    // slot it is still in, so that the slot can be reused once it is gone
+    struct wheel_entry* pushed = calloc(1, sizeof(*pushed));
+    assert("", pushed != NULL);
+    const uint64_t base = 100 + WHEEL_SLOTS * 5;
+    wheel_schedule(&wheel, pushed, base + 10);
+    wheel_schedule(&wheel, pushed, base + 11);
+    wheel_cancel(&wheel, pushed);
+    free(pushed);
+    wheel_schedule(&wheel, &entries[3], base + 10);
+    assert("", TAILQ_FIRST(&wheel.slots[(base + 10) % WHEEL_SLOTS]) == &entries[3]);
+    assert("", TAILQ_NEXT(&entries[3], entries) == NULL);
+    assert("", wheel_advance(&wheel, base + 11, wheel_fire) == 1);
+    assert("", wheel_fired[3] == 1);
+}
+
+static void test_history(void) {
+    test();
+
+    static struct history history;
+    static struct history_event events[HISTORY_LEN];
+    history_init(&history);
+
+    uint64_t lost;
+    assert("", history_read(&history, 0, events, HISTORY_LEN, &lost) == 0);
+    assert("", lost == 0);
+
+    struct history_event event;
+    memset(&event, 0, sizeof(event));
+    for(uint32_t i = 1; i <= 3; i += 1) {
+        event.ifindex = i;
+        assert("", history_record(&history, &event) == i);
+    }
+
+    assert("", history_read(&history, 1, events, HISTORY_LEN, &lost) == 2);
+    assert("", events[0].seq == 2 && events[0].ifindex == 2);
+    assert("", history_read(&history, 0, events, 1, &lost) == 1);
+    assert("", events[0].seq == 1);
+    assert("", history_read(&history, 3, events, HISTORY_LEN, &lost) == 0);
+
+    // A cursor that has been overwritten is reported, and reading carries
+    // on from the oldest event left
+    for(uint32_t i = 0; i < HISTORY_LEN; i += 1) {
+        history_record(&history, &event);
+    }
+    assert("", history_read(&history, 1, events, HISTORY_LEN, &lost) == HISTORY_LEN);
+    assert("", lost == 2);
+    assert("", events[0].seq == 4);
+    assert("", events[HISTORY_LEN - 1].seq == HISTORY_LEN + 3);
+
+    // A cursor from before a restart starts over
+    assert("", history_read(&history, HISTORY_LEN * 10, events, 1, &lost) == 1);
+    assert("", events[0].seq == 4);
+}
+
+static void test_scan(void) {
+    test();
+
+    struct scan_result result;
+    assert("", scan_parse_line("\t\tnwid home chan 6 bssid 00:11:22:33:44:55 -58dBm HT-MCS15 privacy,wpa2", &result));
+    assert("", strcmp(result.nwid, "home") == 0);
+    assert("", strcmp(result.bssid, "00:11:22:33:44:55") == 0);
+    assert("", result.chan == 6);
+    assert("", strcmp(result.signal, "-58dBm") == 0);
+
+    assert("", scan_parse_line("\t\tnwid \"cafe wifi\" chan 149 bssid 0:1b:21:0:0:1 45% 54M short_preamble", &result));
+    assert("", strcmp(result.nwid, "cafe wifi") == 0);
+    assert("", result.chan == 149 && strcmp(result.signal, "45%") == 0);
+    assert("", scan_parse_line("\t\tnwid \"\" chan 1 bssid 00:11:22:33:44:55 -80dBm", &result));
+    assert("", result.nwid[0] == '\0');
+
+    assert("", !scan_parse_line("\tieee80211: join home chan 6 bssid 00:11:22:33:44:55 -58dBm", NULL));
+    assert("", !scan_parse_line("\t\tnwid home chan six bssid 00:11:22:33:44:55 -58dBm", NULL));
+
+    struct scans scans;
+    scans_init(&scans);
+    struct scan* scan = scans_get(&scans, "iwm0");
+    assert("", scans_get(&scans, "iwm0") == scan);
+    assert("", scans_get(&scans, "athn0") != scan);
+    assert("", !scan_fresh(scan, 1000, UINT64_MAX));
+
+    char output[] = "iwm0: flags=8843<UP,BROADCAST,RUNNING,SIMPLEX,MULTICAST> mtu 1500\n"
+                    "\tstatus: active\n"
+                    "\t\tnwid home chan 6 bssid 00:11:22:33:44:55 -58dBm HT-MCS15 privacy,wpa2\n"
+                    "\t\tnwid guest chan 11 bssid 00:11:22:33:44:56 -70dBm 54M privacy\n";
+    scan_update(scan, output, 1000);
+    assert("", scan->n_results == 2);
+    assert("", strcmp(scan->results[1].nwid, "guest") == 0);
+    assert("", scan_fresh(scan, 1500, 500));
+    assert("", !scan_fresh(scan, 1501, 500));
+
+    scans_remove(&scans, scan);
+    assert("", scans_get(&scans, "iwm0")->updated == 0);
+    scans_free(&scans);
+}
+
+static void test_addrindex(void) {
+    test();
+
+    struct addr_prefix addr;
+    assert("", addr_prefix_parse("10.1.2.1/24", &addr));
+    assert("", addr.family == AF_INET && addr.len == 24 && addr.bytes[3] == 1);
+    assert("", addr_prefix_parse("10.1.2.3", &addr) && addr.len == 32);
+    assert("", addr_prefix_parse("::/0", &addr) && addr.family == AF_INET6 && addr.len == 0);
+    assert("", !addr_prefix_parse("10.1.2.3/", &addr));
+    assert("", !addr_prefix_parse("10.1.2.3/08", &addr));
+    assert("", !addr_prefix_parse("2001:db8::/129", &addr));
+    assert("", !addr_prefix_parse("em0", &addr));
+
+    static struct addrindex index;
+    addrindex_init(&index);
+    assert("", addr_prefix_parse("10.1.2.1/24", &addr));
+    addrindex_add(&index, 1, &addr);
+    assert("", addr_prefix_parse("10.1.0.1/16", &addr));
+    addrindex_add(&index, 2, &addr);
+    assert("", addr_prefix_parse("2001:db8::1/64", &addr));
+    addrindex_add(&index, 3, &addr);
+    assert("", addr_prefix_parse("fe80::1/64", &addr));
+    addrindex_add(&index, 3, &addr);
+
+    // Announcing an address again changes nothing
+    assert("", addr_prefix_parse("10.1.2.1/24", &addr));
+    addrindex_add(&index, 1, &addr);
+    assert("", index.n_addresses == 3);
+
+    uint32_t ifindex;
+    struct addr_prefix match;
+    char text[ADDR_PREFIX_STRLEN];
+    const struct {
+        const char* query;
+        uint32_t ifindex;
+        const char* match;
+    } cases[] = {
+        {"10.1.2.1", 1, "10.1.2.1/32"},
+        {"10.1.2.3", 1, "10.1.2.0/24"},
+        {"10.1.2.0/25", 1, "10.1.2.0/24"},
+        {"10.1.3.3", 2, "10.1.0.0/16"},
+        {"10.1.0.0/16", 2, "10.1.0.0/16"},
+        {"2001:db8::42", 3, "2001:db8::/64"},
+        {"2001:db8::1", 3, "2001:db8::1/128"},
+    };
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i += 1) {
+        assert(cases[i].query, addr_prefix_parse(cases[i].query, &addr));
+        assert(cases[i].query, addrindex_lookup(&index, &addr, &ifindex, &match));
+        addr_prefix_format(&match, text);
+        assert(cases[i].query, ifindex == cases[i].ifindex && strcmp(text, cases[i].match) == 0);
+    }
+
+    // Prefixes wider than any address are not covered, and link-local
+    // addresses are left out
+    const char* misses[] = {"10.0.0.0/8", "10.2.0.1", "192.168.0.1", "fe80::1", "2001:db9::1"};
+    for(size_t i = 0; i < sizeof(misses) / sizeof(misses[0]); i += 1) {
+        assert(misses[i], addr_prefix_parse(misses[i], &addr));
+        assert(misses[i], !addrindex_lookup(&index, &addr, &ifindex, &match));
+    }
+
+    // Removing the narrower network leaves the wider one
+    assert("", addr_prefix_parse("10.1.2.1/24", &addr));
+    addrindex_remove(&index, 1, &addr);
+    assert("", index.n_addresses == 2);
+    assert("", addr_prefix_parse("10.1.2.1", &addr));
+    assert("", addrindex_lookup(&index, &addr, &ifindex, &match) && ifindex == 2 && match.len == 16);
+
+    // Removing an address the interface never had changes nothing
+    assert("", addr_prefix_parse("10.1.0.1/16", &addr));
+    addrindex_remove(&index, 1, &addr);
+    assert("", index.n_addresses == 2);
+    assert("", addrindex_lookup(&index, &addr, &ifindex, &match) && ifindex == 2 && match.len == 16);
+
+    addrindex_remove_iface(&index, 2);
+    assert("", !addrindex_lookup(&index, &addr, &ifindex, &match));
+    assert("", index.roots[0] == NULL && index.n_addresses == 1);
+    addrindex_remove_iface(&index, 3);
+    assert("", index.roots[1] == NULL && index.n_addresses == 0);
+    addrindex_free(&index);
+}
+
+static void test_counters(void) {
+    test();
+
+    struct counters counters;
+    counters_init(&counters);
+    assert("", counters_get(&counters, 3) == NULL);
+
+    struct counter_sample sample;
+    memset(&sample, 0, sizeof(sample));
+    uint64_t rates[COUNTER_MAX];
+    for(uint64_t i = 0; i < 3; i += 1) {
+        sample.time = 1000000 + i * 500000;
+        sample.values[COUNTER_IBYTES] = i * 1000;
+        sample.values[COUNTER_OERRORS] = 10 - i;
+        counters_begin(&counters);
+        counters_record(&counters, 3, "em0", &sample);
+        counters_end(&counters);
+    }
+
+    const struct counters_iface* iface = counters_get(&counters, 3);
+    assert("", iface != NULL && strcmp(iface->name, "em0") == 0);
+    assert("", counters_sample(iface, 0)->values[COUNTER_IBYTES] == 2000);
+    assert("", counters_sample(iface, 2)->values[COUNTER_IBYTES] == 0);
+    assert("", counters_sample(iface, 3) == NULL);
+
+    // Rates are per second, and counters going backwards give zero
+    assert("", counters_rate(iface, 0, rates));
+    assert("", rates[COUNTER_IBYTES] == 2000);
+    assert("", rates[COUNTER_OERRORS] == 0);
+    assert("", counters_rate(iface, 1, rates));
+    assert("", !counters_rate(iface, 2, rates));
+
+    // The ring keeps only the newest samples
+    for(uint64_t i = 3; i < COUNTERS_HISTORY * 2; i += 1) {
+        sample.time = 1000000 + i * 500000;
+        counters_begin(&counters);
+        counters_record(&counters, 3, "em0", &sample);
+        counters_end(&counters);
+    }
+    assert("", iface->len == COUNTERS_HISTORY);
+    assert("", counters_sample(iface, COUNTERS_HISTORY - 1)->time == 1000000 + COUNTERS_HISTORY * 500000);
+
+    // A new interface on the same index starts over, and one left out of a
+    // round is forgotten
+    counters_begin(&counters);
+    counters_record(&counters, 3, "em1", &sample);
+    counters_record(&counters, 40, "em2", &sample);
+    counters_end(&counters);
+    assert("", strcmp(iface->name, "em1") == 0 && iface->len == 1);
+    assert("", counters_get(&counters, 40) != NULL);
+
+    counters_begin(&counters);
+    counters_record(&counters, 40, "em2", &sample);
+    counters_end(&counters);
+    assert("", counters_get(&counters, 3) == NULL);
+}
+
+static void test_iftable(void) {
+    test();
+
+    struct iftable table;
+    iftable_init(&table);
+    assert("", iftable_lookup(&table, "em0") == 0);
+    assert("", iftable_name(&table, 5) == NULL);
+    assert("", iftable_link(&table, 5) == HISTORY_LINK_UNKNOWN);
+
+    iftable_set(&table, 5, "em0");
+    iftable_set(&table, 300, "vlan300");
+    assert("", iftable_lookup(&table, "em0") == 5);
+    assert("", iftable_lookup(&table, "vlan300") == 300);
+    assert("", strcmp(iftable_name(&table, 300), "vlan300") == 0);
+
+    // Only real changes move the generation on
+    const uint32_t generation = table.generation[5];
+    assert("", iftable_update(&table, 5, 0x8843, 1500, HISTORY_LINK_UP));
+    assert("", table.generation[5] != generation);
+    const uint32_t updated = table.generation[5];
+    assert("", iftable_update(&table, 5, 0x8843, 1500, HISTORY_LINK_UP));
+    assert("", table.generation[5] == updated);
+    assert("", iftable_link(&table, 5) == HISTORY_LINK_UP);
+    assert("", !iftable_update(&table, 6, 0, 0, HISTORY_LINK_UP));
+
+    struct iftable_details details;
+    memset(&details, 0, sizeof(details));
+    iftable_details_add(&details, "flags", "UP");
+    iftable_details_add(&details, "inet", "10.0.0.1");
+    assert("", iftable_set_details(&table, 5, &details));
+    assert("", table.generation[5] != updated);
+
+    size_t offset = 0;
+    const char* key;
+    const char* value;
+    const struct iftable_details* stored = iftable_details(&table, 5);
+    assert("", iftable_details_next(stored, &offset, &key, &value));
+    assert("", strcmp(key, "flags") == 0 && strcmp(value, "UP") == 0);
+    assert("", iftable_details_next(stored, &offset, &key, &value));
+    assert("", strcmp(key, "inet") == 0 && strcmp(value, "10.0.0.1") == 0);
+    assert("", !iftable_details_next(stored, &offset, &key, &value));
+
+    // Details stay current until the interface changes, and setting the same
+    // ones again makes them current without a change
+    assert("", iftable_details_current(&table, 5));
+    assert("", !iftable_details_current(&table, 300));
+    iftable_expire_details(&table, 5);
+    assert("", !iftable_details_current(&table, 5));
+    const uint32_t expired = table.generation[5];
+    assert("", iftable_set_details(&table, 5, &details));
+    assert("", iftable_details_current(&table, 5));
+    assert("", table.generation[5] == expired);
+    assert("", iftable_update(&table, 5, 0x8802, 1500, HISTORY_LINK_DOWN));
+    assert("", !iftable_details_current(&table, 5));
+    free(details.buf);
+
+    // Renaming, and taking over a name from an interface that is gone
+    iftable_set(&table, 5, "em1");
+    assert("", iftable_lookup(&table, "em0") == 0);
+    assert("", iftable_lookup(&table, "em1") == 5);
+    iftable_set(&table, 7, "em1");
+    assert("", iftable_lookup(&table, "em1") == 7);
+    assert("", iftable_name(&table, 5) == NULL);
+
+    iftable_remove(&table, 300);
+    assert("", iftable_lookup(&table, "vlan300") == 0);
+    assert("", table.count == 1);
+
+    // Thousands of interfaces coming and going keep the pool and the hash in
+    // check
+    char name[IF_NAMESIZE];
+    for(uint32_t round = 0; round < 4; round += 1) {
+        for(uint32_t i = 1000; i < 5000; i += 1) {
+            snprintf(name, sizeof(name), "vlan%u", i + round);
+            iftable_set(&table, i, name);
+        }
+    }
+    assert("", table.count == 4001);
+    assert("", iftable_lookup(&table, "vlan5002") == 4999);
+    assert("", iftable_lookup(&table, "vlan1000") == 0);
+    assert("", table.pool_len < 4001 * IF_NAMESIZE * 2);
+}
+
+struct replies {
+    char got[8][64];
+    size_t n;
+};
+
+static void record_reply(void* arg, const struct networkd_reply* reply) {
+    struct replies* replies = arg;
+    snprintf(replies->got[replies->n++], sizeof(replies->got[0]), "%s %zu %s",
+             reply->ok? "ok" : "error", reply->n_values, (reply->n_values > 0)? reply->values[0] : "");
+}
+
+static void record_event(void* arg, const struct networkd_event* event) {
+    struct replies* replies = arg;
+    snprintf(replies->got[replies->n++], sizeof(replies->got[0]), "event %llu %s %s",
+             (unsigned long long)event->seq, event->iface, event->new_link);
+}
+
+static void test_libnetworkd(void) {
+    test();
+
+    int sv[2];
+    assert("", socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    struct networkd* nd = networkd_open_fd(sv[0]);
+    assert("", nd != NULL);
+
+    // Requests are pipelined without waiting on replies
+    struct replies replies;
+    memset(&replies, 0, sizeof(replies));
+    assert("", networkd_request(nd, record_reply, &replies, "connect", "em\"0", NULL) == 0);
+    assert("", networkd_request(nd, record_reply, &replies, "stats", NULL) == 0);
+    assert("", networkd_subscribe(nd, 4, record_event, record_reply, &replies) == 0);
+    assert("", networkd_pending(nd) == 3);
+
+    char buf[256];
+    const ssize_t n = read(sv[1], buf, sizeof(buf) - 1);
+    assert("", n > 0);
+    buf[n] = '\0';
+    assert("", strcmp(buf, "[\"connect\", \"em\\\"0\"]\n[\"stats\"]\n[\"subscribe\", \"since\", \"4\"]\n") == 0);
+
+    // Replies match requests in order, with events routed apart, and lines
+    // split across reads
+    const char* reply = "[\"error\", \"No such interface\"]\n[\"ok\", \"uptime\", 3]\n"
+                        "[\"ok\", \"cursor\", \"5\"]\n[\"event\", \"seq\", \"5\", \"iface\", \"em0\", \"new\", \"up\"]\n[\"ok\"";
+    assert("", write(sv[1], reply, strlen(reply)) == (ssize_t)strlen(reply));
+    assert("", networkd_dispatch(nd) == 0);
+    assert("", replies.n == 4);
+    assert("", strcmp(replies.got[0], "error 1 No such interface") == 0);
+    assert("", strcmp(replies.got[1], "ok 2 uptime") == 0);
+    assert("", strcmp(replies.got[2], "ok 2 cursor") == 0);
+    assert("", strcmp(replies.got[3], "event 5 em0 up") == 0);
+    assert("", networkd_pending(nd) == 0);
+
+    // A reply nobody is waiting on is dropped
+    assert("", write(sv[1], "]\n", 2) == 2);
+    assert("", networkd_dispatch(nd) == 0);
+    assert("", replies.n == 4);
+
+    close(sv[1]);
+    assert("", networkd_dispatch(nd) == -1);
+    networkd_close(nd);
+}
+
+static void test_fragments(void) {
+    test();
+
+    struct iftable table;
+    iftable_init(&table);
+    iftable_set(&table, 3, "em0");
+    iftable_set_mtu(&table, 3, 1500);
+
+    struct iftable_details details;
+    memset(&details, 0, sizeof(details));
+    iftable_details_add(&details, "flags", "UP,BROADCAST");
+    iftable_details_add(&details, "inet", "10.0.0.1 \"quoted\"");
+    iftable_set_details(&table, 3, &details);
+
+    // Fragments follow other values
+    const char* expected = ", \"em0.flags\", \"UP,BROADCAST\", \"em0.mtu\", \"1500\", "
+                           "\"em0.inet\", \"10.0.0.1 \\\"quoted\\\"\"";
+    struct fragments fragments;
+    fragments_init(&fragments);
+    bool encoded;
+    const struct fragment* fragment = fragments_get(&fragments, &table, 3, &encoded);
+    assert("", fragment != NULL && encoded);
+    assert("", fragment->len == strlen(expected) && memcmp(fragment->buf, expected, fragment->len) == 0);
+    assert("", fragments_get(&fragments, &table, 1, &encoded) == NULL);
+
+    // Only a change to the interface encodes it again
+    const char* buf = fragment->buf;
+    fragment = fragments_get(&fragments, &table, 3, &encoded);
+    assert("", !encoded && fragment->buf == buf);
+    iftable_set_details(&table, 3, &details);
+    iftable_set_mtu(&table, 3, 1500);
+    fragments_get(&fragments, &table, 3, &encoded);
+    assert("", !encoded);
+    iftable_set_mtu(&table, 3, 9000);
+    fragment = fragments_get(&fragments, &table, 3, &encoded);
+    assert("", encoded && strncmp(fragment->buf + 42, "\"9000\"", 6) == 0);
+
+    // A new interface on the same index is never given the old one's
+    iftable_remove(&table, 3);
+    iftable_set(&table, 3, "em1");
+    iftable_set_details(&table, 3, &details);
+    fragment = fragments_get(&fragments, &table, 3, &encoded);
+    assert("", encoded && strncmp(fragment->buf, ", \"em1.flags\"", 13) == 0);
+
+    fragments_free(&fragments);
+    iftable_free(&table);
+    free(details.buf);
+}
+
+static void test_snapshot(void) {
+    test();
+
+    struct iftable table;
+    iftable_init(&table);
+    iftable_set(&table, 1, "lo0");
+    iftable_update(&table, 1, 0x8049, 32768, HISTORY_LINK_UP);
+    iftable_set(&table, 300, "em0");
+    iftable_update(&table, 300, 0x8843, 1500, HISTORY_LINK_DOWN);
+
+    struct iftable_details details;
+    memset(&details, 0, sizeof(details));
+    iftable_details_add(&details, "flags", "UP,BROADCAST");
+    iftable_details_add(&details, "inet", "10.0.0.1 netmask 0xffffff00");
+    iftable_set_details(&table, 300, &details);
+
+    FILE* f = tmpfile();
+    assert("", f != NULL);
+    const int fd = fileno(f);
+
+    // An empty file holds no snapshot
+    struct snapshot_info info;
+    struct iftable loaded;
+    iftable_init(&loaded);
+    assert("", !snapshot_load(fd, &loaded, &info));
+
+    assert("", snapshot_save(fd, &table, 42));
+    assert("", snapshot_load(fd, &loaded, &info));
+    assert("", info.next_seq == 42);
+    assert("", info.count == 2);
+    assert("", loaded.count == 2);
+    assert("", iftable_lookup(&loaded, "em0") == 300);
+    assert("", strcmp(iftable_name(&loaded, 1), "lo0") == 0);
+    assert("", loaded.flags[300] == 0x8843 && loaded.mtu[300] == 1500);
+    assert("", iftable_link(&loaded, 1) == HISTORY_LINK_UP);
+    assert("", iftable_link(&loaded, 300) == HISTORY_LINK_DOWN);
+
+    const struct iftable_details* got = iftable_details(&loaded, 300);
+    assert("", got->len == details.len && memcmp(got->buf, details.buf, details.len) == 0);
+    assert("", iftable_details(&loaded, 1)->len == 0);
+    iftable_free(&loaded);
+
+    // A damaged snapshot loads nothing
+    char byte;
+    assert("", pread(fd, &byte, 1, 80) == 1);
+    byte ^= 1;
+    assert("", pwrite(fd, &byte, 1, 80) == 1);
+    iftable_init(&loaded);
+    assert("", !snapshot_load(fd, &loaded, &info));
+    assert("", loaded.count == 0);
+
+    // A shorter snapshot replaces a longer one
+    iftable_remove(&table, 300);
+    assert("", snapshot_save(fd, &table, 43));
+    assert("", snapshot_load(fd, &loaded, &info));
+    assert("", loaded.count == 1 && info.next_seq == 43);
+    iftable_free(&loaded);
+    iftable_free(&table);
+    fclose(f);
+
+    // Events from before a restart are lost, and numbering carries on
+    static struct history history;
+    history_init(&history);
+    history_resume(&history, 42);
+
+    struct history_event event;
+    memset(&event, 0, sizeof(event));
+    assert("", history_record(&history, &event) == 42);
+
+    struct history_event events[4];
+    uint64_t lost;
+    assert("", history_read(&history, 40, events, 4, &lost) == 1);
+    assert("", lost == 1 && events[0].seq == 42);
+    assert("", history_read(&history, 42, events, 4, &lost) == 0);
+    assert("", lost == 0);
+}
+
+static void test_publish(void) {
+    test();
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/networkd-test.%d.state", (int)getpid());
+
+    struct iftable table;
+    iftable_init(&table);
+    iftable_set(&table, 1, "lo0");
+    iftable_update(&table, 1, 0x8049, 32768, HISTORY_LINK_UP);
+    assert("", publish_open(path, (gid_t)-1));
+
+    // Nothing has been published yet
+    struct networkd_state* state = networkd_state_open(path);
+    assert("", state != NULL);
+    static struct networkd_state_snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    assert("", networkd_state_read(state, &snapshot) == 1);
+    assert("", snapshot.count == 0);
+
+    publish_update(&table);
+    assert("", networkd_state_read(state, &snapshot) == 1);
+    assert("", snapshot.seq == 2 && snapshot.count == 1 && snapshot.truncated == 0);
+    assert("", snapshot.ifaces[0].ifindex == 1 && strcmp(snapshot.ifaces[0].name, "lo0") == 0);
+    assert("", snapshot.ifaces[0].mtu == 32768 && snapshot.ifaces[0].link == NETWORKD_LINK_UP);
+    assert("", snapshot.ifaces[0].generation == table.generation[1]);
+
+    // Unchanged tables are not copied again
+    publish_update(&table);
+    assert("", networkd_state_read(state, &snapshot) == 0);
+
+    iftable_set(&table, 300, "em0");
+    iftable_update(&table, 300, 0x8843, 1500, HISTORY_LINK_DOWN);
+    iftable_remove(&table, 1);
+    publish_update(&table);
+    assert("", networkd_state_read(state, &snapshot) == 1);
+    assert("", snapshot.seq == 4 && snapshot.count == 1);
+    assert("", snapshot.ifaces[0].ifindex == 300 && strcmp(snapshot.ifaces[0].name, "em0") == 0);
+    assert("", snapshot.ifaces[0].link == NETWORKD_LINK_DOWN);
+
+    // Readers are told once networkd has shut down
+    publish_close();
+    assert("", networkd_state_read(state, &snapshot) == -1 && errno == ESTALE);
+    networkd_state_close(state);
+
+    // Files that are not state files are refused
+    FILE* f = fopen(path, "w");
+    assert("", f != NULL);
+    fclose(f);
+    assert("", networkd_state_open(path) == NULL && errno == EINVAL);
+    unlink(path);
+    iftable_free(&table);
+}
+
 static void run_tests(void) {
     test_chomp();
 
     test_unescape_simple();
     test_unescape_overflow();
     test_unescape_escapes();
+    test_unescape_numbers();
 
     test_escape_simple();
     test_escape_overflow();
 
     test_validate_iface();
     test_validate_stanza();
+    test_command();
 
     test_parse_ifconfig_kv();
     test_iface_is_pseudo();
 
+    test_hist();
+    test_trace_ring();
+    test_bucket();
+    test_wheel();
+    test_history();
+    test_counters();
+    test_scan();
+    test_addrindex();
+    test_iftable();
+    test_fragments();
+    test_snapshot();
+    test_publish();
+    test_libnetworkd();
+
     tests_passed += 1;
 }
 